@@ -23,8 +23,43 @@
  */
 
 #include <mpack.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MPACK_POSIX 1
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#define MPACK_SHM 1
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define MPACK_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#endif
+
 typedef union mpack_anyint {
   int8_t i8;
   int16_t i16;
@@ -61,6 +96,9 @@ void mpack_decoder_init(mpack_decoder_t *decoder, const void *data, size_t size)
   decoder->begin = data;
   decoder->end = data + size;
   decoder->pos = data;
+  decoder->intern = NULL;
+  decoder->dict = NULL;
+  decoder->flags = 0;
 }
 
 void mpack_decoder_term(mpack_decoder_t *decoder)
@@ -147,6 +185,10 @@ void mpack_encoder_init(mpack_encoder_t *encoder, void *data, size_t size)
   encoder->begin = data;
   encoder->end = data + size;
   encoder->pos = data;
+  encoder->flags = 0;
+  encoder->dict = NULL;
+  encoder->base = 0;
+  encoder->grow = NULL;
 }
 
 void mpack_encoder_term(mpack_encoder_t *encoder)
@@ -185,6 +227,33 @@ void mpack_encoder_write_int32(mpack_encoder_t *encoder, int32_t value)
 void mpack_encoder_write_int64(mpack_encoder_t *encoder, int64_t value)
 { mpack_encoder_write_uint64(encoder, value); }
 
+/* Fills the current buffer and carries on in the ones the grow callback
+   provides, when it has none left the encoder overflows like any other. */
+static void mpack_encoder_spill(mpack_encoder_t *encoder, const char *data, size_t size)
+{
+  size_t n;
+
+  for (;;) {
+    if ((n = encoder->end - encoder->pos) >= size) {
+      memmove(encoder->pos, data, size);
+      encoder->pos += size;
+      return;
+    }
+
+    memmove(encoder->pos, data, n);
+    data += n;
+    size -= n;
+    encoder->base += encoder->end - encoder->begin;
+    encoder->pos = encoder->end;
+
+    if (encoder->grow(encoder) < 0) {
+      encoder->base -= encoder->end - encoder->begin;
+      encoder->pos += size;
+      return;
+    }
+  }
+}
+
 void mpack_encoder_write_bytes(mpack_encoder_t *encoder, const void *data, size_t size)
 {
   char *end = encoder->end;
@@ -194,10 +263,263 @@ void mpack_encoder_write_bytes(mpack_encoder_t *encoder, const void *data, size_
   if (ptr <= end) {
     memmove(pos, data, size);
   }
+  else if (encoder->grow && (pos <= end)) {
+    mpack_encoder_spill(encoder, data, size);
+    return;
+  }
   
   encoder->pos = ptr;
 }
 
+size_t mpack_encoder_offset(const mpack_encoder_t *encoder)
+{ return encoder->base + (encoder->pos - encoder->begin); }
+
+typedef struct mpack_value_header {
+  mpack_type_t type;
+  size_t header;
+  size_t payload;
+  size_t length;
+  size_t children;
+} mpack_value_header_t;
+
+static uint16_t mpack_load16(const uint8_t *p)
+{
+  uint16_t x;
+  memcpy(&x, p, sizeof(x));
+  return be16(x);
+}
+
+static uint32_t mpack_load32(const uint8_t *p)
+{
+  uint32_t x;
+  memcpy(&x, p, sizeof(x));
+  return be32(x);
+}
+
+static uint64_t mpack_load64(const uint8_t *p)
+{
+  uint64_t x;
+  memcpy(&x, p, sizeof(x));
+  return be64(x);
+}
+
+/* Describes the value starting at p from its tag and length fields alone:
+   the header is the tag, length and extension type bytes, the payload the
+   bytes that follow it and children the number of values nested in it. Only
+   the header needs to fit in the available bytes. */
+static int mpack_value_header(const uint8_t *p, size_t available, mpack_value_header_t *h)
+{
+  static const uint8_t sizes[] = { 1, 2, 4, 8 };
+  const int tag = *p;
+
+  h->header = 1;
+  h->payload = 0;
+  h->length = 0;
+  h->children = 0;
+
+  if ((tag & MPACK_POSITIVE_FIXNUM_MASK) == MPACK_POSITIVE_FIXNUM) {
+    h->type = MPACK_INTEGER;
+    return 0;
+  }
+
+  if ((tag & MPACK_NEGATIVE_FIXNUM_MASK) == MPACK_NEGATIVE_FIXNUM) {
+    h->type = MPACK_INTEGER;
+    return 0;
+  }
+
+  if ((tag & MPACK_FIXSTR_MASK) == MPACK_FIXSTR) {
+    h->type = MPACK_STRING;
+    h->payload = h->length = tag & ~MPACK_FIXSTR_MASK;
+    return 0;
+  }
+
+  if ((tag & MPACK_FIXARRAY_MASK) == MPACK_FIXARRAY) {
+    h->type = MPACK_ARRAY;
+    h->children = h->length = tag & ~MPACK_FIXARRAY_MASK;
+    return 0;
+  }
+
+  if ((tag & MPACK_FIXMAP_MASK) == MPACK_FIXMAP) {
+    h->type = MPACK_MAP;
+    h->length = tag & ~MPACK_FIXMAP_MASK;
+    h->children = 2 * h->length;
+    return 0;
+  }
+
+  switch (tag) {
+  case MPACK_NIL:
+    h->type = MPACK_NONE;
+    return 0;
+
+  case MPACK_TRUE:
+  case MPACK_FALSE:
+    h->type = MPACK_BOOLEAN;
+    return 0;
+
+  case MPACK_INT8:
+  case MPACK_INT16:
+  case MPACK_INT32:
+  case MPACK_INT64:
+    h->type = MPACK_INTEGER;
+    h->payload = sizes[tag - MPACK_INT8];
+    return 0;
+
+  case MPACK_UINT8:
+  case MPACK_UINT16:
+  case MPACK_UINT32:
+  case MPACK_UINT64:
+    h->type = MPACK_INTEGER;
+    h->payload = sizes[tag - MPACK_UINT8];
+    return 0;
+
+  case MPACK_FLOAT32:
+  case MPACK_FLOAT64:
+    h->type = MPACK_NUMBER;
+    h->payload = (tag == MPACK_FLOAT32) ? 4 : 8;
+    return 0;
+
+  case MPACK_FIXEXT1:
+  case MPACK_FIXEXT2:
+  case MPACK_FIXEXT4:
+  case MPACK_FIXEXT8:
+  case MPACK_FIXEXT16:
+    h->type = MPACK_EXTENDED;
+    h->header = 2;
+    h->payload = h->length = 1 << (tag - MPACK_FIXEXT1);
+    break;
+
+  case MPACK_STR8:
+  case MPACK_STR16:
+  case MPACK_STR32:
+    h->type = MPACK_STRING;
+    h->header = 1 + sizes[tag - MPACK_STR8];
+    break;
+
+  case MPACK_BIN8:
+  case MPACK_BIN16:
+  case MPACK_BIN32:
+    h->type = MPACK_BINARY;
+    h->header = 1 + sizes[tag - MPACK_BIN8];
+    break;
+
+  case MPACK_EXT8:
+  case MPACK_EXT16:
+  case MPACK_EXT32:
+    h->type = MPACK_EXTENDED;
+    h->header = 2 + sizes[tag - MPACK_EXT8];
+    break;
+
+  case MPACK_ARRAY16:
+  case MPACK_ARRAY32:
+    h->type = MPACK_ARRAY;
+    h->header = 1 + sizes[tag - MPACK_ARRAY16 + 1];
+    break;
+
+  case MPACK_MAP16:
+  case MPACK_MAP32:
+    h->type = MPACK_MAP;
+    h->header = 1 + sizes[tag - MPACK_MAP16 + 1];
+    break;
+
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (available < h->header) {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  switch (h->header - ((h->type == MPACK_EXTENDED) ? 2 : 1)) {
+  case 1:
+    h->length = p[1];
+    break;
+
+  case 2:
+    h->length = mpack_load16(p + 1);
+    break;
+
+  case 4:
+    h->length = mpack_load32(p + 1);
+    break;
+  }
+
+  switch (h->type) {
+  case MPACK_ARRAY:
+    h->children = h->length;
+    break;
+
+  case MPACK_MAP:
+    h->children = 2 * h->length;
+    break;
+
+  default:
+    h->payload = h->length;
+    break;
+  }
+
+  return 0;
+}
+
+/* Decoders whose remaining input passed mpack_validate read values through
+   mpack_value_header without bounds checks, a value of another type than
+   the one asked for is rejected before the decoder moves. Strings of a
+   session dictionary are left to the checked decoders. */
+static bool mpack_decoder_trusted(const mpack_decoder_t *decoder)
+{ return (decoder->flags & MPACK_DECODE_TRUSTED) && !decoder->dict && (decoder->pos != decoder->end); }
+
+static const uint8_t *mpack_decode_trusted(mpack_decoder_t *decoder, mpack_type_t type, mpack_value_header_t *h)
+{
+  const uint8_t *p = (const uint8_t *)decoder->pos;
+
+  mpack_value_header(p, SIZE_MAX, h);
+
+  if (h->type != type) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  decoder->pos = (const char *)(p + h->header + h->payload);
+  return p;
+}
+
+/* The integer at p as its 64 bit pattern, uint64 values above INT64_MAX come
+   out negative and are told apart by their tag. */
+static int64_t mpack_load_integer(const uint8_t *p)
+{
+  const uint8_t *data = p + 1;
+  mpack_anyint_t var;
+
+  switch (*p) {
+  case MPACK_INT8:
+    return (int8_t)data[0];
+
+  case MPACK_INT16:
+    return (int16_t)mpack_load16(data);
+
+  case MPACK_INT32:
+    return (int32_t)mpack_load32(data);
+
+  case MPACK_UINT8:
+    return data[0];
+
+  case MPACK_UINT16:
+    return mpack_load16(data);
+
+  case MPACK_UINT32:
+    return mpack_load32(data);
+
+  case MPACK_INT64:
+  case MPACK_UINT64:
+    var.u64 = mpack_load64(data);
+    return var.i64;
+
+  default:
+    return (int8_t)*p;
+  }
+}
+
 static int mpack_decode_tag(mpack_decoder_t *decoder, int *tag)
 {
   const char *pos = decoder->pos;
@@ -261,6 +583,18 @@ int mpack_decode_signed(mpack_decoder_t *decoder, signed long *value)
   MPACK_DECODE_BEGIN(decoder);
   int tag;
   mpack_anyint_t var;
+  mpack_value_header_t h;
+  const uint8_t *p;
+
+  if (mpack_decoder_trusted(decoder)) {
+    if (!(p = mpack_decode_trusted(decoder, MPACK_INTEGER, &h)))
+      goto fail;
+    var.i64 = mpack_load_integer(p);
+    if ((*p == MPACK_UINT64) && (var.i64 < 0))
+      MPACK_DECODE_FAIL(ERANGE);
+    *value = var.i64;
+    return h.header + h.payload;
+  }
 
   MPACK_DECODE_ASSERT(mpack_decode_tag(decoder, &tag));
   var.u64 = 0;
@@ -326,6 +660,18 @@ int mpack_decode_unsigned(mpack_decoder_t *decoder, unsigned long *value)
   MPACK_DECODE_BEGIN(decoder);
   int tag;
   mpack_anyint_t var;
+  mpack_value_header_t h;
+  const uint8_t *p;
+
+  if (mpack_decoder_trusted(decoder)) {
+    if (!(p = mpack_decode_trusted(decoder, MPACK_INTEGER, &h)))
+      goto fail;
+    var.i64 = mpack_load_integer(p);
+    if ((*p != MPACK_UINT64) && (var.i64 < 0))
+      MPACK_DECODE_FAIL(ERANGE);
+    *value = var.u64;
+    return h.header + h.payload;
+  }
 
   MPACK_DECODE_ASSERT(mpack_decode_tag(decoder, &tag));
   var.u64 = 0;
@@ -396,6 +742,13 @@ int mpack_decode_float(mpack_decoder_t *decoder, float *value)
   
   MPACK_DECODE_BEGIN(decoder);
 
+  if (mpack_decoder_trusted(decoder) && ((uint8_t)*decoder->pos == MPACK_FLOAT32)) {
+    var.u = mpack_load32((const uint8_t *)decoder->pos + 1);
+    decoder->pos += 5;
+    *value = var.f;
+    return 5;
+  }
+
   if ((size = mpack_decode_unsigned(decoder, &conv.u)) > 0) {
     if (conv.u > 8388608) {
       MPACK_DECODE_FAIL(ERANGE);
@@ -426,6 +779,13 @@ int mpack_decode_double(mpack_decoder_t *decoder, double *value)
   
   MPACK_DECODE_BEGIN(decoder);
 
+  if (mpack_decoder_trusted(decoder) && ((uint8_t)*decoder->pos == MPACK_FLOAT64)) {
+    var.u = mpack_load64((const uint8_t *)decoder->pos + 1);
+    decoder->pos += 9;
+    *value = var.f;
+    return 9;
+  }
+
   if ((size = mpack_decode_unsigned(decoder, &conv.u)) > 0) {
     if (conv.u > 9007199254740992) {
       MPACK_DECODE_FAIL(ERANGE);
@@ -453,12 +813,107 @@ int mpack_decode_double(mpack_decoder_t *decoder, double *value)
   MPACK_DECODE_END(decoder);
 }
 
+/* Tells whether the next value is one of the extensions of the session
+   dictionary attached to the decoder. */
+static bool mpack_decode_is_dict_string(mpack_decoder_t *decoder)
+{
+  mpack_decoder_t peek = *decoder;
+  mpack_extended_t value;
+
+  if (!decoder->dict || (decoder->pos == decoder->end)) {
+    return false;
+  }
+
+  switch ((uint8_t)*decoder->pos) {
+  case MPACK_FIXEXT1:
+  case MPACK_FIXEXT2:
+  case MPACK_EXT8:
+  case MPACK_EXT16:
+  case MPACK_EXT32:
+    break;
+
+  default:
+    return false;
+  }
+
+  return (mpack_decode_extended(&peek, &value) > 0)
+      && ((value.type == decoder->dict->define) || (value.type == decoder->dict->reference));
+}
+
+static int mpack_decode_dict_string(mpack_decoder_t *decoder, mpack_string_t *value)
+{
+  MPACK_DECODE_BEGIN(decoder);
+  mpack_dict_t *dict = decoder->dict;
+  const mpack_symbol_t *symbol;
+  const uint8_t *bytes;
+  mpack_extended_t ext;
+  mpack_string_t string;
+  uint32_t id;
+
+  MPACK_DECODE_ASSERT(mpack_decode_extended(decoder, &ext));
+  bytes = ext.data;
+
+  if (ext.type == dict->define) {
+    string.data = ext.data;
+    string.size = ext.size;
+
+    /* A definition may be decoded again when a message is retried, it must
+       not take a new id. */
+    if (!(symbol = mpack_intern_find(&dict->strings, string))) {
+      if (dict->strings.count == dict->strings.capacity) {
+        MPACK_DECODE_FAIL(ERANGE);
+      }
+      if (!(symbol = mpack_intern_insert(&dict->strings, string))) {
+        goto fail;
+      }
+    }
+  }
+  else {
+    switch (ext.size) {
+    case 1:
+      id = bytes[0];
+      break;
+
+    case 2:
+      id = ((uint32_t)bytes[0] << 8) | bytes[1];
+      break;
+
+    default:
+      MPACK_DECODE_FAIL(EINVAL);
+    }
+
+    if (id >= dict->strings.count) {
+      MPACK_DECODE_FAIL(EINVAL);
+    }
+
+    symbol = dict->strings.entries[id].symbol;
+  }
+
+  value->data = symbol->data;
+  value->size = symbol->size;
+  MPACK_DECODE_END(decoder);
+}
+
 int mpack_decode_string(mpack_decoder_t *decoder, mpack_string_t *value)
 {
   MPACK_DECODE_BEGIN(decoder);
   int tag;
   size_t size;
   mpack_anyint_t var;
+  mpack_value_header_t h;
+  const uint8_t *p;
+
+  if (mpack_decoder_trusted(decoder)) {
+    if (!(p = mpack_decode_trusted(decoder, MPACK_STRING, &h)))
+      goto fail;
+    value->data = (const char *)(p + h.header);
+    value->size = h.length;
+    return h.header + h.payload;
+  }
+
+  if (mpack_decode_is_dict_string(decoder)) {
+    return mpack_decode_dict_string(decoder, value);
+  }
 
   MPACK_DECODE_ASSERT(mpack_decode_tag(decoder, &tag));
 
@@ -499,6 +954,16 @@ int mpack_decode_binary(mpack_decoder_t *decoder, mpack_binary_t *value)
   int tag;
   size_t size;
   mpack_anyint_t var;
+  mpack_value_header_t h;
+  const uint8_t *p;
+
+  if (mpack_decoder_trusted(decoder)) {
+    if (!(p = mpack_decode_trusted(decoder, MPACK_BINARY, &h)))
+      goto fail;
+    value->data = p + h.header;
+    value->size = h.length;
+    return h.header + h.payload;
+  }
 
   MPACK_DECODE_ASSERT(mpack_decode_tag(decoder, &tag));
 
@@ -534,6 +999,14 @@ int mpack_decode_array(mpack_decoder_t *decoder, mpack_array_t *value)
   int tag;
   size_t size;
   mpack_anyint_t var;
+  mpack_value_header_t h;
+
+  if (mpack_decoder_trusted(decoder)) {
+    if (!mpack_decode_trusted(decoder, MPACK_ARRAY, &h))
+      goto fail;
+    value->size = h.length;
+    return h.header;
+  }
 
   MPACK_DECODE_ASSERT(mpack_decode_tag(decoder, &tag));
 
@@ -567,6 +1040,14 @@ int mpack_decode_map(mpack_decoder_t *decoder, mpack_map_t *value)
   int tag;
   size_t size;
   mpack_anyint_t var;
+  mpack_value_header_t h;
+
+  if (mpack_decoder_trusted(decoder)) {
+    if (!mpack_decode_trusted(decoder, MPACK_MAP, &h))
+      goto fail;
+    value->size = h.length;
+    return h.header;
+  }
 
   MPACK_DECODE_ASSERT(mpack_decode_tag(decoder, &tag));
 
@@ -600,6 +1081,17 @@ int mpack_decode_extended(mpack_decoder_t *decoder, mpack_extended_t *value)
   int tag;
   size_t size;
   mpack_anyint_t var;
+  mpack_value_header_t h;
+  const uint8_t *p;
+
+  if (mpack_decoder_trusted(decoder)) {
+    if (!(p = mpack_decode_trusted(decoder, MPACK_EXTENDED, &h)))
+      goto fail;
+    value->type = (int8_t)p[h.header - 1];
+    value->data = p + h.header;
+    value->size = h.length;
+    return h.header + h.payload;
+  }
 
   MPACK_DECODE_ASSERT(mpack_decode_tag(decoder, &tag));
 
@@ -651,6 +1143,97 @@ int mpack_decode_extended(mpack_decoder_t *decoder, mpack_extended_t *value)
   MPACK_DECODE_END(decoder);
 }
 
+enum {
+  MPACK_VALIDATE_STACK_SIZE = 32,
+};
+
+/* Decoding of buffers that went through mpack_validate, the header and
+   payload of every value are known to be in range so reads are not checked
+   and there is nothing to roll back. */
+static int mpack_decode_object_trusted(mpack_decoder_t *decoder, mpack_object_t *value)
+{
+  const uint8_t *p = (const uint8_t *)decoder->pos;
+  const uint8_t *data;
+  mpack_value_header_t h;
+
+  mpack_value_header(p, SIZE_MAX, &h);
+  data = p + h.header;
+  value->type = h.type;
+
+  switch (h.type) {
+  case MPACK_NONE:
+    break;
+
+  case MPACK_BOOLEAN:
+    value->data.boolean = (*p == MPACK_TRUE);
+    break;
+
+  case MPACK_INTEGER:
+    value->data.integer = mpack_load_integer(p);
+    if ((*p == MPACK_UINT64) && (value->data.integer < 0)) {
+      errno = ERANGE;
+      return -1;
+    }
+    break;
+
+  case MPACK_NUMBER:
+    if (*p == MPACK_FLOAT32) {
+      union { uint32_t u; float f; } x = { mpack_load32(data) };
+      value->data.number = x.f;
+    }
+    else {
+      union { uint64_t u; double f; } x = { mpack_load64(data) };
+      value->data.number = x.f;
+    }
+    break;
+
+  case MPACK_STRING:
+    value->data.string.data = (const char *)data;
+    value->data.string.size = h.length;
+    break;
+
+  case MPACK_BINARY:
+    value->data.binary.data = data;
+    value->data.binary.size = h.length;
+    break;
+
+  case MPACK_ARRAY:
+    value->data.array.size = h.length;
+    break;
+
+  case MPACK_MAP:
+    value->data.map.size = h.length;
+    break;
+
+  case MPACK_EXTENDED:
+    value->data.extended.type = (int8_t)data[-1];
+    value->data.extended.data = data;
+    value->data.extended.size = h.length;
+    break;
+  }
+
+  decoder->pos = (const char *)(data + h.payload);
+  return h.header + h.payload;
+}
+
+static int mpack_decode_skip_trusted(mpack_decoder_t *decoder)
+{
+  const uint8_t *p = (const uint8_t *)decoder->pos;
+  mpack_value_header_t h;
+  size_t count = 1;
+  int size;
+
+  while (count != 0) {
+    mpack_value_header(p, SIZE_MAX, &h);
+    p += h.header + h.payload;
+    count += h.children - 1;
+  }
+
+  size = (const char *)p - decoder->pos;
+  decoder->pos = (const char *)p;
+  return size;
+}
+
 int mpack_decode_object(mpack_decoder_t *decoder, mpack_object_t *value)
 {
   const char *end = decoder->end;
@@ -663,6 +1246,10 @@ int mpack_decode_object(mpack_decoder_t *decoder, mpack_object_t *value)
     return -1;
   }
 
+  if ((decoder->flags & MPACK_DECODE_TRUSTED) && !decoder->dict) {
+    return mpack_decode_object_trusted(decoder, value);
+  }
+
   tag = (uint8_t)(*pos);
 
   if ((tag & MPACK_POSITIVE_FIXNUM_MASK) == MPACK_POSITIVE_FIXNUM) {
@@ -752,6 +1339,10 @@ int mpack_decode_object(mpack_decoder_t *decoder, mpack_object_t *value)
   case MPACK_EXT8:
   case MPACK_EXT16:
   case MPACK_EXT32:
+    if (mpack_decode_is_dict_string(decoder)) {
+      value->type = MPACK_STRING;
+      return mpack_decode_dict_string(decoder, &(value->data.string));
+    }
     value->type = MPACK_EXTENDED;
     return mpack_decode_extended(decoder, &(value->data.extended));
 
@@ -761,309 +1352,6942 @@ int mpack_decode_object(mpack_decoder_t *decoder, mpack_object_t *value)
   }
 }
 
-int mpack_encode_nil(mpack_encoder_t *encoder)
+int mpack_decode_skip(mpack_decoder_t *decoder)
 {
-  mpack_encoder_write_uint8(encoder, MPACK_NIL);
-  return 1;
-}
+  MPACK_DECODE_BEGIN(decoder);
+  mpack_object_t object;
+  size_t count = 1;
 
-int mpack_encode_true(mpack_encoder_t *encoder)
-{
-  mpack_encoder_write_uint8(encoder, MPACK_TRUE);
-  return 1;
-}
+  if ((decoder->flags & MPACK_DECODE_TRUSTED) && !decoder->dict && (decoder->pos != decoder->end)) {
+    return mpack_decode_skip_trusted(decoder);
+  }
 
-int mpack_encode_false(mpack_encoder_t *encoder)
-{
-  mpack_encoder_write_uint8(encoder, MPACK_FALSE);
-  return 1;
-}
+  /* Containers only add their elements to the number of values left to skip,
+     nested values never recurse. */
+  while (count != 0) {
+    MPACK_DECODE_ASSERT(mpack_decode_object(decoder, &object));
+    --count;
 
-int mpack_encode_boolean(mpack_encoder_t *encoder, bool value)
-{ return value ? mpack_encode_true(encoder) : mpack_encode_false(encoder); }
+    switch (object.type) {
+    case MPACK_ARRAY:
+      count += object.data.array.size;
+      break;
 
-int mpack_encode_signed(mpack_encoder_t *encoder, signed long value)
+    case MPACK_MAP:
+      count += 2 * object.data.map.size;
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  MPACK_DECODE_END(decoder);
+}
+
+/* Strings, binaries and extensions are compared by content, containers by
+   their number of elements only. */
+bool mpack_object_equal(const mpack_object_t *a, const mpack_object_t *b)
 {
-  if (value >= 0) {
-    return mpack_encode_unsigned(encoder, value);
+  if (a->type != b->type) {
+    return false;
   }
 
-  if (value >= -31) {
-    mpack_encoder_write_int8(encoder, value);
-    return 1;
+  switch (a->type) {
+  case MPACK_NONE:
+    return true;
+
+  case MPACK_BOOLEAN:
+    return a->data.boolean == b->data.boolean;
+
+  case MPACK_INTEGER:
+    return a->data.integer == b->data.integer;
+
+  case MPACK_NUMBER:
+    return a->data.number == b->data.number;
+
+  case MPACK_STRING:
+    return (a->data.string.size == b->data.string.size) &&
+      (memcmp(a->data.string.data, b->data.string.data, a->data.string.size) == 0);
+
+  case MPACK_BINARY:
+    return (a->data.binary.size == b->data.binary.size) &&
+      (memcmp(a->data.binary.data, b->data.binary.data, a->data.binary.size) == 0);
+
+  case MPACK_ARRAY:
+    return a->data.array.size == b->data.array.size;
+
+  case MPACK_MAP:
+    return a->data.map.size == b->data.map.size;
+
+  case MPACK_EXTENDED:
+    return (a->data.extended.type == b->data.extended.type) && (a->data.extended.size == b->data.extended.size) &&
+      (memcmp(a->data.extended.data, b->data.extended.data, a->data.extended.size) == 0);
+
+  default:
+    return false;
   }
+}
 
-  if (value >= INT8_MIN) {
-    mpack_encoder_write_uint8(encoder, MPACK_INT8);
-    mpack_encoder_write_int8(encoder, value);
-    return 2;
+/* Follows the path from the value at the decoder position, each element is
+   the key of a map entry or the integer index of an array element. On
+   success the decoder is left at the value found and the size of its
+   encoding is returned, a missing key or index fails with ENOENT. Map keys
+   that are containers never match. */
+int mpack_find(mpack_decoder_t *decoder, const mpack_object_t *path, size_t count)
+{
+  MPACK_DECODE_BEGIN(decoder);
+  mpack_object_t object;
+  mpack_object_t key;
+  const char *pos;
+  size_t i;
+  size_t j;
+  int n;
+
+  for (i = 0; i != count; ++i) {
+    MPACK_DECODE_ASSERT(mpack_decode_object(decoder, &object));
+
+    if (object.type == MPACK_ARRAY) {
+      if ((path[i].type != MPACK_INTEGER) || (path[i].data.integer < 0) ||
+          ((unsigned long)path[i].data.integer >= object.data.array.size)) {
+        MPACK_DECODE_FAIL(ENOENT);
+      }
+
+      for (j = 0; j != (size_t)path[i].data.integer; ++j) {
+        MPACK_DECODE_ASSERT(mpack_decode_skip(decoder));
+      }
+    }
+    else if (object.type == MPACK_MAP) {
+      for (j = 0; ; ++j) {
+        if (j == object.data.map.size) {
+          MPACK_DECODE_FAIL(ENOENT);
+        }
+
+        pos = decoder->pos;
+        MPACK_DECODE_ASSERT(mpack_decode_object(decoder, &key));
+
+        if ((key.type == MPACK_ARRAY) || (key.type == MPACK_MAP)) {
+          decoder->pos = pos;
+          MPACK_DECODE_ASSERT(mpack_decode_skip(decoder));
+        }
+        else if (mpack_object_equal(&key, &path[i])) {
+          break;
+        }
+
+        MPACK_DECODE_ASSERT(mpack_decode_skip(decoder));
+      }
+    }
+    else {
+      MPACK_DECODE_FAIL(ENOENT);
+    }
   }
 
-  if (value >= INT16_MIN) {
-    mpack_encoder_write_uint8(encoder, MPACK_INT16);
-    mpack_encoder_write_int16(encoder, value);
-    return 3;
+  /* The value found is measured but the decoder is left in front of it. */
+  pos = decoder->pos;
+  MPACK_DECODE_ASSERT(n = mpack_decode_skip(decoder));
+  decoder->pos = pos;
+  return n;
+  MPACK_DECODE_END(decoder);
+}
+
+/* Skips the next value and returns the span of its encoding, which
+   mpack_encode_raw writes to another output as is. Decoders with a session
+   dictionary are rejected with EINVAL, their strings refer to definitions
+   the other output has not seen. */
+int mpack_decode_raw(mpack_decoder_t *decoder, mpack_segment_t *value)
+{
+  const char *pos = decoder->pos;
+  int n;
+
+  if (decoder->dict) {
+    errno = EINVAL;
+    return -1;
   }
 
-  if (value >= INT32_MIN) {
-    mpack_encoder_write_uint8(encoder, MPACK_INT32);
-    mpack_encoder_write_int32(encoder, value);
-    return 5;
+  if ((n = mpack_decode_skip(decoder)) < 0) {
+    return -1;
   }
 
-  mpack_encoder_write_uint8(encoder, MPACK_INT64);
-  mpack_encoder_write_int64(encoder, value);
-  return 9;
+  value->data = pos;
+  value->size = n;
+  return n;
 }
 
-int mpack_encode_unsigned(mpack_encoder_t *encoder, unsigned long value)
+/* Values are walked without decoding them, containers only push the number
+   of values nested in them on a stack that grows on the heap past the inline
+   frames. */
+int mpack_validate(const void *data, size_t size, const mpack_limits_t *limits)
 {
-  if (value <= INT8_MAX) {
-    mpack_encoder_write_uint8(encoder, value);
-    return 1;
+  static const mpack_limits_t unlimited = { 0, 0, 0 };
+  size_t frames[MPACK_VALIDATE_STACK_SIZE];
+  size_t *stack = frames;
+  size_t *tmp;
+  size_t capacity = MPACK_VALIDATE_STACK_SIZE;
+  size_t depth = 0;
+  size_t count = 0;
+  const uint8_t *p = data;
+  const uint8_t *end = p + size;
+  mpack_value_header_t h;
+  int result = -1;
+
+  if (!limits) {
+    limits = &unlimited;
   }
 
-  if (value <= UINT8_MAX) {
-    mpack_encoder_write_uint8(encoder, MPACK_UINT8);
-    mpack_encoder_write_uint8(encoder, value);
-    return 2;
+  while (p != end) {
+    if ((count == (size_t)INT_MAX) || (limits->count && (count == limits->count))) {
+      errno = EINVAL;
+      goto done;
+    }
+
+    for (;;) {
+      if (p == end) {
+        errno = EAGAIN;
+        goto done;
+      }
+
+      if (mpack_value_header(p, end - p, &h) < 0) {
+        goto done;
+      }
+
+      if (limits->length && (h.length > limits->length)) {
+        errno = ERANGE;
+        goto done;
+      }
+
+      if ((size_t)(end - p - h.header) < h.payload) {
+        errno = EAGAIN;
+        goto done;
+      }
+
+      p += h.header + h.payload;
+
+      if ((h.type == MPACK_ARRAY) || (h.type == MPACK_MAP)) {
+        if (limits->depth && (depth == limits->depth)) {
+          errno = ERANGE;
+          goto done;
+        }
+
+        if (h.children != 0) {
+          if (depth == capacity) {
+            if (!(tmp = malloc(2 * capacity * sizeof(*tmp)))) {
+              errno = ENOMEM;
+              goto done;
+            }
+
+            memcpy(tmp, stack, capacity * sizeof(*tmp));
+
+            if (stack != frames) {
+              free(stack);
+            }
+
+            stack = tmp;
+            capacity *= 2;
+          }
+
+          stack[depth++] = h.children;
+          continue;
+        }
+      }
+
+      while ((depth != 0) && (--stack[depth - 1] == 0)) {
+        --depth;
+      }
+
+      if (depth == 0) {
+        break;
+      }
+    }
+
+    ++count;
   }
 
-  if (value <= UINT16_MAX) {
-    mpack_encoder_write_uint8(encoder, MPACK_UINT16);
-    mpack_encoder_write_uint16(encoder, value);
-    return 3;
+  if (limits->count && (count != limits->count)) {
+    errno = EAGAIN;
+    goto done;
   }
 
-  if (value <= UINT32_MAX) {
-    mpack_encoder_write_uint8(encoder, MPACK_UINT32);
-    mpack_encoder_write_uint32(encoder, value);
-    return 5;
+  result = count;
+done:
+  if (stack != frames) {
+    free(stack);
   }
 
-  mpack_encoder_write_uint8(encoder, MPACK_UINT64);
-  mpack_encoder_write_uint64(encoder, value);
-  return 9;
+  return result;
 }
 
-int mpack_encode_float(mpack_encoder_t *encoder, float value)
+int mpack_decoder_trust(mpack_decoder_t *decoder, const mpack_limits_t *limits)
 {
-  union { uint32_t u; float f; } var;
-  var.f = value;
-  mpack_encoder_write_uint8(encoder, MPACK_FLOAT32);
-  mpack_encoder_write_uint32(encoder, var.u);
-  return 5;
+  int count;
+
+  if ((count = mpack_validate(decoder->pos, decoder->end - decoder->pos, limits)) >= 0) {
+    decoder->flags |= MPACK_DECODE_TRUSTED;
+  }
+
+  return count;
 }
 
-int mpack_encode_double(mpack_encoder_t *encoder, double value)
+void mpack_scanner_init(mpack_scanner_t *scanner)
 {
-  union { uint64_t u; double f; } var;
-  var.f = value;
-  mpack_encoder_write_uint8(encoder, MPACK_FLOAT64);
-  mpack_encoder_write_uint64(encoder, var.u);
-  return 9;
+  scanner->offset = 0;
+  scanner->count = 1;
 }
 
-int mpack_encode_string(mpack_encoder_t *encoder, mpack_string_t value)
+/* Same walk as mpack_decode_skip, but the number of values left and the
+   offset reached are kept in the scanner when the input runs out, so bytes
+   that were already scanned are not read again on the next call. */
+int mpack_scan(mpack_scanner_t *scanner, const void *data, size_t size)
 {
-  if (value.size <= 15) {
-    mpack_encoder_write_uint8(encoder, MPACK_FIXSTR | value.size);
-    mpack_encoder_write_bytes(encoder, value.data, value.size);
-    return value.size + 1;
-  }
+  const uint8_t *p = data;
+  mpack_value_header_t h;
 
-  if (value.size <= UINT8_MAX) {
-    mpack_encoder_write_uint8(encoder, MPACK_STR8);
-    mpack_encoder_write_uint8(encoder, value.size);
-    mpack_encoder_write_bytes(encoder, value.data, value.size);
-    return value.size + 2;
+  while (scanner->count != 0) {
+    if (scanner->offset >= size) {
+      errno = EAGAIN;
+      return -1;
+    }
+
+    if (mpack_value_header(p + scanner->offset, size - scanner->offset, &h) < 0) {
+      return -1;
+    }
+
+    scanner->offset += h.header + h.payload;
+    scanner->count += h.children - 1;
   }
 
-  if (value.size <= UINT16_MAX) {
-    mpack_encoder_write_uint8(encoder, MPACK_STR16);
-    mpack_encoder_write_uint16(encoder, value.size);
-    mpack_encoder_write_bytes(encoder, value.data, value.size);
-    return value.size + 3;
+  if (scanner->offset > size) {
+    errno = EAGAIN;
+    return -1;
   }
 
-  if (value.size <= UINT32_MAX) {
-    mpack_encoder_write_uint8(encoder, MPACK_STR32);
-    mpack_encoder_write_uint32(encoder, value.size);
-    mpack_encoder_write_bytes(encoder, value.data, value.size);
-    return value.size + 5;
+  if (scanner->offset > INT_MAX) {
+    errno = ERANGE;
+    return -1;
   }
 
-  errno = ERANGE;
-  return -1;
+  return scanner->offset;
 }
 
-int mpack_encode_binary(mpack_encoder_t *encoder, mpack_binary_t value)
+enum {
+  MPACK_HEADER_MAX = 6,
+};
+
+static void mpack_rope_normalize(const mpack_rope_t *rope, size_t *index, size_t *offset)
 {
-  if (value.size <= UINT8_MAX) {
-    mpack_encoder_write_uint8(encoder, MPACK_BIN8);
-    mpack_encoder_write_uint8(encoder, value.size);
-    mpack_encoder_write_bytes(encoder, value.data, value.size);
-    return value.size + 2;
+  while ((*index != rope->count) && (*offset == rope->segments[*index].size)) {
+    ++*index;
+    *offset = 0;
   }
+}
 
-  if (value.size <= UINT16_MAX) {
-    mpack_encoder_write_uint8(encoder, MPACK_BIN16);
-    mpack_encoder_write_uint16(encoder, value.size);
-    mpack_encoder_write_bytes(encoder, value.data, value.size);
-    return value.size + 3;
+/* Moves the cursor size bytes forward, fails if the segments end first. */
+static bool mpack_rope_advance(const mpack_rope_t *rope, size_t *index, size_t *offset, size_t size)
+{
+  size_t left;
+
+  for (;;) {
+    mpack_rope_normalize(rope, index, offset);
+
+    if (size == 0) {
+      return true;
+    }
+
+    if (*index == rope->count) {
+      return false;
+    }
+
+    left = rope->segments[*index].size - *offset;
+
+    if (size <= left) {
+      *offset += size;
+      size = 0;
+    }
+    else {
+      *offset += left;
+      size -= left;
+    }
   }
+}
 
-  if (value.size <= UINT32_MAX) {
-    mpack_encoder_write_uint8(encoder, MPACK_BIN32);
-    mpack_encoder_write_uint32(encoder, value.size);
-    mpack_encoder_write_bytes(encoder, value.data, value.size);
-    return value.size + 5;
+/* Copies up to size bytes from the cursor, which is left unchanged. */
+static size_t mpack_rope_copy(const mpack_rope_t *rope, size_t index, size_t offset, void *data, size_t size)
+{
+  char *out = data;
+  size_t n = 0;
+  size_t chunk;
+
+  for (mpack_rope_normalize(rope, &index, &offset); (n != size) && (index != rope->count); ++index, offset = 0) {
+    chunk = rope->segments[index].size - offset;
+    chunk = (chunk < (size - n)) ? chunk : (size - n);
+    memcpy(out + n, (const char *)rope->segments[index].data + offset, chunk);
+    n += chunk;
   }
 
-  errno = ERANGE;
-  return -1;
+  return n;
 }
 
-int mpack_encode_array(mpack_encoder_t *encoder, mpack_array_t value)
+/* Headers are read in place unless they cross a boundary. */
+static int mpack_rope_header(const mpack_rope_t *rope, size_t index, size_t offset, mpack_value_header_t *h)
 {
-  if (value.size <= 15) {
-    mpack_encoder_write_uint8(encoder, value.size | MPACK_FIXARRAY);
-    return 1;
-  }
+  uint8_t buffer[MPACK_HEADER_MAX];
+  const mpack_segment_t *segment;
+  size_t size;
 
-  if (value.size <= UINT16_MAX) {
-    mpack_encoder_write_uint8(encoder, MPACK_ARRAY16);
-    mpack_encoder_write_uint16(encoder, value.size);
-    return 3;
+  mpack_rope_normalize(rope, &index, &offset);
+
+  if (index == rope->count) {
+    errno = EAGAIN;
+    return -1;
   }
 
-  if (value.size <= UINT32_MAX) {
-    mpack_encoder_write_uint8(encoder, MPACK_ARRAY32);
-    mpack_encoder_write_uint32(encoder, value.size);
-    return 5;
+  segment = &rope->segments[index];
+
+  if ((segment->size - offset) >= MPACK_HEADER_MAX) {
+    return mpack_value_header((const uint8_t *)segment->data + offset, MPACK_HEADER_MAX, h);
   }
 
-  errno = ERANGE;
-  return -1;
+  size = mpack_rope_copy(rope, index, offset, buffer, sizeof(buffer));
+  return mpack_value_header(buffer, size, h);
 }
 
-int mpack_encode_map(mpack_encoder_t *encoder, mpack_map_t value)
+/* Scans the headers of the current value from where the last call stopped,
+   on success the scanner offset is the size of what is left of it. */
+static int mpack_rope_measure(mpack_rope_t *rope)
 {
-  if (value.size <= 15) {
-    mpack_encoder_write_uint8(encoder, value.size | MPACK_FIXMAP);
-    return 1;
+  mpack_scanner_t *scanner = &rope->scanner;
+  size_t index = rope->index;
+  size_t offset = rope->offset;
+  mpack_value_header_t h;
+
+  if (!mpack_rope_advance(rope, &index, &offset, scanner->offset)) {
+    errno = EAGAIN;
+    return -1;
   }
 
-  if (value.size <= UINT16_MAX) {
-    mpack_encoder_write_uint8(encoder, MPACK_MAP16);
-    mpack_encoder_write_uint16(encoder, value.size);
-    return 3;
+  while (scanner->count != 0) {
+    if (mpack_rope_header(rope, index, offset, &h) < 0) {
+      return -1;
+    }
+
+    scanner->offset += h.header + h.payload;
+    scanner->count += h.children - 1;
+
+    if (!mpack_rope_advance(rope, &index, &offset, h.header + h.payload)) {
+      errno = EAGAIN;
+      return -1;
+    }
   }
 
-  if (value.size <= UINT32_MAX) {
-    mpack_encoder_write_uint8(encoder, MPACK_MAP32);
-    mpack_encoder_write_uint32(encoder, value.size);
-    return 5;
+  if (scanner->offset > INT_MAX) {
+    errno = ERANGE;
+    return -1;
   }
 
-  errno = ERANGE;
-  return -1;
+  return 0;
 }
 
-int mpack_encode_extended(mpack_encoder_t *encoder, mpack_extended_t value)
+/* Points at the next size bytes, copying them to the scratch buffer only if
+   they cross a boundary. */
+static const char *mpack_rope_span(mpack_rope_t *rope, size_t size)
 {
-  switch (value.size) {
-  case 1:
-    mpack_encoder_write_uint8(encoder, MPACK_FIXEXT1);
-    mpack_encoder_write_int8(encoder, value.type);
-    mpack_encoder_write_bytes(encoder, value.data, 1);
-    return 3;
+  const mpack_segment_t *segment = &rope->segments[rope->index];
+  size_t capacity;
+  char *scratch;
 
-  case 2:
-    mpack_encoder_write_uint8(encoder, MPACK_FIXEXT2);
-    mpack_encoder_write_int8(encoder, value.type);
-    mpack_encoder_write_bytes(encoder, value.data, 2);
-    return 4;
+  if ((segment->size - rope->offset) >= size) {
+    return (const char *)segment->data + rope->offset;
+  }
 
-  case 4:
-    mpack_encoder_write_uint8(encoder, MPACK_FIXEXT4);
-    mpack_encoder_write_int8(encoder, value.type);
-    mpack_encoder_write_bytes(encoder, value.data, 4);
-    return 6;
+  if (size > rope->scratch_size) {
+    capacity = (size > (2 * rope->scratch_size)) ? size : (2 * rope->scratch_size);
 
-  case 8:
-    mpack_encoder_write_uint8(encoder, MPACK_FIXEXT8);
-    mpack_encoder_write_int8(encoder, value.type);
-    mpack_encoder_write_bytes(encoder, value.data, 8);
-    return 10;
+    if (!(scratch = realloc(rope->scratch, capacity))) {
+      errno = ENOMEM;
+      return NULL;
+    }
 
-  case 16:
-    mpack_encoder_write_uint8(encoder, MPACK_FIXEXT16);
-    mpack_encoder_write_int8(encoder, value.type);
-    mpack_encoder_write_bytes(encoder, value.data, 16);
-    return 18;
+    rope->scratch = scratch;
+    rope->scratch_size = capacity;
   }
 
-  if (value.size <= UINT8_MAX) {
-    mpack_encoder_write_uint8(encoder, MPACK_EXT8);
-    mpack_encoder_write_uint8(encoder, value.size);
-    mpack_encoder_write_int8(encoder, value.type);
-    mpack_encoder_write_bytes(encoder, value.data, value.size);
-    return value.size + 3;
+  mpack_rope_copy(rope, rope->index, rope->offset, rope->scratch, size);
+  return rope->scratch;
+}
+
+/* Never goes past the bytes already scanned, the scanner starts over once
+   the current value was consumed entirely. */
+static void mpack_rope_consume(mpack_rope_t *rope, size_t size)
+{
+  mpack_rope_advance(rope, &rope->index, &rope->offset, size);
+  rope->position += size;
+  rope->scanner.offset -= size;
+
+  if ((rope->scanner.offset == 0) && (rope->scanner.count == 0)) {
+    mpack_scanner_init(&rope->scanner);
   }
+}
 
-  if (value.size <= UINT16_MAX) {
-    mpack_encoder_write_uint8(encoder, MPACK_EXT16);
-    mpack_encoder_write_uint16(encoder, value.size);
-    mpack_encoder_write_int8(encoder, value.type);
-    mpack_encoder_write_bytes(encoder, value.data, value.size);
-    return value.size + 4;
+void mpack_rope_init(mpack_rope_t *rope, const mpack_segment_t *segments, size_t count)
+{
+  rope->segments = segments;
+  rope->count = count;
+  rope->index = 0;
+  rope->offset = 0;
+  rope->position = 0;
+  rope->scratch = NULL;
+  rope->scratch_size = 0;
+  mpack_scanner_init(&rope->scanner);
+  mpack_rope_normalize(rope, &rope->index, &rope->offset);
+}
+
+void mpack_rope_term(mpack_rope_t *rope)
+{ free(rope->scratch); }
+
+/* The decoder is pointed at what is left of the current value once all of
+   it is available, in place up to the end of the segment and cut after the
+   last token that fits. A token that crosses the boundary is handed out
+   alone from the scratch buffer, so large values are never copied as a
+   whole. The scanner offset is back to zero once the value was handed out
+   entirely, only the last part went through the same checks as
+   mpack_validate and is marked trusted. The intern table and dictionary of
+   the decoder are left as they were. */
+int mpack_rope_next(mpack_rope_t *rope, mpack_decoder_t *decoder)
+{
+  mpack_value_header_t h;
+  const char *data;
+  size_t left;
+  size_t size;
+
+  if (mpack_rope_measure(rope) < 0) {
+    return -1;
   }
 
-  if (value.size <= UINT32_MAX) {
-    mpack_encoder_write_uint8(encoder, MPACK_EXT32);
-    mpack_encoder_write_uint32(encoder, value.size);
-    mpack_encoder_write_int8(encoder, value.type);
-    mpack_encoder_write_bytes(encoder, value.data, value.size);
-    return value.size + 6;
+  left = rope->segments[rope->index].size - rope->offset;
+  size = rope->scanner.offset;
+
+  if (size > left) {
+    for (size = 0; ; size += h.header + h.payload) {
+      if (mpack_rope_header(rope, rope->index, rope->offset + size, &h) < 0) {
+        return -1;
+      }
+
+      if ((size + h.header + h.payload) > left) {
+        break;
+      }
+    }
+
+    if (size == 0) {
+      size = h.header + h.payload;
+    }
   }
 
-  errno = ERANGE;
-  return -1;
+  if (!(data = mpack_rope_span(rope, size))) {
+    return -1;
+  }
+
+  decoder->begin = data;
+  decoder->pos = data;
+  decoder->end = data + size;
+
+  if (size == rope->scanner.offset) {
+    decoder->flags |= MPACK_DECODE_TRUSTED;
+  }
+  else {
+    decoder->flags &= ~MPACK_DECODE_TRUSTED;
+  }
+
+  mpack_rope_consume(rope, size);
+  return size;
 }
 
-int mpack_encode_object(mpack_encoder_t *encoder, mpack_object_t value)
+/* Containers only consume their header, like mpack_decode_object, so large
+   containers that cross a boundary are never copied as a whole. */
+int mpack_rope_decode_object(mpack_rope_t *rope, mpack_object_t *value)
 {
-  switch (value.type) {
-  case MPACK_NONE:
-    return mpack_encode_nil(encoder);
-    
-  case MPACK_BOOLEAN:
-    return mpack_encode_boolean(encoder, value.data.boolean);
+  mpack_decoder_t decoder;
+  mpack_value_header_t h;
+  size_t index = rope->index;
+  size_t offset = rope->offset;
+  const char *data;
+  int size;
 
-  case MPACK_INTEGER:
-    return mpack_encode_signed(encoder, value.data.integer);
+  if (mpack_rope_header(rope, index, offset, &h) < 0) {
+    return -1;
+  }
 
-  case MPACK_NUMBER:
-    return mpack_encode_double(encoder, value.data.number);
+  if (!mpack_rope_advance(rope, &index, &offset, h.header + h.payload)) {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  if ((h.header + h.payload) > INT_MAX) {
+    errno = ERANGE;
+    return -1;
+  }
+
+  if (!(data = mpack_rope_span(rope, h.header + h.payload))) {
+    return -1;
+  }
+
+  mpack_decoder_init(&decoder, data, h.header + h.payload);
+
+  if ((size = mpack_decode_object(&decoder, value)) < 0) {
+    return -1;
+  }
+
+  if (rope->scanner.offset == 0) {
+    rope->scanner.offset = size;
+    rope->scanner.count += h.children - 1;
+  }
+
+  mpack_rope_consume(rope, size);
+  return size;
+}
+
+/* Skips what is left of the current value. */
+int mpack_rope_skip(mpack_rope_t *rope)
+{
+  size_t size;
+
+  if (mpack_rope_measure(rope) < 0) {
+    return -1;
+  }
+
+  size = rope->scanner.offset;
+  mpack_rope_consume(rope, size);
+  return size;
+}
+
+enum {
+  MPACK_WALK_STACK_SIZE = 32,
+};
+
+typedef struct mpack_walk_frame {
+  size_t remaining;
+  bool map;
+} mpack_walk_frame_t;
 
+static int mpack_walk_skip(mpack_decoder_t *decoder, size_t count)
+{
+  for (; count != 0; --count) {
+    if (mpack_decode_skip(decoder) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int mpack_walk_value(const mpack_visitor_t *visitor, void *context, const mpack_object_t *value)
+{
+  switch (value->type) {
   case MPACK_STRING:
-    return mpack_encode_string(encoder, value.data.string);
+    return visitor->string ? visitor->string(context, value->data.string) : 0;
 
   case MPACK_BINARY:
-    return mpack_encode_binary(encoder, value.data.binary);
+    return visitor->binary ? visitor->binary(context, value->data.binary) : 0;
+
+  case MPACK_EXTENDED:
+    return visitor->extended ? visitor->extended(context, value->data.extended) : 0;
 
   case MPACK_ARRAY:
-    return mpack_encode_array(encoder, value.data.array);
+    return visitor->array_begin ? visitor->array_begin(context, value->data.array.size) : 0;
 
   case MPACK_MAP:
-    return mpack_encode_map(encoder, value.data.map);
+    return visitor->map_begin ? visitor->map_begin(context, value->data.map.size) : 0;
 
-  case MPACK_EXTENDED:
-    return mpack_encode_extended(encoder, value.data.extended);
+  default:
+    return visitor->scalar ? visitor->scalar(context, value) : 0;
+  }
+}
+
+/* Containers are tracked on an explicit stack of the number of values left in
+   each of them, the walk never recurses. Map keys go to map_key first, keys
+   that are containers then go through the same begin and end events as
+   values, so map_key flags them. */
+int mpack_walk(mpack_decoder_t *decoder, const mpack_visitor_t *visitor, void *context)
+{
+  mpack_walk_frame_t frames[MPACK_WALK_STACK_SIZE];
+  mpack_walk_frame_t *stack = frames;
+  mpack_walk_frame_t *frame = NULL;
+  size_t capacity = MPACK_WALK_STACK_SIZE;
+  size_t depth = 0;
+  size_t count = 0;
+  const char *pos = decoder->pos;
+  mpack_object_t value;
+  int (*end)(void *);
+  int result = -1;
+  int status;
+  bool key;
+
+  for (;;) {
+    key = false;
+
+    if (depth != 0) {
+      frame = &stack[depth - 1];
+
+      if (frame->remaining == 0) {
+        end = frame->map ? visitor->map_end : visitor->array_end;
+
+        if (end && (end(context) < 0)) {
+          goto done;
+        }
+        if (--depth == 0) {
+          break;
+        }
+        continue;
+      }
+
+      key = frame->map && !(frame->remaining & 1);
+      --frame->remaining;
+    }
+
+    if (mpack_decode_object(decoder, &value) < 0) {
+      goto done;
+    }
+
+    switch (value.type) {
+    case MPACK_ARRAY:
+      count = value.data.array.size;
+      break;
+
+    case MPACK_MAP:
+      count = 2 * value.data.map.size;
+      break;
+
+    default:
+      count = 0;
+      break;
+    }
+
+    if (key) {
+      if ((status = visitor->map_key ? visitor->map_key(context, &value) : 0) < 0) {
+        goto done;
+      }
+
+      if (status == MPACK_WALK_SKIP) {
+        if ((mpack_walk_skip(decoder, count) < 0) || (mpack_decode_skip(decoder) < 0)) {
+          goto done;
+        }
+        --frame->remaining;
+        continue;
+      }
+
+      if ((value.type != MPACK_ARRAY) && (value.type != MPACK_MAP)) {
+        continue;
+      }
+    }
+
+    if (((value.type == MPACK_ARRAY) || (value.type == MPACK_MAP)) && visitor->depth && (depth == visitor->depth)) {
+      errno = ERANGE;
+      goto done;
+    }
+
+    if ((status = mpack_walk_value(visitor, context, &value)) < 0) {
+      goto done;
+    }
+
+    if ((value.type == MPACK_ARRAY) || (value.type == MPACK_MAP)) {
+      if (status == MPACK_WALK_SKIP) {
+        if (mpack_walk_skip(decoder, count) < 0) {
+          goto done;
+        }
+      }
+      else {
+        if (depth == capacity) {
+          if (!(frame = malloc(2 * capacity * sizeof(*frame)))) {
+            errno = ENOMEM;
+            goto done;
+          }
+
+          memcpy(frame, stack, capacity * sizeof(*frame));
+
+          if (stack != frames) {
+            free(stack);
+          }
+
+          stack = frame;
+          capacity *= 2;
+        }
+
+        frame = &stack[depth++];
+        frame->remaining = count;
+        frame->map = (value.type == MPACK_MAP);
+        continue;
+      }
+    }
+
+    if (depth == 0) {
+      break;
+    }
+  }
+
+  result = decoder->pos - pos;
+done:
+  if (stack != frames) {
+    free(stack);
+  }
+
+  if (result < 0) {
+    decoder->pos = pos;
+  }
+
+  return result;
+}
+
+int mpack_decode_symbol(mpack_decoder_t *decoder, const mpack_symbol_t **value)
+{
+  MPACK_DECODE_BEGIN(decoder);
+  mpack_string_t string;
+
+  if (!decoder->intern) {
+    MPACK_DECODE_FAIL(EINVAL);
+  }
+
+  MPACK_DECODE_ASSERT(mpack_decode_string(decoder, &string));
+
+  if (!(*value = mpack_intern_insert(decoder->intern, string))) {
+    goto fail;
+  }
+
+  MPACK_DECODE_END(decoder);
+}
+
+/* Timestamps come in three layouts: 32 bits of seconds, 30 bits of
+   nanoseconds and 34 bits of seconds packed in 64 bits, or 32 bits of
+   nanoseconds followed by 64 bits of signed seconds. */
+int mpack_decode_timestamp(mpack_decoder_t *decoder, struct timespec *value)
+{
+  MPACK_DECODE_BEGIN(decoder);
+  mpack_extended_t ext;
+  uint32_t u32;
+  uint64_t u64;
+
+  MPACK_DECODE_ASSERT(mpack_decode_extended(decoder, &ext));
+
+  if (ext.type != MPACK_EXT_TIMESTAMP) {
+    MPACK_DECODE_FAIL(EINVAL);
+  }
+
+  switch (ext.size) {
+  case 4:
+    memcpy(&u32, ext.data, 4);
+    value->tv_sec = be32(u32);
+    value->tv_nsec = 0;
+    break;
+
+  case 8:
+    memcpy(&u64, ext.data, 8);
+    u64 = be64(u64);
+    value->tv_sec = u64 & 0x3ffffffffULL;
+    value->tv_nsec = u64 >> 34;
+    break;
+
+  case 12:
+    memcpy(&u32, ext.data, 4);
+    memcpy(&u64, (const char *)ext.data + 4, 8);
+    value->tv_sec = (int64_t)be64(u64);
+    value->tv_nsec = be32(u32);
+    break;
 
   default:
-    errno = EINVAL;
-    return -1;
+    MPACK_DECODE_FAIL(EINVAL);
+  }
+
+  if (value->tv_nsec >= 1000000000) {
+    MPACK_DECODE_FAIL(EINVAL);
+  }
+
+  MPACK_DECODE_END(decoder);
+}
+
+int mpack_encode_nil(mpack_encoder_t *encoder)
+{
+  mpack_encoder_write_uint8(encoder, MPACK_NIL);
+  return 1;
+}
+
+int mpack_encode_true(mpack_encoder_t *encoder)
+{
+  mpack_encoder_write_uint8(encoder, MPACK_TRUE);
+  return 1;
+}
+
+int mpack_encode_false(mpack_encoder_t *encoder)
+{
+  mpack_encoder_write_uint8(encoder, MPACK_FALSE);
+  return 1;
+}
+
+int mpack_encode_boolean(mpack_encoder_t *encoder, bool value)
+{ return value ? mpack_encode_true(encoder) : mpack_encode_false(encoder); }
+
+int mpack_encode_signed(mpack_encoder_t *encoder, signed long value)
+{
+  if (value >= 0) {
+    return mpack_encode_unsigned(encoder, value);
+  }
+
+  if (encoder->flags & MPACK_ENCODE_FIXED_WIDTH) {
+    mpack_encoder_write_uint8(encoder, MPACK_INT64);
+    mpack_encoder_write_int64(encoder, value);
+    return 9;
+  }
+
+  if (value >= -31) {
+    mpack_encoder_write_int8(encoder, value);
+    return 1;
+  }
+
+  if (value >= INT8_MIN) {
+    mpack_encoder_write_uint8(encoder, MPACK_INT8);
+    mpack_encoder_write_int8(encoder, value);
+    return 2;
+  }
+
+  if (value >= INT16_MIN) {
+    mpack_encoder_write_uint8(encoder, MPACK_INT16);
+    mpack_encoder_write_int16(encoder, value);
+    return 3;
+  }
+
+  if (value >= INT32_MIN) {
+    mpack_encoder_write_uint8(encoder, MPACK_INT32);
+    mpack_encoder_write_int32(encoder, value);
+    return 5;
+  }
+
+  mpack_encoder_write_uint8(encoder, MPACK_INT64);
+  mpack_encoder_write_int64(encoder, value);
+  return 9;
+}
+
+int mpack_encode_unsigned(mpack_encoder_t *encoder, unsigned long value)
+{
+  if (encoder->flags & MPACK_ENCODE_FIXED_WIDTH) {
+    mpack_encoder_write_uint8(encoder, MPACK_UINT64);
+    mpack_encoder_write_uint64(encoder, value);
+    return 9;
+  }
+
+  if (value <= INT8_MAX) {
+    mpack_encoder_write_uint8(encoder, value);
+    return 1;
+  }
+
+  if (value <= UINT8_MAX) {
+    mpack_encoder_write_uint8(encoder, MPACK_UINT8);
+    mpack_encoder_write_uint8(encoder, value);
+    return 2;
   }
+
+  if (value <= UINT16_MAX) {
+    mpack_encoder_write_uint8(encoder, MPACK_UINT16);
+    mpack_encoder_write_uint16(encoder, value);
+    return 3;
+  }
+
+  if (value <= UINT32_MAX) {
+    mpack_encoder_write_uint8(encoder, MPACK_UINT32);
+    mpack_encoder_write_uint32(encoder, value);
+    return 5;
+  }
+
+  mpack_encoder_write_uint8(encoder, MPACK_UINT64);
+  mpack_encoder_write_uint64(encoder, value);
+  return 9;
+}
+
+int mpack_encode_float(mpack_encoder_t *encoder, float value)
+{
+  union { uint32_t u; float f; } var;
+  var.f = value;
+  mpack_encoder_write_uint8(encoder, MPACK_FLOAT32);
+  mpack_encoder_write_uint32(encoder, var.u);
+  return 5;
+}
+
+static int mpack_encode_float64(mpack_encoder_t *encoder, double value)
+{
+  union { uint64_t u; double f; } var;
+  var.f = value;
+  mpack_encoder_write_uint8(encoder, MPACK_FLOAT64);
+  mpack_encoder_write_uint64(encoder, var.u);
+  return 9;
+}
+
+/* Integers are limited to 2^53 because that is what mpack_decode_double
+   accepts back, and -0.0 is left out since it would decode as +0.0. */
+static bool mpack_double_is_integer(double value)
+{
+  return (value >= -9007199254740992.0) && (value <= 9007199254740992.0)
+      && (value == (double)(long)value) && !((value == 0) && signbit(value));
+}
+
+static bool mpack_double_is_float(double value)
+{ return ((value <= FLT_MAX) && (value >= -FLT_MAX) && ((double)(float)value == value)) || isinf(value); }
+
+static int mpack_encode_double_integer(mpack_encoder_t *encoder, double value)
+{
+  if (value >= 0) {
+    return mpack_encode_unsigned(encoder, (unsigned long)value);
+  }
+  return mpack_encode_signed(encoder, (long)value);
+}
+
+static int mpack_encode_double_compact(mpack_encoder_t *encoder, double value)
+{
+  if (mpack_double_is_integer(value)) {
+    return mpack_encode_double_integer(encoder, value);
+  }
+
+  if (mpack_double_is_float(value)) {
+    return mpack_encode_float(encoder, (float)value);
+  }
+
+  return mpack_encode_float64(encoder, value);
+}
+
+int mpack_encode_double(mpack_encoder_t *encoder, double value)
+{
+  if (encoder->flags & MPACK_ENCODE_COMPACT_FLOAT) {
+    return mpack_encode_double_compact(encoder, value);
+  }
+  return mpack_encode_float64(encoder, value);
+}
+
+int mpack_encode_double_array(mpack_encoder_t *encoder, const double *values, size_t count)
+{
+  size_t start = mpack_encoder_offset(encoder);
+  mpack_array_t array;
+  size_t i = 0;
+
+  array.size = count;
+
+  if (mpack_encode_array(encoder, array) < 0) {
+    return -1;
+  }
+
+  if (!(encoder->flags & MPACK_ENCODE_COMPACT_FLOAT)) {
+    for (; i != count; ++i) {
+      mpack_encode_float64(encoder, values[i]);
+    }
+    return mpack_encoder_offset(encoder) - start;
+  }
+
+#if defined(__SSE2__)
+  /* Two lanes are classified at a time: a lane that survives a round trip
+     through int32 is a small integer, one that survives a round trip through
+     float is a float32, anything else goes through the scalar path which also
+     catches the large integers and -0.0. */
+  for (; (i + 2) <= count; i += 2) {
+    __m128d x = _mm_loadu_pd(values + i);
+    int integers = _mm_movemask_pd(_mm_cmpeq_pd(x, _mm_cvtepi32_pd(_mm_cvttpd_epi32(x))));
+    int floats = _mm_movemask_pd(_mm_cmpeq_pd(x, _mm_cvtps_pd(_mm_cvtpd_ps(x))));
+    int lane;
+
+    for (lane = 0; lane != 2; ++lane) {
+      double value = values[i + lane];
+
+      if ((integers & (1 << lane)) && (value != 0)) {
+        mpack_encode_double_integer(encoder, value);
+      }
+      else if ((floats & (1 << lane)) && (value != 0)) {
+        mpack_encode_float(encoder, (float)value);
+      }
+      else {
+        mpack_encode_double_compact(encoder, value);
+      }
+    }
+  }
+#endif /* __SSE2__ */
+
+  for (; i != count; ++i) {
+    mpack_encode_double_compact(encoder, values[i]);
+  }
+
+  return mpack_encoder_offset(encoder) - start;
+}
+
+static int mpack_encode_str(mpack_encoder_t *encoder, mpack_string_t value)
+{
+  if (value.size <= 15) {
+    mpack_encoder_write_uint8(encoder, MPACK_FIXSTR | value.size);
+    mpack_encoder_write_bytes(encoder, value.data, value.size);
+    return value.size + 1;
+  }
+
+  if (value.size <= UINT8_MAX) {
+    mpack_encoder_write_uint8(encoder, MPACK_STR8);
+    mpack_encoder_write_uint8(encoder, value.size);
+    mpack_encoder_write_bytes(encoder, value.data, value.size);
+    return value.size + 2;
+  }
+
+  if (value.size <= UINT16_MAX) {
+    mpack_encoder_write_uint8(encoder, MPACK_STR16);
+    mpack_encoder_write_uint16(encoder, value.size);
+    mpack_encoder_write_bytes(encoder, value.data, value.size);
+    return value.size + 3;
+  }
+
+  if (value.size <= UINT32_MAX) {
+    mpack_encoder_write_uint8(encoder, MPACK_STR32);
+    mpack_encoder_write_uint32(encoder, value.size);
+    mpack_encoder_write_bytes(encoder, value.data, value.size);
+    return value.size + 5;
+  }
+
+  errno = ERANGE;
+  return -1;
+}
+
+static int mpack_encode_dict_string(mpack_encoder_t *encoder, mpack_string_t value)
+{
+  mpack_dict_t *dict = encoder->dict;
+  const mpack_symbol_t *symbol;
+  mpack_extended_t ext;
+  uint8_t id[2];
+  int size;
+
+  if (value.size < dict->min_size) {
+    return mpack_encode_str(encoder, value);
+  }
+
+  if ((symbol = mpack_intern_find(&dict->strings, value))) {
+    if (symbol->id <= UINT8_MAX) {
+      id[0] = symbol->id;
+      ext.size = 1;
+    }
+    else {
+      id[0] = symbol->id >> 8;
+      id[1] = symbol->id;
+      ext.size = 2;
+    }
+    ext.data = id;
+    ext.type = dict->reference;
+    return mpack_encode_extended(encoder, ext);
+  }
+
+  if ((dict->strings.count == dict->strings.capacity) || (value.size > UINT32_MAX)) {
+    return mpack_encode_str(encoder, value);
+  }
+
+  if (!mpack_intern_insert(&dict->strings, value)) {
+    return -1;
+  }
+
+  /* Definitions always use a sized extension so decoders only have to look
+     at fixext1/fixext2 for references. */
+  if (value.size <= UINT8_MAX) {
+    mpack_encoder_write_uint8(encoder, MPACK_EXT8);
+    mpack_encoder_write_uint8(encoder, value.size);
+    size = 3;
+  }
+  else if (value.size <= UINT16_MAX) {
+    mpack_encoder_write_uint8(encoder, MPACK_EXT16);
+    mpack_encoder_write_uint16(encoder, value.size);
+    size = 4;
+  }
+  else {
+    mpack_encoder_write_uint8(encoder, MPACK_EXT32);
+    mpack_encoder_write_uint32(encoder, value.size);
+    size = 6;
+  }
+
+  mpack_encoder_write_int8(encoder, dict->define);
+  mpack_encoder_write_bytes(encoder, value.data, value.size);
+  return size + value.size;
+}
+
+int mpack_encode_string(mpack_encoder_t *encoder, mpack_string_t value)
+{
+  if (encoder->dict && (encoder->flags & MPACK_ENCODE_DICT_STRINGS)) {
+    return mpack_encode_dict_string(encoder, value);
+  }
+  return mpack_encode_str(encoder, value);
+}
+
+int mpack_encode_key(mpack_encoder_t *encoder, mpack_string_t value)
+{
+  if (encoder->dict) {
+    return mpack_encode_dict_string(encoder, value);
+  }
+  return mpack_encode_str(encoder, value);
+}
+
+int mpack_encode_binary(mpack_encoder_t *encoder, mpack_binary_t value)
+{
+  if (value.size <= UINT8_MAX) {
+    mpack_encoder_write_uint8(encoder, MPACK_BIN8);
+    mpack_encoder_write_uint8(encoder, value.size);
+    mpack_encoder_write_bytes(encoder, value.data, value.size);
+    return value.size + 2;
+  }
+
+  if (value.size <= UINT16_MAX) {
+    mpack_encoder_write_uint8(encoder, MPACK_BIN16);
+    mpack_encoder_write_uint16(encoder, value.size);
+    mpack_encoder_write_bytes(encoder, value.data, value.size);
+    return value.size + 3;
+  }
+
+  if (value.size <= UINT32_MAX) {
+    mpack_encoder_write_uint8(encoder, MPACK_BIN32);
+    mpack_encoder_write_uint32(encoder, value.size);
+    mpack_encoder_write_bytes(encoder, value.data, value.size);
+    return value.size + 5;
+  }
+
+  errno = ERANGE;
+  return -1;
+}
+
+int mpack_encode_array(mpack_encoder_t *encoder, mpack_array_t value)
+{
+  if (value.size <= 15) {
+    mpack_encoder_write_uint8(encoder, value.size | MPACK_FIXARRAY);
+    return 1;
+  }
+
+  if (value.size <= UINT16_MAX) {
+    mpack_encoder_write_uint8(encoder, MPACK_ARRAY16);
+    mpack_encoder_write_uint16(encoder, value.size);
+    return 3;
+  }
+
+  if (value.size <= UINT32_MAX) {
+    mpack_encoder_write_uint8(encoder, MPACK_ARRAY32);
+    mpack_encoder_write_uint32(encoder, value.size);
+    return 5;
+  }
+
+  errno = ERANGE;
+  return -1;
+}
+
+int mpack_encode_map(mpack_encoder_t *encoder, mpack_map_t value)
+{
+  if (value.size <= 15) {
+    mpack_encoder_write_uint8(encoder, value.size | MPACK_FIXMAP);
+    return 1;
+  }
+
+  if (value.size <= UINT16_MAX) {
+    mpack_encoder_write_uint8(encoder, MPACK_MAP16);
+    mpack_encoder_write_uint16(encoder, value.size);
+    return 3;
+  }
+
+  if (value.size <= UINT32_MAX) {
+    mpack_encoder_write_uint8(encoder, MPACK_MAP32);
+    mpack_encoder_write_uint32(encoder, value.size);
+    return 5;
+  }
+
+  errno = ERANGE;
+  return -1;
+}
+
+static int mpack_encode_begin(mpack_encoder_t *encoder, size_t *offset, uint8_t tag)
+{
+  *offset = mpack_encoder_offset(encoder);
+  mpack_encoder_write_uint8(encoder, tag);
+  mpack_encoder_write_uint32(encoder, 0);
+  return 5;
+}
+
+/* The header must still be in the encoder's current buffer, it cannot be
+   patched once the encoder moved on to another one. */
+static int mpack_encode_end(mpack_encoder_t *encoder, size_t offset, size_t size, uint8_t tag)
+{
+  char *header;
+  uint32_t value;
+
+  if (size > UINT32_MAX) {
+    errno = ERANGE;
+    return -1;
+  }
+
+  if (offset < encoder->base) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  header = encoder->begin + (offset - encoder->base);
+
+  if ((header + 5) > encoder->end) {
+    /* the header itself was never written, there is nothing to patch */
+    return 0;
+  }
+
+  if ((uint8_t)header[0] != tag) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  value = be32(size);
+  memcpy(header + 1, &value, 4);
+  return 0;
+}
+
+int mpack_encode_array_begin(mpack_encoder_t *encoder, size_t *offset)
+{ return mpack_encode_begin(encoder, offset, MPACK_ARRAY32); }
+
+int mpack_encode_array_end(mpack_encoder_t *encoder, size_t offset, size_t size)
+{ return mpack_encode_end(encoder, offset, size, MPACK_ARRAY32); }
+
+int mpack_encode_map_begin(mpack_encoder_t *encoder, size_t *offset)
+{ return mpack_encode_begin(encoder, offset, MPACK_MAP32); }
+
+int mpack_encode_map_end(mpack_encoder_t *encoder, size_t offset, size_t size)
+{ return mpack_encode_end(encoder, offset, size, MPACK_MAP32); }
+
+int mpack_encoder_compact(mpack_encoder_t *encoder, size_t offset)
+{
+  char *header;
+  char *body;
+  uint32_t size;
+  uint16_t size16;
+  int length;
+
+  if ((encoder->pos > encoder->end) || (offset < encoder->base)) {
+    /* part of the body was dropped, shrinking pos would hide the overflow,
+       or the header is in a buffer the encoder already left */
+    return 0;
+  }
+
+  header = encoder->begin + (offset - encoder->base);
+  body = header + 5;
+
+  if ((body > encoder->pos) || ((uint8_t)header[0] != MPACK_ARRAY32 && (uint8_t)header[0] != MPACK_MAP32)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memcpy(&size, header + 1, 4);
+  size = be32(size);
+
+  if (size <= 15) {
+    header[0] = size | ((uint8_t)header[0] == MPACK_ARRAY32 ? MPACK_FIXARRAY : MPACK_FIXMAP);
+    length = 1;
+  }
+  else if (size <= UINT16_MAX) {
+    header[0] = (uint8_t)header[0] == MPACK_ARRAY32 ? MPACK_ARRAY16 : MPACK_MAP16;
+    size16 = be16(size);
+    memcpy(header + 1, &size16, 2);
+    length = 3;
+  }
+  else {
+    return 0;
+  }
+
+  memmove(header + length, body, encoder->pos - body);
+  encoder->pos -= 5 - length;
+  return 5 - length;
+}
+
+int mpack_encode_extended(mpack_encoder_t *encoder, mpack_extended_t value)
+{
+  switch (value.size) {
+  case 1:
+    mpack_encoder_write_uint8(encoder, MPACK_FIXEXT1);
+    mpack_encoder_write_int8(encoder, value.type);
+    mpack_encoder_write_bytes(encoder, value.data, 1);
+    return 3;
+
+  case 2:
+    mpack_encoder_write_uint8(encoder, MPACK_FIXEXT2);
+    mpack_encoder_write_int8(encoder, value.type);
+    mpack_encoder_write_bytes(encoder, value.data, 2);
+    return 4;
+
+  case 4:
+    mpack_encoder_write_uint8(encoder, MPACK_FIXEXT4);
+    mpack_encoder_write_int8(encoder, value.type);
+    mpack_encoder_write_bytes(encoder, value.data, 4);
+    return 6;
+
+  case 8:
+    mpack_encoder_write_uint8(encoder, MPACK_FIXEXT8);
+    mpack_encoder_write_int8(encoder, value.type);
+    mpack_encoder_write_bytes(encoder, value.data, 8);
+    return 10;
+
+  case 16:
+    mpack_encoder_write_uint8(encoder, MPACK_FIXEXT16);
+    mpack_encoder_write_int8(encoder, value.type);
+    mpack_encoder_write_bytes(encoder, value.data, 16);
+    return 18;
+  }
+
+  if (value.size <= UINT8_MAX) {
+    mpack_encoder_write_uint8(encoder, MPACK_EXT8);
+    mpack_encoder_write_uint8(encoder, value.size);
+    mpack_encoder_write_int8(encoder, value.type);
+    mpack_encoder_write_bytes(encoder, value.data, value.size);
+    return value.size + 3;
+  }
+
+  if (value.size <= UINT16_MAX) {
+    mpack_encoder_write_uint8(encoder, MPACK_EXT16);
+    mpack_encoder_write_uint16(encoder, value.size);
+    mpack_encoder_write_int8(encoder, value.type);
+    mpack_encoder_write_bytes(encoder, value.data, value.size);
+    return value.size + 4;
+  }
+
+  if (value.size <= UINT32_MAX) {
+    mpack_encoder_write_uint8(encoder, MPACK_EXT32);
+    mpack_encoder_write_uint32(encoder, value.size);
+    mpack_encoder_write_int8(encoder, value.type);
+    mpack_encoder_write_bytes(encoder, value.data, value.size);
+    return value.size + 6;
+  }
+
+  errno = ERANGE;
+  return -1;
+}
+
+/* The three timestamp formats, each one is written only if it can hold the
+   value and the size of the format is returned, or zero. */
+static int mpack_encode_timestamp32(mpack_encoder_t *encoder, struct timespec value)
+{
+  if ((value.tv_nsec != 0) || (value.tv_sec < 0) || ((uint64_t)value.tv_sec > UINT32_MAX)) {
+    return 0;
+  }
+
+  mpack_encoder_write_uint8(encoder, MPACK_FIXEXT4);
+  mpack_encoder_write_int8(encoder, MPACK_EXT_TIMESTAMP);
+  mpack_encoder_write_uint32(encoder, value.tv_sec);
+  return 6;
+}
+
+static int mpack_encode_timestamp64(mpack_encoder_t *encoder, struct timespec value)
+{
+  if ((value.tv_sec < 0) || ((uint64_t)value.tv_sec > 0x3ffffffffULL)) {
+    return 0;
+  }
+
+  mpack_encoder_write_uint8(encoder, MPACK_FIXEXT8);
+  mpack_encoder_write_int8(encoder, MPACK_EXT_TIMESTAMP);
+  mpack_encoder_write_uint64(encoder, ((uint64_t)value.tv_nsec << 34) | (uint64_t)value.tv_sec);
+  return 10;
+}
+
+static int mpack_encode_timestamp96(mpack_encoder_t *encoder, struct timespec value)
+{
+  mpack_encoder_write_uint8(encoder, MPACK_EXT8);
+  mpack_encoder_write_uint8(encoder, 12);
+  mpack_encoder_write_int8(encoder, MPACK_EXT_TIMESTAMP);
+  mpack_encoder_write_uint32(encoder, value.tv_nsec);
+  mpack_encoder_write_int64(encoder, value.tv_sec);
+  return 15;
+}
+
+int mpack_encode_timestamp(mpack_encoder_t *encoder, struct timespec value)
+{
+  int n;
+
+  if ((value.tv_nsec < 0) || (value.tv_nsec >= 1000000000)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (!(encoder->flags & MPACK_ENCODE_FIXED_WIDTH) &&
+      ((n = mpack_encode_timestamp32(encoder, value)) || (n = mpack_encode_timestamp64(encoder, value)))) {
+    return n;
+  }
+
+  return mpack_encode_timestamp96(encoder, value);
+}
+
+int mpack_encode_object(mpack_encoder_t *encoder, mpack_object_t value)
+{
+  switch (value.type) {
+  case MPACK_NONE:
+    return mpack_encode_nil(encoder);
+    
+  case MPACK_BOOLEAN:
+    return mpack_encode_boolean(encoder, value.data.boolean);
+
+  case MPACK_INTEGER:
+    return mpack_encode_signed(encoder, value.data.integer);
+
+  case MPACK_NUMBER:
+    return mpack_encode_double(encoder, value.data.number);
+
+  case MPACK_STRING:
+    return mpack_encode_string(encoder, value.data.string);
+
+  case MPACK_BINARY:
+    return mpack_encode_binary(encoder, value.data.binary);
+
+  case MPACK_ARRAY:
+    return mpack_encode_array(encoder, value.data.array);
+
+  case MPACK_MAP:
+    return mpack_encode_map(encoder, value.data.map);
+
+  case MPACK_EXTENDED:
+    return mpack_encode_extended(encoder, value.data.extended);
+
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+}
+
+/* Splices values that are already encoded, the bytes are not checked and
+   strings in them do not go through the encoder's dictionary. */
+int mpack_encode_raw(mpack_encoder_t *encoder, const void *data, size_t size)
+{
+  if (size > INT_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  mpack_encoder_write_bytes(encoder, data, size);
+  return size;
+}
+
+int mpack_encode_fragment(mpack_encoder_t *encoder, const mpack_fragments_t *fragments, size_t id)
+{
+  const mpack_fragment_t *fragment;
+
+  if (id >= fragments->count) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  fragment = &fragments->entries[id];
+  mpack_encoder_write_bytes(encoder, fragments->data + fragment->offset, fragment->size);
+  return fragment->size;
+}
+
+/* Integers are written with the format of the given size, whether or not it
+   is the smallest one for the value. */
+static bool mpack_patch_integer(mpack_encoder_t *encoder, signed long value, size_t size)
+{
+  switch (size) {
+  case 1:
+    if ((value < -32) || (value > INT8_MAX)) {
+      return false;
+    }
+    mpack_encoder_write_int8(encoder, value);
+    return true;
+
+  case 2:
+    if ((value < INT8_MIN) || (value > UINT8_MAX)) {
+      return false;
+    }
+    mpack_encoder_write_uint8(encoder, (value < 0) ? MPACK_INT8 : MPACK_UINT8);
+    mpack_encoder_write_uint8(encoder, value);
+    return true;
+
+  case 3:
+    if ((value < INT16_MIN) || (value > UINT16_MAX)) {
+      return false;
+    }
+    mpack_encoder_write_uint8(encoder, (value < 0) ? MPACK_INT16 : MPACK_UINT16);
+    mpack_encoder_write_uint16(encoder, value);
+    return true;
+
+  case 5:
+    if ((value < INT32_MIN) || (value > (signed long)UINT32_MAX)) {
+      return false;
+    }
+    mpack_encoder_write_uint8(encoder, (value < 0) ? MPACK_INT32 : MPACK_UINT32);
+    mpack_encoder_write_uint32(encoder, value);
+    return true;
+
+  case 9:
+    mpack_encoder_write_uint8(encoder, (value < 0) ? MPACK_INT64 : MPACK_UINT64);
+    mpack_encoder_write_uint64(encoder, value);
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+/* Writes the header of a string, binary or extension of length bytes whose
+   formats are listed from the smallest to the largest header, fix is the
+   tag of the fixed size format if any. */
+static bool mpack_patch_header(mpack_encoder_t *encoder, size_t length, size_t size, int fix, const int *tags)
+{
+  if ((fix >= 0) && (size == (1 + length))) {
+    mpack_encoder_write_uint8(encoder, fix);
+    return true;
+  }
+
+  if ((size == (2 + length)) && (length <= UINT8_MAX)) {
+    mpack_encoder_write_uint8(encoder, tags[0]);
+    mpack_encoder_write_uint8(encoder, length);
+    return true;
+  }
+
+  if ((size == (3 + length)) && (length <= UINT16_MAX)) {
+    mpack_encoder_write_uint8(encoder, tags[1]);
+    mpack_encoder_write_uint16(encoder, length);
+    return true;
+  }
+
+  if ((size == (5 + length)) && (length <= UINT32_MAX)) {
+    mpack_encoder_write_uint8(encoder, tags[2]);
+    mpack_encoder_write_uint32(encoder, length);
+    return true;
+  }
+
+  return false;
+}
+
+static bool mpack_patch_extended(mpack_encoder_t *encoder, mpack_extended_t value, size_t size)
+{
+  static const int tags[] = { MPACK_EXT8, MPACK_EXT16, MPACK_EXT32 };
+
+  if (size == (2 + value.size)) {
+    switch (value.size) {
+    case 1:
+      mpack_encoder_write_uint8(encoder, MPACK_FIXEXT1);
+      break;
+    case 2:
+      mpack_encoder_write_uint8(encoder, MPACK_FIXEXT2);
+      break;
+    case 4:
+      mpack_encoder_write_uint8(encoder, MPACK_FIXEXT4);
+      break;
+    case 8:
+      mpack_encoder_write_uint8(encoder, MPACK_FIXEXT8);
+      break;
+    case 16:
+      mpack_encoder_write_uint8(encoder, MPACK_FIXEXT16);
+      break;
+    default:
+      return false;
+    }
+  }
+  else if ((size < 3) || !mpack_patch_header(encoder, value.size, size - 1, -1, tags)) {
+    return false;
+  }
+
+  mpack_encoder_write_int8(encoder, value.type);
+  mpack_encoder_write_bytes(encoder, value.data, value.size);
+  return true;
+}
+
+/* Overwrites the size bytes of the value encoded at data, typically found
+   with mpack_find, with an encoding of value that has the same size. When
+   there is none the call fails with ERANGE and data is left untouched,
+   containers cannot be patched. Returns size. */
+int mpack_patch_object(void *data, size_t size, mpack_object_t value)
+{
+  static const int string_tags[] = { MPACK_STR8, MPACK_STR16, MPACK_STR32 };
+  static const int binary_tags[] = { MPACK_BIN8, MPACK_BIN16, MPACK_BIN32 };
+  mpack_encoder_t encoder;
+  bool patched = false;
+
+  mpack_encoder_init(&encoder, data, size);
+
+  switch (value.type) {
+  case MPACK_NONE:
+    patched = (size == 1) && (mpack_encode_nil(&encoder) == 1);
+    break;
+
+  case MPACK_BOOLEAN:
+    patched = (size == 1) && (mpack_encode_boolean(&encoder, value.data.boolean) == 1);
+    break;
+
+  case MPACK_INTEGER:
+    patched = mpack_patch_integer(&encoder, value.data.integer, size);
+    break;
+
+  case MPACK_NUMBER:
+    if ((size == 5) && mpack_double_is_float(value.data.number)) {
+      patched = mpack_encode_float(&encoder, (float)value.data.number) == 5;
+    }
+    else if (size == 9) {
+      patched = mpack_encode_float64(&encoder, value.data.number) == 9;
+    }
+    break;
+
+  case MPACK_STRING:
+    patched = mpack_patch_header(&encoder, value.data.string.size, size,
+                                 (value.data.string.size < 32) ? (int)(MPACK_FIXSTR | value.data.string.size) : -1,
+                                 string_tags);
+    if (patched) {
+      mpack_encoder_write_bytes(&encoder, value.data.string.data, value.data.string.size);
+    }
+    break;
+
+  case MPACK_BINARY:
+    patched = mpack_patch_header(&encoder, value.data.binary.size, size, -1, binary_tags);
+    if (patched) {
+      mpack_encoder_write_bytes(&encoder, value.data.binary.data, value.data.binary.size);
+    }
+    break;
+
+  case MPACK_EXTENDED:
+    patched = mpack_patch_extended(&encoder, value.data.extended, size);
+    break;
+
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (!patched) {
+    errno = ERANGE;
+    return -1;
+  }
+
+  return size;
+}
+
+/* The value is written in the format of the timestamp it replaces, a
+   timestamp64 takes any value it can hold even if a shorter format would
+   do. */
+int mpack_patch_timestamp(void *data, size_t size, struct timespec value)
+{
+  char buffer[15];
+  mpack_encoder_t encoder;
+  int n;
+
+  if ((value.tv_nsec < 0) || (value.tv_nsec >= 1000000000)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+
+  switch (size) {
+  case 6:
+    n = mpack_encode_timestamp32(&encoder, value);
+    break;
+
+  case 10:
+    n = mpack_encode_timestamp64(&encoder, value);
+    break;
+
+  case 15:
+    n = mpack_encode_timestamp96(&encoder, value);
+    break;
+
+  default:
+    n = 0;
+    break;
+  }
+
+  if (n == 0) {
+    errno = ERANGE;
+    return -1;
+  }
+
+  memcpy(data, buffer, size);
+  return size;
+}
+
+size_t mpack_sizeof_nil(void)
+{ return 1; }
+
+size_t mpack_sizeof_boolean(bool value)
+{
+  (void)value;
+  return 1;
+}
+
+size_t mpack_sizeof_signed(signed long value)
+{
+  if (value >= 0) {
+    return mpack_sizeof_unsigned(value);
+  }
+
+  if (value >= -31) {
+    return 1;
+  }
+
+  if (value >= INT8_MIN) {
+    return 2;
+  }
+
+  if (value >= INT16_MIN) {
+    return 3;
+  }
+
+  if (value >= INT32_MIN) {
+    return 5;
+  }
+
+  return 9;
+}
+
+size_t mpack_sizeof_unsigned(unsigned long value)
+{
+  if (value <= INT8_MAX) {
+    return 1;
+  }
+
+  if (value <= UINT8_MAX) {
+    return 2;
+  }
+
+  if (value <= UINT16_MAX) {
+    return 3;
+  }
+
+  if (value <= UINT32_MAX) {
+    return 5;
+  }
+
+  return 9;
+}
+
+size_t mpack_sizeof_float(float value)
+{
+  (void)value;
+  return 5;
+}
+
+size_t mpack_sizeof_double(double value)
+{
+  (void)value;
+  return 9;
+}
+
+size_t mpack_sizeof_double_compact(double value)
+{
+  if (mpack_double_is_integer(value)) {
+    return (value >= 0) ? mpack_sizeof_unsigned((unsigned long)value) : mpack_sizeof_signed((long)value);
+  }
+
+  if (mpack_double_is_float(value)) {
+    return 5;
+  }
+
+  return 9;
+}
+
+size_t mpack_sizeof_string(size_t size)
+{
+  if (size <= 15) {
+    return size + 1;
+  }
+
+  if (size <= UINT8_MAX) {
+    return size + 2;
+  }
+
+  if (size <= UINT16_MAX) {
+    return size + 3;
+  }
+
+  if (size <= UINT32_MAX) {
+    return size + 5;
+  }
+
+  return 0;
+}
+
+size_t mpack_sizeof_binary(size_t size)
+{
+  if (size <= UINT8_MAX) {
+    return size + 2;
+  }
+
+  if (size <= UINT16_MAX) {
+    return size + 3;
+  }
+
+  if (size <= UINT32_MAX) {
+    return size + 5;
+  }
+
+  return 0;
+}
+
+size_t mpack_sizeof_array_header(size_t size)
+{
+  if (size <= 15) {
+    return 1;
+  }
+
+  if (size <= UINT16_MAX) {
+    return 3;
+  }
+
+  if (size <= UINT32_MAX) {
+    return 5;
+  }
+
+  return 0;
+}
+
+size_t mpack_sizeof_map_header(size_t size)
+{ return mpack_sizeof_array_header(size); }
+
+size_t mpack_sizeof_extended(size_t size)
+{
+  switch (size) {
+  case 1:
+  case 2:
+  case 4:
+  case 8:
+  case 16:
+    return size + 2;
+  }
+
+  if (size <= UINT8_MAX) {
+    return size + 3;
+  }
+
+  if (size <= UINT16_MAX) {
+    return size + 4;
+  }
+
+  if (size <= UINT32_MAX) {
+    return size + 6;
+  }
+
+  return 0;
+}
+
+size_t mpack_sizeof_timestamp(struct timespec value)
+{
+  if ((value.tv_nsec < 0) || (value.tv_nsec >= 1000000000)) {
+    return 0;
+  }
+
+  if ((value.tv_sec >= 0) && ((uint64_t)value.tv_sec <= 0x3ffffffffULL)) {
+    return ((value.tv_nsec == 0) && ((uint64_t)value.tv_sec <= UINT32_MAX)) ? 6 : 10;
+  }
+
+  return 15;
+}
+
+size_t mpack_sizeof_object(mpack_object_t value)
+{
+  switch (value.type) {
+  case MPACK_NONE:
+    return mpack_sizeof_nil();
+
+  case MPACK_BOOLEAN:
+    return mpack_sizeof_boolean(value.data.boolean);
+
+  case MPACK_INTEGER:
+    return mpack_sizeof_signed(value.data.integer);
+
+  case MPACK_NUMBER:
+    return mpack_sizeof_double(value.data.number);
+
+  case MPACK_STRING:
+    return mpack_sizeof_string(value.data.string.size);
+
+  case MPACK_BINARY:
+    return mpack_sizeof_binary(value.data.binary.size);
+
+  case MPACK_ARRAY:
+    return mpack_sizeof_array_header(value.data.array.size);
+
+  case MPACK_MAP:
+    return mpack_sizeof_map_header(value.data.map.size);
+
+  case MPACK_EXTENDED:
+    return mpack_sizeof_extended(value.data.extended.size);
+
+  default:
+    return 0;
+  }
+}
+
+static uint32_t mpack_hash(const char *data, size_t size)
+{
+  uint32_t h = 2166136261U;
+  size_t i;
+
+  for (i = 0; i != size; ++i) {
+    h ^= (uint8_t)data[i];
+    h *= 16777619U;
+  }
+
+  return h ^ (h >> 15);
+}
+
+int mpack_struct_compile(mpack_struct_desc_t *desc)
+{
+  const mpack_field_desc_t *field;
+  mpack_struct_key_t *key;
+  size_t i;
+  size_t k;
+
+  if (desc->compiled) {
+    return 0;
+  }
+
+  if (desc->count > MPACK_STRUCT_MAX_FIELDS) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(desc->slots, 0, sizeof(desc->slots));
+  desc->required = 0;
+
+  for (i = 0; i != desc->count; ++i) {
+    field = &(desc->fields[i]);
+    key = &(desc->keys[i]);
+    key->length = strlen(field->name);
+    key->hash = mpack_hash(field->name, key->length);
+
+    if (key->length <= 15) {
+      key->data[0] = MPACK_FIXSTR | key->length;
+      key->size = 1;
+    }
+    else if (key->length <= UINT8_MAX) {
+      key->data[0] = MPACK_STR8;
+      key->data[1] = key->length;
+      key->size = 2;
+    }
+    else {
+      errno = EINVAL;
+      return -1;
+    }
+
+    if (field->required) {
+      desc->required |= ((uint64_t)1) << i;
+    }
+
+    k = key->hash % MPACK_STRUCT_SLOTS;
+
+    while (desc->slots[k] != 0) {
+      k = (k + 1) % MPACK_STRUCT_SLOTS;
+    }
+
+    desc->slots[k] = i + 1;
+  }
+
+  desc->compiled = true;
+
+  for (i = 0; i != desc->count; ++i) {
+    field = &(desc->fields[i]);
+
+    if (field->type != MPACK_FIELD_STRUCT) {
+      continue;
+    }
+
+    if ((field->nested == NULL) || (mpack_struct_compile(field->nested) < 0)) {
+      desc->compiled = false;
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static size_t mpack_struct_find(const mpack_struct_desc_t *desc, mpack_string_t name)
+{
+  const uint32_t hash = mpack_hash(name.data, name.size);
+  const mpack_struct_key_t *key;
+  size_t k = hash % MPACK_STRUCT_SLOTS;
+  size_t i;
+
+  while ((i = desc->slots[k]) != 0) {
+    key = &(desc->keys[i - 1]);
+
+    if ((key->hash == hash) &&
+        (key->length == name.size) &&
+        (memcmp(desc->fields[i - 1].name, name.data, name.size) == 0)) {
+      return i - 1;
+    }
+
+    k = (k + 1) % MPACK_STRUCT_SLOTS;
+  }
+
+  return desc->count;
+}
+
+static size_t mpack_struct_match(const mpack_struct_desc_t *desc, const mpack_decoder_t *decoder, size_t index)
+{
+  const mpack_struct_key_t *key;
+  const char *pos = decoder->pos;
+
+  if (index >= desc->count) {
+    return desc->count;
+  }
+
+  key = &(desc->keys[index]);
+
+  if (((size_t)(decoder->end - pos) < (key->size + key->length)) ||
+      (memcmp(pos, key->data, key->size) != 0) ||
+      (memcmp(pos + key->size, desc->fields[index].name, key->length) != 0)) {
+    return desc->count;
+  }
+
+  return index;
+}
+
+static int mpack_encode_field(mpack_encoder_t *encoder, const mpack_field_desc_t *field, const char *ptr)
+{
+  switch (field->type) {
+  case MPACK_FIELD_BOOLEAN:
+    return mpack_encode_boolean(encoder, *(const bool *)ptr);
+
+  case MPACK_FIELD_INT8:
+    return mpack_encode_signed(encoder, *(const int8_t *)ptr);
+
+  case MPACK_FIELD_INT16:
+    return mpack_encode_signed(encoder, *(const int16_t *)ptr);
+
+  case MPACK_FIELD_INT32:
+    return mpack_encode_signed(encoder, *(const int32_t *)ptr);
+
+  case MPACK_FIELD_INT64:
+    return mpack_encode_signed(encoder, *(const int64_t *)ptr);
+
+  case MPACK_FIELD_UINT8:
+    return mpack_encode_unsigned(encoder, *(const uint8_t *)ptr);
+
+  case MPACK_FIELD_UINT16:
+    return mpack_encode_unsigned(encoder, *(const uint16_t *)ptr);
+
+  case MPACK_FIELD_UINT32:
+    return mpack_encode_unsigned(encoder, *(const uint32_t *)ptr);
+
+  case MPACK_FIELD_UINT64:
+    return mpack_encode_unsigned(encoder, *(const uint64_t *)ptr);
+
+  case MPACK_FIELD_FLOAT:
+    return mpack_encode_float(encoder, *(const float *)ptr);
+
+  case MPACK_FIELD_DOUBLE:
+    return mpack_encode_double(encoder, *(const double *)ptr);
+
+  case MPACK_FIELD_STRING:
+    return mpack_encode_string(encoder, *(const mpack_string_t *)ptr);
+
+  case MPACK_FIELD_BINARY:
+    return mpack_encode_binary(encoder, *(const mpack_binary_t *)ptr);
+
+  case MPACK_FIELD_EXTENDED:
+    return mpack_encode_extended(encoder, *(const mpack_extended_t *)ptr);
+
+  case MPACK_FIELD_STRUCT:
+    return mpack_encode_struct(encoder, field->nested, ptr);
+
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+}
+
+int mpack_encode_struct(mpack_encoder_t *encoder, const mpack_struct_desc_t *desc, const void *value)
+{
+  size_t start = mpack_encoder_offset(encoder);
+  const mpack_struct_key_t *key;
+  const mpack_field_desc_t *field;
+  mpack_string_t name;
+  mpack_map_t map;
+  size_t i;
+
+  if (!desc->compiled) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  map.size = desc->count;
+
+  if (mpack_encode_map(encoder, map) < 0) {
+    return -1;
+  }
+
+  for (i = 0; i != desc->count; ++i) {
+    field = &(desc->fields[i]);
+    key = &(desc->keys[i]);
+
+    if (encoder->dict) {
+      name.data = field->name;
+      name.size = key->length;
+
+      if (mpack_encode_key(encoder, name) < 0) {
+        return -1;
+      }
+    }
+    else {
+      mpack_encoder_write_bytes(encoder, key->data, key->size);
+      mpack_encoder_write_bytes(encoder, field->name, key->length);
+    }
+
+    if (mpack_encode_field(encoder, field, ((const char *)value) + field->offset) < 0) {
+      return -1;
+    }
+  }
+
+  return mpack_encoder_offset(encoder) - start;
+}
+
+static int mpack_decode_field(mpack_decoder_t *decoder, const mpack_field_desc_t *field, char *ptr)
+{
+  MPACK_DECODE_BEGIN(decoder);
+  union { signed long s; unsigned long u; } var;
+
+  switch (field->type) {
+  case MPACK_FIELD_BOOLEAN:
+    MPACK_DECODE_ASSERT(mpack_decode_boolean(decoder, (bool *)ptr));
+    break;
+
+  case MPACK_FIELD_INT8:
+    MPACK_DECODE_ASSERT(mpack_decode_signed(decoder, &var.s));
+    if ((var.s < INT8_MIN) || (var.s > INT8_MAX))
+      MPACK_DECODE_FAIL(ERANGE);
+    *(int8_t *)ptr = var.s;
+    break;
+
+  case MPACK_FIELD_INT16:
+    MPACK_DECODE_ASSERT(mpack_decode_signed(decoder, &var.s));
+    if ((var.s < INT16_MIN) || (var.s > INT16_MAX))
+      MPACK_DECODE_FAIL(ERANGE);
+    *(int16_t *)ptr = var.s;
+    break;
+
+  case MPACK_FIELD_INT32:
+    MPACK_DECODE_ASSERT(mpack_decode_signed(decoder, &var.s));
+    if ((var.s < INT32_MIN) || (var.s > INT32_MAX))
+      MPACK_DECODE_FAIL(ERANGE);
+    *(int32_t *)ptr = var.s;
+    break;
+
+  case MPACK_FIELD_INT64:
+    MPACK_DECODE_ASSERT(mpack_decode_signed(decoder, &var.s));
+    *(int64_t *)ptr = var.s;
+    break;
+
+  case MPACK_FIELD_UINT8:
+    MPACK_DECODE_ASSERT(mpack_decode_unsigned(decoder, &var.u));
+    if (var.u > UINT8_MAX)
+      MPACK_DECODE_FAIL(ERANGE);
+    *(uint8_t *)ptr = var.u;
+    break;
+
+  case MPACK_FIELD_UINT16:
+    MPACK_DECODE_ASSERT(mpack_decode_unsigned(decoder, &var.u));
+    if (var.u > UINT16_MAX)
+      MPACK_DECODE_FAIL(ERANGE);
+    *(uint16_t *)ptr = var.u;
+    break;
+
+  case MPACK_FIELD_UINT32:
+    MPACK_DECODE_ASSERT(mpack_decode_unsigned(decoder, &var.u));
+    if (var.u > UINT32_MAX)
+      MPACK_DECODE_FAIL(ERANGE);
+    *(uint32_t *)ptr = var.u;
+    break;
+
+  case MPACK_FIELD_UINT64:
+    MPACK_DECODE_ASSERT(mpack_decode_unsigned(decoder, &var.u));
+    *(uint64_t *)ptr = var.u;
+    break;
+
+  case MPACK_FIELD_FLOAT:
+    MPACK_DECODE_ASSERT(mpack_decode_float(decoder, (float *)ptr));
+    break;
+
+  case MPACK_FIELD_DOUBLE:
+    MPACK_DECODE_ASSERT(mpack_decode_double(decoder, (double *)ptr));
+    break;
+
+  case MPACK_FIELD_STRING:
+    MPACK_DECODE_ASSERT(mpack_decode_string(decoder, (mpack_string_t *)ptr));
+    break;
+
+  case MPACK_FIELD_BINARY:
+    MPACK_DECODE_ASSERT(mpack_decode_binary(decoder, (mpack_binary_t *)ptr));
+    break;
+
+  case MPACK_FIELD_EXTENDED:
+    MPACK_DECODE_ASSERT(mpack_decode_extended(decoder, (mpack_extended_t *)ptr));
+    break;
+
+  case MPACK_FIELD_STRUCT:
+    MPACK_DECODE_ASSERT(mpack_decode_struct(decoder, field->nested, ptr));
+    break;
+
+  default:
+    MPACK_DECODE_FAIL(EINVAL);
+  }
+
+  MPACK_DECODE_END(decoder);
+}
+
+int mpack_decode_struct(mpack_decoder_t *decoder, const mpack_struct_desc_t *desc, void *value)
+{
+  MPACK_DECODE_BEGIN(decoder);
+  mpack_map_t map;
+  mpack_string_t name;
+  uint64_t seen = 0;
+  size_t next = 0;
+  size_t index;
+  size_t i;
+
+  if (!desc->compiled) {
+    MPACK_DECODE_FAIL(EINVAL);
+  }
+
+  MPACK_DECODE_ASSERT(mpack_decode_map(decoder, &map));
+
+  for (i = 0; i != map.size; ++i) {
+    /* Fields usually arrive in the order of the descriptor, the encoded key
+       of the one following the last decoded field is tried first. */
+    if ((index = mpack_struct_match(desc, decoder, next)) != desc->count) {
+      decoder->pos += desc->keys[index].size + desc->keys[index].length;
+    }
+    else {
+      MPACK_DECODE_ASSERT(mpack_decode_string(decoder, &name));
+      index = mpack_struct_find(desc, name);
+    }
+
+    if (index == desc->count) {
+      MPACK_DECODE_ASSERT(mpack_decode_skip(decoder));
+      continue;
+    }
+
+    MPACK_DECODE_ASSERT(mpack_decode_field(decoder, &(desc->fields[index]), ((char *)value) + desc->fields[index].offset));
+    seen |= ((uint64_t)1) << index;
+    next = index + 1;
+  }
+
+  if ((seen & desc->required) != desc->required) {
+    MPACK_DECODE_FAIL(EINVAL);
+  }
+
+  MPACK_DECODE_END(decoder);
+}
+
+enum {
+  MPACK_INTERN_EMPTY = 0x80,
+  MPACK_INTERN_DELETED = 0xfe,
+  MPACK_INTERN_GROUP = 16,
+};
+
+static unsigned int mpack_intern_match(const uint8_t *group, uint8_t tag)
+{
+#if defined(__SSE2__)
+  __m128i control = _mm_loadu_si128((const __m128i *)group);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8((char)tag)));
+#else
+  unsigned int bits = 0;
+  int i;
+
+  for (i = 0; i != MPACK_INTERN_GROUP; ++i) {
+    bits |= (unsigned int)(group[i] == tag) << i;
+  }
+
+  return bits;
+#endif /* __SSE2__ */
+}
+
+/* Empty and deleted slots are the only control bytes with the high bit set. */
+static unsigned int mpack_intern_match_free(const uint8_t *group)
+{
+#if defined(__SSE2__)
+  return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+  unsigned int bits = 0;
+  int i;
+
+  for (i = 0; i != MPACK_INTERN_GROUP; ++i) {
+    bits |= (unsigned int)(group[i] >> 7) << i;
+  }
+
+  return bits;
+#endif /* __SSE2__ */
+}
+
+/* Groups are visited with triangular probing which reaches every group
+   since their count is a power of two. */
+static size_t mpack_intern_group(const mpack_intern_t *intern, uint32_t hash, size_t step)
+{
+  size_t groups = (intern->mask + 1) / MPACK_INTERN_GROUP;
+  return (((hash >> 7) + step * (step + 1) / 2) & (groups - 1)) * MPACK_INTERN_GROUP;
+}
+
+static mpack_intern_entry_t *mpack_intern_lookup(mpack_intern_t *intern, mpack_string_t value, uint32_t hash)
+{
+  size_t groups = (intern->mask + 1) / MPACK_INTERN_GROUP;
+  mpack_intern_entry_t *entry;
+  unsigned int bits;
+  size_t group;
+  size_t step;
+
+  for (step = 0; step != groups; ++step) {
+    group = mpack_intern_group(intern, hash, step);
+
+    for (bits = mpack_intern_match(intern->control + group, hash & 0x7f); bits; bits &= bits - 1) {
+      entry = &intern->entries[intern->slots[group + __builtin_ctz(bits)]];
+
+      if ((entry->hash == hash) && (entry->symbol->size == value.size) &&
+          (memcmp(entry->symbol->data, value.data, value.size) == 0)) {
+        return entry;
+      }
+    }
+
+    if (mpack_intern_match(intern->control + group, MPACK_INTERN_EMPTY)) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+static void mpack_intern_place(mpack_intern_t *intern, size_t index)
+{
+  mpack_intern_entry_t *entry = &intern->entries[index];
+  unsigned int bits;
+  size_t group;
+  size_t slot;
+  size_t step;
+
+  for (step = 0; !(bits = mpack_intern_match_free(intern->control + (group = mpack_intern_group(intern, entry->hash, step)))); ++step) {
+    /* the table is never more than 3/4 full so this terminates */
+  }
+
+  slot = group + __builtin_ctz(bits);
+
+  if (intern->control[slot] == MPACK_INTERN_DELETED) {
+    --intern->tombstones;
+  }
+
+  intern->control[slot] = entry->hash & 0x7f;
+  intern->slots[slot] = index;
+  entry->slot = slot;
+}
+
+static void mpack_intern_rehash(mpack_intern_t *intern)
+{
+  size_t i;
+
+  memset(intern->control, MPACK_INTERN_EMPTY, intern->mask + 1);
+  intern->tombstones = 0;
+
+  for (i = 0; i != intern->count; ++i) {
+    mpack_intern_place(intern, i);
+  }
+}
+
+static size_t mpack_intern_evict(mpack_intern_t *intern)
+{
+  mpack_intern_entry_t *entry;
+
+  for (;;) {
+    entry = &intern->entries[intern->hand];
+    intern->hand = (intern->hand + 1) % intern->capacity;
+
+    if (!entry->referenced) {
+      break;
+    }
+
+    entry->referenced = false;
+  }
+
+  intern->control[entry->slot] = MPACK_INTERN_DELETED;
+  ++intern->tombstones;
+  mpack_symbol_release(entry->symbol);
+  return entry - intern->entries;
+}
+
+int mpack_intern_init(mpack_intern_t *intern, size_t capacity)
+{
+  size_t slots = MPACK_INTERN_GROUP;
+
+  if ((capacity == 0) || (capacity > (UINT32_MAX / 2))) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  while (slots < (2 * capacity)) {
+    slots *= 2;
+  }
+
+  intern->control = malloc(slots);
+  intern->slots = malloc(slots * sizeof(uint32_t));
+  intern->entries = malloc(capacity * sizeof(mpack_intern_entry_t));
+  intern->capacity = capacity;
+  intern->count = 0;
+  intern->mask = slots - 1;
+  intern->tombstones = 0;
+  intern->hand = 0;
+  intern->next_id = 0;
+
+  if (!intern->control || !intern->slots || !intern->entries) {
+    mpack_intern_term(intern);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  memset(intern->control, MPACK_INTERN_EMPTY, slots);
+  return 0;
+}
+
+void mpack_intern_term(mpack_intern_t *intern)
+{
+  size_t i;
+
+  for (i = 0; i != intern->count; ++i) {
+    mpack_symbol_release(intern->entries[i].symbol);
+  }
+
+  free(intern->control);
+  free(intern->slots);
+  free(intern->entries);
+  intern->control = NULL;
+  intern->slots = NULL;
+  intern->entries = NULL;
+  intern->count = 0;
+}
+
+const mpack_symbol_t *mpack_intern_find(mpack_intern_t *intern, mpack_string_t value)
+{
+  mpack_intern_entry_t *entry = mpack_intern_lookup(intern, value, mpack_hash(value.data, value.size));
+
+  if (!entry) {
+    return NULL;
+  }
+
+  entry->referenced = true;
+  return entry->symbol;
+}
+
+const mpack_symbol_t *mpack_intern_insert(mpack_intern_t *intern, mpack_string_t value)
+{
+  uint32_t hash = mpack_hash(value.data, value.size);
+  mpack_intern_entry_t *entry;
+  mpack_symbol_t *symbol;
+  char *data;
+  size_t index;
+
+  if ((entry = mpack_intern_lookup(intern, value, hash))) {
+    entry->referenced = true;
+    return entry->symbol;
+  }
+
+  if (intern->next_id == UINT32_MAX) {
+    errno = ERANGE;
+    return NULL;
+  }
+
+  /* The string is stored right after the symbol, a single allocation that
+     the table and every holder of a reference share. */
+  if (!(symbol = malloc(sizeof(mpack_symbol_t) + value.size + 1))) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  data = (char *)(symbol + 1);
+  memcpy(data, value.data, value.size);
+  data[value.size] = '\0';
+
+  if ((intern->tombstones + 1) > ((intern->mask + 1) / 4)) {
+    mpack_intern_rehash(intern);
+  }
+
+  index = (intern->count == intern->capacity) ? mpack_intern_evict(intern) : intern->count++;
+  symbol->data = data;
+  symbol->size = value.size;
+  symbol->id = intern->next_id++;
+  symbol->refs = 1;
+  entry = &intern->entries[index];
+  entry->symbol = symbol;
+  entry->hash = hash;
+  entry->referenced = false;
+  mpack_intern_place(intern, index);
+  return symbol;
+}
+
+/* References may be taken and dropped from any thread, the table itself is
+   not thread safe. */
+const mpack_symbol_t *mpack_symbol_retain(const mpack_symbol_t *symbol)
+{
+  __atomic_add_fetch(&((mpack_symbol_t *)symbol)->refs, 1, __ATOMIC_RELAXED);
+  return symbol;
+}
+
+void mpack_symbol_release(const mpack_symbol_t *symbol)
+{
+  if (symbol && (__atomic_sub_fetch(&((mpack_symbol_t *)symbol)->refs, 1, __ATOMIC_ACQ_REL) == 0)) {
+    free((mpack_symbol_t *)symbol);
+  }
+}
+
+int mpack_dict_init(mpack_dict_t *dict, size_t capacity)
+{
+  if (capacity > MPACK_DICT_MAX_SIZE) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  dict->min_size = 3;
+  dict->define = MPACK_DICT_DEFINE;
+  dict->reference = MPACK_DICT_REFERENCE;
+  return mpack_intern_init(&dict->strings, capacity);
+}
+
+void mpack_dict_term(mpack_dict_t *dict)
+{ mpack_intern_term(&dict->strings); }
+
+size_t mpack_dict_size(const mpack_dict_t *dict)
+{ return dict->strings.count; }
+
+/* Forgets the strings defined after the dictionary had the given size, which
+   is how an encoder discards the definitions of a message that was never
+   sent. Ids are handed out again since the peer never saw them. */
+void mpack_dict_truncate(mpack_dict_t *dict, size_t size)
+{
+  mpack_intern_t *strings = &dict->strings;
+  mpack_intern_entry_t *entry;
+
+  while (strings->count > size) {
+    entry = &(strings->entries[--strings->count]);
+    strings->control[entry->slot] = MPACK_INTERN_DELETED;
+    ++strings->tombstones;
+    --strings->next_id;
+    mpack_symbol_release(entry->symbol);
+  }
+}
+
+void mpack_fragments_init(mpack_fragments_t *fragments)
+{
+  fragments->data = NULL;
+  fragments->size = 0;
+  fragments->capacity = 0;
+  fragments->entries = NULL;
+  fragments->count = 0;
+  fragments->limit = 0;
+}
+
+void mpack_fragments_term(mpack_fragments_t *fragments)
+{
+  free(fragments->data);
+  free(fragments->entries);
+  mpack_fragments_init(fragments);
+}
+
+/* Reserves size bytes at the end of the storage and a new entry for them,
+   fragments are added once at startup so the storage simply doubles. */
+static char *mpack_fragments_reserve(mpack_fragments_t *fragments, size_t size)
+{
+  mpack_fragment_t *entries;
+  size_t capacity;
+  size_t limit;
+  char *data;
+
+  if (fragments->count == fragments->limit) {
+    limit = fragments->limit ? (2 * fragments->limit) : 16;
+
+    if (!(entries = realloc(fragments->entries, limit * sizeof(mpack_fragment_t)))) {
+      errno = ENOMEM;
+      return NULL;
+    }
+
+    fragments->entries = entries;
+    fragments->limit = limit;
+  }
+
+  if (size > (fragments->capacity - fragments->size)) {
+    for (capacity = fragments->capacity ? fragments->capacity : 256; capacity < (fragments->size + size); capacity *= 2) {
+      /* grow until the fragment fits */
+    }
+
+    if (!(data = realloc(fragments->data, capacity))) {
+      errno = ENOMEM;
+      return NULL;
+    }
+
+    fragments->data = data;
+    fragments->capacity = capacity;
+  }
+
+  return fragments->data + fragments->size;
+}
+
+static int mpack_fragments_push(mpack_fragments_t *fragments, size_t size)
+{
+  mpack_fragment_t *fragment = &fragments->entries[fragments->count];
+
+  fragment->offset = fragments->size;
+  fragment->size = size;
+  fragments->size += size;
+  return fragments->count++;
+}
+
+/* The data must hold one or more complete values, it is copied. Returns the
+   id of the fragment. */
+int mpack_fragments_add(mpack_fragments_t *fragments, const void *data, size_t size)
+{
+  char *ptr;
+
+  if ((size > INT_MAX) || (fragments->count >= INT_MAX)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (mpack_validate(data, size, NULL) <= 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (!(ptr = mpack_fragments_reserve(fragments, size))) {
+    return -1;
+  }
+
+  memcpy(ptr, data, size);
+  return mpack_fragments_push(fragments, size);
+}
+
+int mpack_fragments_add_string(mpack_fragments_t *fragments, mpack_string_t value)
+{
+  size_t size = mpack_sizeof_string(value.size);
+  mpack_encoder_t encoder;
+  char *ptr;
+
+  if ((size > INT_MAX) || (fragments->count >= INT_MAX)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (!(ptr = mpack_fragments_reserve(fragments, size))) {
+    return -1;
+  }
+
+  mpack_encoder_init(&encoder, ptr, size);
+
+  if (mpack_encode_string(&encoder, value) < 0) {
+    return -1;
+  }
+
+  return mpack_fragments_push(fragments, size);
+}
+
+void mpack_template_init(mpack_template_t *tpl)
+{
+  tpl->data = NULL;
+  tpl->size = 0;
+  tpl->capacity = 0;
+  tpl->slots = NULL;
+  tpl->count = 0;
+  tpl->limit = 0;
+  tpl->strings = 0;
+}
+
+void mpack_template_term(mpack_template_t *tpl)
+{
+  free(tpl->data);
+  free(tpl->slots);
+  mpack_template_init(tpl);
+}
+
+static char *mpack_template_reserve(mpack_template_t *tpl, size_t size)
+{
+  size_t capacity;
+  char *data;
+
+  if ((size > INT_MAX) || ((tpl->size + size) > INT_MAX)) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (size > (tpl->capacity - tpl->size)) {
+    for (capacity = tpl->capacity ? tpl->capacity : 256; capacity < (tpl->size + size); capacity *= 2) {
+      /* grow until the bytes fit */
+    }
+
+    if (!(data = realloc(tpl->data, capacity))) {
+      errno = ENOMEM;
+      return NULL;
+    }
+
+    tpl->data = data;
+    tpl->capacity = capacity;
+  }
+
+  return tpl->data + tpl->size;
+}
+
+/* Constant bytes are not checked, they may hold only the header of a map or
+   an array whose values follow. */
+int mpack_template_append(mpack_template_t *tpl, const void *data, size_t size)
+{
+  char *ptr;
+
+  if (!(ptr = mpack_template_reserve(tpl, size))) {
+    return -1;
+  }
+
+  memcpy(ptr, data, size);
+  tpl->size += size;
+  return size;
+}
+
+int mpack_template_append_object(mpack_template_t *tpl, mpack_object_t value)
+{
+  size_t size = mpack_sizeof_object(value);
+  mpack_encoder_t encoder;
+  char *ptr;
+
+  if (!(ptr = mpack_template_reserve(tpl, size))) {
+    return -1;
+  }
+
+  mpack_encoder_init(&encoder, ptr, size);
+
+  if (mpack_encode_object(&encoder, value) < 0) {
+    return -1;
+  }
+
+  tpl->size += size;
+  return size;
+}
+
+static size_t mpack_slot_width(int type)
+{
+  switch (type) {
+  case MPACK_UINT8:
+  case MPACK_INT8:
+    return 1;
+
+  case MPACK_UINT16:
+  case MPACK_INT16:
+    return 2;
+
+  case MPACK_UINT32:
+  case MPACK_INT32:
+  case MPACK_FLOAT32:
+    return 4;
+
+  case MPACK_UINT64:
+  case MPACK_INT64:
+  case MPACK_FLOAT64:
+    return 8;
+
+  default:
+    return 0;
+  }
+}
+
+/* Appends a slot of the given format, length is the maximum size of values
+   in str8 and bin8 slots and is ignored for the other formats. The slot holds
+   zero, or an empty value, until it is set. Returns the id of the slot. */
+int mpack_template_slot(mpack_template_t *tpl, int type, size_t length)
+{
+  mpack_slot_t *slots;
+  mpack_slot_t *slot;
+  size_t limit;
+  size_t size;
+  char *ptr;
+
+  if ((type == MPACK_STR8) || (type == MPACK_BIN8)) {
+    if (length > UINT8_MAX) {
+      errno = EINVAL;
+      return -1;
+    }
+    size = 2 + length;
+  }
+  else if ((size = mpack_slot_width(type)) != 0) {
+    size += 1;
+  }
+  else {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (tpl->count >= INT_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (tpl->count == tpl->limit) {
+    limit = tpl->limit ? (2 * tpl->limit) : 16;
+
+    if (!(slots = realloc(tpl->slots, limit * sizeof(mpack_slot_t)))) {
+      errno = ENOMEM;
+      return -1;
+    }
+
+    tpl->slots = slots;
+    tpl->limit = limit;
+  }
+
+  if (!(ptr = mpack_template_reserve(tpl, size))) {
+    return -1;
+  }
+
+  memset(ptr, 0, size);
+  ptr[0] = (char)type;
+
+  slot = &tpl->slots[tpl->count];
+  slot->offset = tpl->size;
+  slot->size = size;
+  slot->type = type;
+  tpl->size += size;
+  tpl->strings += (type == MPACK_STR8) || (type == MPACK_BIN8);
+  return tpl->count++;
+}
+
+int mpack_template_copy(const mpack_template_t *tpl, void *data, size_t size)
+{
+  if (size < tpl->size) {
+    errno = ERANGE;
+    return -1;
+  }
+
+  memcpy(data, tpl->data, tpl->size);
+  return tpl->size;
+}
+
+static void mpack_slot_store(char *ptr, uint64_t value, size_t width)
+{
+  uint16_t u16;
+  uint32_t u32;
+  uint64_t u64;
+
+  switch (width) {
+  case 1:
+    *ptr = (char)value;
+    break;
+
+  case 2:
+    u16 = be16(value);
+    memcpy(ptr, &u16, 2);
+    break;
+
+  case 4:
+    u32 = be32(value);
+    memcpy(ptr, &u32, 4);
+    break;
+
+  default:
+    u64 = be64(value);
+    memcpy(ptr, &u64, 8);
+    break;
+  }
+}
+
+static const mpack_slot_t *mpack_template_find_slot(const mpack_template_t *tpl, size_t id)
+{
+  if (id >= tpl->count) {
+    errno = EINVAL;
+    return NULL;
+  }
+  return &tpl->slots[id];
+}
+
+int mpack_template_set_unsigned(const mpack_template_t *tpl, void *data, size_t id, unsigned long value)
+{
+  const mpack_slot_t *slot;
+  size_t width;
+
+  if (!(slot = mpack_template_find_slot(tpl, id))) {
+    return -1;
+  }
+
+  switch (slot->type) {
+  case MPACK_UINT8:
+  case MPACK_UINT16:
+  case MPACK_UINT32:
+  case MPACK_UINT64:
+    width = slot->size - 1;
+    if ((width < 8) && (value >> (8 * width))) {
+      errno = ERANGE;
+      return -1;
+    }
+    break;
+
+  case MPACK_INT8:
+  case MPACK_INT16:
+  case MPACK_INT32:
+  case MPACK_INT64:
+    if (value > LONG_MAX) {
+      errno = ERANGE;
+      return -1;
+    }
+    return mpack_template_set_signed(tpl, data, id, value);
+
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+
+  mpack_slot_store((char *)data + slot->offset + 1, value, width);
+  return slot->size;
+}
+
+int mpack_template_set_signed(const mpack_template_t *tpl, void *data, size_t id, signed long value)
+{
+  const mpack_slot_t *slot;
+  signed long limit;
+  size_t width;
+
+  if (!(slot = mpack_template_find_slot(tpl, id))) {
+    return -1;
+  }
+
+  switch (slot->type) {
+  case MPACK_UINT8:
+  case MPACK_UINT16:
+  case MPACK_UINT32:
+  case MPACK_UINT64:
+    if (value < 0) {
+      errno = ERANGE;
+      return -1;
+    }
+    return mpack_template_set_unsigned(tpl, data, id, value);
+
+  case MPACK_INT8:
+  case MPACK_INT16:
+  case MPACK_INT32:
+  case MPACK_INT64:
+    width = slot->size - 1;
+    if (width < 8) {
+      limit = 1L << (8 * width - 1);
+      if ((value < -limit) || (value >= limit)) {
+        errno = ERANGE;
+        return -1;
+      }
+    }
+    break;
+
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+
+  mpack_slot_store((char *)data + slot->offset + 1, (uint64_t)value, width);
+  return slot->size;
+}
+
+/* Values stored in float32 slots are rounded to single precision. */
+int mpack_template_set_double(const mpack_template_t *tpl, void *data, size_t id, double value)
+{
+  const mpack_slot_t *slot;
+  union { float f; uint32_t u; } f32;
+  union { double f; uint64_t u; } f64;
+
+  if (!(slot = mpack_template_find_slot(tpl, id))) {
+    return -1;
+  }
+
+  switch (slot->type) {
+  case MPACK_FLOAT32:
+    f32.f = (float)value;
+    mpack_slot_store((char *)data + slot->offset + 1, f32.u, 4);
+    break;
+
+  case MPACK_FLOAT64:
+    f64.f = value;
+    mpack_slot_store((char *)data + slot->offset + 1, f64.u, 8);
+    break;
+
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+
+  return slot->size;
+}
+
+static int mpack_template_set_bytes(const mpack_template_t *tpl, void *data, size_t id, int type, const void *value, size_t size)
+{
+  const mpack_slot_t *slot;
+  char *ptr;
+
+  if (!(slot = mpack_template_find_slot(tpl, id))) {
+    return -1;
+  }
+
+  if (slot->type != type) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (size > (slot->size - 2)) {
+    errno = ERANGE;
+    return -1;
+  }
+
+  ptr = (char *)data + slot->offset;
+  ptr[1] = (char)size;
+  memcpy(ptr + 2, value, size);
+  return slot->size;
+}
+
+int mpack_template_set_string(const mpack_template_t *tpl, void *data, size_t id, mpack_string_t value)
+{ return mpack_template_set_bytes(tpl, data, id, MPACK_STR8, value.data, value.size); }
+
+int mpack_template_set_binary(const mpack_template_t *tpl, void *data, size_t id, mpack_binary_t value)
+{ return mpack_template_set_bytes(tpl, data, id, MPACK_BIN8, value.data, value.size); }
+
+/* Moves the bytes following str8 and bin8 slots over the part of the slots
+   their values left unused, the slot offsets do not apply to the message
+   anymore afterwards. Returns the size of the message. */
+int mpack_template_pack(const mpack_template_t *tpl, void *data)
+{
+  const mpack_slot_t *slot;
+  char *ptr = data;
+  size_t src = 0;
+  size_t dst = 0;
+  size_t end;
+  size_t i;
+
+  if (tpl->strings == 0) {
+    return tpl->size;
+  }
+
+  for (i = 0; i != tpl->count; ++i) {
+    slot = &tpl->slots[i];
+
+    if ((slot->type != MPACK_STR8) && (slot->type != MPACK_BIN8)) {
+      continue;
+    }
+
+    if ((end = 2 + (uint8_t)ptr[slot->offset + 1]) > slot->size) {
+      errno = EINVAL;
+      return -1;
+    }
+
+    end += slot->offset;
+
+    if (dst != src) {
+      memmove(ptr + dst, ptr + src, end - src);
+    }
+
+    dst += end - src;
+    src = slot->offset + slot->size;
+  }
+
+  if (dst != src) {
+    memmove(ptr + dst, ptr + src, tpl->size - src);
+  }
+
+  return dst + (tpl->size - src);
+}
+
+struct mpack_arena_block {
+  struct mpack_arena_block *next;
+  size_t size;
+};
+
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+static _Thread_local mpack_arena_t *mpack_arena_cache;
+#else
+static __thread mpack_arena_t *mpack_arena_cache;
+#endif
+
+static size_t mpack_arena_header_size(void)
+{ return (sizeof(struct mpack_arena_block) + MPACK_ARENA_ALIGN - 1) & ~(size_t)(MPACK_ARENA_ALIGN - 1); }
+
+static char *mpack_arena_data(struct mpack_arena_block *block)
+{ return (char *)block + mpack_arena_header_size(); }
+
+static struct mpack_arena_block *mpack_arena_block_new(size_t size)
+{
+  struct mpack_arena_block *block;
+
+  if ((size > (SIZE_MAX - mpack_arena_header_size())) || !(block = malloc(mpack_arena_header_size() + size))) {
+    return NULL;
+  }
+
+  block->next = NULL;
+  block->size = size;
+  return block;
+}
+
+static void mpack_arena_block_free(struct mpack_arena_block *block)
+{
+  struct mpack_arena_block *next;
+
+  for (; block; block = next) {
+    next = block->next;
+    free(block);
+  }
+}
+
+/* A block size of zero selects MPACK_ARENA_BLOCK_SIZE, no memory is
+   allocated until the first allocation. */
+void mpack_arena_init(mpack_arena_t *arena, size_t block_size)
+{
+  arena->blocks = NULL;
+  arena->last = NULL;
+  arena->free = NULL;
+  arena->large = NULL;
+  arena->pos = NULL;
+  arena->end = NULL;
+  arena->block_size = block_size ? ((block_size + MPACK_ARENA_ALIGN - 1) & ~(size_t)(MPACK_ARENA_ALIGN - 1)) : MPACK_ARENA_BLOCK_SIZE;
+}
+
+void mpack_arena_term(mpack_arena_t *arena)
+{
+  mpack_arena_block_free(arena->blocks);
+  mpack_arena_block_free(arena->free);
+  mpack_arena_block_free(arena->large);
+  mpack_arena_init(arena, arena->block_size);
+}
+
+/* The blocks in use are moved to the free list in one step and in the order
+   they were used, the cost only depends on the number of large
+   allocations. */
+void mpack_arena_reset(mpack_arena_t *arena)
+{
+  if (arena->last) {
+    arena->last->next = arena->free;
+    arena->free = arena->blocks;
+  }
+
+  mpack_arena_block_free(arena->large);
+  arena->blocks = NULL;
+  arena->last = NULL;
+  arena->large = NULL;
+  arena->pos = NULL;
+  arena->end = NULL;
+}
+
+static void *mpack_arena_grow(mpack_arena_t *arena, size_t size)
+{
+  struct mpack_arena_block *block;
+
+  if (size > arena->block_size) {
+    if (!(block = mpack_arena_block_new(size))) {
+      errno = ENOMEM;
+      return NULL;
+    }
+
+    block->next = arena->large;
+    arena->large = block;
+    return mpack_arena_data(block);
+  }
+
+  if ((block = arena->free)) {
+    arena->free = block->next;
+  }
+  else if (!(block = mpack_arena_block_new(arena->block_size))) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  block->next = NULL;
+
+  if (arena->last) {
+    arena->last->next = block;
+  }
+  else {
+    arena->blocks = block;
+  }
+
+  arena->last = block;
+
+  arena->pos = mpack_arena_data(block) + size;
+  arena->end = mpack_arena_data(block) + block->size;
+  return mpack_arena_data(block);
+}
+
+/* Memory is aligned for any type and stays valid until the arena is reset,
+   there is no way to free a single allocation. */
+void *mpack_arena_alloc(mpack_arena_t *arena, size_t size)
+{
+  char *ptr;
+
+  if (size > (SIZE_MAX - MPACK_ARENA_ALIGN)) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  size = size ? ((size + MPACK_ARENA_ALIGN - 1) & ~(size_t)(MPACK_ARENA_ALIGN - 1)) : MPACK_ARENA_ALIGN;
+
+  if (size > (size_t)(arena->end - arena->pos)) {
+    return mpack_arena_grow(arena, size);
+  }
+
+  ptr = arena->pos;
+  arena->pos += size;
+  return ptr;
+}
+
+/* Owned copy of a string or binary value, the input it was decoded from can
+   then be reused. */
+void *mpack_arena_copy(mpack_arena_t *arena, const void *data, size_t size)
+{
+  void *ptr;
+
+  if ((ptr = mpack_arena_alloc(arena, size))) {
+    memcpy(ptr, data, size);
+  }
+
+  return ptr;
+}
+
+/* Each thread caches the last arena it released, so a server that acquires
+   an arena per request decodes into the same warm blocks every time. */
+mpack_arena_t *mpack_arena_acquire(void)
+{
+  mpack_arena_t *arena;
+
+  if ((arena = mpack_arena_cache)) {
+    mpack_arena_cache = NULL;
+    return arena;
+  }
+
+  if (!(arena = malloc(sizeof(mpack_arena_t)))) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  mpack_arena_init(arena, 0);
+  return arena;
+}
+
+void mpack_arena_release(mpack_arena_t *arena)
+{
+  if (!arena) {
+    return;
+  }
+
+  mpack_arena_reset(arena);
+
+  if (!mpack_arena_cache) {
+    mpack_arena_cache = arena;
+    return;
+  }
+
+  mpack_arena_term(arena);
+  free(arena);
+}
+
+/* Frees the arena cached by the calling thread, threads call it before they
+   exit. */
+void mpack_arena_cache_term(void)
+{
+  mpack_arena_t *arena;
+
+  if ((arena = mpack_arena_cache)) {
+    mpack_arena_cache = NULL;
+    mpack_arena_term(arena);
+    free(arena);
+  }
+}
+
+/* The block format is the one of LZ4: sequences of literals followed by a
+   match of at least 4 bytes at an offset of up to 64 KB, the last sequence
+   only has literals. */
+enum {
+  MPACK_LZ_HASH_BITS = 12,
+  MPACK_LZ_MIN_MATCH = 4,
+  MPACK_LZ_LAST_LITERALS = 5,
+  MPACK_LZ_MATCH_LIMIT = 12,
+  MPACK_LZ_MAX_OFFSET = 65535,
+};
+
+static uint32_t mpack_lz_read32(const uint8_t *p)
+{
+  uint32_t x;
+  memcpy(&x, p, 4);
+  return x;
+}
+
+static uint32_t mpack_lz_hash(uint32_t x)
+{ return (x * 2654435761U) >> (32 - MPACK_LZ_HASH_BITS); }
+
+static size_t mpack_lz_length_size(size_t length)
+{ return (length < 15) ? 0 : ((length - 15) / 255 + 1); }
+
+static uint8_t *mpack_lz_write_length(uint8_t *op, size_t length)
+{
+  if (length >= 15) {
+    for (length -= 15; length >= 255; length -= 255) {
+      *op++ = 255;
+    }
+    *op++ = length;
+  }
+  return op;
+}
+
+static uint8_t *mpack_lz_write_sequence(uint8_t *op, uint8_t *oend, const uint8_t *literals, size_t count, size_t offset, size_t match)
+{
+  const size_t length = match ? (match - MPACK_LZ_MIN_MATCH) : 0;
+  const size_t size = 1 + mpack_lz_length_size(count) + count + (match ? (2 + mpack_lz_length_size(length)) : 0);
+
+  if ((size_t)(oend - op) < size) {
+    return NULL;
+  }
+
+  *op++ = (((count < 15) ? count : 15) << 4) | ((length < 15) ? length : 15);
+  op = mpack_lz_write_length(op, count);
+  memcpy(op, literals, count);
+  op += count;
+
+  if (match) {
+    *op++ = offset;
+    *op++ = offset >> 8;
+    op = mpack_lz_write_length(op, length);
+  }
+
+  return op;
+}
+
+size_t mpack_lz_bound(size_t size)
+{ return size + (size / 255) + 16; }
+
+size_t mpack_lz_compress(void *dst, size_t capacity, const void *src, size_t size)
+{
+  const uint8_t *base = src;
+  const uint8_t *iend = base + size;
+  const uint8_t *ip = base;
+  const uint8_t *anchor = base;
+  const uint8_t *ref;
+  const uint8_t *mp;
+  const uint8_t *rp;
+  uint8_t *op = dst;
+  uint8_t *oend = op + capacity;
+  uint32_t table[1 << MPACK_LZ_HASH_BITS];
+  uint32_t sequence;
+  uint32_t h;
+
+  memset(table, 0, sizeof(table));
+
+  /* Matches never start in the last bytes of the input so the decoder always
+     ends on literals. */
+  if (size > MPACK_LZ_MATCH_LIMIT) {
+    while (ip < (iend - MPACK_LZ_MATCH_LIMIT)) {
+      sequence = mpack_lz_read32(ip);
+      h = mpack_lz_hash(sequence);
+      ref = base + table[h];
+      table[h] = ip - base;
+
+      if ((ref >= ip) || ((ip - ref) > MPACK_LZ_MAX_OFFSET) || (mpack_lz_read32(ref) != sequence)) {
+        ++ip;
+        continue;
+      }
+
+      for (mp = ip + MPACK_LZ_MIN_MATCH, rp = ref + MPACK_LZ_MIN_MATCH; (mp < (iend - MPACK_LZ_LAST_LITERALS)) && (*mp == *rp); ++mp, ++rp) {
+        /* extend the match forward */
+      }
+
+      for (; (ip > anchor) && (ref > base) && (ip[-1] == ref[-1]); --ip, --ref) {
+        /* and backward over the pending literals */
+      }
+
+      if (!(op = mpack_lz_write_sequence(op, oend, anchor, ip - anchor, ip - ref, mp - ip))) {
+        return 0;
+      }
+
+      ip = mp;
+      anchor = ip;
+    }
+  }
+
+  if (!(op = mpack_lz_write_sequence(op, oend, anchor, iend - anchor, 0, 0))) {
+    return 0;
+  }
+
+  return op - (uint8_t *)dst;
+}
+
+static bool mpack_lz_read_length(const uint8_t **ip, const uint8_t *iend, size_t *length)
+{
+  uint8_t byte;
+
+  if (*length == 15) {
+    do {
+      if (*ip == iend) {
+        return false;
+      }
+      byte = *(*ip)++;
+      *length += byte;
+    } while (byte == 255);
+  }
+
+  return true;
+}
+
+int mpack_lz_decompress(void *dst, size_t size, const void *src, size_t length)
+{
+  const uint8_t *ip = src;
+  const uint8_t *iend = ip + length;
+  uint8_t *base = dst;
+  uint8_t *op = base;
+  uint8_t *oend = op + size;
+  size_t count;
+  size_t offset;
+  size_t match;
+  uint8_t token;
+
+  while (ip != iend) {
+    token = *ip++;
+    count = token >> 4;
+
+    if (!mpack_lz_read_length(&ip, iend, &count) ||
+        (count > (size_t)(iend - ip)) || (count > (size_t)(oend - op))) {
+      break;
+    }
+
+    memcpy(op, ip, count);
+    op += count;
+    ip += count;
+
+    if (ip == iend) {
+      return (op == oend) ? 0 : (errno = EINVAL, -1);
+    }
+
+    if ((iend - ip) < 2) {
+      break;
+    }
+
+    offset = ip[0] | ((size_t)ip[1] << 8);
+    ip += 2;
+    match = token & 15;
+
+    if ((offset == 0) || (offset > (size_t)(op - base)) || !mpack_lz_read_length(&ip, iend, &match)) {
+      break;
+    }
+
+    if ((match += MPACK_LZ_MIN_MATCH) > (size_t)(oend - op)) {
+      break;
+    }
+
+    if (offset >= match) {
+      memcpy(op, op - offset, match);
+      op += match;
+    }
+    else {
+      /* overlapping copies repeat the last offset bytes */
+      for (; match != 0; --match, ++op) {
+        *op = op[-offset];
+      }
+    }
+  }
+
+  errno = EINVAL;
+  return -1;
+}
+
+size_t mpack_frame_bound(size_t size)
+{ return MPACK_FRAME_HEADER_SIZE + size; }
+
+int mpack_frame_encode(void *frame, size_t capacity, const void *data, size_t size)
+{
+  char *header = frame;
+  char *payload = header + MPACK_FRAME_HEADER_SIZE;
+  size_t length;
+  uint32_t value;
+
+  if ((size > UINT32_MAX) || (size > (INT_MAX - MPACK_FRAME_HEADER_SIZE)) || (capacity < mpack_frame_bound(size))) {
+    errno = ERANGE;
+    return -1;
+  }
+
+  /* Blocks that do not compress are stored so a frame is never larger than
+     its header and the raw block. */
+  if ((length = mpack_lz_compress(payload, size, data, size)) != 0) {
+    header[0] = MPACK_FRAME_LZ;
+  }
+  else {
+    header[0] = MPACK_FRAME_STORED;
+    memcpy(payload, data, size);
+    length = size;
+  }
+
+  value = be32(size);
+  memcpy(header + 1, &value, 4);
+  value = be32(length);
+  memcpy(header + 5, &value, 4);
+  return MPACK_FRAME_HEADER_SIZE + length;
+}
+
+int mpack_frame_header(const void *frame, size_t size, mpack_frame_t *header)
+{
+  const char *bytes = frame;
+  uint32_t value;
+
+  if (size < MPACK_FRAME_HEADER_SIZE) {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  header->method = bytes[0];
+  memcpy(&value, bytes + 1, 4);
+  header->size = be32(value);
+  memcpy(&value, bytes + 5, 4);
+  header->length = be32(value);
+
+  if ((header->method > MPACK_FRAME_LZ) || ((header->method == MPACK_FRAME_STORED) && (header->size != header->length))) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return MPACK_FRAME_HEADER_SIZE;
+}
+
+int mpack_frame_decode(void *data, const mpack_frame_t *header, const void *payload)
+{
+  if (header->method == MPACK_FRAME_STORED) {
+    memmove(data, payload, header->size);
+    return 0;
+  }
+  return mpack_lz_decompress(data, header->size, payload, header->length);
+}
+
+int mpack_frame_writer_init(mpack_frame_writer_t *writer, size_t block_size, mpack_write_t write, void *context)
+{
+  char *block = malloc(block_size);
+
+  writer->capacity = mpack_frame_bound(block_size);
+  writer->frame = malloc(writer->capacity);
+  writer->block_size = block_size;
+  writer->mark = 0;
+  writer->dict_size = 0;
+  writer->write = write;
+  writer->context = context;
+  mpack_encoder_init(&writer->encoder, block, block_size);
+
+  if (!block || !writer->frame) {
+    mpack_frame_writer_term(writer);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  return 0;
+}
+
+void mpack_frame_writer_term(mpack_frame_writer_t *writer)
+{
+  free(writer->encoder.begin);
+  free(writer->frame);
+  writer->encoder.begin = NULL;
+  writer->frame = NULL;
+}
+
+static int mpack_frame_writer_emit(mpack_frame_writer_t *writer, size_t size)
+{
+  int length;
+
+  if ((length = mpack_frame_encode(writer->frame, writer->capacity, writer->encoder.begin, size)) < 0) {
+    return -1;
+  }
+
+  if (writer->write(writer->context, writer->frame, length) != length) {
+    return -1;
+  }
+
+  return length;
+}
+
+/* Called after each record, a record that did not fit in the current block
+   is dropped with the strings it defined in the encoder's dictionary and the
+   call fails with EAGAIN once the previous records were written, the
+   application then encodes the record again. A record larger
+   than the block size is written alone in a frame of its own. */
+int mpack_frame_writer_commit(mpack_frame_writer_t *writer)
+{
+  mpack_encoder_t *encoder = &writer->encoder;
+  size_t size = encoder->pos - encoder->begin;
+  size_t capacity;
+  char *block;
+  char *frame;
+
+  if (encoder->pos <= encoder->end) {
+    writer->mark = size;
+    writer->dict_size = encoder->dict ? mpack_dict_size(encoder->dict) : 0;
+    return ((size >= writer->block_size) && (mpack_frame_writer_flush(writer) < 0)) ? -1 : 0;
+  }
+
+  if (encoder->dict) {
+    mpack_dict_truncate(encoder->dict, writer->dict_size);
+  }
+
+  if ((writer->mark != 0) && (mpack_frame_writer_emit(writer, writer->mark) < 0)) {
+    return -1;
+  }
+
+  size -= writer->mark;
+  encoder->pos = encoder->begin;
+  writer->mark = 0;
+
+  if (size > (size_t)(encoder->end - encoder->begin)) {
+    capacity = mpack_frame_bound(size);
+
+    if (!(frame = realloc(writer->frame, capacity))) {
+      errno = ENOMEM;
+      return -1;
+    }
+
+    writer->frame = frame;
+    writer->capacity = capacity;
+
+    if (!(block = realloc(encoder->begin, size))) {
+      errno = ENOMEM;
+      return -1;
+    }
+
+    encoder->begin = block;
+    encoder->pos = block;
+    encoder->end = block + size;
+  }
+
+  errno = EAGAIN;
+  return -1;
+}
+
+int mpack_frame_writer_flush(mpack_frame_writer_t *writer)
+{
+  int length = 0;
+
+  if ((writer->mark != 0) && ((length = mpack_frame_writer_emit(writer, writer->mark)) < 0)) {
+    return -1;
+  }
+
+  writer->encoder.pos = writer->encoder.begin;
+  writer->encoder.end = writer->encoder.begin + writer->block_size;
+  writer->mark = 0;
+  writer->dict_size = writer->encoder.dict ? mpack_dict_size(writer->encoder.dict) : 0;
+  return length;
+}
+
+int mpack_frame_reader_init(mpack_frame_reader_t *reader, size_t window_size, size_t max_size, mpack_read_t read, void *context)
+{
+  if (window_size > max_size) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  reader->window = malloc(window_size);
+  reader->window_size = window_size;
+  reader->max_size = max_size;
+  reader->payload = malloc(window_size);
+  reader->payload_size = window_size;
+  reader->read = read;
+  reader->context = context;
+
+  if (!reader->window || !reader->payload) {
+    mpack_frame_reader_term(reader);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  /* Empty until the first frame, the window holds nothing yet. */
+  mpack_decoder_init(&reader->decoder, NULL, 0);
+  return 0;
+}
+
+void mpack_frame_reader_term(mpack_frame_reader_t *reader)
+{
+  free(reader->window);
+  free(reader->payload);
+  reader->window = NULL;
+  reader->payload = NULL;
+}
+
+static bool mpack_frame_reader_reserve(char **buffer, size_t *size, size_t length)
+{
+  char *data;
+
+  if (length <= *size) {
+    return true;
+  }
+
+  if (!(data = realloc(*buffer, length))) {
+    return false;
+  }
+
+  *buffer = data;
+  *size = length;
+  return true;
+}
+
+static int mpack_frame_reader_fill(mpack_frame_reader_t *reader, void *data, size_t size)
+{
+  int n;
+
+  if ((n = reader->read(reader->context, data, size)) < 0) {
+    return -1;
+  }
+
+  if ((size_t)n != size) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return n;
+}
+
+/* Loads the next frame and points the decoder at its content. Stored blocks
+   are read straight into the window, compressed ones are decompressed from
+   the payload buffer into it. Returns the size of the block, or 0 at the end
+   of the stream. */
+int mpack_frame_reader_next(mpack_frame_reader_t *reader)
+{
+  char bytes[MPACK_FRAME_HEADER_SIZE];
+  mpack_frame_t header;
+  int n;
+
+  if ((n = reader->read(reader->context, bytes, sizeof(bytes))) <= 0) {
+    mpack_decoder_init(&reader->decoder, reader->window, 0);
+    return n;
+  }
+
+  if (mpack_frame_header(bytes, n, &header) < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if ((header.size > INT_MAX) || (header.size > reader->max_size) || (header.length > reader->max_size)) {
+    errno = ERANGE;
+    return -1;
+  }
+
+  if (!mpack_frame_reader_reserve(&reader->window, &reader->window_size, header.size)) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  if (header.method == MPACK_FRAME_STORED) {
+    if (mpack_frame_reader_fill(reader, reader->window, header.length) < 0) {
+      return -1;
+    }
+  }
+  else {
+    if (!mpack_frame_reader_reserve(&reader->payload, &reader->payload_size, header.length)) {
+      errno = ENOMEM;
+      return -1;
+    }
+
+    if ((mpack_frame_reader_fill(reader, reader->payload, header.length) < 0) ||
+        (mpack_frame_decode(reader->window, &header, reader->payload) < 0)) {
+      return -1;
+    }
+  }
+
+  mpack_decoder_init(&reader->decoder, reader->window, header.size);
+  return header.size;
+}
+
+int mpack_chunk_pool_init(mpack_chunk_pool_t *pool, size_t chunk_size, size_t limit)
+{
+  if (chunk_size == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  pool->free = NULL;
+  pool->chunk_size = chunk_size;
+  pool->count = 0;
+  pool->limit = limit;
+  return 0;
+}
+
+void mpack_chunk_pool_term(mpack_chunk_pool_t *pool)
+{
+  mpack_chunk_t *chunk;
+
+  while ((chunk = pool->free)) {
+    pool->free = chunk->next;
+    free(chunk);
+  }
+
+  pool->count = 0;
+}
+
+/* Chunks are allocated with their data in one block. */
+static mpack_chunk_t *mpack_chunk_get(mpack_chunk_pool_t *pool)
+{
+  mpack_chunk_t *chunk;
+
+  if ((chunk = pool->free)) {
+    pool->free = chunk->next;
+    --pool->count;
+  }
+  else {
+    if ((pool->chunk_size > (SIZE_MAX - sizeof(mpack_chunk_t))) || !(chunk = malloc(sizeof(mpack_chunk_t) + pool->chunk_size))) {
+      errno = ENOMEM;
+      return NULL;
+    }
+
+    chunk->data = (char *)(chunk + 1);
+    chunk->capacity = pool->chunk_size;
+  }
+
+  chunk->next = NULL;
+  chunk->size = 0;
+  return chunk;
+}
+
+static void mpack_chunk_put(mpack_chunk_pool_t *pool, mpack_chunk_t *chunk)
+{
+  if ((pool->limit != 0) && (pool->count >= pool->limit)) {
+    free(chunk);
+    return;
+  }
+
+  chunk->next = pool->free;
+  pool->free = chunk;
+  ++pool->count;
+}
+
+static void mpack_chain_attach(mpack_chain_t *chain, mpack_chunk_t *chunk)
+{
+  if (chain->tail) {
+    chain->tail->next = chunk;
+  }
+  else {
+    chain->head = chunk;
+  }
+
+  chain->tail = chunk;
+  ++chain->count;
+  chain->encoder.begin = chunk->data;
+  chain->encoder.pos = chunk->data;
+  chain->encoder.end = chunk->data + chunk->capacity;
+}
+
+/* Grow callback of the chain's encoder, which is the first member of the
+   chain. The full tail is linked to a new chunk, a mark at the very end of
+   the tail moves to the start of the new one. */
+static int mpack_chain_grow(mpack_encoder_t *encoder)
+{
+  mpack_chain_t *chain = (mpack_chain_t *)encoder;
+  mpack_chunk_t *tail = chain->tail;
+  mpack_chunk_t *chunk;
+
+  if (!(chunk = mpack_chunk_get(chain->pool))) {
+    return -1;
+  }
+
+  tail->size = tail->capacity;
+
+  if ((chain->mark == tail) && (chain->mark_size == tail->capacity)) {
+    chain->mark = chunk;
+    chain->mark_size = 0;
+  }
+
+  mpack_chain_attach(chain, chunk);
+  return 0;
+}
+
+int mpack_chain_init(mpack_chain_t *chain, mpack_chunk_pool_t *pool)
+{
+  mpack_chunk_t *chunk;
+
+  mpack_encoder_init(&chain->encoder, NULL, 0);
+  chain->encoder.grow = mpack_chain_grow;
+  chain->pool = pool;
+  chain->head = NULL;
+  chain->tail = NULL;
+  chain->mark = NULL;
+  chain->mark_size = 0;
+  chain->committed = 0;
+  chain->dict_size = 0;
+  chain->sent_dict_size = 0;
+  chain->count = 0;
+  chain->size = 0;
+  chain->sent = 0;
+
+  if (!(chunk = mpack_chunk_get(pool))) {
+    return -1;
+  }
+
+  mpack_chain_attach(chain, chunk);
+  chain->mark = chunk;
+  return 0;
+}
+
+void mpack_chain_term(mpack_chain_t *chain)
+{
+  mpack_chunk_t *chunk;
+
+  while ((chunk = chain->head)) {
+    chain->head = chunk->next;
+    mpack_chunk_put(chain->pool, chunk);
+  }
+
+  chain->tail = NULL;
+  chain->mark = NULL;
+  chain->mark_size = 0;
+  chain->committed = 0;
+  chain->dict_size = 0;
+  chain->sent_dict_size = 0;
+  chain->count = 0;
+  chain->size = 0;
+  chain->sent = 0;
+  mpack_encoder_init(&chain->encoder, NULL, 0);
+}
+
+/* Called after each record. The record may span any number of chunks, it
+   only fails with ENOMEM when the pool could not provide one, the partial
+   record is then dropped as by mpack_chain_cancel. Containers opened with
+   mpack_encode_array_begin or mpack_encode_map_begin must be closed before
+   the encoder moves to another chunk, and a dictionary attached to the
+   encoder after init must be followed by a commit before the first record. */
+int mpack_chain_commit(mpack_chain_t *chain)
+{
+  mpack_encoder_t *encoder = &chain->encoder;
+  mpack_chunk_t *tail = chain->tail;
+  size_t offset;
+
+  if (encoder->pos > encoder->end) {
+    mpack_chain_cancel(chain);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  if (chain->size == 0) {
+    chain->sent_dict_size = chain->dict_size;
+  }
+
+  offset = mpack_encoder_offset(encoder);
+  tail->size = encoder->pos - tail->data;
+  chain->size += offset - chain->committed;
+  chain->committed = offset;
+  chain->mark = tail;
+  chain->mark_size = tail->size;
+  chain->dict_size = encoder->dict ? mpack_dict_size(encoder->dict) : 0;
+  return 0;
+}
+
+/* Drops what was encoded since the last commit, along with the chunks it
+   took and the strings it added to the encoder's dictionary. */
+void mpack_chain_cancel(mpack_chain_t *chain)
+{
+  mpack_encoder_t *encoder = &chain->encoder;
+  mpack_chunk_t *mark = chain->mark;
+  mpack_chunk_t *chunk;
+
+  while ((chunk = mark->next)) {
+    mark->next = chunk->next;
+    --chain->count;
+    mpack_chunk_put(chain->pool, chunk);
+  }
+
+  mark->size = chain->mark_size;
+  chain->tail = mark;
+  encoder->begin = mark->data;
+  encoder->pos = mark->data + chain->mark_size;
+  encoder->end = mark->data + mark->capacity;
+  encoder->base = chain->committed - chain->mark_size;
+
+  if (encoder->dict) {
+    mpack_dict_truncate(encoder->dict, chain->dict_size);
+  }
+}
+
+/* Drops all the records, the chain keeps its first chunk. The strings
+   defined by records that were not written are dropped from the encoder's
+   dictionary as well, so that later records define them again. */
+int mpack_chain_reset(mpack_chain_t *chain)
+{
+  mpack_encoder_t *encoder = &chain->encoder;
+  mpack_chunk_t *head = chain->head;
+  mpack_chunk_t *chunk;
+
+  while ((chunk = head->next)) {
+    head->next = chunk->next;
+    mpack_chunk_put(chain->pool, chunk);
+  }
+
+  if (encoder->dict) {
+    mpack_dict_truncate(encoder->dict, chain->sent_dict_size);
+  }
+
+  head->size = 0;
+  chain->tail = head;
+  chain->mark = head;
+  chain->mark_size = 0;
+  chain->committed = 0;
+  chain->dict_size = chain->sent_dict_size;
+  chain->count = 1;
+  chain->size = 0;
+  chain->sent = 0;
+  encoder->begin = head->data;
+  encoder->pos = head->data;
+  encoder->end = head->data + head->capacity;
+  encoder->base = 0;
+  return 0;
+}
+
+/* Fills up to count entries with the data committed and not written yet, and
+   returns the number of entries needed to describe all of it. */
+int mpack_chain_iovec(const mpack_chain_t *chain, struct iovec *iov, int count)
+{
+#ifdef MPACK_POSIX
+  const mpack_chunk_t *chunk;
+  size_t offset = chain->sent;
+  size_t left = chain->size;
+  size_t size;
+  int n = 0;
+
+  for (chunk = chain->head; chunk && (left != 0); chunk = chunk->next, offset = 0) {
+    if ((size = chunk->size - offset) > left) {
+      size = left;
+    }
+
+    if (size != 0) {
+      if (n < count) {
+        iov[n].iov_base = chunk->data + offset;
+        iov[n].iov_len = size;
+      }
+      left -= size;
+      ++n;
+    }
+  }
+
+  return n;
+#else
+  (void)chain;
+  (void)iov;
+  (void)count;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+#ifdef MPACK_POSIX
+enum {
+  MPACK_CHAIN_IOV_SIZE = 64,
+};
+
+/* Written chunks go back to the pool except for the one holding the end of
+   the committed records, which the encoder may still be writing to. */
+static int mpack_chain_release(mpack_chain_t *chain, size_t size)
+{
+  mpack_chunk_t *chunk;
+
+  chain->size -= size;
+  size += chain->sent;
+
+  while (((chunk = chain->head) != chain->mark) && (size >= chunk->size)) {
+    size -= chunk->size;
+    chain->head = chunk->next;
+    --chain->count;
+    mpack_chunk_put(chain->pool, chunk);
+  }
+
+  chain->sent = size;
+
+  if ((chain->size == 0) && (mpack_encoder_offset(&chain->encoder) == chain->committed)) {
+    chain->sent_dict_size = chain->dict_size;
+    return mpack_chain_reset(chain);
+  }
+
+  return 0;
+}
+#endif
+
+/* Writes the committed data to fd, short writes are resumed and what was
+   written is released, so on a non-blocking descriptor the call may fail
+   with EAGAIN and be retried once fd is writable again. */
+int mpack_chain_writev(mpack_chain_t *chain, int fd)
+{
+#ifdef MPACK_POSIX
+  struct iovec iov[MPACK_CHAIN_IOV_SIZE];
+  ssize_t n;
+  int count;
+
+  while (chain->size != 0) {
+    if ((count = mpack_chain_iovec(chain, iov, MPACK_CHAIN_IOV_SIZE)) > MPACK_CHAIN_IOV_SIZE) {
+      count = MPACK_CHAIN_IOV_SIZE;
+    }
+
+    if ((n = writev(fd, iov, count)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    if (mpack_chain_release(chain, n) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+#else
+  (void)chain;
+  (void)fd;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+enum {
+  MPACK_JSON_BUFFER_SIZE = 8192,
+  MPACK_JSON_STACK_SIZE = 32,
+};
+
+/* The text of a value is collected in begin, which starts as buffer and
+   moves to the heap when it grows larger, so the sink only sees values that
+   were converted entirely. */
+typedef struct mpack_json {
+  const mpack_json_sink_t *sink;
+  char *begin;
+  char *pos;
+  char *end;
+  char buffer[MPACK_JSON_BUFFER_SIZE];
+} mpack_json_t;
+
+typedef struct mpack_json_frame {
+  size_t index;
+  size_t size;
+  bool map;
+} mpack_json_frame_t;
+
+typedef struct mpack_diyfp {
+  uint64_t f;
+  int e;
+} mpack_diyfp_t;
+
+static const char mpack_digits[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+static const uint64_t mpack_pow10[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL,
+  10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+  100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL,
+  1000000000000ULL, 10000000000000ULL, 100000000000000ULL, 1000000000000000ULL,
+  10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL,
+};
+
+/* Normalized approximations of 10^k for k = -348, -340, ..., 340. */
+static const mpack_diyfp_t mpack_cached_powers[] = {
+  { 0xfa8fd5a0081c0288ULL, -1220 }, { 0xbaaee17fa23ebf76ULL, -1193 }, { 0x8b16fb203055ac76ULL, -1166 },
+  { 0xcf42894a5dce35eaULL, -1140 }, { 0x9a6bb0aa55653b2dULL, -1113 }, { 0xe61acf033d1a45dfULL, -1087 },
+  { 0xab70fe17c79ac6caULL, -1060 }, { 0xff77b1fcbebcdc4fULL, -1034 }, { 0xbe5691ef416bd60cULL, -1007 },
+  { 0x8dd01fad907ffc3cULL, -980 }, { 0xd3515c2831559a83ULL, -954 }, { 0x9d71ac8fada6c9b5ULL, -927 },
+  { 0xea9c227723ee8bcbULL, -901 }, { 0xaecc49914078536dULL, -874 }, { 0x823c12795db6ce57ULL, -847 },
+  { 0xc21094364dfb5637ULL, -821 }, { 0x9096ea6f3848984fULL, -794 }, { 0xd77485cb25823ac7ULL, -768 },
+  { 0xa086cfcd97bf97f4ULL, -741 }, { 0xef340a98172aace5ULL, -715 }, { 0xb23867fb2a35b28eULL, -688 },
+  { 0x84c8d4dfd2c63f3bULL, -661 }, { 0xc5dd44271ad3cdbaULL, -635 }, { 0x936b9fcebb25c996ULL, -608 },
+  { 0xdbac6c247d62a584ULL, -582 }, { 0xa3ab66580d5fdaf6ULL, -555 }, { 0xf3e2f893dec3f126ULL, -529 },
+  { 0xb5b5ada8aaff80b8ULL, -502 }, { 0x87625f056c7c4a8bULL, -475 }, { 0xc9bcff6034c13053ULL, -449 },
+  { 0x964e858c91ba2655ULL, -422 }, { 0xdff9772470297ebdULL, -396 }, { 0xa6dfbd9fb8e5b88fULL, -369 },
+  { 0xf8a95fcf88747d94ULL, -343 }, { 0xb94470938fa89bcfULL, -316 }, { 0x8a08f0f8bf0f156bULL, -289 },
+  { 0xcdb02555653131b6ULL, -263 }, { 0x993fe2c6d07b7facULL, -236 }, { 0xe45c10c42a2b3b06ULL, -210 },
+  { 0xaa242499697392d3ULL, -183 }, { 0xfd87b5f28300ca0eULL, -157 }, { 0xbce5086492111aebULL, -130 },
+  { 0x8cbccc096f5088ccULL, -103 }, { 0xd1b71758e219652cULL, -77 }, { 0x9c40000000000000ULL, -50 },
+  { 0xe8d4a51000000000ULL, -24 }, { 0xad78ebc5ac620000ULL, 3 }, { 0x813f3978f8940984ULL, 30 },
+  { 0xc097ce7bc90715b3ULL, 56 }, { 0x8f7e32ce7bea5c70ULL, 83 }, { 0xd5d238a4abe98068ULL, 109 },
+  { 0x9f4f2726179a2245ULL, 136 }, { 0xed63a231d4c4fb27ULL, 162 }, { 0xb0de65388cc8ada8ULL, 189 },
+  { 0x83c7088e1aab65dbULL, 216 }, { 0xc45d1df942711d9aULL, 242 }, { 0x924d692ca61be758ULL, 269 },
+  { 0xda01ee641a708deaULL, 295 }, { 0xa26da3999aef774aULL, 322 }, { 0xf209787bb47d6b85ULL, 348 },
+  { 0xb454e4a179dd1877ULL, 375 }, { 0x865b86925b9bc5c2ULL, 402 }, { 0xc83553c5c8965d3dULL, 428 },
+  { 0x952ab45cfa97a0b3ULL, 455 }, { 0xde469fbd99a05fe3ULL, 481 }, { 0xa59bc234db398c25ULL, 508 },
+  { 0xf6c69a72a3989f5cULL, 534 }, { 0xb7dcbf5354e9beceULL, 561 }, { 0x88fcf317f22241e2ULL, 588 },
+  { 0xcc20ce9bd35c78a5ULL, 614 }, { 0x98165af37b2153dfULL, 641 }, { 0xe2a0b5dc971f303aULL, 667 },
+  { 0xa8d9d1535ce3b396ULL, 694 }, { 0xfb9b7cd9a4a7443cULL, 720 }, { 0xbb764c4ca7a44410ULL, 747 },
+  { 0x8bab8eefb6409c1aULL, 774 }, { 0xd01fef10a657842cULL, 800 }, { 0x9b10a4e5e9913129ULL, 827 },
+  { 0xe7109bfba19c0c9dULL, 853 }, { 0xac2820d9623bf429ULL, 880 }, { 0x80444b5e7aa7cf85ULL, 907 },
+  { 0xbf21e44003acdd2dULL, 933 }, { 0x8e679c2f5e44ff8fULL, 960 }, { 0xd433179d9c8cb841ULL, 986 },
+  { 0x9e19db92b4e31ba9ULL, 1013 }, { 0xeb96bf6ebadf77d9ULL, 1039 }, { 0xaf87023b9bf0ee6bULL, 1066 },
+};
+
+/* Characters that must be escaped in JSON strings, 'u' stands for the \u00XX
+   form. */
+static const char mpack_json_escapes[256] = {
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+};
+
+static char *mpack_format_unsigned(char *p, uint64_t value)
+{
+  char buffer[20];
+  char *q = buffer + sizeof(buffer);
+  size_t i;
+
+  while (value >= 100) {
+    i = (value % 100) * 2;
+    value /= 100;
+    *--q = mpack_digits[i + 1];
+    *--q = mpack_digits[i];
+  }
+
+  if (value >= 10) {
+    *--q = mpack_digits[value * 2 + 1];
+    *--q = mpack_digits[value * 2];
+  }
+  else {
+    *--q = '0' + value;
+  }
+
+  i = buffer + sizeof(buffer) - q;
+  memcpy(p, q, i);
+  return p + i;
+}
+
+static char *mpack_format_fixed(char *p, uint64_t value, int width)
+{
+  int i;
+
+  for (i = width - 1; i >= 0; --i) {
+    p[i] = '0' + (value % 10);
+    value /= 10;
+  }
+
+  return p + width;
+}
+
+/* Shortest round-trip formatting of floating point numbers, this is the
+   Grisu2 algorithm from Florian Loitsch's "Printing Floating-Point Numbers
+   Quickly and Accurately with Integers". */
+static mpack_diyfp_t mpack_diyfp_make(uint64_t f, int e)
+{
+  mpack_diyfp_t x;
+  x.f = f;
+  x.e = e;
+  return x;
+}
+
+static mpack_diyfp_t mpack_diyfp_normalize(mpack_diyfp_t x)
+{
+  const int shift = __builtin_clzll(x.f);
+  return mpack_diyfp_make(x.f << shift, x.e - shift);
+}
+
+static mpack_diyfp_t mpack_diyfp_multiply(mpack_diyfp_t x, mpack_diyfp_t y)
+{
+  const uint64_t mask = 0xffffffffULL;
+  const uint64_t a = x.f >> 32;
+  const uint64_t b = x.f & mask;
+  const uint64_t c = y.f >> 32;
+  const uint64_t d = y.f & mask;
+  const uint64_t ac = a * c;
+  const uint64_t bc = b * c;
+  const uint64_t ad = a * d;
+  const uint64_t bd = b * d;
+  const uint64_t tmp = (bd >> 32) + (ad & mask) + (bc & mask) + (1ULL << 31);
+  return mpack_diyfp_make(ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64);
+}
+
+static void mpack_grisu_round(char *buffer, int length, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+  while ((rest < wp_w) && ((delta - rest) >= ten_kappa) &&
+         (((rest + ten_kappa) < wp_w) || ((wp_w - rest) > (rest + ten_kappa - wp_w)))) {
+    --buffer[length - 1];
+    rest += ten_kappa;
+  }
+}
+
+static int mpack_grisu_digits(mpack_diyfp_t w, mpack_diyfp_t mp, uint64_t delta, char *buffer, int *k)
+{
+  const int shift = -mp.e;
+  const uint64_t one = 1ULL << shift;
+  const uint64_t wp_w = mp.f - w.f;
+  uint32_t p1 = mp.f >> shift;
+  uint64_t p2 = mp.f & (one - 1);
+  uint64_t rest;
+  int length = 0;
+  int kappa = 1;
+  int d;
+
+  while ((kappa < 10) && (p1 >= mpack_pow10[kappa])) {
+    ++kappa;
+  }
+
+  while (kappa > 0) {
+    d = p1 / mpack_pow10[kappa - 1];
+    p1 %= mpack_pow10[kappa - 1];
+
+    if (d || length) {
+      buffer[length++] = '0' + d;
+    }
+
+    --kappa;
+    rest = ((uint64_t)p1 << shift) + p2;
+
+    if (rest <= delta) {
+      *k += kappa;
+      mpack_grisu_round(buffer, length, delta, rest, mpack_pow10[kappa] << shift, wp_w);
+      return length;
+    }
+  }
+
+  for (;;) {
+    p2 *= 10;
+    delta *= 10;
+    d = p2 >> shift;
+
+    if (d || length) {
+      buffer[length++] = '0' + d;
+    }
+
+    p2 &= one - 1;
+    --kappa;
+
+    if (p2 < delta) {
+      *k += kappa;
+      mpack_grisu_round(buffer, length, delta, p2, one, (-kappa < 20) ? (wp_w * mpack_pow10[-kappa]) : 0);
+      return length;
+    }
+  }
+}
+
+/* Writes the digits of f * 2^e to buffer and the decimal exponent to k,
+   lower is set when the gap to the previous floating point number is half
+   the gap to the next one. */
+static int mpack_grisu2(uint64_t f, int e, bool lower, char *buffer, int *k)
+{
+  mpack_diyfp_t plus = mpack_diyfp_normalize(mpack_diyfp_make((f << 1) + 1, e - 1));
+  mpack_diyfp_t minus = lower ? mpack_diyfp_make((f << 2) - 1, e - 2) : mpack_diyfp_make((f << 1) - 1, e - 1);
+  mpack_diyfp_t c;
+  mpack_diyfp_t w;
+  double dk;
+  int index;
+
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+  index = (int)dk;
+
+  if ((dk - index) > 0.0) {
+    ++index;
+  }
+
+  index = (index >> 3) + 1;
+  *k = 348 - (index * 8);
+  c = mpack_cached_powers[index];
+
+  w = mpack_diyfp_multiply(mpack_diyfp_normalize(mpack_diyfp_make(f, e)), c);
+  plus = mpack_diyfp_multiply(plus, c);
+  minus = mpack_diyfp_multiply(minus, c);
+  --plus.f;
+  ++minus.f;
+  return mpack_grisu_digits(w, plus, plus.f - minus.f, buffer, k);
+}
+
+static char *mpack_format_exponent(char *p, int k)
+{
+  if (k < 0) {
+    *p++ = '-';
+    k = -k;
+  }
+
+  if (k >= 100) {
+    *p++ = '0' + (k / 100);
+    k %= 100;
+    *p++ = mpack_digits[k * 2];
+    *p++ = mpack_digits[k * 2 + 1];
+  }
+  else if (k >= 10) {
+    *p++ = mpack_digits[k * 2];
+    *p++ = mpack_digits[k * 2 + 1];
+  }
+  else {
+    *p++ = '0' + k;
+  }
+
+  return p;
+}
+
+/* Lays out the length digits at p, which represent digits * 10^k, in the
+   shortest form that still reads as a floating point number. */
+static char *mpack_format_digits(char *p, int length, int k)
+{
+  const int n = length + k;
+  int offset;
+
+  if ((k >= 0) && (n <= 21)) {
+    memset(p + length, '0', k);
+    p[n] = '.';
+    p[n + 1] = '0';
+    return p + n + 2;
+  }
+
+  if ((n > 0) && (n <= 21)) {
+    memmove(p + n + 1, p + n, length - n);
+    p[n] = '.';
+    return p + length + 1;
+  }
+
+  if ((n > -6) && (n <= 0)) {
+    offset = 2 - n;
+    memmove(p + offset, p, length);
+    p[0] = '0';
+    p[1] = '.';
+    memset(p + 2, '0', offset - 2);
+    return p + length + offset;
+  }
+
+  if (length == 1) {
+    p[1] = 'e';
+    return mpack_format_exponent(p + 2, n - 1);
+  }
+
+  memmove(p + 2, p + 1, length - 1);
+  p[1] = '.';
+  p[length + 1] = 'e';
+  return mpack_format_exponent(p + length + 2, n - 1);
+}
+
+static char *mpack_format_double(char *p, double value)
+{
+  union { double f; uint64_t u; } var;
+  uint64_t f;
+  int e;
+  int k;
+  int length;
+
+  var.f = value;
+  f = var.u & ((1ULL << 52) - 1);
+  e = (var.u >> 52) & 0x7ff;
+
+  if (var.u >> 63) {
+    *p++ = '-';
+  }
+
+  if ((e == 0) && (f == 0)) {
+    memcpy(p, "0.0", 3);
+    return p + 3;
+  }
+
+  if (e != 0) {
+    length = mpack_grisu2(f | (1ULL << 52), e - 1075, (f == 0) && (e > 1), p, &k);
+  }
+  else {
+    length = mpack_grisu2(f, -1074, false, p, &k);
+  }
+
+  return mpack_format_digits(p, length, k);
+}
+
+static char *mpack_format_float(char *p, float value)
+{
+  union { float f; uint32_t u; } var;
+  uint32_t f;
+  int e;
+  int k;
+  int length;
+
+  var.f = value;
+  f = var.u & ((1U << 23) - 1);
+  e = (var.u >> 23) & 0xff;
+
+  if (var.u >> 31) {
+    *p++ = '-';
+  }
+
+  if ((e == 0) && (f == 0)) {
+    memcpy(p, "0.0", 3);
+    return p + 3;
+  }
+
+  if (e != 0) {
+    length = mpack_grisu2(f | (1U << 23), e - 150, (f == 0) && (e > 1), p, &k);
+  }
+  else {
+    length = mpack_grisu2(f, -149, false, p, &k);
+  }
+
+  return mpack_format_digits(p, length, k);
+}
+
+static int mpack_json_flush(mpack_json_t *json)
+{
+  const int size = json->pos - json->begin;
+
+  if ((size != 0) && (json->sink->write(json->sink->context, json->begin, size) != size)) {
+    return -1;
+  }
+
+  json->pos = json->begin;
+  return 0;
+}
+
+static char *mpack_json_reserve(mpack_json_t *json, size_t size)
+{
+  const size_t used = json->pos - json->begin;
+  size_t capacity = json->end - json->begin;
+  char *data;
+
+  if ((size_t)(json->end - json->pos) >= size) {
+    return json->pos;
+  }
+
+  while ((capacity - used) < size) {
+    if (capacity > (INT_MAX / 2)) {
+      errno = ENOMEM;
+      return NULL;
+    }
+    capacity *= 2;
+  }
+
+  if (json->begin == json->buffer) {
+    if ((data = malloc(capacity))) {
+      memcpy(data, json->begin, used);
+    }
+  }
+  else {
+    data = realloc(json->begin, capacity);
+  }
+
+  if (!data) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  json->begin = data;
+  json->pos = data + used;
+  json->end = data + capacity;
+  return json->pos;
+}
+
+static int mpack_json_write(mpack_json_t *json, const char *data, size_t size)
+{
+  char *p;
+
+  if (!(p = mpack_json_reserve(json, size))) {
+    return -1;
+  }
+
+  memcpy(p, data, size);
+  json->pos = p + size;
+  return 0;
+}
+
+/* Returns the length of the prefix of data that can be copied to a JSON
+   string without escaping, when ascii is set bytes outside of ASCII stop the
+   scan as well so their encoding can be checked. */
+static size_t mpack_json_scan(const char *data, size_t size, bool ascii)
+{
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1f);
+  __m128i x;
+  int mask;
+
+  for (; (i + 16) <= size; i += 16) {
+    x = _mm_loadu_si128((const __m128i *)(data + i));
+    mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash)),
+                                          _mm_cmpeq_epi8(_mm_max_epu8(x, control), control)));
+
+    if (ascii) {
+      mask |= _mm_movemask_epi8(x);
+    }
+
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+
+  while ((i != size) && !(ascii && ((uint8_t)data[i] >= 0x80)) && !mpack_json_escapes[(uint8_t)data[i]]) {
+    ++i;
+  }
+
+  return i;
+}
+
+/* Length of the well formed UTF-8 sequence at the start of p, or zero if
+   there is none, invalid is then the length of the maximal prefix of a
+   sequence to replace with U+FFFD, at least one byte. */
+static size_t mpack_utf8_sequence(const uint8_t *p, size_t size, size_t *invalid)
+{
+  const uint8_t c = p[0];
+  uint8_t lo = 0x80;
+  uint8_t hi = 0xbf;
+  size_t length;
+  size_t i;
+
+  if (c < 0x80) {
+    return 1;
+  }
+
+  if ((c >= 0xc2) && (c <= 0xdf)) {
+    length = 2;
+  }
+  else if ((c >= 0xe0) && (c <= 0xef)) {
+    length = 3;
+    lo = (c == 0xe0) ? 0xa0 : 0x80;
+    hi = (c == 0xed) ? 0x9f : 0xbf;
+  }
+  else if ((c >= 0xf0) && (c <= 0xf4)) {
+    length = 4;
+    lo = (c == 0xf0) ? 0x90 : 0x80;
+    hi = (c == 0xf4) ? 0x8f : 0xbf;
+  }
+  else {
+    *invalid = 1;
+    return 0;
+  }
+
+  for (i = 1; i != length; ++i, lo = 0x80, hi = 0xbf) {
+    if ((i == size) || (p[i] < lo) || (p[i] > hi)) {
+      *invalid = i;
+      return 0;
+    }
+  }
+
+  return length;
+}
+
+/* Strings are written as UTF-8, ill-formed sequences are replaced with
+   U+FFFD. */
+static int mpack_json_string(mpack_json_t *json, const char *data, size_t size)
+{
+  static const char hex[] = "0123456789abcdef";
+  const char *end = data + size;
+  size_t invalid;
+  size_t n;
+  char *p;
+  char c;
+
+  if (mpack_json_write(json, "\"", 1) < 0) {
+    return -1;
+  }
+
+  while (data != end) {
+    if (!(p = mpack_json_reserve(json, 6))) {
+      return -1;
+    }
+
+    n = json->end - p;
+
+    if (n > (size_t)(end - data)) {
+      n = end - data;
+    }
+
+    n = mpack_json_scan(data, n, true);
+    memcpy(p, data, n);
+    json->pos = (p += n);
+    data += n;
+
+    if ((data == end) || ((json->end - p) < 6)) {
+      continue;
+    }
+
+    if ((uint8_t)*data >= 0x80) {
+      if ((n = mpack_utf8_sequence((const uint8_t *)data, end - data, &invalid))) {
+        memcpy(p, data, n);
+        json->pos = p + n;
+        data += n;
+      }
+      else {
+        memcpy(p, "\xef\xbf\xbd", 3);
+        json->pos = p + 3;
+        data += invalid;
+      }
+      continue;
+    }
+
+    c = mpack_json_escapes[(uint8_t)*data];
+
+    p[0] = '\\';
+
+    if (c == 'u') {
+      memcpy(p + 1, "u00", 3);
+      p[4] = hex[(uint8_t)*data >> 4];
+      p[5] = hex[(uint8_t)*data & 0xf];
+      json->pos = p + 6;
+    }
+    else {
+      p[1] = c;
+      json->pos = p + 2;
+    }
+
+    ++data;
+  }
+
+  return mpack_json_write(json, "\"", 1);
+}
+
+static int mpack_json_literal(mpack_json_t *json, const char *data, size_t size, bool key)
+{
+  char *p;
+
+  if (!(p = mpack_json_reserve(json, size + 2))) {
+    return -1;
+  }
+
+  if (key) {
+    *p++ = '"';
+  }
+
+  memcpy(p, data, size);
+  p += size;
+
+  if (key) {
+    *p++ = '"';
+  }
+
+  json->pos = p;
+  return 0;
+}
+
+static int mpack_json_integer(mpack_json_t *json, bool negative, uint64_t value, bool key)
+{
+  char *p;
+
+  if (!(p = mpack_json_reserve(json, 24))) {
+    return -1;
+  }
+
+  if (key) {
+    *p++ = '"';
+  }
+
+  if (negative) {
+    *p++ = '-';
+  }
+
+  p = mpack_format_unsigned(p, value);
+
+  if (key) {
+    *p++ = '"';
+  }
+
+  json->pos = p;
+  return 0;
+}
+
+/* NaN and infinities have no JSON representation and are written as null. */
+static int mpack_json_number(mpack_json_t *json, double value, bool single, bool key)
+{
+  char *p;
+
+  if (!isfinite(value)) {
+    return mpack_json_literal(json, "null", 4, key);
+  }
+
+  if (!(p = mpack_json_reserve(json, 40))) {
+    return -1;
+  }
+
+  if (key) {
+    *p++ = '"';
+  }
+
+  p = single ? mpack_format_float(p, value) : mpack_format_double(p, value);
+
+  if (key) {
+    *p++ = '"';
+  }
+
+  json->pos = p;
+  return 0;
+}
+
+static int mpack_json_binary(mpack_json_t *json, const void *data, size_t size, bool key)
+{
+  static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  static const char hex[] = "0123456789abcdef";
+  const unsigned int format = json->sink->flags & MPACK_JSON_BINARY_MASK;
+  const uint8_t *bytes = data;
+  uint32_t bits;
+  size_t i;
+  char *p;
+
+  if (key && (format == MPACK_JSON_BINARY_ARRAY)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  switch (format) {
+  case MPACK_JSON_BINARY_HEX:
+    if (mpack_json_write(json, "\"", 1) < 0) {
+      return -1;
+    }
+
+    for (i = 0; i != size; ++i) {
+      if (!(p = mpack_json_reserve(json, 2))) {
+        return -1;
+      }
+      p[0] = hex[bytes[i] >> 4];
+      p[1] = hex[bytes[i] & 0xf];
+      json->pos = p + 2;
+    }
+
+    return mpack_json_write(json, "\"", 1);
+
+  case MPACK_JSON_BINARY_ARRAY:
+    if (mpack_json_write(json, "[", 1) < 0) {
+      return -1;
+    }
+
+    for (i = 0; i != size; ++i) {
+      if (!(p = mpack_json_reserve(json, 4))) {
+        return -1;
+      }
+      if (i != 0) {
+        *p++ = ',';
+      }
+      json->pos = mpack_format_unsigned(p, bytes[i]);
+    }
+
+    return mpack_json_write(json, "]", 1);
+
+  default:
+    if (mpack_json_write(json, "\"", 1) < 0) {
+      return -1;
+    }
+
+    for (i = 0; i < size; i += 3) {
+      if (!(p = mpack_json_reserve(json, 4))) {
+        return -1;
+      }
+      bits = bytes[i] << 16;
+      bits |= ((i + 1) < size) ? (bytes[i + 1] << 8) : 0;
+      bits |= ((i + 2) < size) ? bytes[i + 2] : 0;
+      p[0] = base64[(bits >> 18) & 0x3f];
+      p[1] = base64[(bits >> 12) & 0x3f];
+      p[2] = ((i + 1) < size) ? base64[(bits >> 6) & 0x3f] : '=';
+      p[3] = ((i + 2) < size) ? base64[bits & 0x3f] : '=';
+      json->pos = p + 4;
+    }
+
+    return mpack_json_write(json, "\"", 1);
+  }
+}
+
+static int mpack_json_extended(mpack_json_t *json, const mpack_extended_t *value, bool key)
+{
+  char *p;
+
+  switch (json->sink->flags & MPACK_JSON_EXTENDED_MASK) {
+  case MPACK_JSON_EXTENDED_DATA:
+    return mpack_json_binary(json, value->data, value->size, key);
+
+  case MPACK_JSON_EXTENDED_NULL:
+    return mpack_json_literal(json, "null", 4, key);
+
+  default:
+    if (key) {
+      errno = EINVAL;
+      return -1;
+    }
+
+    if (!(p = mpack_json_reserve(json, 24))) {
+      return -1;
+    }
+
+    memcpy(p, "{\"type\":", 8);
+    p += 8;
+
+    if (value->type < 0) {
+      *p++ = '-';
+    }
+
+    p = mpack_format_unsigned(p, (value->type < 0) ? -value->type : value->type);
+    memcpy(p, ",\"data\":", 8);
+    json->pos = p + 8;
+
+    if (mpack_json_binary(json, value->data, value->size, false) < 0) {
+      return -1;
+    }
+
+    return mpack_json_write(json, "}", 1);
+  }
+}
+
+/* Timestamps are written in the RFC 3339 format, in UTC. */
+static int mpack_json_timestamp(mpack_json_t *json, struct timespec value)
+{
+  int64_t days = value.tv_sec / 86400;
+  int64_t secs = value.tv_sec % 86400;
+  int64_t era;
+  int64_t year;
+  unsigned int doe;
+  unsigned int yoe;
+  unsigned int doy;
+  unsigned int mp;
+  unsigned int month;
+  unsigned int day;
+  unsigned long nsec = value.tv_nsec;
+  char *p;
+  int width;
+
+  if (secs < 0) {
+    secs += 86400;
+    days -= 1;
+  }
+
+  /* Howard Hinnant's civil_from_days. */
+  days += 719468;
+  era = ((days >= 0) ? days : (days - 146096)) / 146097;
+  doe = days - era * 146097;
+  yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  mp = (5 * doy + 2) / 153;
+  day = doy - (153 * mp + 2) / 5 + 1;
+  month = (mp < 10) ? (mp + 3) : (mp - 9);
+  year = yoe + era * 400 + (month <= 2);
+
+  if (!(p = mpack_json_reserve(json, 48))) {
+    return -1;
+  }
+
+  *p++ = '"';
+
+  if (year < 0) {
+    *p++ = '-';
+    year = -year;
+  }
+
+  p = (year < 10000) ? mpack_format_fixed(p, year, 4) : mpack_format_unsigned(p, year);
+  *p++ = '-';
+  p = mpack_format_fixed(p, month, 2);
+  *p++ = '-';
+  p = mpack_format_fixed(p, day, 2);
+  *p++ = 'T';
+  p = mpack_format_fixed(p, secs / 3600, 2);
+  *p++ = ':';
+  p = mpack_format_fixed(p, (secs / 60) % 60, 2);
+  *p++ = ':';
+  p = mpack_format_fixed(p, secs % 60, 2);
+
+  if (nsec != 0) {
+    for (width = 9; (nsec % 10) == 0; --width) {
+      nsec /= 10;
+    }
+    *p++ = '.';
+    p = mpack_format_fixed(p, nsec, width);
+  }
+
+  memcpy(p, "Z\"", 2);
+  json->pos = p + 2;
+  return 0;
+}
+
+/* Decodes the next value and writes it, map keys that are not strings are
+   written as strings. */
+static int mpack_json_value(mpack_decoder_t *decoder, mpack_json_t *json, bool key, mpack_object_t *value)
+{
+  const char *pos = decoder->pos;
+  const int tag = (pos != decoder->end) ? (uint8_t)*pos : -1;
+  struct timespec time;
+  unsigned long u;
+  float x;
+
+  /* Unsigned integers may not fit in the signed value of an object. */
+  if (tag == MPACK_UINT64) {
+    value->type = MPACK_INTEGER;
+    return (mpack_decode_unsigned(decoder, &u) < 0) ? -1 : mpack_json_integer(json, false, u, key);
+  }
+
+  /* Single precision numbers have a shorter representation. */
+  if (tag == MPACK_FLOAT32) {
+    value->type = MPACK_NUMBER;
+    return (mpack_decode_float(decoder, &x) < 0) ? -1 : mpack_json_number(json, x, true, key);
+  }
+
+  if (mpack_decode_object(decoder, value) < 0) {
+    return -1;
+  }
+
+  switch (value->type) {
+  case MPACK_NONE:
+    return mpack_json_literal(json, "null", 4, key);
+
+  case MPACK_BOOLEAN:
+    return value->data.boolean ? mpack_json_literal(json, "true", 4, key) : mpack_json_literal(json, "false", 5, key);
+
+  case MPACK_INTEGER:
+    if (value->data.integer < 0) {
+      return mpack_json_integer(json, true, -(uint64_t)value->data.integer, key);
+    }
+    return mpack_json_integer(json, false, value->data.integer, key);
+
+  case MPACK_NUMBER:
+    return mpack_json_number(json, value->data.number, false, key);
+
+  case MPACK_STRING:
+    return mpack_json_string(json, value->data.string.data, value->data.string.size);
+
+  case MPACK_BINARY:
+    return mpack_json_binary(json, value->data.binary.data, value->data.binary.size, key);
+
+  case MPACK_ARRAY:
+    return key ? 0 : mpack_json_write(json, "[", 1);
+
+  case MPACK_MAP:
+    return key ? 0 : mpack_json_write(json, "{", 1);
+
+  case MPACK_EXTENDED:
+    if ((value->data.extended.type == MPACK_EXT_TIMESTAMP) && (json->sink->flags & MPACK_JSON_TIMESTAMP_STRING)) {
+      u = decoder->pos - pos;
+      decoder->pos = pos;
+
+      if (mpack_decode_timestamp(decoder, &time) >= 0) {
+        return mpack_json_timestamp(json, time);
+      }
+
+      decoder->pos = pos + u;
+    }
+    return mpack_json_extended(json, &(value->data.extended), key);
+  }
+
+  return 0;
+}
+
+/* Containers are tracked on an explicit stack so nesting depth is only bound
+   by the memory available. */
+static int mpack_json_walk(mpack_decoder_t *decoder, mpack_json_t *json)
+{
+  mpack_json_frame_t frames[MPACK_JSON_STACK_SIZE];
+  mpack_json_frame_t *stack = frames;
+  mpack_json_frame_t *frame;
+  size_t capacity = MPACK_JSON_STACK_SIZE;
+  size_t depth = 0;
+  const char *pos = decoder->pos;
+  mpack_object_t value;
+  bool key = false;
+  int result = -1;
+
+  for (;;) {
+    if (depth != 0) {
+      frame = &stack[depth - 1];
+
+      if (frame->index == frame->size) {
+        if (mpack_json_write(json, frame->map ? "}" : "]", 1) < 0) {
+          goto done;
+        }
+        if (--depth == 0) {
+          break;
+        }
+        continue;
+      }
+
+      key = frame->map && !(frame->index & 1);
+
+      if ((frame->index != 0) && (mpack_json_write(json, (key || !frame->map) ? "," : ":", 1) < 0)) {
+        goto done;
+      }
+
+      ++frame->index;
+    }
+
+    if (mpack_json_value(decoder, json, key, &value) < 0) {
+      goto done;
+    }
+
+    if ((value.type == MPACK_ARRAY) || (value.type == MPACK_MAP)) {
+      if (key) {
+        errno = EINVAL;
+        goto done;
+      }
+
+      if (depth == capacity) {
+        if (!(frame = malloc(2 * capacity * sizeof(*frame)))) {
+          errno = ENOMEM;
+          goto done;
+        }
+
+        memcpy(frame, stack, capacity * sizeof(*frame));
+
+        if (stack != frames) {
+          free(stack);
+        }
+
+        stack = frame;
+        capacity *= 2;
+      }
+
+      frame = &stack[depth++];
+      frame->index = 0;
+      frame->map = (value.type == MPACK_MAP);
+      frame->size = frame->map ? (2 * value.data.map.size) : value.data.array.size;
+      continue;
+    }
+
+    if (depth == 0) {
+      break;
+    }
+  }
+
+  result = decoder->pos - pos;
+done:
+  if (stack != frames) {
+    free(stack);
+  }
+
+  if (result < 0) {
+    decoder->pos = pos;
+  }
+
+  return result;
+}
+
+/* The value is converted in a single pass and only handed to the sink once
+   it was entirely available and converted. */
+int mpack_to_json(mpack_decoder_t *decoder, const mpack_json_sink_t *sink)
+{
+  const char *pos = decoder->pos;
+  mpack_json_t json;
+  int size;
+
+  json.sink = sink;
+  json.begin = json.buffer;
+  json.pos = json.buffer;
+  json.end = json.buffer + sizeof(json.buffer);
+
+  if (((size = mpack_json_walk(decoder, &json)) < 0) || (mpack_json_flush(&json) < 0)) {
+    decoder->pos = pos;
+    size = -1;
+  }
+
+  if (json.begin != json.buffer) {
+    free(json.begin);
+  }
+
+  return size;
+}
+
+enum {
+  MPACK_JSON_VALUE,
+  MPACK_JSON_ELEMENT,
+  MPACK_JSON_FIRST_ELEMENT,
+  MPACK_JSON_KEY,
+  MPACK_JSON_FIRST_KEY,
+  MPACK_JSON_COLON,
+  MPACK_JSON_NEXT,
+};
+
+/* Element counts of the containers of a JSON value, in the order they are
+   opened, and the stack of open containers, each entry holds the index of
+   the container in counts shifted left by one, the low bit is set for
+   objects. */
+typedef struct mpack_json_parser {
+  size_t *counts;
+  size_t *stack;
+  size_t count;
+  size_t depth;
+  size_t counts_capacity;
+  size_t stack_capacity;
+  size_t counts_buffer[64];
+  size_t stack_buffer[32];
+} mpack_json_parser_t;
+
+static const double mpack_exact_pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static bool mpack_json_is_space(char c)
+{ return (c == ' ') || (c == '\n') || (c == '\r') || (c == '\t'); }
+
+static bool mpack_json_is_delimiter(char c)
+{
+  switch (c) {
+  case ' ': case '\n': case '\r': case '\t':
+  case ',': case ':': case '[': case ']': case '{': case '}': case '"':
+    return true;
+  default:
+    return false;
+  }
+}
+
+static const char *mpack_json_skip_space(const char *p, const char *end)
+{
+#if defined(__SSE2__)
+  __m128i x;
+  int mask;
+
+  if ((p != end) && !mpack_json_is_space(*p)) {
+    return p;
+  }
+
+  for (; (end - p) >= 16; p += 16) {
+    x = _mm_loadu_si128((const __m128i *)p);
+    mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\n'))),
+                                          _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\t')))));
+
+    if (mask != 0xffff) {
+      return p + __builtin_ctz(~mask);
+    }
+  }
+#endif
+
+  while ((p != end) && mpack_json_is_space(*p)) {
+    ++p;
+  }
+
+  return p;
+}
+
+/* Returns the position of the closing quote of the string starting at p,
+   escaped is set if the string contains escape sequences. */
+static const char *mpack_json_skip_string(const char *p, const char *end, bool *escaped)
+{
+  ++p;
+
+  for (;;) {
+    p += mpack_json_scan(p, end - p, false);
+
+    if (p == end) {
+      errno = EAGAIN;
+      return NULL;
+    }
+
+    switch (*p) {
+    case '"':
+      return p;
+
+    case '\\':
+      if ((end - p) < 2) {
+        errno = EAGAIN;
+        return NULL;
+      }
+      *escaped = true;
+      p += 2;
+      break;
+
+    default:
+      errno = EINVAL;
+      return NULL;
+    }
+  }
+}
+
+/* A token that reaches the end of the input completes the top-level value
+   unless it can only be the beginning of a literal or of a number. */
+static const char *mpack_json_skip_token(const char *p, const char *end, bool top)
+{
+  const char *q = p;
+
+  while ((q != end) && !mpack_json_is_delimiter(*q)) {
+    ++q;
+  }
+
+  if (q == p) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (top && (q == end)) {
+    if (((size_t)(q - p) < 4 && memcmp(p, "true", q - p) == 0) ||
+        ((size_t)(q - p) < 4 && memcmp(p, "null", q - p) == 0) ||
+        ((size_t)(q - p) < 5 && memcmp(p, "false", q - p) == 0) ||
+        (((*p == '-') || ((*p >= '0') && (*p <= '9'))) && (memchr("-+.eE", q[-1], 5) != NULL))) {
+      errno = EAGAIN;
+      return NULL;
+    }
+  }
+
+  return q;
+}
+
+static bool mpack_json_grow(size_t **array, size_t *capacity, const size_t *buffer, size_t size)
+{
+  size_t *tmp;
+
+  if (size < *capacity) {
+    return true;
+  }
+
+  if (!(tmp = malloc(2 * *capacity * sizeof(size_t)))) {
+    errno = ENOMEM;
+    return false;
+  }
+
+  memcpy(tmp, *array, *capacity * sizeof(size_t));
+
+  if (*array != buffer) {
+    free(*array);
+  }
+
+  *array = tmp;
+  *capacity *= 2;
+  return true;
+}
+
+static bool mpack_json_open(mpack_json_parser_t *parser, bool object)
+{
+  if (!mpack_json_grow(&parser->counts, &parser->counts_capacity, parser->counts_buffer, parser->count) ||
+      !mpack_json_grow(&parser->stack, &parser->stack_capacity, parser->stack_buffer, parser->depth)) {
+    return false;
+  }
+
+  parser->counts[parser->count] = 0;
+  parser->stack[parser->depth++] = (parser->count++ << 1) | object;
+  return true;
+}
+
+/* First pass, finds the end of the JSON value at p, checks its structure and
+   counts the elements of each container. */
+static const char *mpack_json_index(mpack_json_parser_t *parser, const char *p, const char *end)
+{
+  int state = MPACK_JSON_VALUE;
+  size_t top = 0;
+  bool escaped;
+
+  for (;;) {
+    if ((p = mpack_json_skip_space(p, end)) == end) {
+      errno = EAGAIN;
+      return NULL;
+    }
+
+    if (parser->depth != 0) {
+      top = parser->stack[parser->depth - 1];
+    }
+
+    switch (state) {
+    case MPACK_JSON_FIRST_KEY:
+      if (*p == '}') {
+        goto close;
+      }
+      /* fallthrough */
+    case MPACK_JSON_KEY:
+      if (*p != '"') {
+        goto invalid;
+      }
+      ++parser->counts[top >> 1];
+      if (!(p = mpack_json_skip_string(p, end, &escaped))) {
+        return NULL;
+      }
+      ++p;
+      state = MPACK_JSON_COLON;
+      continue;
+
+    case MPACK_JSON_COLON:
+      if (*p != ':') {
+        goto invalid;
+      }
+      ++p;
+      state = MPACK_JSON_VALUE;
+      continue;
+
+    case MPACK_JSON_NEXT:
+      if (*p == ',') {
+        ++p;
+        state = (top & 1) ? MPACK_JSON_KEY : MPACK_JSON_ELEMENT;
+        continue;
+      }
+      if (*p == ((top & 1) ? '}' : ']')) {
+        goto close;
+      }
+      goto invalid;
+
+    case MPACK_JSON_FIRST_ELEMENT:
+      if (*p == ']') {
+        goto close;
+      }
+      /* fallthrough */
+    case MPACK_JSON_ELEMENT:
+      ++parser->counts[top >> 1];
+      /* fallthrough */
+    default:
+      switch (*p) {
+      case '{':
+      case '[':
+        if (!mpack_json_open(parser, *p == '{')) {
+          return NULL;
+        }
+        state = (*p == '{') ? MPACK_JSON_FIRST_KEY : MPACK_JSON_FIRST_ELEMENT;
+        ++p;
+        continue;
+
+      case '"':
+        if (!(p = mpack_json_skip_string(p, end, &escaped))) {
+          return NULL;
+        }
+        ++p;
+        break;
+
+      default:
+        if (!(p = mpack_json_skip_token(p, end, parser->depth == 0))) {
+          return NULL;
+        }
+      }
+
+      if (parser->depth == 0) {
+        return p;
+      }
+
+      state = MPACK_JSON_NEXT;
+      continue;
+    }
+
+  close:
+    ++p;
+
+    if (--parser->depth == 0) {
+      return p;
+    }
+
+    state = MPACK_JSON_NEXT;
+  }
+
+invalid:
+  errno = EINVAL;
+  return NULL;
+}
+
+static int mpack_json_hex(const char *p, uint32_t *value)
+{
+  int i;
+  char c;
+
+  *value = 0;
+
+  for (i = 0; i != 4; ++i) {
+    c = p[i];
+
+    if ((c >= '0') && (c <= '9')) {
+      *value = (*value << 4) | (c - '0');
+    }
+    else if (((c | 0x20) >= 'a') && ((c | 0x20) <= 'f')) {
+      *value = (*value << 4) | ((c | 0x20) - 'a' + 10);
+    }
+    else {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* Decodes the escape sequences of a string to dst, which must hold at least
+   size bytes, and returns the decoded size. Unpaired surrogates are
+   rejected. */
+static long mpack_json_unescape(char *dst, const char *src, size_t size)
+{
+  const char *end = src + size;
+  const char *q;
+  char *p = dst;
+  uint32_t c;
+  uint32_t d;
+  size_t n;
+
+  while (src != end) {
+    if (*src != '\\') {
+      n = (q = memchr(src, '\\', end - src)) ? (size_t)(q - src) : (size_t)(end - src);
+      memcpy(p, src, n);
+      p += n;
+      src += n;
+      continue;
+    }
+
+    switch (src[1]) {
+    case '"':  *p++ = '"';  break;
+    case '\\': *p++ = '\\'; break;
+    case '/':  *p++ = '/';  break;
+    case 'b':  *p++ = '\b'; break;
+    case 'f':  *p++ = '\f'; break;
+    case 'n':  *p++ = '\n'; break;
+    case 'r':  *p++ = '\r'; break;
+    case 't':  *p++ = '\t'; break;
+
+    case 'u':
+      if (((end - src) < 6) || (mpack_json_hex(src + 2, &c) < 0)) {
+        return -1;
+      }
+
+      if ((c >= 0xd800) && (c <= 0xdbff)) {
+        if (((end - src) < 12) || (src[6] != '\\') || (src[7] != 'u') || (mpack_json_hex(src + 8, &d) < 0) ||
+            (d < 0xdc00) || (d > 0xdfff)) {
+          return -1;
+        }
+        c = 0x10000 + ((c - 0xd800) << 10) + (d - 0xdc00);
+        src += 6;
+      }
+      else if ((c >= 0xdc00) && (c <= 0xdfff)) {
+        return -1;
+      }
+
+      if (c < 0x80) {
+        *p++ = c;
+      }
+      else if (c < 0x800) {
+        *p++ = 0xc0 | (c >> 6);
+        *p++ = 0x80 | (c & 0x3f);
+      }
+      else if (c < 0x10000) {
+        *p++ = 0xe0 | (c >> 12);
+        *p++ = 0x80 | ((c >> 6) & 0x3f);
+        *p++ = 0x80 | (c & 0x3f);
+      }
+      else {
+        *p++ = 0xf0 | (c >> 18);
+        *p++ = 0x80 | ((c >> 12) & 0x3f);
+        *p++ = 0x80 | ((c >> 6) & 0x3f);
+        *p++ = 0x80 | (c & 0x3f);
+      }
+
+      src += 4;
+      break;
+
+    default:
+      return -1;
+    }
+
+    src += 2;
+  }
+
+  return p - dst;
+}
+
+static const char *mpack_json_parse_string(mpack_encoder_t *encoder, const char *p, const char *end, bool key)
+{
+  char buffer[256];
+  bool escaped = false;
+  const char *q = mpack_json_skip_string(p, end, &escaped);
+  mpack_string_t string;
+  char *data = buffer;
+  long size;
+
+  string.data = p + 1;
+  string.size = q - (p + 1);
+
+  if (escaped) {
+    if ((string.size > sizeof(buffer)) && !(data = malloc(string.size))) {
+      errno = ENOMEM;
+      return NULL;
+    }
+
+    if ((size = mpack_json_unescape(data, string.data, string.size)) < 0) {
+      if (data != buffer) {
+        free(data);
+      }
+      errno = EINVAL;
+      return NULL;
+    }
+
+    string.data = data;
+    string.size = size;
+  }
+
+  if (key) {
+    mpack_encode_key(encoder, string);
+  }
+  else {
+    mpack_encode_string(encoder, string);
+  }
+
+  if (data != buffer) {
+    free(data);
+  }
+
+  return q + 1;
+}
+
+/* Integers are encoded in their smallest format, other numbers are parsed
+   exactly when the mantissa and the power of ten both fit in a double and
+   with strtod otherwise. */
+static int mpack_json_parse_number(mpack_encoder_t *encoder, const char *p, const char *end)
+{
+  const char *start = p;
+  const int saved_errno = errno;
+  char buffer[64];
+  char *copy = buffer;
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  int e = 0;
+  bool negative = false;
+  bool integer = true;
+  bool truncated = false;
+  bool e_negative = false;
+  double value;
+
+  if (*p == '-') {
+    negative = true;
+    ++p;
+  }
+
+  if ((p == end) || (*p < '0') || (*p > '9') || ((*p == '0') && ((p + 1) != end) && (p[1] >= '0') && (p[1] <= '9'))) {
+    return -1;
+  }
+
+  for (; (p != end) && (*p >= '0') && (*p <= '9'); ++p) {
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      digits += (mantissa != 0);
+    }
+    else if ((digits == 19) && (mantissa <= (UINT64_MAX - (*p - '0')) / 10)) {
+      mantissa = mantissa * 10 + (*p - '0');
+      ++digits;
+    }
+    else {
+      truncated = true;
+      ++exponent;
+    }
+  }
+
+  if ((p != end) && (*p == '.')) {
+    integer = false;
+
+    if ((++p == end) || (*p < '0') || (*p > '9')) {
+      return -1;
+    }
+
+    for (; (p != end) && (*p >= '0') && (*p <= '9'); ++p) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        digits += (mantissa != 0);
+        --exponent;
+      }
+      else {
+        truncated = true;
+      }
+    }
+  }
+
+  if ((p != end) && ((*p == 'e') || (*p == 'E'))) {
+    integer = false;
+
+    if ((++p != end) && ((*p == '+') || (*p == '-'))) {
+      e_negative = (*p++ == '-');
+    }
+
+    if ((p == end) || (*p < '0') || (*p > '9')) {
+      return -1;
+    }
+
+    for (; (p != end) && (*p >= '0') && (*p <= '9'); ++p) {
+      if (e < 100000) {
+        e = e * 10 + (*p - '0');
+      }
+    }
+
+    exponent += e_negative ? -e : e;
+  }
+
+  if (p != end) {
+    return -1;
+  }
+
+  if (integer && !truncated) {
+    if (!negative) {
+      return (mantissa <= INT64_MAX) ? mpack_encode_signed(encoder, mantissa) : mpack_encode_unsigned(encoder, mantissa);
+    }
+    if (mantissa <= (uint64_t)INT64_MAX + 1) {
+      return mpack_encode_signed(encoder, (int64_t)(0 - mantissa));
+    }
+  }
+
+  if (!truncated && (mantissa <= (1ULL << 53)) && (exponent >= -22) && (exponent <= 22)) {
+    value = (exponent < 0) ? (mantissa / mpack_exact_pow10[-exponent]) : (mantissa * mpack_exact_pow10[exponent]);
+    return mpack_encode_double(encoder, negative ? -value : value);
+  }
+
+  if (((size_t)(end - start) >= sizeof(buffer)) && !(copy = malloc(end - start + 1))) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  memcpy(copy, start, end - start);
+  copy[end - start] = '\0';
+  value = strtod(copy, NULL);
+  errno = saved_errno;
+
+  if (copy != buffer) {
+    free(copy);
+  }
+
+  return mpack_encode_double(encoder, value);
+}
+
+static int mpack_json_parse_token(mpack_encoder_t *encoder, const char *p, const char *end)
+{
+  switch (end - p) {
+  case 4:
+    if (memcmp(p, "null", 4) == 0) {
+      return mpack_encode_nil(encoder);
+    }
+    if (memcmp(p, "true", 4) == 0) {
+      return mpack_encode_boolean(encoder, true);
+    }
+    break;
+
+  case 5:
+    if (memcmp(p, "false", 5) == 0) {
+      return mpack_encode_boolean(encoder, false);
+    }
+    break;
+  }
+
+  return mpack_json_parse_number(encoder, p, end);
+}
+
+/* Second pass, encodes the value indexed by the first pass, the stack only
+   tracks whether each open container is an object. */
+static const char *mpack_json_emit(mpack_json_parser_t *parser, mpack_encoder_t *encoder, const char *p, const char *end)
+{
+  size_t index = 0;
+  size_t depth = 0;
+  bool key = false;
+  mpack_array_t array;
+  mpack_map_t map;
+  const char *q;
+
+  for (;;) {
+    p = mpack_json_skip_space(p, end);
+
+    switch (*p) {
+    case '{':
+      map.size = parser->counts[index++];
+      mpack_encode_map(encoder, map);
+      parser->stack[depth++] = key = true;
+      ++p;
+      continue;
+
+    case '[':
+      array.size = parser->counts[index++];
+      mpack_encode_array(encoder, array);
+      parser->stack[depth++] = key = false;
+      ++p;
+      continue;
+
+    case ',':
+      key = parser->stack[depth - 1];
+      ++p;
+      continue;
+
+    case ':':
+      key = false;
+      ++p;
+      continue;
+
+    case '}':
+    case ']':
+      --depth;
+      ++p;
+      break;
+
+    case '"':
+      if (!(p = mpack_json_parse_string(encoder, p, end, key))) {
+        return NULL;
+      }
+      break;
+
+    default:
+      for (q = p; (q != end) && !mpack_json_is_delimiter(*q); ++q);
+
+      if (mpack_json_parse_token(encoder, p, q) < 0) {
+        errno = EINVAL;
+        return NULL;
+      }
+
+      p = q;
+    }
+
+    if (depth == 0) {
+      return p;
+    }
+  }
+}
+
+/* When the value fails to parse or does not fit in the encoder, the strings
+   it added to the encoder's dictionary are forgotten since their definitions
+   are never sent. An encoder that moved to another buffer is not rewound,
+   the owner of the buffers drops the partial value, as mpack_chain_cancel
+   does. */
+int mpack_from_json(mpack_encoder_t *encoder, const char *data, size_t size)
+{
+  char *pos = encoder->pos;
+  size_t base = encoder->base;
+  size_t dict_size = encoder->dict ? mpack_dict_size(encoder->dict) : 0;
+  const char *end;
+  int result = -1;
+  mpack_json_parser_t parser;
+
+  parser.counts = parser.counts_buffer;
+  parser.stack = parser.stack_buffer;
+  parser.count = 0;
+  parser.depth = 0;
+  parser.counts_capacity = sizeof(parser.counts_buffer) / sizeof(parser.counts_buffer[0]);
+  parser.stack_capacity = sizeof(parser.stack_buffer) / sizeof(parser.stack_buffer[0]);
+
+  if ((end = mpack_json_index(&parser, data, data + size)) && mpack_json_emit(&parser, encoder, data, end)) {
+    result = end - data;
+  }
+  else if (encoder->base == base) {
+    encoder->pos = pos;
+  }
+
+  if (encoder->dict && ((result < 0) || (encoder->pos > encoder->end))) {
+    mpack_dict_truncate(encoder->dict, dict_size);
+  }
+
+  if (parser.counts != parser.counts_buffer) {
+    free(parser.counts);
+  }
+
+  if (parser.stack != parser.stack_buffer) {
+    free(parser.stack);
+  }
+
+  return result;
+}
+
+#if defined(MPACK_URING)
+enum {
+  MPACK_URING_FREE,
+  MPACK_URING_BUSY,
+  MPACK_URING_READY,
+};
+
+static int mpack_uring_init(mpack_uring_t *ring, unsigned int entries)
+{
+  struct io_uring_params params;
+  char *sq;
+  char *cq;
+  int error;
+
+  memset(&params, 0, sizeof(params));
+  memset(ring, 0, sizeof(*ring));
+
+  if ((ring->fd = syscall(__NR_io_uring_setup, entries, &params)) < 0) {
+    return -1;
+  }
+
+  ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  /* Recent kernels map both rings with a single mapping. */
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_map_size > ring->sq_map_size) {
+      ring->sq_map_size = ring->cq_map_size;
+    }
+    ring->cq_map_size = 0;
+  }
+
+  sq = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+
+  if (sq == MAP_FAILED) {
+    goto fail;
+  }
+
+  ring->sq_map = sq;
+  cq = sq;
+
+  if (ring->cq_map_size != 0) {
+    cq = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+
+    if (cq == MAP_FAILED) {
+      goto fail;
+    }
+
+    ring->cq_map = cq;
+  }
+
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    goto fail;
+  }
+
+  ring->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned int *)(sq + params.sq_off.array);
+  ring->cq_head = (unsigned int *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+  ring->cqes = cq + params.cq_off.cqes;
+  return 0;
+
+fail:
+  error = errno;
+
+  if (ring->sq_map) {
+    munmap(ring->sq_map, ring->sq_map_size);
+  }
+
+  if (ring->cq_map) {
+    munmap(ring->cq_map, ring->cq_map_size);
+  }
+
+  close(ring->fd);
+  errno = error;
+  return -1;
+}
+
+static void mpack_uring_term(mpack_uring_t *ring)
+{
+  munmap(ring->sqes, ring->sqes_size);
+  munmap(ring->sq_map, ring->sq_map_size);
+
+  if (ring->cq_map) {
+    munmap(ring->cq_map, ring->cq_map_size);
+  }
+
+  close(ring->fd);
+}
+
+/* The rings are sized for every slot to be in flight at once, so there is
+   always a free submission entry. */
+static void mpack_uring_submit(mpack_uring_t *ring, int op, bool fixed, int fd, void *data, size_t size,
+                               uint64_t offset, unsigned int slot)
+{
+  const unsigned int tail = *ring->sq_tail;
+  const unsigned int index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = (struct io_uring_sqe *)ring->sqes + index;
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = op;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)data;
+  sqe->len = size;
+  sqe->off = offset;
+  sqe->user_data = slot;
+
+  if (fixed) {
+    sqe->opcode = (op == IORING_OP_READ) ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+    sqe->buf_index = slot;
+  }
+
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ++ring->pending;
+}
+
+/* Passes the pending submissions to the kernel and waits for at least one
+   completion if wait is set. */
+static int mpack_uring_enter(mpack_uring_t *ring, bool wait)
+{
+  long n;
+
+  do {
+    n = syscall(__NR_io_uring_enter, ring->fd, ring->pending, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  } while ((n < 0) && (errno == EINTR));
+
+  if (n < 0) {
+    return -1;
+  }
+
+  ring->pending -= n;
+  return 0;
+}
+
+static bool mpack_uring_complete(mpack_uring_t *ring, unsigned int *slot, int *result)
+{
+  const unsigned int head = *ring->cq_head;
+  const struct io_uring_cqe *cqe;
+
+  if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+
+  cqe = (const struct io_uring_cqe *)ring->cqes + (head & *ring->cq_mask);
+  *slot = cqe->user_data;
+  *result = cqe->res;
+  __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/* Allocates the slots and their buffers and registers the buffers with the
+   ring, which falls back to plain reads and writes if the memory can't be
+   pinned. */
+static int mpack_uring_setup(mpack_uring_t *ring, int fd, size_t block_size, unsigned int depth, char **buffers,
+                             mpack_uring_slot_t **slots, bool *seekable, bool *fixed)
+{
+  struct iovec *iov;
+  unsigned int i;
+  void *memory;
+  int error;
+
+  if ((block_size == 0) || (block_size > INT_MAX) || (depth == 0) || (depth > 4096)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if ((error = posix_memalign(&memory, 4096, block_size * depth)) != 0) {
+    errno = error;
+    return -1;
+  }
+
+  if (!(*slots = calloc(depth, sizeof(**slots)))) {
+    free(memory);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  if (mpack_uring_init(ring, depth) < 0) {
+    error = errno;
+    free(*slots);
+    free(memory);
+    errno = error;
+    return -1;
+  }
+
+  *buffers = memory;
+  *seekable = lseek(fd, 0, SEEK_CUR) >= 0;
+  *fixed = false;
+
+  if ((iov = malloc(depth * sizeof(*iov)))) {
+    for (i = 0; i != depth; ++i) {
+      iov[i].iov_base = *buffers + i * block_size;
+      iov[i].iov_len = block_size;
+    }
+
+    *fixed = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, depth) == 0;
+    free(iov);
+  }
+
+  return 0;
+}
+
+static void mpack_uring_reader_submit(mpack_uring_reader_t *reader, unsigned int i)
+{
+  mpack_uring_slot_t *slot = &reader->slots[i];
+
+  slot->state = MPACK_URING_BUSY;
+  mpack_uring_submit(&reader->ring, IORING_OP_READ, reader->fixed, reader->fd,
+                     reader->buffers + i * reader->block_size + slot->size, reader->block_size - slot->size,
+                     reader->seekable ? (slot->offset + slot->size) : (uint64_t)-1, i);
+}
+
+/* Short reads of files are continued until the block is full or the end of
+   the file is reached, data from streams is handed out as it arrives. */
+static void mpack_uring_reader_complete(mpack_uring_reader_t *reader, unsigned int i, int result)
+{
+  mpack_uring_slot_t *slot = &reader->slots[i];
+
+  if ((result == -EINTR) || (result == -EAGAIN)) {
+    mpack_uring_reader_submit(reader, i);
+    return;
+  }
+
+  if (result > 0) {
+    slot->size += result;
+
+    if (reader->seekable && (slot->size != reader->block_size)) {
+      mpack_uring_reader_submit(reader, i);
+      return;
+    }
+  }
+
+  if (result <= 0) {
+    reader->eof = true;
+  }
+
+  slot->result = result;
+  slot->state = MPACK_URING_READY;
+}
+
+int mpack_uring_reader_init(mpack_uring_reader_t *reader, int fd, size_t block_size, unsigned int depth)
+{
+  if (mpack_uring_setup(&reader->ring, fd, block_size, depth, &reader->buffers, &reader->slots,
+                        &reader->seekable, &reader->fixed) < 0) {
+    return -1;
+  }
+
+  reader->fd = fd;
+  reader->eof = false;
+  reader->block_size = block_size;
+  reader->depth = depth;
+  reader->next = 0;
+  reader->delivered = false;
+  reader->offset = reader->seekable ? (uint64_t)lseek(fd, 0, SEEK_CUR) : 0;
+  reader->data = NULL;
+  reader->size = 0;
+  return 0;
+}
+
+void mpack_uring_reader_term(mpack_uring_reader_t *reader)
+{
+  unsigned int i;
+  unsigned int busy = 0;
+  int result;
+
+  for (i = 0; i != reader->depth; ++i) {
+    busy += reader->slots[i].state == MPACK_URING_BUSY;
+  }
+
+  /* The kernel may still be writing to the buffers. */
+  while ((busy != 0) && (mpack_uring_enter(&reader->ring, true) == 0)) {
+    while (mpack_uring_complete(&reader->ring, &i, &result)) {
+      --busy;
+    }
+  }
+
+  mpack_uring_term(&reader->ring);
+  free(reader->slots);
+  free(reader->buffers);
+}
+
+/* Submits reads to the free slots in delivery order, streams get their next
+   read only when none is in flight. */
+static void mpack_uring_reader_fill(mpack_uring_reader_t *reader)
+{
+  mpack_uring_slot_t *slot;
+  unsigned int busy = 0;
+  unsigned int i;
+  unsigned int k;
+
+  for (k = 0; k != reader->depth; ++k) {
+    busy += reader->slots[k].state == MPACK_URING_BUSY;
+  }
+
+  for (k = 0; (k != reader->depth) && !reader->eof; ++k) {
+    i = (reader->next + k) % reader->depth;
+    slot = &reader->slots[i];
+
+    if ((slot->state != MPACK_URING_FREE) || (!reader->seekable && (busy != 0))) {
+      continue;
+    }
+
+    slot->offset = reader->offset;
+    slot->size = 0;
+    reader->offset += reader->block_size;
+    mpack_uring_reader_submit(reader, i);
+    ++busy;
+  }
+}
+
+/* The block handed out by the previous call is reused for the next read past
+   the others in flight, so blocks keep coming in file order. */
+int mpack_uring_reader_next(mpack_uring_reader_t *reader, const void **data)
+{
+  mpack_uring_slot_t *slot;
+  unsigned int i;
+  int result;
+
+  if (reader->delivered) {
+    reader->slots[reader->next].state = MPACK_URING_FREE;
+    reader->next = (reader->next + 1) % reader->depth;
+    reader->delivered = false;
+  }
+
+  mpack_uring_reader_fill(reader);
+  slot = &reader->slots[reader->next];
+
+  while (slot->state == MPACK_URING_BUSY) {
+    if (mpack_uring_enter(&reader->ring, true) < 0) {
+      return -1;
+    }
+
+    while (mpack_uring_complete(&reader->ring, &i, &result)) {
+      mpack_uring_reader_complete(reader, i, result);
+    }
+  }
+
+  /* Streams read ahead while the caller consumes this block. */
+  mpack_uring_reader_fill(reader);
+
+  if (reader->ring.pending && (mpack_uring_enter(&reader->ring, false) < 0)) {
+    return -1;
+  }
+
+  if (slot->state == MPACK_URING_FREE) {
+    return 0;
+  }
+
+  if (slot->result < 0) {
+    errno = -slot->result;
+    return -1;
+  }
+
+  if (slot->size == 0) {
+    return 0;
+  }
+
+  reader->delivered = true;
+  *data = reader->buffers + reader->next * reader->block_size;
+  return slot->size;
+}
+
+/* Adapts the reader to the read callbacks of the library, like fread it only
+   returns less than size at the end of the input. */
+int mpack_uring_read(void *context, void *data, size_t size)
+{
+  mpack_uring_reader_t *reader = context;
+  char *out = data;
+  const void *block;
+  size_t n = 0;
+  size_t chunk;
+  int result;
+
+  while (n != size) {
+    if (reader->size == 0) {
+      if ((result = mpack_uring_reader_next(reader, &block)) < 0) {
+        return -1;
+      }
+
+      if (result == 0) {
+        break;
+      }
+
+      reader->data = block;
+      reader->size = result;
+    }
+
+    chunk = ((size - n) < reader->size) ? (size - n) : reader->size;
+    memcpy(out + n, reader->data, chunk);
+    reader->data += chunk;
+    reader->size -= chunk;
+    n += chunk;
+  }
+
+  return n;
+}
+
+static void mpack_uring_writer_submit(mpack_uring_writer_t *writer, unsigned int i)
+{
+  mpack_uring_slot_t *slot = &writer->slots[i];
+
+  slot->state = MPACK_URING_BUSY;
+  mpack_uring_submit(&writer->ring, IORING_OP_WRITE, writer->fixed, writer->fd,
+                     writer->buffers + i * writer->block_size + slot->done, slot->size - slot->done,
+                     writer->seekable ? (slot->offset + slot->done) : (uint64_t)-1, i);
+}
+
+static void mpack_uring_writer_complete(mpack_uring_writer_t *writer, unsigned int i, int result)
+{
+  mpack_uring_slot_t *slot = &writer->slots[i];
+
+  if ((result == -EINTR) || (result == -EAGAIN)) {
+    mpack_uring_writer_submit(writer, i);
+    return;
+  }
+
+  if (result <= 0) {
+    if (writer->error == 0) {
+      writer->error = (result < 0) ? -result : EIO;
+    }
+  }
+  else if ((slot->done += result) != slot->size) {
+    mpack_uring_writer_submit(writer, i);
+    return;
+  }
+
+  slot->size = 0;
+  slot->done = 0;
+  slot->state = MPACK_URING_FREE;
+}
+
+/* Waits until the slot is free, or until nothing is in flight at all. */
+static int mpack_uring_writer_wait(mpack_uring_writer_t *writer, const mpack_uring_slot_t *slot)
+{
+  unsigned int busy;
+  unsigned int i;
+  int result;
+
+  for (;;) {
+    for (busy = 0, i = 0; i != writer->depth; ++i) {
+      busy += writer->slots[i].state == MPACK_URING_BUSY;
+    }
+
+    if ((busy == 0) || (slot && (slot->state != MPACK_URING_BUSY))) {
+      return 0;
+    }
+
+    if (mpack_uring_enter(&writer->ring, true) < 0) {
+      return -1;
+    }
+
+    while (mpack_uring_complete(&writer->ring, &i, &result)) {
+      mpack_uring_writer_complete(writer, i, result);
+    }
+  }
+}
+
+static int mpack_uring_writer_commit(mpack_uring_writer_t *writer)
+{
+  mpack_uring_slot_t *slot = &writer->slots[writer->next];
+
+  if (!writer->seekable && (mpack_uring_writer_wait(writer, NULL) < 0)) {
+    return -1;
+  }
+
+  slot->offset = writer->offset;
+  writer->offset += slot->size;
+  mpack_uring_writer_submit(writer, writer->next);
+  writer->next = (writer->next + 1) % writer->depth;
+
+  if (mpack_uring_enter(&writer->ring, false) < 0) {
+    return -1;
+  }
+
+  return mpack_uring_writer_wait(writer, &writer->slots[writer->next]);
+}
+
+int mpack_uring_writer_init(mpack_uring_writer_t *writer, int fd, size_t block_size, unsigned int depth)
+{
+  if (mpack_uring_setup(&writer->ring, fd, block_size, depth, &writer->buffers, &writer->slots,
+                        &writer->seekable, &writer->fixed) < 0) {
+    return -1;
+  }
+
+  writer->fd = fd;
+  writer->block_size = block_size;
+  writer->depth = depth;
+  writer->next = 0;
+  writer->offset = writer->seekable ? (uint64_t)lseek(fd, 0, SEEK_CUR) : 0;
+  writer->error = 0;
+  return 0;
+}
+
+/* Bytes still buffered are dropped, mpack_uring_writer_flush must be called
+   first to write them. */
+void mpack_uring_writer_term(mpack_uring_writer_t *writer)
+{
+  mpack_uring_writer_wait(writer, NULL);
+  mpack_uring_term(&writer->ring);
+  free(writer->slots);
+  free(writer->buffers);
+}
+
+/* Writes the block being filled and waits for all writes to complete, the
+   file offset of seekable descriptors is then moved past the data written. */
+int mpack_uring_writer_flush(mpack_uring_writer_t *writer)
+{
+  if ((writer->slots[writer->next].size != 0) && (mpack_uring_writer_commit(writer) < 0)) {
+    return -1;
+  }
+
+  if (mpack_uring_writer_wait(writer, NULL) < 0) {
+    return -1;
+  }
+
+  if (writer->error != 0) {
+    errno = writer->error;
+    return -1;
+  }
+
+  if (writer->seekable && (lseek(writer->fd, writer->offset, SEEK_SET) < 0)) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Adapts the writer to the write callbacks of the library, errors of writes
+   completed in the background are reported by the next call. */
+int mpack_uring_write(void *context, const void *data, size_t size)
+{
+  mpack_uring_writer_t *writer = context;
+  const char *in = data;
+  mpack_uring_slot_t *slot;
+  size_t n = 0;
+  size_t chunk;
+
+  if (size > INT_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  while (n != size) {
+    if (writer->error != 0) {
+      errno = writer->error;
+      return -1;
+    }
+
+    slot = &writer->slots[writer->next];
+    chunk = writer->block_size - slot->size;
+    chunk = ((size - n) < chunk) ? (size - n) : chunk;
+    memcpy(writer->buffers + writer->next * writer->block_size + slot->size, in + n, chunk);
+    slot->size += chunk;
+    n += chunk;
+
+    if ((slot->size == writer->block_size) && (mpack_uring_writer_commit(writer) < 0)) {
+      return -1;
+    }
+  }
+
+  return size;
+}
+#else
+int mpack_uring_reader_init(mpack_uring_reader_t *reader, int fd, size_t block_size, unsigned int depth)
+{
+  (void)reader;
+  (void)fd;
+  (void)block_size;
+  (void)depth;
+  errno = ENOSYS;
+  return -1;
+}
+
+void mpack_uring_reader_term(mpack_uring_reader_t *reader)
+{ (void)reader; }
+
+int mpack_uring_reader_next(mpack_uring_reader_t *reader, const void **data)
+{
+  (void)reader;
+  (void)data;
+  errno = ENOSYS;
+  return -1;
+}
+
+int mpack_uring_read(void *context, void *data, size_t size)
+{
+  (void)context;
+  (void)data;
+  (void)size;
+  errno = ENOSYS;
+  return -1;
+}
+
+int mpack_uring_writer_init(mpack_uring_writer_t *writer, int fd, size_t block_size, unsigned int depth)
+{
+  (void)writer;
+  (void)fd;
+  (void)block_size;
+  (void)depth;
+  errno = ENOSYS;
+  return -1;
+}
+
+void mpack_uring_writer_term(mpack_uring_writer_t *writer)
+{ (void)writer; }
+
+int mpack_uring_writer_flush(mpack_uring_writer_t *writer)
+{
+  (void)writer;
+  errno = ENOSYS;
+  return -1;
+}
+
+int mpack_uring_write(void *context, const void *data, size_t size)
+{
+  (void)context;
+  (void)data;
+  (void)size;
+  errno = ENOSYS;
+  return -1;
+}
+#endif /* MPACK_URING */
+
+#if defined(MPACK_SHM)
+enum {
+  MPACK_SHM_MAGIC = 0x6d706b72,
+  MPACK_SHM_HEADER_SIZE = 256,
+  MPACK_SHM_MIN_CAPACITY = 64,
+  MPACK_SHM_MAX_CAPACITY = 1 << 30,
+  MPACK_SHM_SLOT_EMPTY = 0,
+  MPACK_SHM_SLOT_MESSAGE = 1,
+  MPACK_SHM_SLOT_PADDING = 2,
+};
+
+/* Producers and the consumer update their fields on separate cache lines.
+   Positions only grow, their offset in the ring is taken modulo the
+   capacity. The released and published counters are the futex words slept
+   on by producers waiting for space and by the consumer waiting for
+   messages, the producers and consumer fields count the sleepers so wakeups
+   are only issued when someone waits. */
+struct mpack_shm_header {
+  uint32_t magic;
+  uint32_t capacity;
+  char unused0[56];
+  uint64_t reserve;
+  uint32_t released;
+  uint32_t producers;
+  char unused1[48];
+  uint64_t head;
+  uint32_t published;
+  uint32_t consumer;
+  char unused2[48];
+};
+
+/* Slot sizes are multiples of the size of their header, a slot that would
+   cross the end of the ring is preceded by a padding slot up to the end. */
+typedef struct mpack_shm_slot {
+  uint32_t state;
+  uint32_t size;
+  uint32_t length;
+  uint32_t unused;
+} mpack_shm_slot_t;
+
+static size_t mpack_shm_slot_size(size_t size)
+{ return (sizeof(mpack_shm_slot_t) + size + sizeof(mpack_shm_slot_t) - 1) & ~(sizeof(mpack_shm_slot_t) - 1); }
+
+static mpack_shm_slot_t *mpack_shm_slot(const mpack_shm_ring_t *ring, uint64_t position)
+{ return (mpack_shm_slot_t *)(ring->data + (position & (ring->capacity - 1))); }
+
+static const struct timespec *mpack_shm_deadline(struct timespec *deadline, int timeout)
+{
+  if (timeout < 0) {
+    return NULL;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, deadline);
+  deadline->tv_sec += timeout / 1000;
+  deadline->tv_nsec += (timeout % 1000) * 1000000L;
+
+  if (deadline->tv_nsec >= 1000000000L) {
+    deadline->tv_nsec -= 1000000000L;
+    ++deadline->tv_sec;
+  }
+
+  return deadline;
+}
+
+/* Sleeps until the word no longer holds value, a deadline that passed fails
+   with EAGAIN like a call that does not wait. */
+static int mpack_shm_sleep(uint32_t *word, uint32_t value, const struct timespec *deadline)
+{
+  if ((syscall(SYS_futex, word, FUTEX_WAIT_BITSET, value, deadline, NULL, FUTEX_BITSET_MATCH_ANY) < 0) &&
+      (errno != EAGAIN) && (errno != EINTR)) {
+    if (errno == ETIMEDOUT) {
+      errno = EAGAIN;
+    }
+    return -1;
+  }
+
+  return 0;
+}
+
+static void mpack_shm_wake(uint32_t *word, int count)
+{ syscall(SYS_futex, word, FUTEX_WAKE, count, NULL, NULL, 0); }
+
+static int mpack_shm_ring_map(mpack_shm_ring_t *ring, int fd, size_t size)
+{
+  void *map;
+
+  if ((map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    return -1;
+  }
+
+  ring->header = map;
+  ring->data = (char *)map + MPACK_SHM_HEADER_SIZE;
+  ring->capacity = size - MPACK_SHM_HEADER_SIZE;
+  ring->map_size = size;
+  return 0;
+}
+
+/* Creates the named segment, which must not exist yet. The capacity is a
+   power of two, the segment is removed with shm_unlink once the processes
+   opened it. */
+int mpack_shm_ring_create(mpack_shm_ring_t *ring, const char *name, size_t capacity)
+{
+  int error;
+  int fd;
+
+  ring->header = NULL;
+
+  if ((capacity < MPACK_SHM_MIN_CAPACITY) || (capacity > MPACK_SHM_MAX_CAPACITY) || (capacity & (capacity - 1))) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0) {
+    return -1;
+  }
+
+  if ((ftruncate(fd, MPACK_SHM_HEADER_SIZE + capacity) < 0) ||
+      (mpack_shm_ring_map(ring, fd, MPACK_SHM_HEADER_SIZE + capacity) < 0)) {
+    error = errno;
+    close(fd);
+    shm_unlink(name);
+    errno = error;
+    return -1;
+  }
+
+  close(fd);
+  ring->header->capacity = capacity;
+  __atomic_store_n(&ring->header->magic, MPACK_SHM_MAGIC, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/* Fails with EAGAIN while the creator has not initialized the segment. */
+int mpack_shm_ring_open(mpack_shm_ring_t *ring, const char *name)
+{
+  struct stat st;
+  uint32_t magic;
+  int error;
+  int fd;
+
+  ring->header = NULL;
+
+  if ((fd = shm_open(name, O_RDWR, 0)) < 0) {
+    return -1;
+  }
+
+  if (fstat(fd, &st) < 0) {
+    error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+
+  if ((size_t)st.st_size < (MPACK_SHM_HEADER_SIZE + MPACK_SHM_MIN_CAPACITY)) {
+    close(fd);
+    errno = (st.st_size == 0) ? EAGAIN : EINVAL;
+    return -1;
+  }
+
+  if (mpack_shm_ring_map(ring, fd, st.st_size) < 0) {
+    error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+
+  close(fd);
+
+  if ((magic = __atomic_load_n(&ring->header->magic, __ATOMIC_ACQUIRE)) != MPACK_SHM_MAGIC ||
+      (ring->header->capacity != ring->capacity)) {
+    mpack_shm_ring_term(ring);
+    errno = (magic == 0) ? EAGAIN : EINVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
+void mpack_shm_ring_term(mpack_shm_ring_t *ring)
+{
+  if (ring->header) {
+    munmap(ring->header, ring->map_size);
+    ring->header = NULL;
+  }
+}
+
+/* Makes a slot visible to the consumer and wakes it if it sleeps. */
+static void mpack_shm_ring_publish(mpack_shm_ring_t *ring, mpack_shm_slot_t *slot, uint32_t state)
+{
+  struct mpack_shm_header *header = ring->header;
+
+  __atomic_store_n(&slot->state, state, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&header->published, 1, __ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&header->consumer, __ATOMIC_SEQ_CST) != 0) {
+    mpack_shm_wake(&header->published, 1);
+  }
+}
+
+/* Points the encoder at a slot of at least size bytes. A timeout of zero
+   fails with EAGAIN when the ring is full, a negative timeout waits for as
+   long as it takes, like poll. A slot that would cross the end of the ring
+   first reserves and publishes the padding up to the end on its own, then
+   waits for the consumer to skip it before starting over at offset zero. */
+int mpack_shm_ring_reserve(mpack_shm_ring_t *ring, size_t size, mpack_encoder_t *encoder, int timeout)
+{
+  struct mpack_shm_header *header = ring->header;
+  const struct timespec *deadline = NULL;
+  struct timespec buffer;
+  bool waiting = false;
+  mpack_shm_slot_t *slot;
+  uint64_t position;
+  uint32_t released;
+  size_t offset;
+  size_t length;
+  size_t padding;
+  size_t need;
+  int result;
+
+  if ((size > ring->capacity) || ((length = mpack_shm_slot_size(size)) > ring->capacity)) {
+    errno = ERANGE;
+    return -1;
+  }
+
+  position = __atomic_load_n(&header->reserve, __ATOMIC_RELAXED);
+
+  for (;;) {
+    offset = position & (ring->capacity - 1);
+    padding = ((offset + length) > ring->capacity) ? (ring->capacity - offset) : 0;
+    need = padding ? padding : length;
+
+    if ((position + need - __atomic_load_n(&header->head, __ATOMIC_ACQUIRE)) <= ring->capacity) {
+      if (!__atomic_compare_exchange_n(&header->reserve, &position, position + need, false,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        continue;
+      }
+
+      if (padding == 0) {
+        break;
+      }
+
+      slot = mpack_shm_slot(ring, position);
+      slot->size = padding;
+      mpack_shm_ring_publish(ring, slot, MPACK_SHM_SLOT_PADDING);
+      position += padding;
+      continue;
+    }
+
+    if (timeout == 0) {
+      errno = EAGAIN;
+      return -1;
+    }
+
+    if (!waiting) {
+      deadline = mpack_shm_deadline(&buffer, timeout);
+      waiting = true;
+    }
+
+    released = __atomic_load_n(&header->released, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&header->producers, 1, __ATOMIC_SEQ_CST);
+    result = 0;
+
+    if ((position + need - __atomic_load_n(&header->head, __ATOMIC_SEQ_CST)) > ring->capacity) {
+      result = mpack_shm_sleep(&header->released, released, deadline);
+    }
+
+    __atomic_sub_fetch(&header->producers, 1, __ATOMIC_SEQ_CST);
+
+    if (result < 0) {
+      return -1;
+    }
+
+    position = __atomic_load_n(&header->reserve, __ATOMIC_RELAXED);
+  }
+
+  slot = mpack_shm_slot(ring, position);
+  slot->size = length;
+  mpack_encoder_init(encoder, slot + 1, length - sizeof(mpack_shm_slot_t));
+  return 0;
+}
+
+/* Publishes the slot the encoder was pointed at by mpack_shm_ring_reserve.
+   A message that did not fit in the slot is dropped and the call fails with
+   ERANGE, the slot is still consumed. */
+int mpack_shm_ring_commit(mpack_shm_ring_t *ring, mpack_encoder_t *encoder)
+{
+  mpack_shm_slot_t *slot = (mpack_shm_slot_t *)encoder->begin - 1;
+  uint32_t state = MPACK_SHM_SLOT_MESSAGE;
+
+  if (encoder->pos > encoder->end) {
+    state = MPACK_SHM_SLOT_PADDING;
+  }
+
+  slot->length = encoder->pos - encoder->begin;
+  mpack_shm_ring_publish(ring, slot, state);
+
+  if (state != MPACK_SHM_SLOT_MESSAGE) {
+    errno = ERANGE;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Slots are zeroed before they are handed back to producers, so the state of
+   a slot reserved later is empty wherever its header lands. */
+static void mpack_shm_ring_advance(mpack_shm_ring_t *ring, mpack_shm_slot_t *slot)
+{
+  struct mpack_shm_header *header = ring->header;
+  uint64_t head = __atomic_load_n(&header->head, __ATOMIC_RELAXED);
+  size_t size = slot->size;
+
+  memset(slot, 0, size);
+  __atomic_store_n(&header->head, head + size, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&header->released, 1, __ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&header->producers, __ATOMIC_SEQ_CST) != 0) {
+    mpack_shm_wake(&header->released, INT_MAX);
+  }
+}
+
+/* Points the decoder at the oldest message of the ring, which stays in place
+   until mpack_shm_ring_release. Only one process consumes from a ring. */
+int mpack_shm_ring_next(mpack_shm_ring_t *ring, mpack_decoder_t *decoder, int timeout)
+{
+  struct mpack_shm_header *header = ring->header;
+  const struct timespec *deadline = NULL;
+  struct timespec buffer;
+  bool waiting = false;
+  mpack_shm_slot_t *slot;
+  uint32_t published;
+  uint32_t state;
+  int result;
+
+  for (;;) {
+    slot = mpack_shm_slot(ring, __atomic_load_n(&header->head, __ATOMIC_RELAXED));
+    state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+
+    if (state == MPACK_SHM_SLOT_MESSAGE) {
+      mpack_decoder_init(decoder, slot + 1, slot->length);
+      return slot->length;
+    }
+
+    if (state == MPACK_SHM_SLOT_PADDING) {
+      mpack_shm_ring_advance(ring, slot);
+      continue;
+    }
+
+    if (timeout == 0) {
+      errno = EAGAIN;
+      return -1;
+    }
+
+    if (!waiting) {
+      deadline = mpack_shm_deadline(&buffer, timeout);
+      waiting = true;
+    }
+
+    published = __atomic_load_n(&header->published, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&header->consumer, 1, __ATOMIC_SEQ_CST);
+    result = 0;
+
+    if (__atomic_load_n(&slot->state, __ATOMIC_SEQ_CST) == MPACK_SHM_SLOT_EMPTY) {
+      result = mpack_shm_sleep(&header->published, published, deadline);
+    }
+
+    __atomic_store_n(&header->consumer, 0, __ATOMIC_SEQ_CST);
+
+    if (result < 0) {
+      return -1;
+    }
+  }
+}
+
+/* Hands the slot returned by mpack_shm_ring_next back to producers. */
+int mpack_shm_ring_release(mpack_shm_ring_t *ring)
+{
+  mpack_shm_slot_t *slot = mpack_shm_slot(ring, __atomic_load_n(&ring->header->head, __ATOMIC_RELAXED));
+
+  if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != MPACK_SHM_SLOT_MESSAGE) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  mpack_shm_ring_advance(ring, slot);
+  return 0;
+}
+#else
+int mpack_shm_ring_create(mpack_shm_ring_t *ring, const char *name, size_t capacity)
+{
+  (void)name;
+  (void)capacity;
+  ring->header = NULL;
+  errno = ENOSYS;
+  return -1;
+}
+
+int mpack_shm_ring_open(mpack_shm_ring_t *ring, const char *name)
+{
+  (void)name;
+  ring->header = NULL;
+  errno = ENOSYS;
+  return -1;
+}
+
+void mpack_shm_ring_term(mpack_shm_ring_t *ring)
+{ (void)ring; }
+
+int mpack_shm_ring_reserve(mpack_shm_ring_t *ring, size_t size, mpack_encoder_t *encoder, int timeout)
+{
+  (void)ring;
+  (void)size;
+  (void)encoder;
+  (void)timeout;
+  errno = ENOSYS;
+  return -1;
+}
+
+int mpack_shm_ring_commit(mpack_shm_ring_t *ring, mpack_encoder_t *encoder)
+{
+  (void)ring;
+  (void)encoder;
+  errno = ENOSYS;
+  return -1;
+}
+
+int mpack_shm_ring_next(mpack_shm_ring_t *ring, mpack_decoder_t *decoder, int timeout)
+{
+  (void)ring;
+  (void)decoder;
+  (void)timeout;
+  errno = ENOSYS;
+  return -1;
+}
+
+int mpack_shm_ring_release(mpack_shm_ring_t *ring)
+{
+  (void)ring;
+  errno = ENOSYS;
+  return -1;
 }
+#endif /* MPACK_SHM */
@@ -27,10 +27,12 @@
 
 namespace mpack {
 
-  decoder::decoder() noexcept
+  decoder::decoder() noexcept:
+    reserve_limit(MPACK_RESERVE_LIMIT)
   { mpack_decoder_init(this, nullptr, 0); }
 
-  decoder::decoder(const void *data, size_t size) noexcept
+  decoder::decoder(const void *data, size_t size) noexcept:
+    reserve_limit(MPACK_RESERVE_LIMIT)
   { mpack_decoder_init(this, data, size); }
 
   template < typename T >
@@ -39,7 +41,7 @@ namespace mpack {
     signed long x;
     MPACK_DECODE_BEGIN(this);
 
-    this->decode(x);
+    MPACK_DECODE_ASSERT(this->decode(x));
 
     if ((x < static_cast<signed long>(std::numeric_limits<T>::min())) ||
         (x > static_cast<signed long>(std::numeric_limits<T>::max()))) {
@@ -56,7 +58,7 @@ namespace mpack {
     unsigned long x;
     MPACK_DECODE_BEGIN(this);
 
-    this->decode(x);
+    MPACK_DECODE_ASSERT(this->decode(x));
 
     if (x > static_cast<unsigned long>(std::numeric_limits<T>::max())) {
       MPACK_DECODE_FAIL(ERANGE);
@@ -87,6 +89,18 @@ namespace mpack {
   int decoder::decode(signed long &value) noexcept
   { return mpack_decode_signed(this, &value); }
 
+  int decoder::decode(signed long long &value) noexcept
+  {
+    signed long x;
+    int n;
+
+    if ((n = mpack_decode_signed(this, &x)) >= 0) {
+      value = x;
+    }
+
+    return n;
+  }
+
   int decoder::decode(unsigned char &value) noexcept
   { return this->decode_unsigned(value); }
 
@@ -99,6 +113,18 @@ namespace mpack {
   int decoder::decode(unsigned long &value) noexcept
   { return mpack_decode_unsigned(this, &value); }
 
+  int decoder::decode(unsigned long long &value) noexcept
+  {
+    unsigned long x;
+    int n;
+
+    if ((n = mpack_decode_unsigned(this, &x)) >= 0) {
+      value = x;
+    }
+
+    return n;
+  }
+
   int decoder::decode(float &value) noexcept
   { return mpack_decode_float(this, &value); }
 
@@ -120,6 +146,9 @@ namespace mpack {
   int decoder::decode(extended &value) noexcept
   { return mpack_decode_extended(this, &value); }
 
+  int decoder::decode(timespec &value) noexcept
+  { return mpack_decode_timestamp(this, &value); }
+
   int decoder::decode_nil() noexcept
   { return mpack_decode_nil(this); }
 
@@ -129,6 +158,70 @@ namespace mpack {
   int decoder::decode_false() noexcept
   { return mpack_decode_false(this); }
 
+  int decoder::skip() noexcept
+  { return mpack_decode_skip(this); }
+
+  int decoder::decode(const symbol *&value) noexcept
+  { return mpack_decode_symbol(this, &value); }
+
+  intern_table::intern_table(size_t capacity)
+  {
+    if (mpack_intern_init(this, capacity) < 0) {
+      throw std::system_error(errno, std::generic_category());
+    }
+  }
+
+  intern_table::~intern_table()
+  { mpack_intern_term(this); }
+
+  const symbol *intern_table::find(string value) noexcept
+  { return mpack_intern_find(this, value); }
+
+  const symbol *intern_table::insert(string value) noexcept
+  { return mpack_intern_insert(this, value); }
+
+  dictionary::dictionary(size_t capacity)
+  {
+    if (mpack_dict_init(this, capacity) < 0) {
+      throw std::system_error(errno, std::generic_category());
+    }
+  }
+
+  dictionary::~dictionary()
+  { mpack_dict_term(this); }
+
+  size_t dictionary::size() const noexcept
+  { return mpack_dict_size(this); }
+
+  void dictionary::truncate(size_t size) noexcept
+  { mpack_dict_truncate(this, size); }
+
+  arena::arena(size_t block_size) noexcept
+  { mpack_arena_init(this, block_size); }
+
+  arena::~arena()
+  { mpack_arena_term(this); }
+
+  void *arena::allocate(size_t size)
+  {
+    void *ptr;
+
+    if (!(ptr = mpack_arena_alloc(this, size))) {
+      throw std::bad_alloc();
+    }
+
+    return ptr;
+  }
+
+  void arena::reset() noexcept
+  { mpack_arena_reset(this); }
+
+  arena &arena::local() noexcept
+  {
+    static thread_local arena instance;
+    return instance;
+  }
+
   encoder::encoder() noexcept
   { mpack_encoder_init(this, nullptr, 0); }
 
@@ -153,6 +246,17 @@ namespace mpack {
   int encoder::encode(signed long value) noexcept
   { return mpack_encode_signed(this, value); }
 
+  // Values wider than long, where long is 32 bits, are out of range for the
+  // C encoder.
+  int encoder::encode(signed long long value) noexcept
+  {
+    if ((value < std::numeric_limits<signed long>::min()) || (value > std::numeric_limits<signed long>::max())) {
+      errno = ERANGE;
+      return -1;
+    }
+    return mpack_encode_signed(this, value);
+  }
+
   int encoder::encode(unsigned char value) noexcept
   { return mpack_encode_unsigned(this, value); }
 
@@ -165,6 +269,15 @@ namespace mpack {
   int encoder::encode(unsigned long value) noexcept
   { return mpack_encode_unsigned(this, value); }
 
+  int encoder::encode(unsigned long long value) noexcept
+  {
+    if (value > std::numeric_limits<unsigned long>::max()) {
+      errno = ERANGE;
+      return -1;
+    }
+    return mpack_encode_unsigned(this, value);
+  }
+
   int encoder::encode(float value) noexcept
   { return mpack_encode_float(this, value); }
 
@@ -186,6 +299,9 @@ namespace mpack {
   int encoder::encode(extended value) noexcept
   { return mpack_encode_extended(this, value); }
 
+  int encoder::encode(const timespec &value) noexcept
+  { return mpack_encode_timestamp(this, value); }
+
   int encoder::encode_nil() noexcept
   { return mpack_encode_nil(this); }
 
@@ -195,4 +311,100 @@ namespace mpack {
   int encoder::encode_false() noexcept
   { return mpack_encode_false(this); }
 
+  int encoder::encode_key(string value) noexcept
+  { return mpack_encode_key(this, value); }
+
+  int encoder::encode_array_begin(size_t &offset) noexcept
+  { return mpack_encode_array_begin(this, &offset); }
+
+  int encoder::encode_array_end(size_t offset, size_t size) noexcept
+  { return mpack_encode_array_end(this, offset, size); }
+
+  int encoder::encode_map_begin(size_t &offset) noexcept
+  { return mpack_encode_map_begin(this, &offset); }
+
+  int encoder::encode_map_end(size_t offset, size_t size) noexcept
+  { return mpack_encode_map_end(this, offset, size); }
+
+  int encoder::compact(size_t offset) noexcept
+  { return mpack_encoder_compact(this, offset); }
+
+#if defined(__cpp_impl_coroutine)
+  async_reader::async_reader() noexcept:
+    scan_offset(0),
+    status(-1),
+    error(EAGAIN),
+    closed(false)
+  { mpack_scanner_init(&this->scanner); }
+
+  void async_reader::feed(const void *data, size_t size)
+  {
+    const char *bytes = static_cast<const char *>(data);
+    size_t offset = this->pos - this->begin;
+
+    // Decoded bytes are dropped once they fill half of the buffer so moving
+    // the rest is amortized over the values read.
+    if ((offset != 0) && ((2 * offset) >= this->buffer.size())) {
+      this->buffer.erase(this->buffer.begin(), this->buffer.begin() + offset);
+      this->scan_offset = (this->scan_offset == offset) ? 0 : SIZE_MAX;
+      offset = 0;
+    }
+
+    this->buffer.insert(this->buffer.end(), bytes, bytes + size);
+    this->begin = this->buffer.data();
+    this->end = this->begin + this->buffer.size();
+    this->pos = this->begin + offset;
+    this->flags &= ~MPACK_DECODE_TRUSTED;
+
+    if (this->waiting && this->ready()) {
+      std::exchange(this->waiting, nullptr).resume();
+    }
+  }
+
+  void async_reader::close() noexcept
+  {
+    this->closed = true;
+
+    if (this->waiting && this->ready()) {
+      std::exchange(this->waiting, nullptr).resume();
+    }
+  }
+
+  async_reader::awaiter<void> async_reader::next() noexcept
+  { return awaiter<void>(*this, nullptr); }
+
+  // The scanner picks up where the last call left it as long as no value was
+  // consumed in between, so each byte is only scanned once.
+  bool async_reader::ready() noexcept
+  {
+    const size_t offset = this->pos - this->begin;
+
+    if (offset != this->scan_offset) {
+      mpack_scanner_init(&this->scanner);
+      this->scan_offset = offset;
+    }
+
+    if ((this->status = mpack_scan(&this->scanner, this->pos, this->end - this->pos)) >= 0) {
+      return true;
+    }
+
+    this->error = errno;
+    return (this->error != EAGAIN) || this->closed;
+  }
+
+  int async_reader::complete() noexcept
+  {
+    if (this->status >= 0) {
+      return this->status;
+    }
+
+    if ((this->error == EAGAIN) && (this->pos == this->end)) {
+      return 0;
+    }
+
+    errno = this->error;
+    return -1;
+  }
+#endif
+
 }
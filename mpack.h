@@ -30,6 +30,7 @@
 # include <cstdbool>
 # include <cstddef>
 # include <cstdint>
+# include <ctime>
 
 #define MPACK_DECODE_BEGIN(self)            \
   do {                                      \
@@ -41,6 +42,7 @@ extern "C" {
 # include <stdbool.h>
 # include <stddef.h>
 # include <stdint.h>
+# include <time.h>
 
 #define MPACK_DECODE_BEGIN(self)            \
   do {                                      \
@@ -87,6 +89,10 @@ enum {
   MPACK_FIXMAP_MASK = MPACK_4BIT_MASK,
 };
 
+enum {
+  MPACK_EXT_TIMESTAMP = -1,
+};
+
 typedef enum mpack_format {
   MPACK_NIL = 0xc0,
   MPACK_TRUE = 0xc2,
@@ -118,7 +124,7 @@ typedef enum mpack_format {
   MPACK_MAP32 = 0xdf,
   MPACK_FIXEXT1 = 0xd4,
   MPACK_FIXEXT2 = 0xd5,
-  MPACK_FIXEXT4 = 0x6,
+  MPACK_FIXEXT4 = 0xd6,
   MPACK_FIXEXT8 = 0xd7,
   MPACK_FIXEXT16 = 0xd8,
   MPACK_EXT8 = 0xc7,
@@ -142,12 +148,53 @@ typedef struct mpack_decoder {
   const char *begin;
   const char *end;
   const char *pos;
+  struct mpack_intern *intern;
+  struct mpack_dict *dict;
+  unsigned int flags;
 } mpack_decoder_t;
 
+/* Set on decoders whose remaining input passed mpack_validate, values are
+   then decoded and skipped from their headers without bounds checks. Byte
+   reads such as mpack_decoder_skip_bytes take their size from the caller
+   and stay checked. It must be cleared if the decoder is pointed at other
+   data. */
+enum {
+  MPACK_DECODE_TRUSTED = 0x1,
+};
+
+/* Bounds enforced by mpack_validate, count is the exact number of values
+   expected, depth the nesting of containers and length the size of strings,
+   binaries and extensions or the number of elements of containers. Zero means
+   no limit. */
+typedef struct mpack_limits {
+  size_t count;
+  size_t depth;
+  size_t length;
+} mpack_limits_t;
+
+/* MPACK_ENCODE_FIXED_WIDTH encodes every integer on 9 bytes and every
+   timestamp on 15 bytes, any later value of the same type can then be
+   written over them with mpack_patch_object or mpack_patch_timestamp. The
+   mpack_sizeof_* functions and mpack::encoded_size ignore encoder flags and
+   give the compact size, they are lower bounds for a fixed width encoder. */
+enum {
+  MPACK_ENCODE_COMPACT_FLOAT = 0x1,
+  MPACK_ENCODE_DICT_STRINGS = 0x2,
+  MPACK_ENCODE_FIXED_WIDTH = 0x4,
+};
+
+/* An encoder with a grow callback carries on in the buffer the callback
+   gives it when the current one is full instead of overflowing, base is the
+   number of bytes written to the buffers it left. The callback points begin,
+   pos and end at the new buffer and returns 0, or -1 if there is none. */
 typedef struct mpack_encoder {
   char *begin;
   char *end;
   char *pos;
+  unsigned int flags;
+  struct mpack_dict *dict;
+  size_t base;
+  int (*grow)(struct mpack_encoder *encoder);
 } mpack_encoder_t;
 
 typedef struct mpack_string {
@@ -190,8 +237,418 @@ typedef struct mpack_object {
   mpack_any_t data;
 } mpack_object_t;
 
+typedef enum mpack_field_type {
+  MPACK_FIELD_BOOLEAN,
+  MPACK_FIELD_INT8,
+  MPACK_FIELD_INT16,
+  MPACK_FIELD_INT32,
+  MPACK_FIELD_INT64,
+  MPACK_FIELD_UINT8,
+  MPACK_FIELD_UINT16,
+  MPACK_FIELD_UINT32,
+  MPACK_FIELD_UINT64,
+  MPACK_FIELD_FLOAT,
+  MPACK_FIELD_DOUBLE,
+  MPACK_FIELD_STRING,
+  MPACK_FIELD_BINARY,
+  MPACK_FIELD_EXTENDED,
+  MPACK_FIELD_STRUCT,
+} mpack_field_type_t;
+
+enum {
+  MPACK_STRUCT_MAX_FIELDS = 64,
+  MPACK_STRUCT_SLOTS = 2 * MPACK_STRUCT_MAX_FIELDS,
+};
+
+typedef struct mpack_field_desc {
+  const char *name;
+  size_t offset;
+  mpack_field_type_t type;
+  struct mpack_struct_desc *nested;
+  bool required;
+} mpack_field_desc_t;
+
+typedef struct mpack_struct_key {
+  uint32_t hash;
+  uint8_t size;
+  char data[2];
+  size_t length;
+} mpack_struct_key_t;
+
+/* Describes how a C struct maps to a msgpack map. Only fields and count are
+   set by the application (MPACK_STRUCT_DESC initializes a descriptor from an
+   array of fields), the rest is the lookup index filled once by
+   mpack_struct_compile. */
+typedef struct mpack_struct_desc {
+  const mpack_field_desc_t *fields;
+  size_t count;
+  bool compiled;
+  uint64_t required;
+  mpack_struct_key_t keys[MPACK_STRUCT_MAX_FIELDS];
+  uint8_t slots[MPACK_STRUCT_SLOTS];
+} mpack_struct_desc_t;
+
+#define MPACK_STRUCT_DESC(fields)                  \
+  {                                                \
+    (fields),                                      \
+    sizeof(fields) / sizeof((fields)[0]),          \
+    false,                                         \
+    0,                                             \
+    { { 0, 0, { 0, 0 }, 0 } },                     \
+    { 0 },                                         \
+  }
+
+/* A symbol is the canonical copy of an interned string. Its id is never
+   reused, even after the symbol was evicted from the table. Symbols are
+   allocated apart from the table and never hold another string, a pointer
+   returned by the table is valid until the symbol is evicted, or for as long
+   as a reference taken with mpack_symbol_retain is held. */
+typedef struct mpack_symbol {
+  const char *data;
+  size_t size;
+  uint32_t id;
+  uint32_t refs;
+} mpack_symbol_t;
+
+typedef struct mpack_intern_entry {
+  mpack_symbol_t *symbol;
+  uint32_t hash;
+  uint32_t slot;
+  bool referenced;
+} mpack_intern_entry_t;
+
+/* Bounded string intern table, control bytes hold 7 bits of the hash of the
+   entry in each slot so lookups compare 16 slots at a time. When all entries
+   are in use the least recently referenced one is evicted (CLOCK). */
+typedef struct mpack_intern {
+  uint8_t *control;
+  uint32_t *slots;
+  mpack_intern_entry_t *entries;
+  size_t capacity;
+  size_t count;
+  size_t mask;
+  size_t tombstones;
+  size_t hand;
+  uint32_t next_id;
+} mpack_intern_t;
+
+enum {
+  MPACK_DICT_MAX_SIZE = 65536,
+  MPACK_DICT_DEFINE = 0x70,
+  MPACK_DICT_REFERENCE = 0x71,
+};
+
+/* Dictionary of strings shared by the encoder and the decoder of a session.
+   The first time a string is encoded it is sent in a define extension and
+   assigned the next id, after that only a reference extension carrying the
+   id is sent. Entries are never evicted, once the dictionary is full new
+   strings are sent as is. */
+typedef struct mpack_dict {
+  mpack_intern_t strings;
+  size_t min_size;
+  int8_t define;
+  int8_t reference;
+} mpack_dict_t;
+
+typedef struct mpack_fragment {
+  size_t offset;
+  size_t size;
+} mpack_fragment_t;
+
+/* Constant values encoded once, like common keys, enum strings or static
+   objects, that encoders splice in their output with a single copy. A
+   fragment is identified by the index returned when it was added. */
+typedef struct mpack_fragments {
+  char *data;
+  size_t size;
+  size_t capacity;
+  mpack_fragment_t *entries;
+  size_t count;
+  size_t limit;
+} mpack_fragments_t;
+
+typedef struct mpack_slot {
+  size_t offset;
+  size_t size;
+  int type;
+} mpack_slot_t;
+
+/* Messages of the same shape compiled once, constant keys and structure are
+   encoded when the template is built and values go in slots pinned to fixed
+   width formats. A message is made by copying the template and storing values
+   at the slot offsets, str8 and bin8 slots reserve their maximum length and
+   mpack_template_pack closes the gaps left by shorter values. */
+typedef struct mpack_template {
+  char *data;
+  size_t size;
+  size_t capacity;
+  mpack_slot_t *slots;
+  size_t count;
+  size_t limit;
+  size_t strings;
+} mpack_template_t;
+
+enum {
+  MPACK_ARENA_ALIGN = 16,
+  MPACK_ARENA_BLOCK_SIZE = 65536,
+};
+
+/* Bump allocator over blocks of block_size bytes for the memory of a
+   request. Resetting it reclaims everything at once and keeps the blocks
+   for the next request, only allocations larger than a block get a block of
+   their own which is freed by the reset. */
+typedef struct mpack_arena {
+  struct mpack_arena_block *blocks;
+  struct mpack_arena_block *last;
+  struct mpack_arena_block *free;
+  struct mpack_arena_block *large;
+  char *pos;
+  char *end;
+  size_t block_size;
+} mpack_arena_t;
+
+enum {
+  MPACK_FRAME_HEADER_SIZE = 9,
+  MPACK_FRAME_STORED = 0,
+  MPACK_FRAME_LZ = 1,
+};
+
+/* Callbacks used to move frames in and out of the application. Both return
+   the number of bytes transferred, short counts are only expected from the
+   read callback at the end of the stream, -1 reports an error. */
+typedef int (*mpack_write_t)(void *context, const void *data, size_t size);
+typedef int (*mpack_read_t)(void *context, void *data, size_t size);
+
+typedef struct mpack_frame {
+  uint8_t method;
+  uint32_t size;
+  uint32_t length;
+} mpack_frame_t;
+
+/* Groups records encoded with its encoder into blocks of about block_size
+   bytes, each block is compressed and written as one frame. The size of the
+   encoder's dictionary is remembered at every commit and flush so a dropped
+   record takes its definitions with it, a dictionary attached to the encoder
+   after the writer was initialized must be followed by a flush. */
+typedef struct mpack_frame_writer {
+  mpack_encoder_t encoder;
+  size_t block_size;
+  size_t mark;
+  size_t dict_size;
+  char *frame;
+  size_t capacity;
+  mpack_write_t write;
+  void *context;
+} mpack_frame_writer_t;
+
+/* Reads frames one at a time and exposes the decompressed block through its
+   decoder. The window grows for larger blocks up to max_size, frames that
+   announce more than that are rejected before anything is allocated. */
+typedef struct mpack_frame_reader {
+  mpack_decoder_t decoder;
+  char *window;
+  size_t window_size;
+  size_t max_size;
+  char *payload;
+  size_t payload_size;
+  mpack_read_t read;
+  void *context;
+} mpack_frame_reader_t;
+
+struct iovec;
+
+/* Fixed size buffer of a chain, the first size bytes of data are in use. */
+typedef struct mpack_chunk {
+  struct mpack_chunk *next;
+  char *data;
+  size_t size;
+  size_t capacity;
+} mpack_chunk_t;
+
+/* Chunks of chunk_size bytes released by chains are kept for reuse, up to
+   limit of them, zero means no limit. */
+typedef struct mpack_chunk_pool {
+  mpack_chunk_t *free;
+  size_t chunk_size;
+  size_t count;
+  size_t limit;
+} mpack_chunk_pool_t;
+
+/* Encodes records with its encoder in a list of chunks taken from a pool.
+   When the last chunk is full the encoder carries on in a new one, so
+   records cross chunk boundaries and every chunk but the last is full.
+   Committed records end in mark at mark_size, committed is the encoder
+   offset there. Dict_size is the size of the encoder's dictionary at the
+   last commit and sent_dict_size its size when the chain was last empty.
+   Size is the number of bytes committed and not written yet, sent the
+   number of bytes of the first chunk already written. */
+typedef struct mpack_chain {
+  mpack_encoder_t encoder;
+  mpack_chunk_pool_t *pool;
+  mpack_chunk_t *head;
+  mpack_chunk_t *tail;
+  mpack_chunk_t *mark;
+  size_t mark_size;
+  size_t committed;
+  size_t dict_size;
+  size_t sent_dict_size;
+  size_t count;
+  size_t size;
+  size_t sent;
+} mpack_chain_t;
+
+/* Ring of messages in a shared memory segment, written by any number of
+   producer processes and read by a single consumer. Producers encode in
+   place in the slot they reserved and consumers decode it in place, waiting
+   on either side sleeps on a futex in the segment. */
+typedef struct mpack_shm_ring {
+  struct mpack_shm_header *header;
+  char *data;
+  size_t capacity;
+  size_t map_size;
+} mpack_shm_ring_t;
+
+/* Submission and completion queues shared with the kernel by io_uring. */
+typedef struct mpack_uring {
+  int fd;
+  unsigned int *sq_tail;
+  unsigned int *sq_mask;
+  unsigned int *sq_array;
+  void *sqes;
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int *cq_mask;
+  void *cqes;
+  void *sq_map;
+  size_t sq_map_size;
+  void *cq_map;
+  size_t cq_map_size;
+  size_t sqes_size;
+  unsigned int pending;
+} mpack_uring_t;
+
+typedef struct mpack_uring_slot {
+  uint64_t offset;
+  size_t size;
+  size_t done;
+  int result;
+  int state;
+} mpack_uring_slot_t;
+
+/* Keeps up to depth reads of block_size bytes in flight on a file descriptor
+   with registered buffers, blocks are handed out in order. Pipes and sockets
+   have a single read in flight since their data order follows completion
+   order. */
+typedef struct mpack_uring_reader {
+  mpack_uring_t ring;
+  int fd;
+  bool seekable;
+  bool fixed;
+  bool eof;
+  char *buffers;
+  size_t block_size;
+  unsigned int depth;
+  mpack_uring_slot_t *slots;
+  unsigned int next;
+  bool delivered;
+  uint64_t offset;
+  const char *data;
+  size_t size;
+} mpack_uring_reader_t;
+
+/* Batches the bytes written to it in blocks of block_size bytes, full blocks
+   are submitted and up to depth of them are in flight at once. */
+typedef struct mpack_uring_writer {
+  mpack_uring_t ring;
+  int fd;
+  bool seekable;
+  bool fixed;
+  char *buffers;
+  size_t block_size;
+  unsigned int depth;
+  mpack_uring_slot_t *slots;
+  unsigned int next;
+  uint64_t offset;
+  int error;
+} mpack_uring_writer_t;
+
+typedef struct mpack_segment {
+  const void *data;
+  size_t size;
+} mpack_segment_t;
+
+/* Progress of mpack_scan through a value that is not complete yet. */
+typedef struct mpack_scanner {
+  size_t offset;
+  size_t count;
+} mpack_scanner_t;
+
+/* Decodes values laid out over a list of segments, like the buffers of a
+   packet chain or the two parts of a ring buffer that wrapped around. Tokens
+   within one segment are decoded in place, a token that crosses a boundary
+   is first copied alone to the scratch buffer and points into it until the
+   next call. Position counts the bytes consumed since the first segment, the
+   scanner keeps the progress through the current value so that it is not
+   scanned again when more segments are appended after EAGAIN. */
+typedef struct mpack_rope {
+  const mpack_segment_t *segments;
+  size_t count;
+  size_t index;
+  size_t offset;
+  size_t position;
+  mpack_scanner_t scanner;
+  char *scratch;
+  size_t scratch_size;
+} mpack_rope_t;
+
+/* Callbacks of mpack_walk, any of them may be NULL. They return a negative
+   value to stop the walk, zero to go on or MPACK_WALK_SKIP from array_begin,
+   map_begin and map_key to pass over the container or map entry without
+   visiting it. Scalars are nil, boolean, integer and number values. Keys
+   that are containers are given to map_key with their header, their
+   elements then follow with the usual events. Depth bounds the nesting of
+   containers, zero means no limit. */
+enum {
+  MPACK_WALK_SKIP = 1,
+};
+
+typedef struct mpack_visitor {
+  int (*scalar)(void *context, const mpack_object_t *value);
+  int (*string)(void *context, mpack_string_t value);
+  int (*binary)(void *context, mpack_binary_t value);
+  int (*extended)(void *context, mpack_extended_t value);
+  int (*array_begin)(void *context, size_t size);
+  int (*array_end)(void *context);
+  int (*map_begin)(void *context, size_t size);
+  int (*map_key)(void *context, const mpack_object_t *key);
+  int (*map_end)(void *context);
+  size_t depth;
+} mpack_visitor_t;
+
+enum {
+  MPACK_JSON_BINARY_BASE64 = 0x0,
+  MPACK_JSON_BINARY_HEX = 0x1,
+  MPACK_JSON_BINARY_ARRAY = 0x2,
+  MPACK_JSON_BINARY_MASK = 0x3,
+  MPACK_JSON_EXTENDED_OBJECT = 0x0,
+  MPACK_JSON_EXTENDED_DATA = 0x4,
+  MPACK_JSON_EXTENDED_NULL = 0x8,
+  MPACK_JSON_EXTENDED_MASK = 0xc,
+  MPACK_JSON_TIMESTAMP_STRING = 0x10,
+};
+
+/* Destination of the JSON text produced by mpack_to_json, flags select how
+   binary and extended values are rendered since JSON has no equivalent.
+   Ill-formed UTF-8 in strings is replaced with U+FFFD. */
+typedef struct mpack_json_sink {
+  mpack_write_t write;
+  void *context;
+  unsigned int flags;
+} mpack_json_sink_t;
+
 void mpack_decoder_init(mpack_decoder_t *decoder, const void *data, size_t size);
 void mpack_decoder_term(mpack_decoder_t *decoder);
+int mpack_decoder_trust(mpack_decoder_t *decoder, const mpack_limits_t *limits);
 bool mpack_decoder_read_uint8(mpack_decoder_t *decoder, uint8_t *value);
 bool mpack_decoder_read_uint16(mpack_decoder_t *decoder, uint16_t *value);
 bool mpack_decoder_read_uint32(mpack_decoder_t *decoder, uint32_t *value);
@@ -205,6 +662,7 @@ bool mpack_decoder_skip_bytes(mpack_decoder_t *decoder, size_t size);
 
 void mpack_encoder_init(mpack_encoder_t *encoder, void *data, size_t size);
 void mpack_encoder_term(mpack_encoder_t *encoder);
+size_t mpack_encoder_offset(const mpack_encoder_t *encoder);
 void mpack_encoder_write_uint8(mpack_encoder_t *encoder, uint8_t value);
 void mpack_encoder_write_uint16(mpack_encoder_t *encoder, uint16_t value);
 void mpack_encoder_write_uint32(mpack_encoder_t *encoder, uint32_t value);
@@ -229,6 +687,17 @@ int mpack_decode_array(mpack_decoder_t *decoder, mpack_array_t *value);
 int mpack_decode_map(mpack_decoder_t *decoder, mpack_map_t *value);
 int mpack_decode_extended(mpack_decoder_t *decoder, mpack_extended_t *value);
 int mpack_decode_object(mpack_decoder_t *decoder, mpack_object_t *value);
+int mpack_decode_skip(mpack_decoder_t *decoder);
+int mpack_find(mpack_decoder_t *decoder, const mpack_object_t *path, size_t count);
+bool mpack_object_equal(const mpack_object_t *a, const mpack_object_t *b);
+int mpack_decode_raw(mpack_decoder_t *decoder, mpack_segment_t *value);
+int mpack_validate(const void *data, size_t size, const mpack_limits_t *limits);
+int mpack_walk(mpack_decoder_t *decoder, const mpack_visitor_t *visitor, void *context);
+
+void mpack_scanner_init(mpack_scanner_t *scanner);
+int mpack_scan(mpack_scanner_t *scanner, const void *data, size_t size);
+int mpack_decode_symbol(mpack_decoder_t *decoder, const mpack_symbol_t **value);
+int mpack_decode_timestamp(mpack_decoder_t *decoder, struct timespec *value);
 
 int mpack_encode_nil(mpack_encoder_t *encoder);
 int mpack_encode_true(mpack_encoder_t *encoder);
@@ -239,19 +708,290 @@ int mpack_encode_unsigned(mpack_encoder_t *encoder, unsigned long value);
 int mpack_encode_float(mpack_encoder_t *encoder, float value);
 int mpack_encode_double(mpack_encoder_t *encoder, double value);
 int mpack_encode_string(mpack_encoder_t *encoder, mpack_string_t value);
+int mpack_encode_key(mpack_encoder_t *encoder, mpack_string_t value);
+int mpack_encode_timestamp(mpack_encoder_t *encoder, struct timespec value);
 int mpack_encode_binary(mpack_encoder_t *encoder, mpack_binary_t value);
 int mpack_encode_array(mpack_encoder_t *encoder, mpack_array_t value);
 int mpack_encode_map(mpack_encoder_t *encoder, mpack_map_t value);
 int mpack_encode_extended(mpack_encoder_t *encoder, mpack_extended_t value);
 int mpack_encode_object(mpack_encoder_t *encoder, mpack_object_t value);
+int mpack_encode_raw(mpack_encoder_t *encoder, const void *data, size_t size);
+int mpack_encode_fragment(mpack_encoder_t *encoder, const mpack_fragments_t *fragments, size_t id);
+int mpack_encode_double_array(mpack_encoder_t *encoder, const double *values, size_t count);
+int mpack_encode_array_begin(mpack_encoder_t *encoder, size_t *offset);
+int mpack_encode_array_end(mpack_encoder_t *encoder, size_t offset, size_t size);
+int mpack_encode_map_begin(mpack_encoder_t *encoder, size_t *offset);
+int mpack_encode_map_end(mpack_encoder_t *encoder, size_t offset, size_t size);
+int mpack_encoder_compact(mpack_encoder_t *encoder, size_t offset);
+int mpack_patch_object(void *data, size_t size, mpack_object_t value);
+int mpack_patch_timestamp(void *data, size_t size, struct timespec value);
+
+size_t mpack_sizeof_nil(void);
+size_t mpack_sizeof_boolean(bool value);
+size_t mpack_sizeof_signed(signed long value);
+size_t mpack_sizeof_unsigned(unsigned long value);
+size_t mpack_sizeof_float(float value);
+size_t mpack_sizeof_double(double value);
+size_t mpack_sizeof_double_compact(double value);
+size_t mpack_sizeof_string(size_t size);
+size_t mpack_sizeof_binary(size_t size);
+size_t mpack_sizeof_array_header(size_t size);
+size_t mpack_sizeof_map_header(size_t size);
+size_t mpack_sizeof_extended(size_t size);
+size_t mpack_sizeof_timestamp(struct timespec value);
+size_t mpack_sizeof_object(mpack_object_t value);
+
+int mpack_intern_init(mpack_intern_t *intern, size_t capacity);
+void mpack_intern_term(mpack_intern_t *intern);
+const mpack_symbol_t *mpack_intern_find(mpack_intern_t *intern, mpack_string_t value);
+const mpack_symbol_t *mpack_intern_insert(mpack_intern_t *intern, mpack_string_t value);
+const mpack_symbol_t *mpack_symbol_retain(const mpack_symbol_t *symbol);
+void mpack_symbol_release(const mpack_symbol_t *symbol);
+
+int mpack_dict_init(mpack_dict_t *dict, size_t capacity);
+void mpack_dict_term(mpack_dict_t *dict);
+size_t mpack_dict_size(const mpack_dict_t *dict);
+void mpack_dict_truncate(mpack_dict_t *dict, size_t size);
+
+void mpack_fragments_init(mpack_fragments_t *fragments);
+void mpack_fragments_term(mpack_fragments_t *fragments);
+int mpack_fragments_add(mpack_fragments_t *fragments, const void *data, size_t size);
+int mpack_fragments_add_string(mpack_fragments_t *fragments, mpack_string_t value);
+
+void mpack_template_init(mpack_template_t *tpl);
+void mpack_template_term(mpack_template_t *tpl);
+int mpack_template_append(mpack_template_t *tpl, const void *data, size_t size);
+int mpack_template_append_object(mpack_template_t *tpl, mpack_object_t value);
+int mpack_template_slot(mpack_template_t *tpl, int type, size_t length);
+int mpack_template_copy(const mpack_template_t *tpl, void *data, size_t size);
+int mpack_template_set_unsigned(const mpack_template_t *tpl, void *data, size_t id, unsigned long value);
+int mpack_template_set_signed(const mpack_template_t *tpl, void *data, size_t id, signed long value);
+int mpack_template_set_double(const mpack_template_t *tpl, void *data, size_t id, double value);
+int mpack_template_set_string(const mpack_template_t *tpl, void *data, size_t id, mpack_string_t value);
+int mpack_template_set_binary(const mpack_template_t *tpl, void *data, size_t id, mpack_binary_t value);
+int mpack_template_pack(const mpack_template_t *tpl, void *data);
+
+void mpack_arena_init(mpack_arena_t *arena, size_t block_size);
+void mpack_arena_term(mpack_arena_t *arena);
+void mpack_arena_reset(mpack_arena_t *arena);
+void *mpack_arena_alloc(mpack_arena_t *arena, size_t size);
+void *mpack_arena_copy(mpack_arena_t *arena, const void *data, size_t size);
+mpack_arena_t *mpack_arena_acquire(void);
+void mpack_arena_release(mpack_arena_t *arena);
+void mpack_arena_cache_term(void);
+
+size_t mpack_lz_bound(size_t size);
+size_t mpack_lz_compress(void *dst, size_t capacity, const void *src, size_t size);
+int mpack_lz_decompress(void *dst, size_t size, const void *src, size_t length);
+
+size_t mpack_frame_bound(size_t size);
+int mpack_frame_encode(void *frame, size_t capacity, const void *data, size_t size);
+int mpack_frame_header(const void *frame, size_t size, mpack_frame_t *header);
+int mpack_frame_decode(void *data, const mpack_frame_t *header, const void *payload);
+
+int mpack_frame_writer_init(mpack_frame_writer_t *writer, size_t block_size, mpack_write_t write, void *context);
+void mpack_frame_writer_term(mpack_frame_writer_t *writer);
+int mpack_frame_writer_commit(mpack_frame_writer_t *writer);
+int mpack_frame_writer_flush(mpack_frame_writer_t *writer);
+
+int mpack_frame_reader_init(mpack_frame_reader_t *reader, size_t window_size, size_t max_size, mpack_read_t read, void *context);
+void mpack_frame_reader_term(mpack_frame_reader_t *reader);
+int mpack_frame_reader_next(mpack_frame_reader_t *reader);
+
+int mpack_chunk_pool_init(mpack_chunk_pool_t *pool, size_t chunk_size, size_t limit);
+void mpack_chunk_pool_term(mpack_chunk_pool_t *pool);
+
+int mpack_chain_init(mpack_chain_t *chain, mpack_chunk_pool_t *pool);
+void mpack_chain_term(mpack_chain_t *chain);
+int mpack_chain_commit(mpack_chain_t *chain);
+void mpack_chain_cancel(mpack_chain_t *chain);
+int mpack_chain_reset(mpack_chain_t *chain);
+int mpack_chain_iovec(const mpack_chain_t *chain, struct iovec *iov, int count);
+int mpack_chain_writev(mpack_chain_t *chain, int fd);
+
+void mpack_rope_init(mpack_rope_t *rope, const mpack_segment_t *segments, size_t count);
+void mpack_rope_term(mpack_rope_t *rope);
+int mpack_rope_next(mpack_rope_t *rope, mpack_decoder_t *decoder);
+int mpack_rope_decode_object(mpack_rope_t *rope, mpack_object_t *value);
+int mpack_rope_skip(mpack_rope_t *rope);
+
+int mpack_shm_ring_create(mpack_shm_ring_t *ring, const char *name, size_t capacity);
+int mpack_shm_ring_open(mpack_shm_ring_t *ring, const char *name);
+void mpack_shm_ring_term(mpack_shm_ring_t *ring);
+int mpack_shm_ring_reserve(mpack_shm_ring_t *ring, size_t size, mpack_encoder_t *encoder, int timeout);
+int mpack_shm_ring_commit(mpack_shm_ring_t *ring, mpack_encoder_t *encoder);
+int mpack_shm_ring_next(mpack_shm_ring_t *ring, mpack_decoder_t *decoder, int timeout);
+int mpack_shm_ring_release(mpack_shm_ring_t *ring);
+
+int mpack_uring_reader_init(mpack_uring_reader_t *reader, int fd, size_t block_size, unsigned int depth);
+void mpack_uring_reader_term(mpack_uring_reader_t *reader);
+int mpack_uring_reader_next(mpack_uring_reader_t *reader, const void **data);
+int mpack_uring_read(void *context, void *data, size_t size);
+
+int mpack_uring_writer_init(mpack_uring_writer_t *writer, int fd, size_t block_size, unsigned int depth);
+void mpack_uring_writer_term(mpack_uring_writer_t *writer);
+int mpack_uring_writer_flush(mpack_uring_writer_t *writer);
+int mpack_uring_write(void *context, const void *data, size_t size);
+
+int mpack_to_json(mpack_decoder_t *decoder, const mpack_json_sink_t *sink);
+int mpack_from_json(mpack_encoder_t *encoder, const char *data, size_t size);
+
+int mpack_struct_compile(mpack_struct_desc_t *desc);
+int mpack_encode_struct(mpack_encoder_t *encoder, const mpack_struct_desc_t *desc, const void *value);
+int mpack_decode_struct(mpack_decoder_t *decoder, const mpack_struct_desc_t *desc, void *value);
 
 #ifdef __cplusplus
 }
 
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if __cplusplus >= 201703L
+# include <optional>
+# include <string_view>
+#endif
+
+#if __cplusplus >= 202002L
+# include <span>
+#endif
+
+#if defined(__cpp_impl_coroutine)
+# include <coroutine>
+#endif
+
+#ifndef MPACK_RESERVE_LIMIT
+#define MPACK_RESERVE_LIMIT 65536
+#endif
+
+#if __cplusplus >= 201703L
+#define MPACK_PP_CAT(a, b) MPACK_PP_CAT_(a, b)
+#define MPACK_PP_CAT_(a, b) a##b
+#define MPACK_PP_NARG(...) MPACK_PP_NARG_(__VA_ARGS__, MPACK_PP_RSEQ())
+#define MPACK_PP_NARG_(...) MPACK_PP_ARG_N(__VA_ARGS__)
+#define MPACK_PP_ARG_N(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, \
+  _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, \
+  _27, _28, _29, _30, _31, _32, _33, _34, _35, _36, _37, _38, _39, _40, \
+  _41, _42, _43, _44, _45, _46, _47, _48, _49, _50, _51, _52, _53, _54, \
+  _55, _56, _57, _58, _59, _60, _61, _62, _63, _64, N, ...) N
+#define MPACK_PP_RSEQ() 64, 63, 62, 61, 60, 59, 58, 57, 56, 55, 54, 53, 52, \
+  51, 50, 49, 48, 47, 46, 45, 44, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, \
+  33, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, \
+  15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+#define MPACK_PP_MAP(m, x, ...) \
+  MPACK_PP_CAT(MPACK_PP_MAP_, MPACK_PP_NARG(__VA_ARGS__))(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_1(m, x, a) m(x, a)
+#define MPACK_PP_MAP_2(m, x, a, ...) m(x, a), MPACK_PP_MAP_1(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_3(m, x, a, ...) m(x, a), MPACK_PP_MAP_2(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_4(m, x, a, ...) m(x, a), MPACK_PP_MAP_3(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_5(m, x, a, ...) m(x, a), MPACK_PP_MAP_4(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_6(m, x, a, ...) m(x, a), MPACK_PP_MAP_5(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_7(m, x, a, ...) m(x, a), MPACK_PP_MAP_6(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_8(m, x, a, ...) m(x, a), MPACK_PP_MAP_7(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_9(m, x, a, ...) m(x, a), MPACK_PP_MAP_8(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_10(m, x, a, ...) m(x, a), MPACK_PP_MAP_9(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_11(m, x, a, ...) m(x, a), MPACK_PP_MAP_10(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_12(m, x, a, ...) m(x, a), MPACK_PP_MAP_11(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_13(m, x, a, ...) m(x, a), MPACK_PP_MAP_12(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_14(m, x, a, ...) m(x, a), MPACK_PP_MAP_13(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_15(m, x, a, ...) m(x, a), MPACK_PP_MAP_14(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_16(m, x, a, ...) m(x, a), MPACK_PP_MAP_15(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_17(m, x, a, ...) m(x, a), MPACK_PP_MAP_16(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_18(m, x, a, ...) m(x, a), MPACK_PP_MAP_17(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_19(m, x, a, ...) m(x, a), MPACK_PP_MAP_18(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_20(m, x, a, ...) m(x, a), MPACK_PP_MAP_19(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_21(m, x, a, ...) m(x, a), MPACK_PP_MAP_20(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_22(m, x, a, ...) m(x, a), MPACK_PP_MAP_21(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_23(m, x, a, ...) m(x, a), MPACK_PP_MAP_22(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_24(m, x, a, ...) m(x, a), MPACK_PP_MAP_23(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_25(m, x, a, ...) m(x, a), MPACK_PP_MAP_24(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_26(m, x, a, ...) m(x, a), MPACK_PP_MAP_25(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_27(m, x, a, ...) m(x, a), MPACK_PP_MAP_26(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_28(m, x, a, ...) m(x, a), MPACK_PP_MAP_27(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_29(m, x, a, ...) m(x, a), MPACK_PP_MAP_28(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_30(m, x, a, ...) m(x, a), MPACK_PP_MAP_29(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_31(m, x, a, ...) m(x, a), MPACK_PP_MAP_30(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_32(m, x, a, ...) m(x, a), MPACK_PP_MAP_31(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_33(m, x, a, ...) m(x, a), MPACK_PP_MAP_32(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_34(m, x, a, ...) m(x, a), MPACK_PP_MAP_33(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_35(m, x, a, ...) m(x, a), MPACK_PP_MAP_34(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_36(m, x, a, ...) m(x, a), MPACK_PP_MAP_35(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_37(m, x, a, ...) m(x, a), MPACK_PP_MAP_36(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_38(m, x, a, ...) m(x, a), MPACK_PP_MAP_37(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_39(m, x, a, ...) m(x, a), MPACK_PP_MAP_38(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_40(m, x, a, ...) m(x, a), MPACK_PP_MAP_39(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_41(m, x, a, ...) m(x, a), MPACK_PP_MAP_40(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_42(m, x, a, ...) m(x, a), MPACK_PP_MAP_41(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_43(m, x, a, ...) m(x, a), MPACK_PP_MAP_42(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_44(m, x, a, ...) m(x, a), MPACK_PP_MAP_43(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_45(m, x, a, ...) m(x, a), MPACK_PP_MAP_44(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_46(m, x, a, ...) m(x, a), MPACK_PP_MAP_45(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_47(m, x, a, ...) m(x, a), MPACK_PP_MAP_46(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_48(m, x, a, ...) m(x, a), MPACK_PP_MAP_47(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_49(m, x, a, ...) m(x, a), MPACK_PP_MAP_48(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_50(m, x, a, ...) m(x, a), MPACK_PP_MAP_49(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_51(m, x, a, ...) m(x, a), MPACK_PP_MAP_50(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_52(m, x, a, ...) m(x, a), MPACK_PP_MAP_51(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_53(m, x, a, ...) m(x, a), MPACK_PP_MAP_52(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_54(m, x, a, ...) m(x, a), MPACK_PP_MAP_53(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_55(m, x, a, ...) m(x, a), MPACK_PP_MAP_54(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_56(m, x, a, ...) m(x, a), MPACK_PP_MAP_55(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_57(m, x, a, ...) m(x, a), MPACK_PP_MAP_56(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_58(m, x, a, ...) m(x, a), MPACK_PP_MAP_57(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_59(m, x, a, ...) m(x, a), MPACK_PP_MAP_58(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_60(m, x, a, ...) m(x, a), MPACK_PP_MAP_59(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_61(m, x, a, ...) m(x, a), MPACK_PP_MAP_60(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_62(m, x, a, ...) m(x, a), MPACK_PP_MAP_61(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_63(m, x, a, ...) m(x, a), MPACK_PP_MAP_62(m, x, __VA_ARGS__)
+#define MPACK_PP_MAP_64(m, x, a, ...) m(x, a), MPACK_PP_MAP_63(m, x, __VA_ARGS__)
+
+#define MPACK_PP_FIELD(self, field) self.field
+#define MPACK_PP_NAME(self, field) #field
+
+// Generates the encode and decode overloads of a struct from the list of its
+// fields (up to 64). MPACK_DEFINE and MPACK_DEFINE_MAP encode the struct as a
+// map keyed by field names, MPACK_DEFINE_ARRAY as an array of the field
+// values in declaration order. The macro must appear at namespace scope in
+// the namespace of the struct.
+#define MPACK_DEFINE(type, ...) MPACK_DEFINE_MAP(type, __VA_ARGS__)
+#define MPACK_DEFINE_MAP(type, ...) MPACK_DEFINE_STRUCT(type, true, __VA_ARGS__)
+#define MPACK_DEFINE_ARRAY(type, ...) MPACK_DEFINE_STRUCT(type, false, __VA_ARGS__)
+
+#define MPACK_DEFINE_STRUCT(type, keyed, ...)                                  \
+  constexpr auto mpack_fields(type &self) noexcept                             \
+  { return std::tie(MPACK_PP_MAP(MPACK_PP_FIELD, self, __VA_ARGS__)); }        \
+                                                                               \
+  constexpr auto mpack_fields(const type &self) noexcept                       \
+  { return std::tie(MPACK_PP_MAP(MPACK_PP_FIELD, self, __VA_ARGS__)); }        \
+                                                                               \
+  constexpr auto mpack_schema(const type *) noexcept                           \
+  {                                                                            \
+    constexpr const char *fields[] = {                                         \
+      MPACK_PP_MAP(MPACK_PP_NAME, self, __VA_ARGS__)                           \
+    };                                                                         \
+    return mpack::detail::schema<                                              \
+      sizeof(fields) / sizeof(fields[0]),                                      \
+      mpack::detail::schema_size(fields)                                       \
+    >(keyed, fields);                                                          \
+  }
+#endif
+
 namespace mpack {
 
   using format = mpack_format_t;
   using type = mpack_type_t;
+  using symbol = mpack_symbol_t;
 
   class extended : public mpack_extended_t {
   public:
@@ -308,6 +1048,76 @@ namespace mpack {
     { }
   };
 
+  // Owns a string intern table, decoders use it once their intern member
+  // points to it.
+  class intern_table : public mpack_intern_t {
+  public:
+    explicit intern_table(size_t capacity);
+    intern_table(const intern_table &) = delete;
+    intern_table &operator=(const intern_table &) = delete;
+    ~intern_table();
+
+    const symbol *find(string) noexcept;
+    const symbol *insert(string) noexcept;
+  };
+
+  // Owns a session dictionary, encoders and decoders use it once their dict
+  // member points to it.
+  class dictionary : public mpack_dict_t {
+  public:
+    explicit dictionary(size_t capacity);
+    dictionary(const dictionary &) = delete;
+    dictionary &operator=(const dictionary &) = delete;
+    ~dictionary();
+
+    size_t size() const noexcept;
+    void truncate(size_t) noexcept;
+  };
+
+  // Owns an arena for the memory of a request, reset() reclaims all of it
+  // and keeps the blocks for the next request.
+  class arena : public mpack_arena_t {
+  public:
+    explicit arena(size_t block_size = 0) noexcept;
+    arena(const arena &) = delete;
+    arena &operator=(const arena &) = delete;
+    ~arena();
+
+    void *allocate(size_t);
+    void reset() noexcept;
+
+    // Arena of the calling thread, freed when the thread exits.
+    static arena &local() noexcept;
+  };
+
+  // Allocator for the strings and containers a decoder fills in, memory is
+  // only reclaimed by resetting the arena so deallocate does nothing. It is
+  // always bound to an explicit arena, the decoder builds the elements of a
+  // container with the container's allocator.
+  template < typename T >
+  class arena_allocator {
+  public:
+    using value_type = T;
+
+    arena_allocator(arena &) noexcept;
+
+    template < typename U >
+    arena_allocator(const arena_allocator<U> &) noexcept;
+
+    T *allocate(size_t);
+    void deallocate(T *, size_t) noexcept;
+    arena *resource() const noexcept;
+
+  private:
+    arena *owner;
+  };
+
+  template < typename T, typename U >
+  bool operator==(const arena_allocator<T> &, const arena_allocator<U> &) noexcept;
+
+  template < typename T, typename U >
+  bool operator!=(const arena_allocator<T> &, const arena_allocator<U> &) noexcept;
+
   class decoder : public mpack_decoder_t {
   public:
     decoder() noexcept;
@@ -319,10 +1129,12 @@ namespace mpack {
     int decode(signed short &) noexcept;
     int decode(signed int &) noexcept;
     int decode(signed long &) noexcept;
+    int decode(signed long long &) noexcept;
     int decode(unsigned char &) noexcept;
     int decode(unsigned short &) noexcept;
     int decode(unsigned int &) noexcept;
     int decode(unsigned long &) noexcept;
+    int decode(unsigned long long &) noexcept;
     int decode(float &) noexcept;
     int decode(double &) noexcept;
     int decode(string &) noexcept;
@@ -330,15 +1142,113 @@ namespace mpack {
     int decode(array &) noexcept;
     int decode(map &) noexcept;
     int decode(extended &) noexcept;
+    int decode(timespec &) noexcept;
+
+    template < typename T, typename A >
+    int decode(std::vector<T, A> &);
+
+    template < typename A >
+    int decode(std::vector<bool, A> &);
+
+    template < typename K, typename V, typename C, typename A >
+    int decode(std::map<K, V, C, A> &);
+
+    template < typename K, typename V, typename H, typename E, typename A >
+    int decode(std::unordered_map<K, V, H, E, A> &);
+
+    template < typename T, typename A >
+    int decode(std::basic_string<char, T, A> &);
+
+    template < typename D >
+    int decode(std::chrono::time_point<std::chrono::system_clock, D> &) noexcept;
+
+#if __cplusplus >= 201703L
+    template < typename T >
+    int decode(std::optional<T> &);
+
+    template < typename T >
+    auto decode(T &)
+      -> decltype(mpack_schema(static_cast<const T *>(nullptr)), int());
+#endif
 
     int decode_nil() noexcept;
     int decode_true() noexcept;
     int decode_false() noexcept;
+    int skip() noexcept;
+    int decode(const symbol *&) noexcept;
+
+    // Upper bound on the number of elements reserved up front when decoding
+    // into a standard container, the element count read from the input is
+    // also capped by the number of bytes left in the buffer.
+    size_t reserve_limit;
 
   private:
     template < typename T > int decode_signed(T &) noexcept;
     template < typename T > int decode_unsigned(T &) noexcept;
+
+    template < typename M >
+    int decode_mapping(M &);
+
+    template < typename S, typename Tuple, size_t... I >
+    int decode_struct(const S &, Tuple, std::index_sequence<I...>);
+
+    template < size_t I, typename Tuple >
+    static int decode_field(decoder &, Tuple &);
+
+    size_t reserve_hint(size_t) const noexcept;
+  };
+
+#if defined(__cpp_impl_coroutine)
+  // Decoder over input that arrives in pieces, driven from a coroutine: the
+  // awaitables returned by next() and read() suspend until the next value is
+  // complete in the buffer, and feed() appends the bytes received by the I/O
+  // layer and resumes the coroutine waiting on the reader. Values pointing
+  // into the input stay valid until the next call to feed().
+  class async_reader : public decoder {
+  public:
+    template < typename T >
+    class awaiter {
+    public:
+      awaiter(async_reader &, T *) noexcept;
+
+      bool await_ready() noexcept;
+      void await_suspend(std::coroutine_handle<>) noexcept;
+      int await_resume() noexcept;
+
+    private:
+      async_reader &reader;
+      T *value;
+    };
+
+    async_reader() noexcept;
+    async_reader(const async_reader &) = delete;
+    async_reader &operator=(const async_reader &) = delete;
+
+    void feed(const void *, size_t);
+    void close() noexcept;
+
+    // Waits for the next value without decoding it, the result is its size,
+    // zero once the input is closed and fully consumed, or -1 with errno set
+    // to EAGAIN if it was closed in the middle of a value.
+    awaiter<void> next() noexcept;
+
+    // Waits for the next value and decodes it into the argument.
+    template < typename T >
+    awaiter<T> read(T &) noexcept;
+
+  private:
+    bool ready() noexcept;
+    int complete() noexcept;
+
+    std::vector<char> buffer;
+    std::coroutine_handle<> waiting;
+    mpack_scanner_t scanner;
+    size_t scan_offset;
+    int status;
+    int error;
+    bool closed;
   };
+#endif
 
   class encoder : public mpack_encoder_t {
   public:
@@ -351,10 +1261,12 @@ namespace mpack {
     int encode(signed short) noexcept;
     int encode(signed int) noexcept;
     int encode(signed long) noexcept;
+    int encode(signed long long) noexcept;
     int encode(unsigned char) noexcept;
     int encode(unsigned short) noexcept;
     int encode(unsigned int) noexcept;
     int encode(unsigned long) noexcept;
+    int encode(unsigned long long) noexcept;
     int encode(float) noexcept;
     int encode(double) noexcept;
     int encode(string) noexcept;
@@ -362,12 +1274,1276 @@ namespace mpack {
     int encode(array) noexcept;
     int encode(map) noexcept;
     int encode(extended) noexcept;
+    int encode(const timespec &) noexcept;
+
+    template < typename T, typename A >
+    int encode(const std::vector<T, A> &) noexcept;
+
+    template < typename A >
+    int encode(const std::vector<bool, A> &) noexcept;
+
+    template < typename T, size_t N >
+    int encode(const std::array<T, N> &) noexcept;
+
+    template < typename K, typename V, typename C, typename A >
+    int encode(const std::map<K, V, C, A> &) noexcept;
+
+    template < typename K, typename V, typename H, typename E, typename A >
+    int encode(const std::unordered_map<K, V, H, E, A> &) noexcept;
+
+    template < typename T, typename A >
+    int encode(const std::basic_string<char, T, A> &) noexcept;
+
+    template < typename T, typename U >
+    int encode(const std::pair<T, U> &) noexcept;
+
+    template < typename... T >
+    int encode(const std::tuple<T...> &) noexcept;
+
+    template < typename D >
+    int encode(std::chrono::time_point<std::chrono::system_clock, D>) noexcept;
+
+#if __cplusplus >= 201703L
+    int encode(std::string_view) noexcept;
+
+    template < typename T >
+    int encode(const std::optional<T> &) noexcept;
+#endif
+
+#if __cplusplus >= 202002L
+    template < typename T, size_t N >
+    int encode(std::span<T, N>) noexcept;
+#endif
+
+#if __cplusplus >= 201703L
+    template < typename T >
+    auto encode(const T &) noexcept
+      -> decltype(mpack_schema(static_cast<const T *>(nullptr)), int());
+#endif
 
     int encode_nil() noexcept;
     int encode_true() noexcept;
     int encode_false() noexcept;
+
+    int encode_key(string) noexcept;
+
+    template < typename T, typename A >
+    int encode_key(const std::basic_string<char, T, A> &) noexcept;
+
+#if __cplusplus >= 201703L
+    int encode_key(std::string_view) noexcept;
+#endif
+
+    template < typename T >
+    int encode_key(const T &) noexcept;
+
+    int encode_array_begin(size_t &) noexcept;
+    int encode_array_end(size_t, size_t) noexcept;
+    int encode_map_begin(size_t &) noexcept;
+    int encode_map_end(size_t, size_t) noexcept;
+    int compact(size_t) noexcept;
+
+  private:
+    template < typename T >
+    int encode_contiguous(const T *, size_t) noexcept;
+
+    template < typename T >
+    int encode_contiguous(const T *, size_t, std::true_type) noexcept;
+
+    template < typename T >
+    int encode_contiguous(const T *, size_t, std::false_type) noexcept;
+
+    template < typename Iterator >
+    int encode_sequence(Iterator, Iterator, size_t) noexcept;
+
+    template < typename Iterator >
+    int encode_mapping(Iterator, Iterator, size_t) noexcept;
+
+    template < typename Tuple, size_t... I >
+    int encode_tuple(const Tuple &, std::index_sequence<I...>) noexcept;
+
+    template < typename S, typename Tuple, size_t... I >
+    int encode_struct(const S &, const Tuple &, std::index_sequence<I...>) noexcept;
+
+    template < typename S >
+    int encode_key(const S &, size_t) noexcept;
   };
 
+  namespace detail {
+
+    template < typename T >
+    using is_bulk_encodable = std::integral_constant<bool,
+      std::is_arithmetic<T>::value && !std::is_same<T, bool>::value && (sizeof(T) <= 8)
+    >;
+
+    inline char *store_uint8(char *p, uint8_t x) noexcept
+    {
+      p[0] = static_cast<char>(x);
+      return p + 1;
+    }
+
+    inline char *store_uint16(char *p, uint16_t x) noexcept
+    {
+      p[0] = static_cast<char>(x >> 8);
+      p[1] = static_cast<char>(x);
+      return p + 2;
+    }
+
+    inline char *store_uint32(char *p, uint32_t x) noexcept
+    {
+      p[0] = static_cast<char>(x >> 24);
+      p[1] = static_cast<char>(x >> 16);
+      p[2] = static_cast<char>(x >> 8);
+      p[3] = static_cast<char>(x);
+      return p + 4;
+    }
+
+    inline char *store_uint64(char *p, uint64_t x) noexcept
+    {
+      p = store_uint32(p, static_cast<uint32_t>(x >> 32));
+      return store_uint32(p, static_cast<uint32_t>(x));
+    }
+
+    inline char *store_tag(char *p, int tag) noexcept
+    { return store_uint8(p, static_cast<uint8_t>(tag)); }
+
+    // Mirrors the format selection of mpack_encode_unsigned.
+    inline char *store_unsigned(char *p, unsigned long x) noexcept
+    {
+      if (x <= INT8_MAX) {
+        return store_uint8(p, x);
+      }
+
+      if (x <= UINT8_MAX) {
+        return store_uint8(store_tag(p, MPACK_UINT8), x);
+      }
+
+      if (x <= UINT16_MAX) {
+        return store_uint16(store_tag(p, MPACK_UINT16), x);
+      }
+
+      if (x <= UINT32_MAX) {
+        return store_uint32(store_tag(p, MPACK_UINT32), x);
+      }
+
+      return store_uint64(store_tag(p, MPACK_UINT64), x);
+    }
+
+    // Mirrors the format selection of mpack_encode_signed.
+    inline char *store_signed(char *p, signed long x) noexcept
+    {
+      if (x >= 0) {
+        return store_unsigned(p, x);
+      }
+
+      if (x >= -31) {
+        return store_uint8(p, x);
+      }
+
+      if (x >= INT8_MIN) {
+        return store_uint8(store_tag(p, MPACK_INT8), x);
+      }
+
+      if (x >= INT16_MIN) {
+        return store_uint16(store_tag(p, MPACK_INT16), x);
+      }
+
+      if (x >= INT32_MIN) {
+        return store_uint32(store_tag(p, MPACK_INT32), x);
+      }
+
+      return store_uint64(store_tag(p, MPACK_INT64), x);
+    }
+
+    inline char *store(char *p, float x) noexcept
+    {
+      union { uint32_t u; float f; } var;
+      var.f = x;
+      return store_uint32(store_tag(p, MPACK_FLOAT32), var.u);
+    }
+
+    inline char *store(char *p, double x) noexcept
+    {
+      union { uint64_t u; double f; } var;
+      var.f = x;
+      return store_uint64(store_tag(p, MPACK_FLOAT64), var.u);
+    }
+
+    template < typename T >
+    inline typename std::enable_if<std::is_signed<T>::value && std::is_integral<T>::value, char *>::type
+    store(char *p, T x) noexcept
+    { return store_signed(p, x); }
+
+    template < typename T >
+    inline typename std::enable_if<std::is_unsigned<T>::value, char *>::type
+    store(char *p, T x) noexcept
+    { return store_unsigned(p, x); }
+
+    template < typename K, typename V, typename C, typename A >
+    inline void reserve(std::map<K, V, C, A> &, size_t) noexcept
+    { }
+
+    template < typename K, typename V, typename H, typename E, typename A >
+    inline void reserve(std::unordered_map<K, V, H, E, A> &value, size_t size)
+    { value.reserve(size); }
+
+    // Elements that take an allocator are built with the one of their
+    // container, so the strings of an arena vector come from the same arena.
+    template < typename T, typename A >
+    inline T make_element(const A &allocator, std::true_type)
+    { return T(allocator); }
+
+    template < typename T, typename A >
+    inline T make_element(const A &, std::false_type)
+    { return T(); }
+
+    template < typename T, typename A >
+    inline T make_element(const A &allocator)
+    { return make_element<T>(allocator, std::uses_allocator<T, A>()); }
+
+#if __cplusplus >= 201703L
+    constexpr uint32_t hash(const char *data, size_t size, uint32_t seed) noexcept
+    {
+      uint32_t h = 2166136261U ^ seed;
+
+      for (size_t i = 0; i != size; ++i) {
+        h ^= static_cast<uint8_t>(data[i]);
+        h *= 16777619U;
+      }
+
+      return h ^ (h >> 15);
+    }
+
+    constexpr size_t length(const char *s) noexcept
+    {
+      size_t n = 0;
+
+      while (s[n] != '\0') {
+        ++n;
+      }
+
+      return n;
+    }
+
+    template < size_t N >
+    constexpr size_t schema_size(const char *const (&fields)[N]) noexcept
+    {
+      size_t size = (N <= 15) ? 1 : 3;
+
+      for (size_t i = 0; i != N; ++i) {
+        size += length(fields[i]) + ((length(fields[i]) <= 15) ? 1 : 2);
+      }
+
+      return size;
+    }
+
+    constexpr size_t slot_count(size_t n) noexcept
+    {
+      size_t m = 1;
+
+      while (m < (8 * n)) {
+        m <<= 1;
+      }
+
+      return m;
+    }
+
+    // Compile-time description of a struct declared with MPACK_DEFINE: the
+    // encoded container header followed by the encoded field names, and a
+    // perfect hash of the names to their field index.
+    template < size_t N, size_t Size >
+    class schema {
+    public:
+      static constexpr size_t count = N;
+      static constexpr size_t slots = slot_count(N);
+
+      bool keyed;
+      bool valid;
+      uint32_t seed;
+      size_t header;
+      size_t offsets[N + 1];
+      size_t names[N];
+      uint16_t table[slots];
+      char bytes[Size];
+
+      constexpr schema(bool keyed, const char *const (&fields)[N]) noexcept:
+        keyed(keyed),
+        valid(false),
+        seed(0),
+        header((N <= 15) ? 1 : 3),
+        offsets(),
+        names(),
+        table(),
+        bytes()
+      {
+        static_assert(N <= UINT16_MAX, "too many fields");
+        size_t p = 0;
+
+        if (N <= 15) {
+          bytes[p++] = static_cast<char>((keyed ? MPACK_FIXMAP : MPACK_FIXARRAY) | N);
+        }
+        else {
+          bytes[p++] = static_cast<char>(keyed ? MPACK_MAP16 : MPACK_ARRAY16);
+          bytes[p++] = static_cast<char>(N >> 8);
+          bytes[p++] = static_cast<char>(N);
+        }
+
+        for (size_t i = 0; i != N; ++i) {
+          const size_t n = length(fields[i]);
+          offsets[i] = p;
+
+          if (n <= 15) {
+            bytes[p++] = static_cast<char>(MPACK_FIXSTR | n);
+          }
+          else {
+            bytes[p++] = static_cast<char>(MPACK_STR8);
+            bytes[p++] = static_cast<char>(n);
+          }
+
+          names[i] = p;
+
+          for (size_t j = 0; j != n; ++j) {
+            bytes[p++] = fields[i][j];
+          }
+        }
+
+        offsets[N] = p;
+
+        // Searches for a seed that maps every name to a distinct slot, with 8
+        // slots per field a few attempts are usually enough. Only duplicate
+        // names should leave the schema invalid.
+        for (uint32_t s = 0; (s != 4096) && !valid; ++s) {
+          for (size_t k = 0; k != slots; ++k) {
+            table[k] = 0;
+          }
+
+          valid = true;
+          seed = s;
+
+          for (size_t i = 0; (i != N) && valid; ++i) {
+            const size_t k = hash(bytes + names[i], offsets[i + 1] - names[i], s) & (slots - 1);
+
+            if (table[k] != 0) {
+              valid = false;
+            }
+            else {
+              table[k] = i + 1;
+            }
+          }
+        }
+      }
+
+      size_t key_size(size_t index) const noexcept
+      { return offsets[index + 1] - offsets[index]; }
+
+      // Returns the index of the field named by data, or N if there is none.
+      size_t find(const char *data, size_t size) const noexcept
+      {
+        const size_t i = table[hash(data, size, seed) & (slots - 1)];
+
+        if ((i != 0) &&
+            ((offsets[i] - names[i - 1]) == size) &&
+            (std::memcmp(bytes + names[i - 1], data, size) == 0)) {
+          return i - 1;
+        }
+
+        return N;
+      }
+
+      // Returns index if the encoded key of this field is found at pos, or N
+      // otherwise.
+      size_t match(const char *pos, const char *end, size_t index) const noexcept
+      {
+        if ((index < N) &&
+            (static_cast<size_t>(end - pos) >= key_size(index)) &&
+            (std::memcmp(pos, bytes + offsets[index], key_size(index)) == 0)) {
+          return index;
+        }
+
+        return N;
+      }
+    };
+
+    template < typename T >
+    struct schema_of {
+      static constexpr auto value = mpack_schema(static_cast<const T *>(nullptr));
+    };
+#endif
+
+  }
+
+  // Exact number of bytes produced by encoding a value, or zero if the value
+  // cannot be encoded. The scalar overloads mirror the C mpack_sizeof_*
+  // functions and can be evaluated at compile time. Like them they assume
+  // an encoder without MPACK_ENCODE_FIXED_WIDTH.
+  constexpr size_t encoded_size(std::nullptr_t) noexcept;
+  constexpr size_t encoded_size(bool) noexcept;
+  constexpr size_t encoded_size(signed char) noexcept;
+  constexpr size_t encoded_size(signed short) noexcept;
+  constexpr size_t encoded_size(signed int) noexcept;
+  constexpr size_t encoded_size(signed long) noexcept;
+  constexpr size_t encoded_size(unsigned char) noexcept;
+  constexpr size_t encoded_size(unsigned short) noexcept;
+  constexpr size_t encoded_size(unsigned int) noexcept;
+  constexpr size_t encoded_size(unsigned long) noexcept;
+  constexpr size_t encoded_size(float) noexcept;
+  constexpr size_t encoded_size(double) noexcept;
+  constexpr size_t encoded_size(string) noexcept;
+  constexpr size_t encoded_size(binary) noexcept;
+  constexpr size_t encoded_size(array) noexcept;
+  constexpr size_t encoded_size(map) noexcept;
+  constexpr size_t encoded_size(extended) noexcept;
+  constexpr size_t encoded_size(const timespec &) noexcept;
+
+  template < typename T, typename A >
+  constexpr size_t encoded_size(const std::vector<T, A> &) noexcept;
+
+  template < typename T, size_t N >
+  constexpr size_t encoded_size(const std::array<T, N> &) noexcept;
+
+  template < typename K, typename V, typename C, typename A >
+  size_t encoded_size(const std::map<K, V, C, A> &) noexcept;
+
+  template < typename K, typename V, typename H, typename E, typename A >
+  size_t encoded_size(const std::unordered_map<K, V, H, E, A> &) noexcept;
+
+  template < typename T, typename A >
+  constexpr size_t encoded_size(const std::basic_string<char, T, A> &) noexcept;
+
+  template < typename T, typename U >
+  constexpr size_t encoded_size(const std::pair<T, U> &) noexcept;
+
+  template < typename... T >
+  constexpr size_t encoded_size(const std::tuple<T...> &) noexcept;
+
+  template < typename D >
+  constexpr size_t encoded_size(std::chrono::time_point<std::chrono::system_clock, D>) noexcept;
+
+#if __cplusplus >= 201703L
+  constexpr size_t encoded_size(std::string_view) noexcept;
+
+  template < typename T >
+  constexpr size_t encoded_size(const std::optional<T> &) noexcept;
+
+  template < typename T >
+  constexpr auto encoded_size(const T &) noexcept
+    -> decltype(mpack_schema(static_cast<const T *>(nullptr)), size_t());
+#endif
+
+#if __cplusplus >= 202002L
+  template < typename T, size_t N >
+  constexpr size_t encoded_size(std::span<T, N>) noexcept;
+#endif
+
+  namespace detail {
+
+    constexpr size_t add(size_t a, size_t b) noexcept
+    { return ((a == 0) || (b == 0)) ? 0 : (a + b); }
+
+    constexpr size_t unsigned_size(unsigned long x) noexcept
+    {
+      return (x <= INT8_MAX) ? 1 :
+             (x <= UINT8_MAX) ? 2 :
+             (x <= UINT16_MAX) ? 3 :
+             (x <= UINT32_MAX) ? 5 : 9;
+    }
+
+    constexpr size_t signed_size(signed long x) noexcept
+    {
+      return (x >= 0) ? unsigned_size(x) :
+             (x >= -31) ? 1 :
+             (x >= INT8_MIN) ? 2 :
+             (x >= INT16_MIN) ? 3 :
+             (x >= INT32_MIN) ? 5 : 9;
+    }
+
+    constexpr size_t string_size(size_t n) noexcept
+    {
+      return (n <= 15) ? (n + 1) :
+             (n <= UINT8_MAX) ? (n + 2) :
+             (n <= UINT16_MAX) ? (n + 3) :
+             (n <= UINT32_MAX) ? (n + 5) : 0;
+    }
+
+    constexpr size_t binary_size(size_t n) noexcept
+    {
+      return (n <= UINT8_MAX) ? (n + 2) :
+             (n <= UINT16_MAX) ? (n + 3) :
+             (n <= UINT32_MAX) ? (n + 5) : 0;
+    }
+
+    constexpr size_t header_size(size_t n) noexcept
+    {
+      return (n <= 15) ? 1 :
+             (n <= UINT16_MAX) ? 3 :
+             (n <= UINT32_MAX) ? 5 : 0;
+    }
+
+    constexpr size_t extended_size(size_t n) noexcept
+    {
+      return ((n == 1) || (n == 2) || (n == 4) || (n == 8) || (n == 16)) ? (n + 2) :
+             (n <= UINT8_MAX) ? (n + 3) :
+             (n <= UINT16_MAX) ? (n + 4) :
+             (n <= UINT32_MAX) ? (n + 6) : 0;
+    }
+
+    constexpr size_t timestamp_size(int64_t sec, long nsec) noexcept
+    {
+      return ((nsec < 0) || (nsec >= 1000000000)) ? 0 :
+             ((sec < 0) || (sec > 0x3ffffffffLL)) ? 15 :
+             ((nsec == 0) && (sec <= UINT32_MAX)) ? 6 : 10;
+    }
+
+    template < typename D >
+    constexpr timespec split_time(D d, std::chrono::seconds s) noexcept
+    {
+      return (s > d) ? split_time(d, s - std::chrono::seconds(1)) :
+             timespec{ static_cast<time_t>(s.count()),
+                       static_cast<long>(std::chrono::duration_cast<std::chrono::nanoseconds>(d - s).count()) };
+    }
+
+    // Splits a time point in seconds and nanoseconds, rounding toward the
+    // past so the nanoseconds are never negative.
+    template < typename D >
+    constexpr timespec split_time(std::chrono::time_point<std::chrono::system_clock, D> value) noexcept
+    {
+      return split_time(value.time_since_epoch(),
+                        std::chrono::duration_cast<std::chrono::seconds>(value.time_since_epoch()));
+    }
+
+    template < typename Iterator >
+    constexpr size_t sequence_size(Iterator first, Iterator last, size_t size) noexcept
+    {
+      size_t n = header_size(size);
+
+      for (; first != last; ++first) {
+        n = add(n, encoded_size(*first));
+      }
+
+      return n;
+    }
+
+    template < typename Iterator >
+    constexpr size_t mapping_size(Iterator first, Iterator last, size_t size) noexcept
+    {
+      size_t n = header_size(size);
+
+      for (; first != last; ++first) {
+        n = add(n, encoded_size(first->first));
+        n = add(n, encoded_size(first->second));
+      }
+
+      return n;
+    }
+
+    template < typename Tuple, size_t... I >
+    constexpr size_t tuple_size(const Tuple &value, std::index_sequence<I...>) noexcept
+    {
+      const size_t sizes[] = { header_size(sizeof...(I)), encoded_size(std::get<I>(value))... };
+      size_t n = 0;
+
+      for (size_t i = 0; i != (sizeof...(I) + 1); ++i) {
+        n = (i == 0) ? sizes[i] : add(n, sizes[i]);
+      }
+
+      return n;
+    }
+
+    // Defined only for types whose encoding has an upper bound known at compile
+    // time.
+    template < typename T, typename = void >
+    struct max_size;
+
+    template < >
+    struct max_size<std::nullptr_t> : std::integral_constant<size_t, 1> { };
+
+    template < >
+    struct max_size<bool> : std::integral_constant<size_t, 1> { };
+
+    template < >
+    struct max_size<float> : std::integral_constant<size_t, 5> { };
+
+    template < >
+    struct max_size<double> : std::integral_constant<size_t, 9> { };
+
+    template < typename T >
+    struct max_size<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type> :
+      std::integral_constant<size_t, 1 + sizeof(T)> { };
+
+    template < typename T, size_t N >
+    struct max_size<std::array<T, N>> :
+      std::integral_constant<size_t, header_size(N) + (N * max_size<T>::value)> { };
+
+    template < typename... T >
+    struct max_size_sum;
+
+    template < >
+    struct max_size_sum<> : std::integral_constant<size_t, 0> { };
+
+    template < typename T, typename... U >
+    struct max_size_sum<T, U...> :
+      std::integral_constant<size_t,
+        max_size<typename std::remove_cv<typename std::remove_reference<T>::type>::type>::value +
+        max_size_sum<U...>::value> { };
+
+    template < typename T, typename U >
+    struct max_size<std::pair<T, U>> :
+      std::integral_constant<size_t, 1 + max_size_sum<T, U>::value> { };
+
+    template < typename... T >
+    struct max_size<std::tuple<T...>> :
+      std::integral_constant<size_t, header_size(sizeof...(T)) + max_size_sum<T...>::value> { };
+
+    template < >
+    struct max_size<timespec> : std::integral_constant<size_t, 15> { };
+
+    template < typename D >
+    struct max_size<std::chrono::time_point<std::chrono::system_clock, D>> : std::integral_constant<size_t, 15> { };
+
+#if __cplusplus >= 201703L
+    template < typename T >
+    struct max_size<std::optional<T>> :
+      std::integral_constant<size_t, (max_size<T>::value > 1) ? max_size<T>::value : 1> { };
+
+    template < typename Tuple >
+    struct fields_max_size;
+
+    template < typename... T >
+    struct fields_max_size<std::tuple<T...>> : max_size_sum<T...> { };
+
+    template < typename T >
+    struct max_size<T, std::void_t<decltype(mpack_schema(static_cast<const T *>(nullptr)))>> :
+      std::integral_constant<size_t,
+        (schema_of<T>::value.keyed ? schema_of<T>::value.offsets[schema_of<T>::value.count] : schema_of<T>::value.header) +
+        fields_max_size<decltype(mpack_fields(std::declval<const T &>()))>::value> { };
+
+    template < typename S, typename Tuple, size_t... I >
+    constexpr size_t struct_size(const S &schema, const Tuple &fields, std::index_sequence<I...>) noexcept
+    {
+      size_t n = schema.keyed ? schema.offsets[S::count] : schema.header;
+      ((n = add(n, encoded_size(std::get<I>(fields)))), ...);
+      return n;
+    }
+#endif
+
+  }
+
+  // Upper bound of the encoded size of any value of type T, only defined for
+  // fixed-shape types (scalars, std::array, std::pair, std::tuple,
+  // std::optional and structs declared with MPACK_DEFINE made of those).
+  template < typename T >
+  constexpr size_t max_encoded_size() noexcept
+  { return detail::max_size<typename std::remove_cv<T>::type>::value; }
+
+  constexpr size_t encoded_size(std::nullptr_t) noexcept
+  { return 1; }
+
+  constexpr size_t encoded_size(bool) noexcept
+  { return 1; }
+
+  constexpr size_t encoded_size(signed char value) noexcept
+  { return detail::signed_size(value); }
+
+  constexpr size_t encoded_size(signed short value) noexcept
+  { return detail::signed_size(value); }
+
+  constexpr size_t encoded_size(signed int value) noexcept
+  { return detail::signed_size(value); }
+
+  constexpr size_t encoded_size(signed long value) noexcept
+  { return detail::signed_size(value); }
+
+  constexpr size_t encoded_size(unsigned char value) noexcept
+  { return detail::unsigned_size(value); }
+
+  constexpr size_t encoded_size(unsigned short value) noexcept
+  { return detail::unsigned_size(value); }
+
+  constexpr size_t encoded_size(unsigned int value) noexcept
+  { return detail::unsigned_size(value); }
+
+  constexpr size_t encoded_size(unsigned long value) noexcept
+  { return detail::unsigned_size(value); }
+
+  constexpr size_t encoded_size(float) noexcept
+  { return 5; }
+
+  constexpr size_t encoded_size(double) noexcept
+  { return 9; }
+
+  constexpr size_t encoded_size(string value) noexcept
+  { return detail::string_size(value.size); }
+
+  constexpr size_t encoded_size(binary value) noexcept
+  { return detail::binary_size(value.size); }
+
+  constexpr size_t encoded_size(array value) noexcept
+  { return detail::header_size(value.size); }
+
+  constexpr size_t encoded_size(map value) noexcept
+  { return detail::header_size(value.size); }
+
+  constexpr size_t encoded_size(extended value) noexcept
+  { return detail::extended_size(value.size); }
+
+  template < typename T, typename A >
+  constexpr size_t encoded_size(const std::vector<T, A> &value) noexcept
+  { return detail::sequence_size(value.begin(), value.end(), value.size()); }
+
+  template < typename T, size_t N >
+  constexpr size_t encoded_size(const std::array<T, N> &value) noexcept
+  { return detail::sequence_size(value.begin(), value.end(), N); }
+
+  template < typename K, typename V, typename C, typename A >
+  size_t encoded_size(const std::map<K, V, C, A> &value) noexcept
+  { return detail::mapping_size(value.begin(), value.end(), value.size()); }
+
+  template < typename K, typename V, typename H, typename E, typename A >
+  size_t encoded_size(const std::unordered_map<K, V, H, E, A> &value) noexcept
+  { return detail::mapping_size(value.begin(), value.end(), value.size()); }
+
+  template < typename T, typename A >
+  constexpr size_t encoded_size(const std::basic_string<char, T, A> &value) noexcept
+  { return detail::string_size(value.size()); }
+
+  template < typename T, typename U >
+  constexpr size_t encoded_size(const std::pair<T, U> &value) noexcept
+  { return detail::tuple_size(value, std::make_index_sequence<2>()); }
+
+  template < typename... T >
+  constexpr size_t encoded_size(const std::tuple<T...> &value) noexcept
+  { return detail::tuple_size(value, std::index_sequence_for<T...>()); }
+
+  constexpr size_t encoded_size(const timespec &value) noexcept
+  { return detail::timestamp_size(value.tv_sec, value.tv_nsec); }
+
+  template < typename D >
+  constexpr size_t encoded_size(std::chrono::time_point<std::chrono::system_clock, D> value) noexcept
+  { return encoded_size(detail::split_time(value)); }
+
+#if __cplusplus >= 201703L
+  constexpr size_t encoded_size(std::string_view value) noexcept
+  { return detail::string_size(value.size()); }
+
+  template < typename T >
+  constexpr size_t encoded_size(const std::optional<T> &value) noexcept
+  { return value ? encoded_size(*value) : 1; }
+
+  template < typename T >
+  constexpr auto encoded_size(const T &value) noexcept
+    -> decltype(mpack_schema(static_cast<const T *>(nullptr)), size_t())
+  {
+    return detail::struct_size(detail::schema_of<T>::value, mpack_fields(value),
+                               std::make_index_sequence<detail::schema_of<T>::value.count>());
+  }
+#endif
+
+#if __cplusplus >= 202002L
+  template < typename T, size_t N >
+  constexpr size_t encoded_size(std::span<T, N> value) noexcept
+  { return detail::sequence_size(value.begin(), value.end(), value.size()); }
+#endif
+
+  template < typename T, typename A >
+  int encoder::encode(const std::vector<T, A> &value) noexcept
+  { return this->encode_contiguous(value.data(), value.size()); }
+
+  template < typename A >
+  int encoder::encode(const std::vector<bool, A> &value) noexcept
+  { return this->encode_sequence(value.begin(), value.end(), value.size()); }
+
+  template < typename T, size_t N >
+  int encoder::encode(const std::array<T, N> &value) noexcept
+  { return this->encode_contiguous(value.data(), N); }
+
+  template < typename K, typename V, typename C, typename A >
+  int encoder::encode(const std::map<K, V, C, A> &value) noexcept
+  { return this->encode_mapping(value.begin(), value.end(), value.size()); }
+
+  template < typename K, typename V, typename H, typename E, typename A >
+  int encoder::encode(const std::unordered_map<K, V, H, E, A> &value) noexcept
+  { return this->encode_mapping(value.begin(), value.end(), value.size()); }
+
+  template < typename T, typename A >
+  int encoder::encode(const std::basic_string<char, T, A> &value) noexcept
+  { return this->encode(string{ value.data(), value.size() }); }
+
+  template < typename T, typename A >
+  int encoder::encode_key(const std::basic_string<char, T, A> &value) noexcept
+  { return this->encode_key(string{ value.data(), value.size() }); }
+
+#if __cplusplus >= 201703L
+  inline int encoder::encode_key(std::string_view value) noexcept
+  { return this->encode_key(string{ value.data(), value.size() }); }
+#endif
+
+  template < typename T >
+  int encoder::encode_key(const T &value) noexcept
+  { return this->encode(value); }
+
+  template < typename T, typename U >
+  int encoder::encode(const std::pair<T, U> &value) noexcept
+  { return this->encode_tuple(value, std::make_index_sequence<2>()); }
+
+  template < typename... T >
+  int encoder::encode(const std::tuple<T...> &value) noexcept
+  { return this->encode_tuple(value, std::index_sequence_for<T...>()); }
+
+  template < typename D >
+  int encoder::encode(std::chrono::time_point<std::chrono::system_clock, D> value) noexcept
+  { return this->encode(detail::split_time(value)); }
+
+#if __cplusplus >= 201703L
+  inline int encoder::encode(std::string_view value) noexcept
+  { return this->encode(string{ value.data(), value.size() }); }
+
+  template < typename T >
+  int encoder::encode(const std::optional<T> &value) noexcept
+  { return value ? this->encode(*value) : this->encode_nil(); }
+#endif
+
+#if __cplusplus >= 202002L
+  template < typename T, size_t N >
+  int encoder::encode(std::span<T, N> value) noexcept
+  { return this->encode_contiguous(value.data(), value.size()); }
+#endif
+
+  template < typename T >
+  int encoder::encode_contiguous(const T *data, size_t size) noexcept
+  { return this->encode_contiguous(data, size, detail::is_bulk_encodable<T>()); }
+
+  template < typename T >
+  int encoder::encode_contiguous(const T *data, size_t size, std::true_type) noexcept
+  {
+    const size_t start = mpack_encoder_offset(this);
+
+    if (std::is_same<T, double>::value && (this->flags & MPACK_ENCODE_COMPACT_FLOAT)) {
+      return mpack_encode_double_array(this, reinterpret_cast<const double *>(data), size);
+    }
+
+    if (this->encode(array{ size }) < 0) {
+      return -1;
+    }
+
+    // All elements are encoded straight into the buffer when it can hold the
+    // largest possible encoding of the range, otherwise each element goes
+    // through the regular overloads so the encoder still accounts for the
+    // bytes that did not fit, or pins integers to their fixed width.
+    if (!(this->flags & MPACK_ENCODE_FIXED_WIDTH) && (this->pos <= this->end) &&
+        (size <= (static_cast<size_t>(this->end - this->pos) / max_encoded_size<T>()))) {
+      char *p = this->pos;
+
+      for (size_t i = 0; i != size; ++i) {
+        p = detail::store(p, data[i]);
+      }
+
+      this->pos = p;
+    }
+    else {
+      for (size_t i = 0; i != size; ++i) {
+        this->encode(data[i]);
+      }
+    }
+
+    return mpack_encoder_offset(this) - start;
+  }
+
+  template < typename T >
+  int encoder::encode_contiguous(const T *data, size_t size, std::false_type) noexcept
+  { return this->encode_sequence(data, data + size, size); }
+
+  template < typename Iterator >
+  int encoder::encode_sequence(Iterator first, Iterator last, size_t size) noexcept
+  {
+    int n;
+    int total;
+
+    if ((total = this->encode(array{ size })) < 0) {
+      return -1;
+    }
+
+    for (; first != last; ++first) {
+      if ((n = this->encode(*first)) < 0) {
+        return -1;
+      }
+      total += n;
+    }
+
+    return total;
+  }
+
+  template < typename Iterator >
+  int encoder::encode_mapping(Iterator first, Iterator last, size_t size) noexcept
+  {
+    int n;
+    int total;
+
+    if ((total = this->encode(map{ size })) < 0) {
+      return -1;
+    }
+
+    for (; first != last; ++first) {
+      if ((n = this->encode_key(first->first)) < 0) {
+        return -1;
+      }
+      total += n;
+
+      if ((n = this->encode(first->second)) < 0) {
+        return -1;
+      }
+      total += n;
+    }
+
+    return total;
+  }
+
+  template < typename Tuple, size_t... I >
+  int encoder::encode_tuple(const Tuple &value, std::index_sequence<I...>) noexcept
+  {
+    int total;
+    bool ok = true;
+
+    if ((total = this->encode(array{ sizeof...(I) })) < 0) {
+      return -1;
+    }
+
+    const int sizes[] = { 0, this->encode(std::get<I>(value))... };
+
+    for (int n : sizes) {
+      ok = ok && (n >= 0);
+      total += n;
+    }
+
+    return ok ? total : -1;
+  }
+
+  inline size_t decoder::reserve_hint(size_t size) const noexcept
+  {
+    const size_t left = this->end - this->pos;
+
+    if (size > left) {
+      size = left;
+    }
+
+    if (size > this->reserve_limit) {
+      size = this->reserve_limit;
+    }
+
+    return size;
+  }
+
+  template < typename T, typename A >
+  int decoder::decode(std::vector<T, A> &value)
+  {
+    array header;
+    MPACK_DECODE_BEGIN(this);
+    MPACK_DECODE_ASSERT(this->decode(header));
+
+    if (value.size() > header.size) {
+      value.erase(value.begin() + header.size, value.end());
+    }
+
+    value.reserve(this->reserve_hint(header.size));
+
+    for (size_t i = 0; i != header.size; ++i) {
+      if (i == value.size()) {
+        value.emplace_back(detail::make_element<T>(value.get_allocator()));
+      }
+      MPACK_DECODE_ASSERT(this->decode(value[i]));
+    }
+
+    MPACK_DECODE_END(this);
+  }
+
+  template < typename A >
+  int decoder::decode(std::vector<bool, A> &value)
+  {
+    array header;
+    bool x;
+    MPACK_DECODE_BEGIN(this);
+    MPACK_DECODE_ASSERT(this->decode(header));
+
+    value.clear();
+    value.reserve(this->reserve_hint(header.size));
+
+    for (size_t i = 0; i != header.size; ++i) {
+      MPACK_DECODE_ASSERT(this->decode(x));
+      value.push_back(x);
+    }
+
+    MPACK_DECODE_END(this);
+  }
+
+  template < typename K, typename V, typename C, typename A >
+  int decoder::decode(std::map<K, V, C, A> &value)
+  { return this->decode_mapping(value); }
+
+  template < typename K, typename V, typename H, typename E, typename A >
+  int decoder::decode(std::unordered_map<K, V, H, E, A> &value)
+  { return this->decode_mapping(value); }
+
+  template < typename M >
+  int decoder::decode_mapping(M &value)
+  {
+    map header;
+    M spare { value.get_allocator() };
+    typename M::key_type key = detail::make_element<typename M::key_type>(value.get_allocator());
+    typename M::mapped_type mapped = detail::make_element<typename M::mapped_type>(value.get_allocator());
+    MPACK_DECODE_BEGIN(this);
+    MPACK_DECODE_ASSERT(this->decode(header));
+
+    // The nodes of the previous content are recycled, with C++17 node handles
+    // keys and values are decoded in place so the memory they hold is reused
+    // as well.
+    spare.swap(value);
+    detail::reserve(value, this->reserve_hint(header.size));
+
+    for (size_t i = 0; i != header.size; ++i) {
+#if __cplusplus >= 201703L
+      if (!spare.empty()) {
+        auto node = spare.extract(spare.begin());
+        MPACK_DECODE_ASSERT(this->decode(node.key()));
+        MPACK_DECODE_ASSERT(this->decode(node.mapped()));
+        value.insert(std::move(node));
+        continue;
+      }
+#endif
+      MPACK_DECODE_ASSERT(this->decode(key));
+      MPACK_DECODE_ASSERT(this->decode(mapped));
+      value.emplace(std::move(key), std::move(mapped));
+    }
+
+    MPACK_DECODE_END(this);
+  }
+
+  template < typename T, typename A >
+  int decoder::decode(std::basic_string<char, T, A> &value)
+  {
+    string x;
+    int size;
+
+    if ((size = this->decode(x)) > 0) {
+      value.assign(x.data, x.size);
+    }
+
+    return size;
+  }
+
+  template < typename D >
+  int decoder::decode(std::chrono::time_point<std::chrono::system_clock, D> &value) noexcept
+  {
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+    using std::chrono::seconds;
+    timespec x;
+    MPACK_DECODE_BEGIN(this);
+    MPACK_DECODE_ASSERT(this->decode(x));
+
+    if ((x.tv_sec >= duration_cast<seconds>(D::max()).count()) ||
+        (x.tv_sec <= duration_cast<seconds>(D::min()).count())) {
+      MPACK_DECODE_FAIL(ERANGE);
+    }
+
+    value = std::chrono::time_point<std::chrono::system_clock, D>(
+      duration_cast<D>(seconds(x.tv_sec)) + duration_cast<D>(nanoseconds(x.tv_nsec))
+    );
+    MPACK_DECODE_END(this);
+  }
+
+#if __cplusplus >= 201703L
+  template < typename T >
+  int decoder::decode(std::optional<T> &value)
+  {
+    if ((this->pos != this->end) && (static_cast<uint8_t>(*this->pos) == MPACK_NIL)) {
+      value.reset();
+      return this->decode_nil();
+    }
+
+    if (!value) {
+      value.emplace();
+    }
+
+    return this->decode(*value);
+  }
+
+  template < typename T >
+  auto encoder::encode(const T &value) noexcept
+    -> decltype(mpack_schema(static_cast<const T *>(nullptr)), int())
+  {
+    using schema = detail::schema_of<T>;
+    static_assert(schema::value.valid, "duplicate field names");
+    return this->encode_struct(schema::value, mpack_fields(value), std::make_index_sequence<schema::value.count>());
+  }
+
+  template < typename S, typename Tuple, size_t... I >
+  int encoder::encode_struct(const S &schema, const Tuple &fields, std::index_sequence<I...>) noexcept
+  {
+    const size_t start = mpack_encoder_offset(this);
+    bool ok;
+
+    mpack_encoder_write_bytes(this, schema.bytes, schema.header);
+
+    if (schema.keyed) {
+      ok = (((this->encode_key(schema, I) >= 0) && (this->encode(std::get<I>(fields)) >= 0)) && ...);
+    }
+    else {
+      ok = ((this->encode(std::get<I>(fields)) >= 0) && ...);
+    }
+
+    return ok ? static_cast<int>(mpack_encoder_offset(this) - start) : -1;
+  }
+
+  // Keys are written from their precomputed encoding unless they have to go
+  // through the session dictionary.
+  template < typename S >
+  int encoder::encode_key(const S &schema, size_t i) noexcept
+  {
+    if (this->dict) {
+      return this->encode_key(string{ schema.bytes + schema.names[i], schema.offsets[i + 1] - schema.names[i] });
+    }
+
+    mpack_encoder_write_bytes(this, schema.bytes + schema.offsets[i], schema.key_size(i));
+    return static_cast<int>(schema.key_size(i));
+  }
+
+  template < typename T >
+  auto decoder::decode(T &value)
+    -> decltype(mpack_schema(static_cast<const T *>(nullptr)), int())
+  {
+    using schema = detail::schema_of<T>;
+    static_assert(schema::value.valid, "duplicate field names");
+    return this->decode_struct(schema::value, mpack_fields(value), std::make_index_sequence<schema::value.count>());
+  }
+
+  template < size_t I, typename Tuple >
+  int decoder::decode_field(decoder &self, Tuple &fields)
+  { return self.decode(std::get<I>(fields)); }
+
+  template < typename S, typename Tuple, size_t... I >
+  int decoder::decode_struct(const S &schema, Tuple fields, std::index_sequence<I...>)
+  {
+    static constexpr int (*decoders[])(decoder &, Tuple &) = { &decoder::decode_field<I, Tuple>... };
+    array list;
+    map dict;
+    string key;
+    size_t i;
+    size_t index;
+    size_t next = 0;
+    MPACK_DECODE_BEGIN(this);
+
+    if (!schema.keyed) {
+      MPACK_DECODE_ASSERT(this->decode(list));
+
+      for (i = 0; i != list.size; ++i) {
+        if (i < S::count) {
+          MPACK_DECODE_ASSERT(decoders[i](*this, fields));
+        }
+        else {
+          MPACK_DECODE_ASSERT(this->skip());
+        }
+      }
+    }
+    else {
+      MPACK_DECODE_ASSERT(this->decode(dict));
+
+      for (i = 0; i != dict.size; ++i) {
+        // Fields are expected in declaration order, the encoded key of the
+        // next field is compared with the input before falling back to a
+        // lookup of the decoded key.
+        if ((index = schema.match(this->pos, this->end, next)) != S::count) {
+          this->pos += schema.key_size(index);
+        }
+        else {
+          MPACK_DECODE_ASSERT(this->decode(key));
+          index = schema.find(key.data, key.size);
+        }
+
+        if (index == S::count) {
+          MPACK_DECODE_ASSERT(this->skip());
+        }
+        else {
+          MPACK_DECODE_ASSERT(decoders[index](*this, fields));
+          next = index + 1;
+        }
+      }
+    }
+
+    MPACK_DECODE_END(this);
+  }
+#endif
+
+  template < typename T >
+  arena_allocator<T>::arena_allocator(arena &resource) noexcept:
+    owner(&resource)
+  { }
+
+  template < typename T >
+  template < typename U >
+  arena_allocator<T>::arena_allocator(const arena_allocator<U> &other) noexcept:
+    owner(other.resource())
+  { }
+
+  template < typename T >
+  T *arena_allocator<T>::allocate(size_t count)
+  {
+    static_assert(alignof(T) <= MPACK_ARENA_ALIGN, "arena memory is not aligned enough for this type");
+
+    if (count > (std::numeric_limits<size_t>::max() / sizeof(T))) {
+      throw std::bad_alloc();
+    }
+
+    return static_cast<T *>(this->owner->allocate(count * sizeof(T)));
+  }
+
+  template < typename T >
+  void arena_allocator<T>::deallocate(T *, size_t) noexcept
+  { }
+
+  template < typename T >
+  arena *arena_allocator<T>::resource() const noexcept
+  { return this->owner; }
+
+  template < typename T, typename U >
+  bool operator==(const arena_allocator<T> &a, const arena_allocator<U> &b) noexcept
+  { return a.resource() == b.resource(); }
+
+  template < typename T, typename U >
+  bool operator!=(const arena_allocator<T> &a, const arena_allocator<U> &b) noexcept
+  { return a.resource() != b.resource(); }
+
+#if defined(__cpp_impl_coroutine)
+  template < typename T >
+  async_reader::awaiter<T>::awaiter(async_reader &reader, T *value) noexcept:
+    reader(reader),
+    value(value)
+  { }
+
+  template < typename T >
+  bool async_reader::awaiter<T>::await_ready() noexcept
+  { return this->reader.ready(); }
+
+  template < typename T >
+  void async_reader::awaiter<T>::await_suspend(std::coroutine_handle<> handle) noexcept
+  { this->reader.waiting = handle; }
+
+  template < typename T >
+  int async_reader::awaiter<T>::await_resume() noexcept
+  {
+    const int size = this->reader.complete();
+
+    if constexpr (std::is_void<T>::value) {
+      return size;
+    }
+    else {
+      return (size <= 0) ? size : this->reader.decode(*this->value);
+    }
+  }
+
+  template < typename T >
+  async_reader::awaiter<T> async_reader::read(T &value) noexcept
+  { return awaiter<T>(*this, &value); }
+#endif
+
 }
 
 #endif /* __cplusplus */
@@ -0,0 +1,167 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+static size_t count_blocks(const struct mpack_arena_block *block)
+{
+  size_t count = 0;
+
+  for (; block; block = *reinterpret_cast<struct mpack_arena_block *const *>(block)) {
+    ++count;
+  }
+
+  return count;
+}
+
+BOOST_AUTO_TEST_CASE(test_arena_alloc)
+{
+  mpack_arena_t arena;
+  char *a;
+  char *b;
+  char *c;
+
+  mpack_arena_init(&arena, 1024);
+  BOOST_CHECK(arena.blocks == nullptr);
+
+  a = static_cast<char *>(mpack_arena_alloc(&arena, 1));
+  b = static_cast<char *>(mpack_arena_alloc(&arena, 17));
+  c = static_cast<char *>(mpack_arena_alloc(&arena, 0));
+  BOOST_REQUIRE(a && b && c);
+  BOOST_CHECK((reinterpret_cast<uintptr_t>(a) % MPACK_ARENA_ALIGN) == 0);
+  BOOST_CHECK(b == (a + MPACK_ARENA_ALIGN));
+  BOOST_CHECK(c == (b + 2 * MPACK_ARENA_ALIGN));
+  BOOST_CHECK(count_blocks(arena.blocks) == 1);
+
+  // Filling the block moves on to a new one.
+  for (int i = 0; i != 100; ++i) {
+    BOOST_REQUIRE(mpack_arena_alloc(&arena, 100));
+  }
+
+  BOOST_CHECK(count_blocks(arena.blocks) > 1);
+  BOOST_CHECK(arena.large == nullptr);
+  mpack_arena_term(&arena);
+  BOOST_CHECK(arena.blocks == nullptr);
+  BOOST_CHECK(arena.block_size == 1024);
+}
+
+BOOST_AUTO_TEST_CASE(test_arena_reset)
+{
+  mpack_arena_t arena;
+  void *first[50];
+  void *large;
+
+  mpack_arena_init(&arena, 512);
+
+  for (int i = 0; i != 50; ++i) {
+    BOOST_REQUIRE((first[i] = mpack_arena_alloc(&arena, 40)));
+  }
+
+  large = mpack_arena_alloc(&arena, 4096);
+  BOOST_REQUIRE(large);
+  BOOST_CHECK(count_blocks(arena.large) == 1);
+
+  const size_t blocks = count_blocks(arena.blocks);
+  mpack_arena_reset(&arena);
+  BOOST_CHECK(arena.blocks == nullptr);
+  BOOST_CHECK(arena.large == nullptr);
+  BOOST_CHECK(count_blocks(arena.free) == blocks);
+
+  // The same requests are served from the kept blocks, in the same order.
+  for (int request = 0; request != 3; ++request) {
+    for (int i = 0; i != 50; ++i) {
+      BOOST_REQUIRE(mpack_arena_alloc(&arena, 40) == first[i]);
+    }
+
+    BOOST_CHECK(count_blocks(arena.blocks) == blocks);
+    BOOST_CHECK(arena.free == nullptr);
+    mpack_arena_reset(&arena);
+  }
+
+  mpack_arena_term(&arena);
+}
+
+BOOST_AUTO_TEST_CASE(test_arena_copy)
+{
+  char input[64];
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+  mpack_string_t string;
+  mpack_arena_t arena;
+  const char *owned[2];
+
+  mpack_encoder_init(&encoder, input, sizeof(input));
+  mpack_encode_string(&encoder, mpack_string_t{ "hello", 5 });
+  mpack_encode_string(&encoder, mpack_string_t{ "world", 5 });
+
+  mpack_arena_init(&arena, 0);
+  BOOST_CHECK(arena.block_size == MPACK_ARENA_BLOCK_SIZE);
+  mpack_decoder_init(&decoder, input, encoder.pos - encoder.begin);
+
+  for (int i = 0; i != 2; ++i) {
+    BOOST_REQUIRE(mpack_decode_string(&decoder, &string) > 0);
+    owned[i] = static_cast<const char *>(mpack_arena_copy(&arena, string.data, string.size));
+    BOOST_REQUIRE(owned[i]);
+  }
+
+  // The input buffer is reused for the next request.
+  std::memset(input, 0, sizeof(input));
+  BOOST_CHECK(std::string(owned[0], 5) == "hello");
+  BOOST_CHECK(std::string(owned[1], 5) == "world");
+  mpack_arena_term(&arena);
+}
+
+BOOST_AUTO_TEST_CASE(test_arena_cache)
+{
+  mpack_arena_t *a;
+  mpack_arena_t *b;
+  void *ptr;
+
+  BOOST_REQUIRE((a = mpack_arena_acquire()));
+  BOOST_REQUIRE((ptr = mpack_arena_alloc(a, 100)));
+  mpack_arena_release(a);
+
+  // The thread gets its warm arena back, reset.
+  BOOST_REQUIRE((b = mpack_arena_acquire()));
+  BOOST_CHECK(b == a);
+  BOOST_CHECK(b->blocks == nullptr);
+  BOOST_CHECK(mpack_arena_alloc(b, 100) == ptr);
+
+  // Only one arena is cached per thread.
+  BOOST_REQUIRE((a = mpack_arena_acquire()));
+  BOOST_CHECK(a != b);
+  mpack_arena_release(a);
+  mpack_arena_release(b);
+  BOOST_CHECK(mpack_arena_acquire() == a);
+  mpack_arena_release(a);
+  mpack_arena_release(nullptr);
+
+  mpack_arena_cache_term();
+  mpack_arena_cache_term();
+}
@@ -124,3 +124,91 @@ BOOST_AUTO_TEST_CASE(test_encode_decode_array32)
   mpack_decoder_term(&decoder);
   mpack_encoder_term(&encoder);
 }
+
+BOOST_AUTO_TEST_CASE(test_encode_array_begin_end)
+{
+  char buffer[32] = { 0 };
+  size_t offset = 0;
+  mpack_array_t value;
+
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+
+  BOOST_CHECK(mpack_encode_nil(&encoder) == 1);
+  BOOST_CHECK(mpack_encode_array_begin(&encoder, &offset) == 5);
+  BOOST_CHECK(offset == 1);
+  BOOST_CHECK(mpack_encode_signed(&encoder, 1) == 1);
+  BOOST_CHECK(mpack_encode_signed(&encoder, 2) == 1);
+  BOOST_CHECK(mpack_encode_array_end(&encoder, offset, 2) == 0);
+  BOOST_CHECK((encoder.pos - encoder.begin) == 8);
+
+  mpack_decoder_t decoder;
+  mpack_decoder_init(&decoder, buffer + 1, 7);
+
+  value.size = 0;
+  BOOST_CHECK(mpack_decode_array(&decoder, &value) == 5);
+  BOOST_CHECK(value.size == 2);
+
+  BOOST_CHECK(mpack_encoder_compact(&encoder, offset) == 4);
+  BOOST_CHECK((encoder.pos - encoder.begin) == 4);
+
+  mpack_decoder_init(&decoder, buffer + 1, 3);
+
+  value.size = 0;
+  BOOST_CHECK(mpack_decode_array(&decoder, &value) == 1);
+  BOOST_CHECK(value.size == 2);
+  BOOST_CHECK(buffer[2] == 1);
+  BOOST_CHECK(buffer[3] == 2);
+
+  BOOST_CHECK(mpack_encode_array_end(&encoder, 0, 1) == -1);
+  BOOST_CHECK(errno == EINVAL);
+
+  mpack_decoder_term(&decoder);
+  mpack_encoder_term(&encoder);
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_array_compact_array16)
+{
+  char buffer[64] = { 0 };
+  size_t offset = 0;
+  mpack_array_t value;
+
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+
+  BOOST_CHECK(mpack_encode_array_begin(&encoder, &offset) == 5);
+  for (int i = 0; i != 20; ++i) {
+    BOOST_CHECK(mpack_encode_signed(&encoder, i) == 1);
+  }
+  BOOST_CHECK(mpack_encode_array_end(&encoder, offset, 20) == 0);
+  BOOST_CHECK(mpack_encoder_compact(&encoder, offset) == 2);
+  BOOST_CHECK((encoder.pos - encoder.begin) == 23);
+
+  mpack_decoder_t decoder;
+  mpack_decoder_init(&decoder, buffer, 23);
+
+  value.size = 0;
+  BOOST_CHECK(mpack_decode_array(&decoder, &value) == 3);
+  BOOST_CHECK(value.size == 20);
+  BOOST_CHECK(buffer[22] == 19);
+
+  mpack_decoder_term(&decoder);
+  mpack_encoder_term(&encoder);
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_array_begin_end_overflow)
+{
+  char buffer[4] = { 0 };
+  size_t offset = 0;
+
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+
+  BOOST_CHECK(mpack_encode_array_begin(&encoder, &offset) == 5);
+  BOOST_CHECK(mpack_encode_signed(&encoder, 1) == 1);
+  BOOST_CHECK(mpack_encode_array_end(&encoder, offset, 1) == 0);
+  BOOST_CHECK(mpack_encoder_compact(&encoder, offset) == 0);
+  BOOST_CHECK((encoder.pos - encoder.begin) == 6);
+
+  mpack_encoder_term(&encoder);
+}
@@ -0,0 +1,393 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+static int encode_record(mpack_encoder_t *encoder, unsigned long id, const std::string &name)
+{
+  mpack_encode_array(encoder, mpack_array_t{ 2 });
+  mpack_encode_unsigned(encoder, id);
+  return mpack_encode_string(encoder, mpack_string_t{ name.data(), name.size() });
+}
+
+static void commit_record(mpack_chain_t *chain, unsigned long id, const std::string &name)
+{
+  encode_record(&chain->encoder, id, name);
+  BOOST_REQUIRE(mpack_chain_commit(chain) == 0);
+}
+
+static std::string collect(const mpack_chain_t *chain)
+{
+  std::vector<struct iovec> iov(mpack_chain_iovec(chain, nullptr, 0));
+  std::string data;
+
+  BOOST_REQUIRE(mpack_chain_iovec(chain, iov.data(), iov.size()) == static_cast<int>(iov.size()));
+
+  for (const struct iovec &entry : iov) {
+    data.append(static_cast<const char *>(entry.iov_base), entry.iov_len);
+  }
+
+  return data;
+}
+
+static std::string expected(size_t count, size_t length)
+{
+  std::vector<char> buffer(count * (length + 16));
+  mpack_encoder_t encoder;
+
+  mpack_encoder_init(&encoder, buffer.data(), buffer.size());
+
+  for (size_t i = 0; i != count; ++i) {
+    encode_record(&encoder, i, std::string(length, 'a' + (i % 26)));
+  }
+
+  BOOST_REQUIRE(encoder.pos <= encoder.end);
+  return std::string(encoder.begin, encoder.pos);
+}
+
+static std::string read_all(int fd, size_t size)
+{
+  std::string data(size, '\0');
+  size_t offset = 0;
+  ssize_t n;
+
+  while ((offset != size) && ((n = read(fd, &data[offset], size - offset)) > 0)) {
+    offset += n;
+  }
+
+  data.resize(offset);
+  return data;
+}
+
+BOOST_AUTO_TEST_CASE(test_chain_records)
+{
+  mpack_chunk_pool_t pool;
+  mpack_chain_t chain;
+  std::vector<const char *> chunks;
+
+  BOOST_REQUIRE(mpack_chunk_pool_init(&pool, 64, 0) == 0);
+  BOOST_REQUIRE(mpack_chain_init(&chain, &pool) == 0);
+
+  for (size_t i = 0; i != 100; ++i) {
+    commit_record(&chain, i, std::string(10, 'a' + (i % 26)));
+
+    if (chunks.empty() || (chunks.back() != chain.tail->data)) {
+      chunks.push_back(chain.tail->data);
+    }
+  }
+
+  // Chunks are filled in place and never moved, records cross from one to
+  // the next so only the last one has room left.
+  size_t index = 0;
+
+  for (const mpack_chunk_t *chunk = chain.head; chunk; chunk = chunk->next, ++index) {
+    BOOST_REQUIRE(index < chunks.size());
+    BOOST_CHECK(chunk->data == chunks[index]);
+    BOOST_CHECK(chunk->size == (chunk->next ? chunk->capacity : chunk->size));
+    BOOST_CHECK(chunk->capacity == 64);
+  }
+
+  BOOST_CHECK(index == chain.count);
+  BOOST_CHECK(chain.count > 1);
+  BOOST_CHECK(collect(&chain) == expected(100, 10));
+  BOOST_CHECK(chain.size == expected(100, 10).size());
+
+  mpack_chain_term(&chain);
+  BOOST_CHECK(pool.count == index);
+  mpack_chunk_pool_term(&pool);
+}
+
+BOOST_AUTO_TEST_CASE(test_chain_large_record)
+{
+  mpack_chunk_pool_t pool;
+  mpack_chain_t chain;
+  const std::string large(200, 'x');
+
+  BOOST_REQUIRE(mpack_chunk_pool_init(&pool, 64, 0) == 0);
+  BOOST_REQUIRE(mpack_chain_init(&chain, &pool) == 0);
+
+  // Records larger than a chunk run through as many as they need.
+  commit_record(&chain, 1, large);
+  BOOST_CHECK(chain.count == 4);
+
+  commit_record(&chain, 2, "small");
+  commit_record(&chain, 3, large);
+  BOOST_CHECK(chain.count == 7);
+
+  std::vector<char> buffer(1024);
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer.data(), buffer.size());
+  encode_record(&encoder, 1, large);
+  encode_record(&encoder, 2, "small");
+  encode_record(&encoder, 3, large);
+  BOOST_CHECK(collect(&chain) == std::string(encoder.begin, encoder.pos));
+  BOOST_CHECK(chain.size == static_cast<size_t>(encoder.pos - encoder.begin));
+
+  for (const mpack_chunk_t *chunk = chain.head; chunk != chain.tail; chunk = chunk->next) {
+    BOOST_CHECK(chunk->size == 64);
+    BOOST_CHECK(chunk->capacity == 64);
+  }
+
+  mpack_chain_term(&chain);
+  BOOST_CHECK(pool.count == 7);
+  mpack_chunk_pool_term(&pool);
+}
+
+BOOST_AUTO_TEST_CASE(test_chain_cancel)
+{
+  mpack_chunk_pool_t pool;
+  mpack_chain_t chain;
+
+  BOOST_REQUIRE(mpack_chunk_pool_init(&pool, 64, 0) == 0);
+  BOOST_REQUIRE(mpack_chain_init(&chain, &pool) == 0);
+
+  commit_record(&chain, 1, "first");
+  const std::string committed = collect(&chain);
+
+  // The partial record is dropped with the chunks it spilled into.
+  encode_record(&chain.encoder, 2, std::string(300, 'x'));
+  BOOST_CHECK(chain.count == 5);
+  BOOST_CHECK(collect(&chain) == committed);
+
+  mpack_chain_cancel(&chain);
+  BOOST_CHECK(chain.count == 1);
+  BOOST_CHECK(chain.head->size == committed.size());
+  BOOST_CHECK(collect(&chain) == committed);
+  BOOST_CHECK(pool.count == 4);
+
+  commit_record(&chain, 3, "third");
+
+  std::vector<char> buffer(64);
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer.data(), buffer.size());
+  encode_record(&encoder, 1, "first");
+  encode_record(&encoder, 3, "third");
+  BOOST_CHECK(collect(&chain) == std::string(encoder.begin, encoder.pos));
+  BOOST_CHECK(chain.size == static_cast<size_t>(encoder.pos - encoder.begin));
+
+  mpack_chain_term(&chain);
+  mpack_chunk_pool_term(&pool);
+}
+
+BOOST_AUTO_TEST_CASE(test_chain_cancel_dict)
+{
+  mpack_chunk_pool_t pool;
+  mpack_chain_t chain;
+  mpack_dict_t dict;
+
+  BOOST_REQUIRE(mpack_chunk_pool_init(&pool, 64, 0) == 0);
+  BOOST_REQUIRE(mpack_chain_init(&chain, &pool) == 0);
+  BOOST_REQUIRE(mpack_dict_init(&dict, 64) == 0);
+  chain.encoder.dict = &dict;
+  chain.encoder.flags |= MPACK_ENCODE_DICT_STRINGS;
+
+  commit_record(&chain, 1, "first");
+  const size_t size = mpack_dict_size(&dict);
+  BOOST_CHECK(size == 1);
+
+  // Strings defined by a cancelled record are defined again by the next one.
+  encode_record(&chain.encoder, 2, "second");
+  BOOST_CHECK(mpack_dict_size(&dict) == size + 1);
+  mpack_chain_cancel(&chain);
+  BOOST_CHECK(mpack_dict_size(&dict) == size);
+
+  commit_record(&chain, 2, "second");
+  BOOST_CHECK(mpack_dict_size(&dict) == size + 1);
+
+  mpack_dict_term(&dict);
+  mpack_chain_term(&chain);
+  mpack_chunk_pool_term(&pool);
+}
+
+BOOST_AUTO_TEST_CASE(test_chain_reset_dict)
+{
+  mpack_chunk_pool_t pool;
+  mpack_chain_t chain;
+  mpack_dict_t encoder_dict;
+  mpack_dict_t decoder_dict;
+  mpack_decoder_t decoder;
+  mpack_array_t array;
+  mpack_string_t name;
+  unsigned long id;
+  int fds[2];
+
+  BOOST_REQUIRE(pipe(fds) == 0);
+  BOOST_REQUIRE(mpack_chunk_pool_init(&pool, 64, 0) == 0);
+  BOOST_REQUIRE(mpack_chain_init(&chain, &pool) == 0);
+  BOOST_REQUIRE(mpack_dict_init(&encoder_dict, 64) == 0);
+  BOOST_REQUIRE(mpack_dict_init(&decoder_dict, 64) == 0);
+  chain.encoder.dict = &encoder_dict;
+  chain.encoder.flags |= MPACK_ENCODE_DICT_STRINGS;
+
+  commit_record(&chain, 1, "sent");
+  const std::string sent = collect(&chain);
+  BOOST_CHECK(mpack_chain_writev(&chain, fds[1]) == 0);
+  BOOST_CHECK(read_all(fds[0], sent.size()) == sent);
+
+  // Strings defined by records that were never written are defined again.
+  commit_record(&chain, 2, "dropped");
+  BOOST_CHECK(mpack_dict_size(&encoder_dict) == 2);
+  BOOST_REQUIRE(mpack_chain_reset(&chain) == 0);
+  BOOST_CHECK(mpack_dict_size(&encoder_dict) == 1);
+
+  commit_record(&chain, 3, "dropped");
+  commit_record(&chain, 4, "sent");
+  const std::string data = sent + collect(&chain);
+
+  mpack_decoder_init(&decoder, data.data(), data.size());
+  decoder.dict = &decoder_dict;
+
+  for (const char *expected_name : { "sent", "dropped", "sent" }) {
+    BOOST_REQUIRE(mpack_decode_array(&decoder, &array) > 0);
+    BOOST_REQUIRE(mpack_decode_unsigned(&decoder, &id) > 0);
+    BOOST_REQUIRE(mpack_decode_string(&decoder, &name) > 0);
+    BOOST_CHECK(std::string(name.data, name.size) == expected_name);
+  }
+
+  BOOST_CHECK(id == 4);
+  BOOST_CHECK(decoder.pos == decoder.end);
+
+  mpack_dict_term(&decoder_dict);
+  mpack_dict_term(&encoder_dict);
+  mpack_chain_term(&chain);
+  mpack_chunk_pool_term(&pool);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(test_chain_pool_limit)
+{
+  mpack_chunk_pool_t pool;
+  mpack_chain_t chain;
+
+  BOOST_CHECK(mpack_chunk_pool_init(&pool, 0, 0) == -1);
+  BOOST_CHECK(errno == EINVAL);
+
+  BOOST_REQUIRE(mpack_chunk_pool_init(&pool, 32, 2) == 0);
+  BOOST_REQUIRE(mpack_chain_init(&chain, &pool) == 0);
+
+  for (size_t i = 0; i != 20; ++i) {
+    commit_record(&chain, i, "0123456789");
+  }
+
+  BOOST_CHECK(chain.count > 2);
+  BOOST_REQUIRE(mpack_chain_reset(&chain) == 0);
+  BOOST_CHECK(chain.count == 1);
+  BOOST_CHECK(chain.size == 0);
+  BOOST_CHECK(pool.count == 2);
+  BOOST_CHECK(mpack_chain_iovec(&chain, nullptr, 0) == 0);
+
+  // The chain takes its chunks from the pool again.
+  commit_record(&chain, 0, "0123456789");
+  commit_record(&chain, 1, "0123456789");
+  commit_record(&chain, 2, "0123456789");
+  BOOST_CHECK(chain.count == 2);
+  BOOST_CHECK(pool.count == 1);
+
+  mpack_chain_term(&chain);
+  BOOST_CHECK(pool.count == 2);
+  mpack_chunk_pool_term(&pool);
+}
+
+BOOST_AUTO_TEST_CASE(test_chain_writev)
+{
+  mpack_chunk_pool_t pool;
+  mpack_chain_t chain;
+  int fds[2];
+
+  BOOST_REQUIRE(pipe(fds) == 0);
+  BOOST_REQUIRE(mpack_chunk_pool_init(&pool, 128, 0) == 0);
+  BOOST_REQUIRE(mpack_chain_init(&chain, &pool) == 0);
+
+  for (size_t i = 0; i != 400; ++i) {
+    commit_record(&chain, i, std::string(20, 'a' + (i % 26)));
+  }
+
+  const std::string data = expected(400, 20);
+  BOOST_CHECK(mpack_chain_iovec(&chain, nullptr, 0) > 64);
+  BOOST_CHECK(mpack_chain_writev(&chain, fds[1]) == 0);
+  BOOST_CHECK(chain.size == 0);
+  BOOST_CHECK(chain.count == 1);
+  BOOST_CHECK(read_all(fds[0], data.size()) == data);
+
+  // The chain is empty and takes new records after the write.
+  commit_record(&chain, 7, "again");
+  BOOST_CHECK(mpack_chain_writev(&chain, fds[1]) == 0);
+
+  std::vector<char> buffer(64);
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer.data(), buffer.size());
+  encode_record(&encoder, 7, "again");
+  BOOST_CHECK(read_all(fds[0], encoder.pos - encoder.begin) == std::string(encoder.begin, encoder.pos));
+
+  mpack_chain_term(&chain);
+  mpack_chunk_pool_term(&pool);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(test_chain_writev_nonblocking)
+{
+  mpack_chunk_pool_t pool;
+  mpack_chain_t chain;
+  std::string output;
+  int fds[2];
+
+  BOOST_REQUIRE(pipe(fds) == 0);
+  BOOST_REQUIRE(fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0);
+  BOOST_REQUIRE(mpack_chunk_pool_init(&pool, 4096, 0) == 0);
+  BOOST_REQUIRE(mpack_chain_init(&chain, &pool) == 0);
+
+  // More than the capacity of the pipe, the write stops half way.
+  for (size_t i = 0; i != 5000; ++i) {
+    commit_record(&chain, i, std::string(50, 'a' + (i % 26)));
+  }
+
+  const std::string data = expected(5000, 50);
+  int attempts = 0;
+
+  while (mpack_chain_writev(&chain, fds[1]) < 0) {
+    BOOST_REQUIRE(errno == EAGAIN);
+    BOOST_REQUIRE(chain.size < data.size());
+    output += read_all(fds[0], data.size() - output.size() - chain.size);
+    ++attempts;
+  }
+
+  output += read_all(fds[0], data.size() - output.size());
+  BOOST_CHECK(attempts > 0);
+  BOOST_CHECK(output == data);
+
+  mpack_chain_term(&chain);
+  mpack_chunk_pool_term(&pool);
+  close(fds[0]);
+  close(fds[1]);
+}
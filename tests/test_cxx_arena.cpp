@@ -0,0 +1,159 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+using arena_string = std::basic_string<char, std::char_traits<char>, mpack::arena_allocator<char>>;
+
+template < typename T >
+using arena_vector = std::vector<T, mpack::arena_allocator<T>>;
+
+template < typename K, typename V >
+using arena_map = std::map<K, V, std::less<K>, mpack::arena_allocator<std::pair<const K, V>>>;
+
+static std::vector<char> sample()
+{
+  std::vector<char> buffer(1024);
+  mpack::encoder encoder(buffer.data(), buffer.size());
+  std::vector<int> numbers;
+
+  for (int i = 0; i != 100; ++i) {
+    numbers.push_back(i * 1000);
+  }
+
+  encoder.encode(numbers);
+  encoder.encode(std::string("a string longer than the small string buffer"));
+  encoder.encode(std::map<std::string, int>{ { "first key of the map is long", 1 }, { "second", 2 } });
+  buffer.resize(encoder.pos - encoder.begin);
+  return buffer;
+}
+
+static bool owns(const mpack::arena &arena, const void *ptr)
+{
+  const char *p = static_cast<const char *>(ptr);
+  return (p >= (arena.end - arena.block_size)) && (p < arena.end);
+}
+
+BOOST_AUTO_TEST_CASE(test_cxx_arena_decode)
+{
+  const std::vector<char> input = sample();
+  mpack::arena arena(4096);
+  mpack::decoder decoder(input.data(), input.size());
+  arena_vector<int> numbers(arena);
+  arena_string string(arena);
+
+  BOOST_CHECK(decoder.decode(numbers) > 0);
+  BOOST_CHECK(decoder.decode(string) > 0);
+  BOOST_REQUIRE(numbers.size() == 100);
+  BOOST_CHECK(numbers[99] == 99000);
+  BOOST_CHECK(string == "a string longer than the small string buffer");
+  BOOST_CHECK(owns(arena, numbers.data()));
+  BOOST_CHECK(owns(arena, string.data()));
+  BOOST_CHECK(numbers.get_allocator() == mpack::arena_allocator<char>(arena));
+  BOOST_CHECK(numbers.get_allocator() != mpack::arena_allocator<int>(mpack::arena::local()));
+}
+
+BOOST_AUTO_TEST_CASE(test_cxx_arena_requests)
+{
+  const std::vector<char> input = sample();
+  mpack::arena arena(4096);
+  const int *first = nullptr;
+
+  // Every request decodes into the same memory once the arena is warm.
+  for (int request = 0; request != 10; ++request) {
+    mpack::decoder decoder(input.data(), input.size());
+    arena_vector<int> numbers(arena);
+    arena_string string(arena);
+
+    BOOST_REQUIRE(decoder.decode(numbers) > 0);
+    BOOST_REQUIRE(decoder.decode(string) > 0);
+
+    if (!first) {
+      first = numbers.data();
+    }
+
+    BOOST_CHECK(numbers.data() == first);
+    BOOST_CHECK(arena.large == nullptr);
+    BOOST_CHECK(arena.free == nullptr);
+    arena.reset();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_cxx_arena_elements)
+{
+  std::vector<char> buffer(1024);
+  mpack::encoder encoder(buffer.data(), buffer.size());
+  mpack::arena arena(4096);
+  arena_vector<arena_string> strings(arena);
+  arena_map<arena_string, arena_string> map(arena);
+
+  encoder.encode(std::vector<std::string>{ "a first string too long to be small", "a second string too long to be small" });
+  encoder.encode(std::map<std::string, std::string>{ { "a key too long to be a small string", "and a value that is not small either" } });
+
+  // Elements take the arena of their container, not the thread's one.
+  mpack::decoder decoder(buffer.data(), encoder.pos - encoder.begin);
+  BOOST_REQUIRE(decoder.decode(strings) > 0);
+  BOOST_REQUIRE(decoder.decode(map) > 0);
+  BOOST_REQUIRE(strings.size() == 2);
+  BOOST_REQUIRE(map.size() == 1);
+
+  for (const arena_string &string : strings) {
+    BOOST_CHECK(string.get_allocator().resource() == &arena);
+    BOOST_CHECK(owns(arena, string.data()));
+  }
+
+  BOOST_CHECK(owns(arena, map.begin()->first.data()));
+  BOOST_CHECK(owns(arena, map.begin()->second.data()));
+  BOOST_CHECK(map.begin()->second == "and a value that is not small either");
+}
+
+BOOST_AUTO_TEST_CASE(test_cxx_arena_local)
+{
+  const std::vector<char> input = sample();
+  mpack::arena &local = mpack::arena::local();
+  mpack::decoder decoder(input.data(), input.size());
+  arena_vector<int> numbers(local);
+  arena_string string(local);
+  arena_map<arena_string, int> map(local);
+
+  // Keys are built with the allocator of the map rather than a default one.
+  BOOST_REQUIRE(decoder.decode(numbers) > 0);
+  BOOST_REQUIRE(decoder.decode(string) > 0);
+  BOOST_REQUIRE(decoder.decode(map) > 0);
+  BOOST_CHECK(map.size() == 2);
+  BOOST_CHECK(map[arena_string("second", local)] == 2);
+  BOOST_CHECK(owns(local, map.begin()->first.data()));
+  BOOST_CHECK(map.begin()->first.get_allocator().resource() == &local);
+  BOOST_CHECK(numbers.get_allocator().resource() == &local);
+
+  mpack::arena *other = nullptr;
+  std::thread thread([&other]() { other = &mpack::arena::local(); });
+  thread.join();
+  BOOST_CHECK(other != &local);
+}
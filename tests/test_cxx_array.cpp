@@ -23,6 +23,7 @@
  */
 
 #include <cerrno>
+#include <string>
 #include <boost/test/unit_test.hpp>
 #include <mpack.h>
 
@@ -106,3 +107,26 @@ BOOST_AUTO_TEST_CASE(test_encode_decode_array32)
   BOOST_CHECK(decoder.decode(value) == -1);
   BOOST_CHECK(errno == EAGAIN);
 }
+
+BOOST_AUTO_TEST_CASE(test_encode_array_begin_end)
+{
+  char buffer[32] = { 0 };
+  size_t offset = 0;
+  mpack::array value;
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+
+  BOOST_CHECK(encoder.encode_array_begin(offset) == 5);
+  BOOST_CHECK(encoder.encode(std::string("abc")) == 4);
+  BOOST_CHECK(encoder.encode_array_end(offset, 1) == 0);
+  BOOST_CHECK(encoder.compact(offset) == 4);
+
+  mpack::decoder decoder { buffer, 5 };
+
+  value.size = 0;
+  BOOST_CHECK(decoder.decode(value) == 1);
+  BOOST_CHECK(value.size == 1);
+
+  std::string s;
+  BOOST_CHECK(decoder.decode(s) == 4);
+  BOOST_CHECK(s == "abc");
+}
@@ -0,0 +1,233 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <coroutine>
+#include <exception>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+// Minimal coroutine type, the body runs eagerly until its first suspension
+// and the frame is kept until the task is destroyed so done() can be checked.
+struct task {
+  struct promise_type {
+    task get_return_object() noexcept
+    { return task{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+
+    std::suspend_never initial_suspend() noexcept
+    { return { }; }
+
+    std::suspend_always final_suspend() noexcept
+    { return { }; }
+
+    void return_void() noexcept
+    { }
+
+    void unhandled_exception() noexcept
+    { std::terminate(); }
+  };
+
+  explicit task(std::coroutine_handle<promise_type> handle) noexcept:
+    handle(handle)
+  { }
+
+  task(const task &) = delete;
+  task &operator=(const task &) = delete;
+
+  ~task()
+  { handle.destroy(); }
+
+  bool done() const noexcept
+  { return handle.done(); }
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+static std::string encode_values()
+{
+  char buffer[256];
+  mpack::encoder encoder(buffer, sizeof(buffer));
+
+  encoder.encode(42);
+  encoder.encode(std::string("hello world"));
+  encoder.encode(std::vector<int>{ 1, 2, 3 });
+  encoder.encode(std::map<std::string, int>{ { "a", 1 }, { "b", 2 } });
+  return std::string(encoder.begin, encoder.pos);
+}
+
+struct values {
+  int result[5];
+  int integer = 0;
+  std::string string;
+  std::vector<int> vector;
+  std::map<std::string, int> map;
+};
+
+static task read_values(mpack::async_reader &reader, values &v)
+{
+  v.result[0] = co_await reader.read(v.integer);
+  v.result[1] = co_await reader.read(v.string);
+  v.result[2] = co_await reader.read(v.vector);
+  v.result[3] = co_await reader.read(v.map);
+  v.result[4] = co_await reader.next();
+}
+
+static void check_values(const values &v)
+{
+  BOOST_CHECK(v.result[0] > 0);
+  BOOST_CHECK(v.result[1] > 0);
+  BOOST_CHECK(v.result[2] > 0);
+  BOOST_CHECK(v.result[3] > 0);
+  BOOST_CHECK(v.result[4] == 0);
+  BOOST_CHECK(v.integer == 42);
+  BOOST_CHECK(v.string == "hello world");
+  BOOST_CHECK((v.vector == std::vector<int>{ 1, 2, 3 }));
+  BOOST_CHECK((v.map == std::map<std::string, int>{ { "a", 1 }, { "b", 2 } }));
+}
+
+BOOST_AUTO_TEST_CASE(test_async_reader_whole)
+{
+  const std::string data = encode_values();
+  mpack::async_reader reader;
+  values v;
+  task t = read_values(reader, v);
+
+  BOOST_CHECK(!t.done());
+  reader.feed(data.data(), data.size());
+  BOOST_CHECK(!t.done());
+  reader.close();
+  BOOST_CHECK(t.done());
+  check_values(v);
+}
+
+BOOST_AUTO_TEST_CASE(test_async_reader_bytes)
+{
+  const std::string data = encode_values();
+  mpack::async_reader reader;
+  values v;
+  task t = read_values(reader, v);
+
+  for (char c : data) {
+    BOOST_CHECK(!t.done());
+    reader.feed(&c, 1);
+  }
+
+  reader.close();
+  BOOST_CHECK(t.done());
+  check_values(v);
+}
+
+static task read_strings(mpack::async_reader &reader, std::vector<std::string> &strings, int &result)
+{
+  std::string s;
+
+  while ((result = co_await reader.read(s)) > 0) {
+    strings.push_back(s);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_async_reader_large)
+{
+  std::vector<char> buffer(8 << 20);
+  mpack::encoder encoder(buffer.data(), buffer.size());
+  std::vector<std::string> strings;
+  int result = 1;
+
+  for (int i = 0; i != 100; ++i) {
+    encoder.encode(std::string(i * 1000, 'a' + (i % 26)));
+  }
+
+  mpack::async_reader reader;
+  task t = read_strings(reader, strings, result);
+
+  for (const char *p = encoder.begin; p < encoder.pos; p += 4096) {
+    reader.feed(p, std::min<size_t>(4096, encoder.pos - p));
+  }
+
+  BOOST_CHECK(!t.done());
+  BOOST_CHECK(strings.size() == 100);
+  reader.close();
+  BOOST_CHECK(t.done());
+  BOOST_CHECK(result == 0);
+
+  for (size_t i = 0; i != strings.size(); ++i) {
+    BOOST_CHECK(strings[i] == std::string(i * 1000, 'a' + (i % 26)));
+  }
+}
+
+static task read_int_then_string(mpack::async_reader &reader, int result[2], std::string &s)
+{
+  int x = 0;
+  result[0] = co_await reader.read(x);
+  result[1] = co_await reader.read(s);
+}
+
+BOOST_AUTO_TEST_CASE(test_async_reader_mismatch)
+{
+  mpack::async_reader reader;
+  int result[2] = { 0, 0 };
+  std::string s;
+  task t = read_int_then_string(reader, result, s);
+
+  reader.feed("\xa2hi", 3);
+  BOOST_CHECK(t.done());
+  BOOST_CHECK(result[0] == -1);
+  BOOST_CHECK(result[1] == 3);
+  BOOST_CHECK(s == "hi");
+}
+
+static task read_next(mpack::async_reader &reader, int &result, int &error)
+{
+  result = co_await reader.next();
+  error = errno;
+}
+
+BOOST_AUTO_TEST_CASE(test_async_reader_errors)
+{
+  int result = 0;
+  int error = 0;
+
+  {
+    mpack::async_reader reader;
+    task t = read_next(reader, result, error);
+    reader.feed("\x92\x01", 2);
+    BOOST_CHECK(!t.done());
+    reader.close();
+    BOOST_CHECK(t.done());
+    BOOST_CHECK(result == -1);
+    BOOST_CHECK(error == EAGAIN);
+  }
+
+  {
+    mpack::async_reader reader;
+    task t = read_next(reader, result, error);
+    reader.feed("\x92\xc1", 2);
+    BOOST_CHECK(t.done());
+    BOOST_CHECK(result == -1);
+    BOOST_CHECK(error == EINVAL);
+  }
+}
@@ -0,0 +1,406 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+BOOST_AUTO_TEST_CASE(test_encode_vector)
+{
+  char buffer[64] = { 0 };
+  char expect[64] = { 0 };
+  std::vector<int> value { 1, -1, 200, -200, 70000, -70000 };
+
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  mpack::encoder manual { expect, sizeof(expect) };
+
+  BOOST_CHECK(encoder.encode(value) == 18);
+  manual.encode(mpack::array{ value.size() });
+
+  for (int x : value) {
+    manual.encode(x);
+  }
+
+  BOOST_CHECK((manual.pos - manual.begin) == 18);
+  BOOST_CHECK(memcmp(buffer, expect, 18) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_vector_overflow)
+{
+  char buffer[8] = { 0 };
+  std::vector<double> value { 1.0, 2.0, 3.0 };
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+
+  BOOST_CHECK(encoder.encode(value) == 28);
+  BOOST_CHECK(encoder.pos == (encoder.begin + 28));
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_vector_long_long)
+{
+  char buffer[64] = { 0 };
+  std::vector<long long> value { 1, -1, 1LL << 40, -(1LL << 40) };
+  std::vector<unsigned long long> other { 0, 300, 1ULL << 63 };
+  std::vector<long long> result;
+  std::vector<unsigned long long> other_result;
+
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  BOOST_CHECK(encoder.encode(value) == 21);
+  BOOST_CHECK(encoder.encode(other) == 14);
+
+  mpack::decoder decoder { buffer, 35 };
+  BOOST_CHECK(decoder.decode(result) == 21);
+  BOOST_CHECK(decoder.decode(other_result) == 14);
+  BOOST_CHECK(result == value);
+  BOOST_CHECK(other_result == other);
+
+  // Fixed width integers go through the per-element overloads.
+  mpack::encoder fixed { buffer, sizeof(buffer) };
+  fixed.flags = MPACK_ENCODE_FIXED_WIDTH;
+  BOOST_CHECK(fixed.encode(value) == 37);
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_vector_bool)
+{
+  char buffer[8] = { 0 };
+  std::vector<bool> value { true, false };
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+
+  BOOST_CHECK(encoder.encode(value) == 3);
+  BOOST_CHECK(uint8_t(buffer[0]) == (MPACK_FIXARRAY | 2));
+  BOOST_CHECK(uint8_t(buffer[1]) == MPACK_TRUE);
+  BOOST_CHECK(uint8_t(buffer[2]) == MPACK_FALSE);
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_array)
+{
+  char buffer[64] = { 0 };
+  std::array<unsigned char, 16> value;
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+
+  for (size_t i = 0; i != value.size(); ++i) {
+    value[i] = i * 16;
+  }
+
+  BOOST_CHECK(encoder.encode(value) == 27);
+  BOOST_CHECK(uint8_t(buffer[0]) == MPACK_ARRAY16);
+
+  mpack::decoder decoder { buffer, 27 };
+  mpack::array header;
+  unsigned char x;
+
+  BOOST_CHECK(decoder.decode(header) == 3);
+  BOOST_CHECK(header.size == 16);
+
+  for (size_t i = 0; i != value.size(); ++i) {
+    BOOST_CHECK(decoder.decode(x) > 0);
+    BOOST_CHECK(x == value[i]);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_map)
+{
+  char buffer[64] = { 0 };
+  std::map<std::string, std::vector<float>> value {
+    { "A", { 1.0f } },
+    { "B", { } },
+  };
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+
+  BOOST_CHECK(encoder.encode(value) == 12);
+
+  mpack::decoder decoder { buffer, 12 };
+  mpack::map header;
+  mpack::array items;
+  mpack::string key;
+  float x;
+
+  BOOST_CHECK(decoder.decode(header) == 1);
+  BOOST_CHECK(header.size == 2);
+  BOOST_CHECK(decoder.decode(key) == 2);
+  BOOST_CHECK(memcmp(key.data, "A", 1) == 0);
+  BOOST_CHECK(decoder.decode(items) == 1);
+  BOOST_CHECK(items.size == 1);
+  BOOST_CHECK(decoder.decode(x) == 5);
+  BOOST_CHECK(x == 1.0f);
+  BOOST_CHECK(decoder.decode(key) == 2);
+  BOOST_CHECK(memcmp(key.data, "B", 1) == 0);
+  BOOST_CHECK(decoder.decode(items) == 1);
+  BOOST_CHECK(items.size == 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_unordered_map)
+{
+  char buffer[64] = { 0 };
+  std::unordered_map<int, bool> value { { 42, true } };
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+
+  BOOST_CHECK(encoder.encode(value) == 3);
+  BOOST_CHECK(uint8_t(buffer[0]) == (MPACK_FIXMAP | 1));
+  BOOST_CHECK(uint8_t(buffer[1]) == 42);
+  BOOST_CHECK(uint8_t(buffer[2]) == MPACK_TRUE);
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_strings)
+{
+  char buffer[64] = { 0 };
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+
+  BOOST_CHECK(encoder.encode(std::string("Hello")) == 6);
+  BOOST_CHECK(encoder.encode(std::string_view("World!")) == 7);
+
+  mpack::decoder decoder { buffer, 13 };
+  mpack::string value;
+
+  BOOST_CHECK(decoder.decode(value) == 6);
+  BOOST_CHECK(std::string_view(value.data, value.size) == "Hello");
+  BOOST_CHECK(decoder.decode(value) == 7);
+  BOOST_CHECK(std::string_view(value.data, value.size) == "World!");
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_optional)
+{
+  char buffer[64] = { 0 };
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+
+  BOOST_CHECK(encoder.encode(std::optional<int>()) == 1);
+  BOOST_CHECK(encoder.encode(std::optional<int>(1000)) == 3);
+  BOOST_CHECK(uint8_t(buffer[0]) == MPACK_NIL);
+  BOOST_CHECK(uint8_t(buffer[1]) == MPACK_UINT16);
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_pair_tuple)
+{
+  char buffer[64] = { 0 };
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+
+  BOOST_CHECK(encoder.encode(std::make_pair(1, std::string("A"))) == 4);
+  BOOST_CHECK(encoder.encode(std::make_tuple(true, nullptr, 2.0)) == 12);
+  BOOST_CHECK(encoder.encode(std::tuple<>()) == 1);
+
+  const uint8_t expect[] = {
+    MPACK_FIXARRAY | 2, 0x01, MPACK_FIXSTR | 1, 'A',
+    MPACK_FIXARRAY | 3, MPACK_TRUE, MPACK_NIL, MPACK_FLOAT64,
+  };
+
+  BOOST_CHECK(memcmp(buffer, expect, sizeof(expect)) == 0);
+  BOOST_CHECK(uint8_t(buffer[16]) == MPACK_FIXARRAY);
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_span_nested)
+{
+  char buffer[64] = { 0 };
+  std::vector<std::vector<short>> nested { { 1, 2 }, { 3 } };
+  const long values[] = { -1, 0, 1 };
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+
+  BOOST_CHECK(encoder.encode(std::span<const long>(values)) == 4);
+  BOOST_CHECK(encoder.encode(nested) == 6);
+
+  const uint8_t expect[] = {
+    MPACK_FIXARRAY | 3, 0xff, 0x00, 0x01,
+    MPACK_FIXARRAY | 2, MPACK_FIXARRAY | 2, 0x01, 0x02, MPACK_FIXARRAY | 1, 0x03,
+  };
+
+  BOOST_CHECK(memcmp(buffer, expect, sizeof(expect)) == 0);
+}
+
+namespace {
+
+  class counting_resource : public std::pmr::memory_resource {
+  public:
+    size_t count = 0;
+
+  private:
+    void *do_allocate(size_t size, size_t align) override
+    {
+      ++count;
+      return std::pmr::new_delete_resource()->allocate(size, align);
+    }
+
+    void do_deallocate(void *ptr, size_t size, size_t align) override
+    { std::pmr::new_delete_resource()->deallocate(ptr, size, align); }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    { return this == &other; }
+  };
+
+}
+
+BOOST_AUTO_TEST_CASE(test_decode_vector)
+{
+  char buffer[4096] = { 0 };
+  std::vector<int> input(1000);
+  counting_resource resource;
+  std::pmr::vector<int> value { &resource };
+
+  for (size_t i = 0; i != input.size(); ++i) {
+    input[i] = i * 100;
+  }
+
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  const int size = encoder.encode(input);
+  BOOST_CHECK(size > 0);
+
+  mpack::decoder decoder { buffer, size_t(size) };
+  BOOST_CHECK(decoder.decode(value) == size);
+  BOOST_CHECK(std::equal(input.begin(), input.end(), value.begin(), value.end()));
+  BOOST_CHECK(resource.count == 1);
+
+  mpack::decoder again { buffer, size_t(size) };
+  BOOST_CHECK(again.decode(value) == size);
+  BOOST_CHECK(value.size() == input.size());
+  BOOST_CHECK(resource.count == 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_decode_vector_reserve_limit)
+{
+  char buffer[4096] = { 0 };
+  std::vector<signed char> input(100, 1);
+  std::vector<signed char> value;
+
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  const int size = encoder.encode(input);
+
+  mpack::decoder decoder { buffer, size_t(size) };
+  decoder.reserve_limit = 10;
+  BOOST_CHECK(decoder.decode(value) == size);
+  BOOST_CHECK(value == input);
+
+  // A header announcing more elements than the input holds must neither
+  // allocate for the announced count nor consume anything.
+  mpack::decoder truncated { buffer, 20 };
+  std::vector<signed char> other;
+  BOOST_CHECK(truncated.decode(other) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  BOOST_CHECK(other.capacity() < input.size());
+  BOOST_CHECK(truncated.pos == truncated.begin);
+}
+
+BOOST_AUTO_TEST_CASE(test_decode_map)
+{
+  char buffer[256] = { 0 };
+  std::map<std::string, std::vector<int>> input {
+    { "first", { 1, 2, 3 } },
+    { "second", { } },
+    { "third", { -1 } },
+  };
+  std::map<std::string, std::vector<int>> value;
+
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  const int size = encoder.encode(input);
+
+  mpack::decoder decoder { buffer, size_t(size) };
+  BOOST_CHECK(decoder.decode(value) == size);
+  BOOST_CHECK(value == input);
+
+  value["fourth"] = { 4 };
+  mpack::decoder again { buffer, size_t(size) };
+  BOOST_CHECK(again.decode(value) == size);
+  BOOST_CHECK(value == input);
+}
+
+BOOST_AUTO_TEST_CASE(test_decode_unordered_map)
+{
+  char buffer[256] = { 0 };
+  std::unordered_map<int, std::string> input {
+    { 1, "one" },
+    { 2, "two" },
+  };
+  std::unordered_map<int, std::string> value { { 3, "three" } };
+
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  const int size = encoder.encode(input);
+
+  mpack::decoder decoder { buffer, size_t(size) };
+  BOOST_CHECK(decoder.decode(value) == size);
+  BOOST_CHECK(value == input);
+}
+
+BOOST_AUTO_TEST_CASE(test_decode_optional)
+{
+  char buffer[64] = { 0 };
+  std::optional<std::string> value { "A" };
+
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  encoder.encode(nullptr);
+  encoder.encode(std::string("B"));
+
+  mpack::decoder decoder { buffer, 3 };
+  BOOST_CHECK(decoder.decode(value) == 1);
+  BOOST_CHECK(!value);
+  BOOST_CHECK(decoder.decode(value) == 2);
+  BOOST_CHECK(value && (*value == "B"));
+  BOOST_CHECK(decoder.decode(value) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+}
+
+BOOST_AUTO_TEST_CASE(test_decode_pmr_monotonic)
+{
+  char buffer[256] = { 0 };
+  char memory[4096];
+  std::vector<std::string> input { "a somewhat long string value", "b", "" };
+
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  const int size = encoder.encode(input);
+
+  std::pmr::monotonic_buffer_resource resource {
+    memory, sizeof(memory), std::pmr::null_memory_resource()
+  };
+  std::pmr::vector<std::pmr::string> value { &resource };
+
+  mpack::decoder decoder { buffer, size_t(size) };
+  BOOST_CHECK(decoder.decode(value) == size);
+  BOOST_CHECK(value.size() == 3);
+  BOOST_CHECK(std::string_view(value[0]) == input[0]);
+  BOOST_CHECK(value[0].get_allocator().resource() == &resource);
+  BOOST_CHECK(value[1] == "b");
+  BOOST_CHECK(value[2].empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_vector_compact_double)
+{
+  char buffer[64];
+  std::vector<double> values { 1.0, 0.5, 0.1, -2.0 };
+  std::vector<double> result;
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  encoder.flags = MPACK_ENCODE_COMPACT_FLOAT;
+
+  BOOST_CHECK(encoder.encode(values) == 1 + 1 + 5 + 9 + 1);
+
+  mpack::decoder decoder { buffer, size_t(encoder.pos - encoder.begin) };
+  BOOST_CHECK(decoder.decode(result) == 17);
+  BOOST_CHECK(result == values);
+}
@@ -0,0 +1,94 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <map>
+#include <string>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+namespace test {
+
+  struct point {
+    int x = 0;
+    int y = 0;
+    std::string label;
+  };
+
+  MPACK_DEFINE(point, x, y, label)
+
+}
+
+BOOST_AUTO_TEST_CASE(test_dictionary_map)
+{
+  char buffer[256];
+  std::map<std::string, int> value { { "alpha", 1 }, { "beta", 2 } };
+  std::map<std::string, int> result;
+  mpack::dictionary encode_dict { 64 };
+  mpack::dictionary decode_dict { 64 };
+
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  encoder.dict = &encode_dict;
+  const int first = encoder.encode(value);
+  const int second = encoder.encode(value);
+  BOOST_CHECK(second == 1 + 3 + 1 + 3 + 1);
+  BOOST_CHECK(second < first);
+
+  mpack::decoder decoder { buffer, size_t(encoder.pos - encoder.begin) };
+  decoder.dict = &decode_dict;
+  BOOST_CHECK(decoder.decode(result) == first);
+  BOOST_CHECK(result == value);
+  result.clear();
+  BOOST_CHECK(decoder.decode(result) == second);
+  BOOST_CHECK(result == value);
+  BOOST_CHECK(decode_dict.size() == 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_dictionary_struct)
+{
+  char buffer[256];
+  test::point value;
+  test::point result;
+  mpack::dictionary encode_dict { 64 };
+  mpack::dictionary decode_dict { 64 };
+
+  value.x = 1;
+  value.y = 2;
+  value.label = "origin";
+
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  encoder.dict = &encode_dict;
+  encoder.flags = MPACK_ENCODE_DICT_STRINGS;
+  encoder.encode(value);
+  const int size = encoder.encode(value);
+  BOOST_CHECK(size == 1 + 2 + 1 + 2 + 1 + 3 + 3);
+
+  mpack::decoder decoder { buffer, size_t(encoder.pos - encoder.begin) };
+  decoder.dict = &decode_dict;
+  BOOST_CHECK(decoder.decode(result) > 0);
+  result = test::point();
+  BOOST_CHECK(decoder.decode(result) == size);
+  BOOST_CHECK(result.x == 1);
+  BOOST_CHECK(result.y == 2);
+  BOOST_CHECK(result.label == "origin");
+}
@@ -245,3 +245,29 @@ BOOST_AUTO_TEST_CASE(test_encode_decode_uint64)
   BOOST_CHECK(decoder.decode(value) == -1);
   BOOST_CHECK(errno == EAGAIN);
 }
+
+BOOST_AUTO_TEST_CASE(test_decode_narrow_integer_errors)
+{
+  // Errors of the underlying long decode are passed on before the range check.
+  const char nil[] = { '\xc0' };
+  const char truncated[] = { '\xd1', '\x01' };
+  short s = 42;
+  unsigned short u = 42;
+
+  mpack::decoder decoder { nil, sizeof(nil) };
+  errno = 0;
+  BOOST_CHECK(decoder.decode(s) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(decoder.decode(u) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(decoder.pos == nil);
+
+  mpack::decoder partial { truncated, sizeof(truncated) };
+  errno = 0;
+  BOOST_CHECK(partial.decode(s) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  BOOST_CHECK(partial.pos == truncated);
+
+  BOOST_CHECK(s == 42);
+  BOOST_CHECK(u == 42);
+}
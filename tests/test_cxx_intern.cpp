@@ -0,0 +1,65 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <map>
+#include <string>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+BOOST_AUTO_TEST_CASE(test_intern_table_decode)
+{
+  char buffer[128];
+  std::map<std::string, int> value { { "x", 1 }, { "y", 2 } };
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  encoder.encode(value);
+  encoder.encode(value);
+
+  mpack::intern_table table { 4 };
+  mpack::decoder decoder { buffer, size_t(encoder.pos - encoder.begin) };
+  decoder.intern = &table;
+
+  uint32_t ids[4];
+  for (int i = 0; i != 2; ++i) {
+    mpack::map map;
+    BOOST_CHECK(decoder.decode(map) == 1);
+
+    for (int j = 0; j != 2; ++j) {
+      const mpack::symbol *key = nullptr;
+      int x = 0;
+      BOOST_CHECK(decoder.decode(key) == 2);
+      BOOST_CHECK(decoder.decode(x) == 1);
+      ids[2 * i + j] = key->id;
+    }
+  }
+
+  BOOST_CHECK(ids[0] != ids[1]);
+  BOOST_CHECK(ids[0] == ids[2]);
+  BOOST_CHECK(ids[1] == ids[3]);
+  BOOST_CHECK(table.find(mpack::string{ "y", 1 })->id == ids[1]);
+}
+
+BOOST_AUTO_TEST_CASE(test_intern_table_invalid)
+{
+  BOOST_CHECK_THROW(mpack::intern_table { 0 }, std::system_error);
+}
@@ -0,0 +1,107 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <array>
+#include <map>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+namespace test {
+
+  struct sample {
+    unsigned int id = 0;
+    double value = 0;
+    std::array<short, 3> position = { { 0, 0, 0 } };
+    std::optional<bool> valid;
+  };
+
+  struct pair {
+    int first = 0;
+    int second = 0;
+  };
+
+  MPACK_DEFINE(sample, id, value, position, valid)
+  MPACK_DEFINE_ARRAY(pair, first, second)
+
+}
+
+static_assert(mpack::encoded_size(nullptr) == 1);
+static_assert(mpack::encoded_size(127) == 1);
+static_assert(mpack::encoded_size(128) == 2);
+static_assert(mpack::encoded_size(-32) == 2);
+static_assert(mpack::encoded_size(70000UL) == 5);
+static_assert(mpack::encoded_size(1.0f) == 5);
+static_assert(mpack::encoded_size(mpack::string{ "abc", 3 }) == 4);
+static_assert(mpack::encoded_size(std::string_view("abc")) == 4);
+static_assert(mpack::encoded_size(std::array<int, 3>{ { 1, 200, -200 } }) == 7);
+static_assert(mpack::encoded_size(std::make_tuple(1, true, nullptr)) == 4);
+static_assert(mpack::encoded_size(test::pair{ 1, 1000 }) == 5);
+
+static_assert(mpack::max_encoded_size<bool>() == 1);
+static_assert(mpack::max_encoded_size<unsigned char>() == 2);
+static_assert(mpack::max_encoded_size<int>() == 5);
+static_assert(mpack::max_encoded_size<long>() == 9);
+static_assert(mpack::max_encoded_size<double>() == 9);
+static_assert(mpack::max_encoded_size<std::array<short, 20>>() == 63);
+static_assert(mpack::max_encoded_size<std::pair<int, float>>() == 11);
+static_assert(mpack::max_encoded_size<std::optional<int>>() == 5);
+static_assert(mpack::max_encoded_size<test::pair>() == 11);
+static_assert(mpack::max_encoded_size<test::sample>() == 1 + 3 + 5 + 6 + 9 + 9 + 10 + 6 + 1);
+
+BOOST_AUTO_TEST_CASE(test_encoded_size_matches_encoder)
+{
+  char buffer[256];
+  std::vector<std::string> strings { "a", std::string(20, 'b'), "" };
+  std::map<int, std::vector<double>> map { { 1, { 1.0 } }, { 1000, { } } };
+  test::sample sample;
+  sample.id = 100000;
+  sample.position = { { 1, -1000, 300 } };
+
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  BOOST_CHECK(size_t(encoder.encode(strings)) == mpack::encoded_size(strings));
+
+  encoder = mpack::encoder { buffer, sizeof(buffer) };
+  BOOST_CHECK(size_t(encoder.encode(map)) == mpack::encoded_size(map));
+
+  encoder = mpack::encoder { buffer, sizeof(buffer) };
+  BOOST_CHECK(size_t(encoder.encode(sample)) == mpack::encoded_size(sample));
+}
+
+BOOST_AUTO_TEST_CASE(test_max_encoded_size_stack_buffer)
+{
+  char buffer[mpack::max_encoded_size<test::sample>()];
+  test::sample sample;
+  sample.id = 4294967295U;
+  sample.value = -1.5;
+  sample.position = { { -32768, -32768, -32768 } };
+  sample.valid = false;
+
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  BOOST_CHECK(encoder.encode(sample) > 0);
+  BOOST_CHECK(encoder.pos <= encoder.end);
+}
@@ -0,0 +1,203 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+namespace test {
+
+  struct point {
+    int x = 0;
+    int y = 0;
+  };
+
+  struct event {
+    std::string name;
+    unsigned long id = 0;
+    std::vector<point> points;
+    std::optional<double> score;
+    bool enabled = false;
+  };
+
+  struct wide {
+    int f00 = 0, f01 = 0, f02 = 0, f03 = 0, f04 = 0, f05 = 0, f06 = 0, f07 = 0;
+    int f08 = 0, f09 = 0, f10 = 0, f11 = 0, f12 = 0, f13 = 0, f14 = 0, f15 = 0;
+    int a_field_name_longer_than_31_bytes = 0;
+  };
+
+  struct medium {
+    int a_twenty_byte_name_x = 0;
+  };
+
+  MPACK_DEFINE_ARRAY(point, x, y)
+  MPACK_DEFINE(event, name, id, points, score, enabled)
+  MPACK_DEFINE_MAP(wide,
+    f00, f01, f02, f03, f04, f05, f06, f07,
+    f08, f09, f10, f11, f12, f13, f14, f15,
+    a_field_name_longer_than_31_bytes)
+  MPACK_DEFINE_MAP(medium, a_twenty_byte_name_x)
+
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_decode_struct_array)
+{
+  char buffer[32] = { 0 };
+  test::point value { 1, -2 };
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+
+  BOOST_CHECK(encoder.encode(value) == 3);
+  BOOST_CHECK(uint8_t(buffer[0]) == (MPACK_FIXARRAY | 2));
+
+  test::point other;
+  mpack::decoder decoder { buffer, 3 };
+  BOOST_CHECK(decoder.decode(other) == 3);
+  BOOST_CHECK(other.x == 1);
+  BOOST_CHECK(other.y == -2);
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_decode_struct_map)
+{
+  char buffer[256] = { 0 };
+  test::event value;
+  value.name = "click";
+  value.id = 1000000;
+  value.points = { { 1, 2 }, { 3, 4 } };
+  value.score = 0.5;
+  value.enabled = true;
+
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  const int size = encoder.encode(value);
+  BOOST_CHECK(size > 0);
+
+  mpack::decoder decoder { buffer, size_t(size) };
+  mpack::map header;
+  mpack::string key;
+  BOOST_CHECK(decoder.decode(header) == 1);
+  BOOST_CHECK(header.size == 5);
+  BOOST_CHECK(decoder.decode(key) == 5);
+  BOOST_CHECK(std::string(key.data, key.size) == "name");
+
+  test::event other;
+  mpack::decoder again { buffer, size_t(size) };
+  BOOST_CHECK(again.decode(other) == size);
+  BOOST_CHECK(other.name == "click");
+  BOOST_CHECK(other.id == 1000000);
+  BOOST_CHECK(other.points.size() == 2);
+  BOOST_CHECK(other.points[1].y == 4);
+  BOOST_CHECK(other.score && (*other.score == 0.5));
+  BOOST_CHECK(other.enabled);
+}
+
+BOOST_AUTO_TEST_CASE(test_decode_struct_unordered_unknown)
+{
+  char buffer[256] = { 0 };
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+
+  encoder.encode(mpack::map{ 4 });
+  encoder.encode(std::string("enabled"));
+  encoder.encode(true);
+  encoder.encode(std::string("unknown"));
+  encoder.encode(std::vector<std::vector<int>>{ { 1 }, { 2, 3 } });
+  encoder.encode(std::string("id"));
+  encoder.encode(42);
+  encoder.encode(std::string("name"));
+  encoder.encode(std::string("key"));
+
+  const size_t size = encoder.pos - encoder.begin;
+  test::event value;
+  value.score = 1.0;
+
+  mpack::decoder decoder { buffer, size };
+  BOOST_CHECK(decoder.decode(value) == int(size));
+  BOOST_CHECK(value.enabled);
+  BOOST_CHECK(value.id == 42);
+  BOOST_CHECK(value.name == "key");
+  BOOST_CHECK(value.score && (*value.score == 1.0));
+
+  test::event other;
+  mpack::decoder truncated { buffer, size - 1 };
+  BOOST_CHECK(truncated.decode(other) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  BOOST_CHECK(truncated.pos == truncated.begin);
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_decode_struct_wide)
+{
+  char buffer[512] = { 0 };
+  test::wide value;
+  value.f00 = 1;
+  value.f15 = 15;
+  value.a_field_name_longer_than_31_bytes = 33;
+
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  const int size = encoder.encode(value);
+  BOOST_CHECK(size > 0);
+  BOOST_CHECK(uint8_t(buffer[0]) == MPACK_MAP16);
+
+  test::wide other;
+  mpack::decoder decoder { buffer, size_t(size) };
+  BOOST_CHECK(decoder.decode(other) == size);
+  BOOST_CHECK(other.f00 == 1);
+  BOOST_CHECK(other.f15 == 15);
+  BOOST_CHECK(other.a_field_name_longer_than_31_bytes == 33);
+}
+
+BOOST_AUTO_TEST_CASE(test_struct_schema)
+{
+  constexpr auto schema = mpack_schema(static_cast<const test::event *>(nullptr));
+
+  static_assert(schema.valid);
+  static_assert(schema.keyed);
+  static_assert(schema.count == 5);
+
+  BOOST_CHECK(schema.find("points", 6) == 2);
+  BOOST_CHECK(schema.find("point", 5) == 5);
+  BOOST_CHECK(schema.find("enabled", 7) == 4);
+  BOOST_CHECK(memcmp(schema.bytes + schema.offsets[1], "\xa2id", 3) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_struct_key_encoding)
+{
+  char buffer[64] = { 0 };
+  char expect[64] = { 0 };
+  test::medium value;
+  value.a_twenty_byte_name_x = 7;
+
+  // Keys get the same encoding as strings written by the encoder, names of
+  // 16 to 31 bytes are str8.
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  mpack::encoder manual { expect, sizeof(expect) };
+  BOOST_CHECK(encoder.encode(value) == 24);
+  manual.encode(mpack::map{ 1 });
+  manual.encode(mpack::string{ "a_twenty_byte_name_x", 20 });
+  manual.encode(7);
+  BOOST_CHECK((manual.pos - manual.begin) == 24);
+  BOOST_CHECK(memcmp(buffer, expect, 24) == 0);
+  BOOST_CHECK(uint8_t(buffer[1]) == MPACK_STR8);
+}
@@ -0,0 +1,91 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+using namespace std::chrono;
+
+static_assert(mpack::encoded_size(time_point<system_clock, seconds>(seconds(100))) == 6);
+static_assert(mpack::encoded_size(time_point<system_clock, milliseconds>(milliseconds(1500))) == 10);
+static_assert(mpack::encoded_size(time_point<system_clock, milliseconds>(milliseconds(-1500))) == 15);
+static_assert(mpack::max_encoded_size<time_point<system_clock, nanoseconds>>() == 15);
+
+BOOST_AUTO_TEST_CASE(test_encode_decode_time_point)
+{
+  char buffer[64];
+  const time_point<system_clock, nanoseconds> now(nanoseconds(1500000000123456789LL));
+  const time_point<system_clock, microseconds> before(microseconds(-1500001));
+  time_point<system_clock, nanoseconds> a;
+  time_point<system_clock, microseconds> b;
+  time_point<system_clock, seconds> c;
+
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  BOOST_CHECK(encoder.encode(now) == 10);
+  BOOST_CHECK(encoder.encode(before) == 15);
+  BOOST_CHECK(encoder.encode(now) == 10);
+
+  mpack::decoder decoder { buffer, size_t(encoder.pos - encoder.begin) };
+  BOOST_CHECK(decoder.decode(a) == 10);
+  BOOST_CHECK(a == now);
+  BOOST_CHECK(decoder.decode(b) == 15);
+  BOOST_CHECK(b == before);
+  BOOST_CHECK(decoder.decode(c) == 10);
+  BOOST_CHECK(c.time_since_epoch().count() == 1500000000);
+}
+
+#if __cplusplus >= 202002L
+BOOST_AUTO_TEST_CASE(test_encode_decode_sys_time)
+{
+  char buffer[64];
+  const sys_seconds value = sys_days(year(2024) / 2 / 29) + hours(12);
+  sys_time<milliseconds> result;
+
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  BOOST_CHECK(encoder.encode(value) == 6);
+
+  mpack::decoder decoder { buffer, size_t(encoder.pos - encoder.begin) };
+  BOOST_CHECK(decoder.decode(result) == 6);
+  BOOST_CHECK(result == value);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(test_decode_time_point_range)
+{
+  char buffer[64];
+  timespec far;
+  far.tv_sec = 400LL * 365 * 86400;
+  far.tv_nsec = 0;
+  time_point<system_clock, nanoseconds> value;
+
+  mpack::encoder encoder { buffer, sizeof(buffer) };
+  BOOST_CHECK(encoder.encode(far) == 10);
+
+  mpack::decoder decoder { buffer, size_t(encoder.pos - encoder.begin) };
+  BOOST_CHECK(decoder.decode(value) == -1);
+  BOOST_CHECK(errno == ERANGE);
+  BOOST_CHECK(decoder.pos == decoder.begin);
+}
@@ -51,3 +51,30 @@ BOOST_AUTO_TEST_CASE(test_encode_init_from_buffer)
   
   mpack_decoder_term(&decoder);
 }
+
+BOOST_AUTO_TEST_CASE(test_scan_pieces)
+{
+  const char buffer[] = "\x92\xa5hello\x81\x01\xc4\x03xyz\x01";
+  const int size = 14;
+  mpack_scanner_t scanner;
+
+  for (int n = 0; n != size; ++n) {
+    mpack_scanner_init(&scanner);
+
+    for (int i = 0; i <= n; ++i) {
+      BOOST_CHECK(mpack_scan(&scanner, buffer, i) == -1);
+      BOOST_CHECK(errno == EAGAIN);
+    }
+
+    for (int i = n + 1; i != size; ++i) {
+      BOOST_CHECK(mpack_scan(&scanner, buffer, i) == -1);
+    }
+
+    BOOST_CHECK(mpack_scan(&scanner, buffer, size) == size);
+    BOOST_CHECK(mpack_scan(&scanner, buffer, size + 1) == size);
+  }
+
+  mpack_scanner_init(&scanner);
+  BOOST_CHECK(mpack_scan(&scanner, "\x91\xc1", 2) == -1);
+  BOOST_CHECK(errno == EINVAL);
+}
@@ -0,0 +1,187 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <string>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+#include "test_helpers.h"
+
+static int encode_message(mpack_encoder_t *encoder)
+{
+  char *start = encoder->pos;
+  mpack_map_t map;
+  map.size = 2;
+  mpack_encode_map(encoder, map);
+  mpack_encode_key(encoder, make_string("timestamp"));
+  mpack_encode_signed(encoder, 1);
+  mpack_encode_key(encoder, make_string("hostname"));
+  mpack_encode_string(encoder, make_string("localhost"));
+  return encoder->pos - start;
+}
+
+static void decode_message(mpack_decoder_t *decoder)
+{
+  mpack_map_t map;
+  mpack_string_t string;
+  long value;
+
+  BOOST_CHECK(mpack_decode_map(decoder, &map) == 1);
+  BOOST_CHECK(map.size == 2);
+  BOOST_CHECK(mpack_decode_string(decoder, &string) > 0);
+  BOOST_CHECK(std::string(string.data, string.size) == "timestamp");
+  BOOST_CHECK(mpack_decode_signed(decoder, &value) == 1);
+  BOOST_CHECK(mpack_decode_string(decoder, &string) > 0);
+  BOOST_CHECK(std::string(string.data, string.size) == "hostname");
+  BOOST_CHECK(mpack_decode_string(decoder, &string) > 0);
+  BOOST_CHECK(std::string(string.data, string.size) == "localhost");
+}
+
+BOOST_AUTO_TEST_CASE(test_dict_keys)
+{
+  char buffer[128] = { 0 };
+  mpack_dict_t encode_dict;
+  mpack_dict_t decode_dict;
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+
+  BOOST_CHECK(mpack_dict_init(&encode_dict, 16) == 0);
+  BOOST_CHECK(mpack_dict_init(&decode_dict, 16) == 0);
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  encoder.dict = &encode_dict;
+  BOOST_CHECK(encode_message(&encoder) == 1 + 12 + 1 + 11 + 10);
+  BOOST_CHECK(encode_message(&encoder) == 1 + 3 + 1 + 3 + 10);
+  BOOST_CHECK(mpack_dict_size(&encode_dict) == 2);
+
+  mpack_decoder_init(&decoder, buffer, encoder.pos - encoder.begin);
+  decoder.dict = &decode_dict;
+  decode_message(&decoder);
+  decode_message(&decoder);
+  BOOST_CHECK(decoder.pos == decoder.end);
+  BOOST_CHECK(mpack_dict_size(&decode_dict) == 2);
+
+  mpack_dict_term(&decode_dict);
+  mpack_dict_term(&encode_dict);
+}
+
+BOOST_AUTO_TEST_CASE(test_dict_string_values)
+{
+  char buffer[128] = { 0 };
+  mpack_dict_t encode_dict;
+  mpack_dict_t decode_dict;
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+  mpack_object_t object;
+
+  BOOST_CHECK(mpack_dict_init(&encode_dict, 16) == 0);
+  BOOST_CHECK(mpack_dict_init(&decode_dict, 16) == 0);
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  encoder.dict = &encode_dict;
+  encoder.flags = MPACK_ENCODE_DICT_STRINGS;
+  encode_message(&encoder);
+  BOOST_CHECK(encode_message(&encoder) == 1 + 3 + 1 + 3 + 3);
+
+  mpack_decoder_init(&decoder, buffer, encoder.pos - encoder.begin);
+  decoder.dict = &decode_dict;
+
+  // The first message is skipped, its definitions are still recorded.
+  BOOST_CHECK(mpack_decode_skip(&decoder) == 1 + 12 + 1 + 11 + 12);
+  BOOST_CHECK(mpack_dict_size(&decode_dict) == 3);
+
+  BOOST_CHECK(mpack_decode_object(&decoder, &object) == 1);
+  BOOST_CHECK(mpack_decode_object(&decoder, &object) == 3);
+  BOOST_CHECK(object.type == MPACK_STRING);
+  BOOST_CHECK(std::string(object.data.string.data, object.data.string.size) == "timestamp");
+
+  mpack_dict_term(&decode_dict);
+  mpack_dict_term(&encode_dict);
+}
+
+BOOST_AUTO_TEST_CASE(test_dict_truncate)
+{
+  char buffer[128] = { 0 };
+  char small[8] = { 0 };
+  mpack_dict_t dict;
+  mpack_encoder_t encoder;
+  size_t size;
+
+  BOOST_CHECK(mpack_dict_init(&dict, 16) == 0);
+
+  // The message does not fit so it is discarded along with its definitions.
+  mpack_encoder_init(&encoder, small, sizeof(small));
+  encoder.dict = &dict;
+  size = mpack_dict_size(&dict);
+  encode_message(&encoder);
+  BOOST_CHECK(encoder.pos > encoder.end);
+  mpack_dict_truncate(&dict, size);
+  BOOST_CHECK(mpack_dict_size(&dict) == 0);
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  encoder.dict = &dict;
+  BOOST_CHECK(encode_message(&encoder) == 1 + 12 + 1 + 11 + 10);
+  BOOST_CHECK(dict.strings.entries[0].symbol->id == 0);
+
+  mpack_dict_term(&dict);
+}
+
+BOOST_AUTO_TEST_CASE(test_dict_full)
+{
+  char buffer[128] = { 0 };
+  mpack_dict_t dict;
+  mpack_encoder_t encoder;
+
+  BOOST_CHECK(mpack_dict_init(&dict, 1) == 0);
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  encoder.dict = &dict;
+  BOOST_CHECK(mpack_encode_key(&encoder, make_string("first")) == 8);
+  BOOST_CHECK(mpack_encode_key(&encoder, make_string("second")) == 7);
+  BOOST_CHECK(mpack_encode_key(&encoder, make_string("first")) == 3);
+  BOOST_CHECK(mpack_encode_key(&encoder, make_string("ab")) == 3);
+
+  BOOST_CHECK(mpack_dict_init(&dict, MPACK_DICT_MAX_SIZE + 1) == -1);
+  BOOST_CHECK(errno == EINVAL);
+
+  mpack_dict_term(&dict);
+}
+
+BOOST_AUTO_TEST_CASE(test_dict_unknown_reference)
+{
+  const char buffer[] = { char(MPACK_FIXEXT1), MPACK_DICT_REFERENCE, 3 };
+  mpack_dict_t dict;
+  mpack_decoder_t decoder;
+  mpack_string_t string;
+
+  BOOST_CHECK(mpack_dict_init(&dict, 16) == 0);
+
+  mpack_decoder_init(&decoder, buffer, sizeof(buffer));
+  decoder.dict = &dict;
+  BOOST_CHECK(mpack_decode_string(&decoder, &string) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(decoder.pos == decoder.begin);
+
+  mpack_dict_term(&dict);
+}
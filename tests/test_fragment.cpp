@@ -0,0 +1,234 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+#include "test_helpers.h"
+
+BOOST_AUTO_TEST_CASE(test_fragment_raw)
+{
+  char input[64];
+  char output[64];
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+  mpack_segment_t value;
+  mpack_array_t array;
+
+  mpack_encoder_init(&encoder, input, sizeof(input));
+  mpack_encode_array(&encoder, mpack_array_t{ 2 });
+  mpack_encode_string(&encoder, make_string("hello"));
+  mpack_encode_signed(&encoder, -300);
+  mpack_encode_nil(&encoder);
+  BOOST_REQUIRE(encoder.pos <= encoder.end);
+
+  mpack_decoder_init(&decoder, input, encoder.pos - encoder.begin);
+  BOOST_CHECK(mpack_decode_raw(&decoder, &value) == 10);
+  BOOST_CHECK(value.data == input);
+  BOOST_CHECK(value.size == 10);
+  BOOST_CHECK(decoder.pos == (input + 10));
+
+  mpack_encoder_init(&encoder, output, sizeof(output));
+  BOOST_CHECK(mpack_encode_raw(&encoder, value.data, value.size) == 10);
+  BOOST_CHECK(std::memcmp(output, input, 10) == 0);
+
+  mpack_decoder_init(&decoder, output, encoder.pos - encoder.begin);
+  BOOST_CHECK(mpack_decode_array(&decoder, &array) == 1);
+  BOOST_CHECK(array.size == 2);
+
+  // A truncated value leaves the decoder where it was.
+  mpack_decoder_init(&decoder, input, 6);
+  BOOST_CHECK(mpack_decode_raw(&decoder, &value) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  BOOST_CHECK(decoder.pos == input);
+
+  // Splicing past the end of the buffer reports the size like other values.
+  mpack_encoder_init(&encoder, output, 4);
+  BOOST_CHECK(mpack_encode_raw(&encoder, input, 10) == 10);
+  BOOST_CHECK(encoder.pos > encoder.end);
+
+  // Values of a dictionary session cannot be copied to another output.
+  mpack_dict_t dict;
+  BOOST_REQUIRE(mpack_dict_init(&dict, 16) == 0);
+  mpack_decoder_init(&decoder, input, 10);
+  decoder.dict = &dict;
+  BOOST_CHECK(mpack_decode_raw(&decoder, &value) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(decoder.pos == input);
+  mpack_dict_term(&dict);
+}
+
+// A proxy rewrites the "id" of an envelope and forwards the other fields as
+// they were received.
+BOOST_AUTO_TEST_CASE(test_fragment_proxy)
+{
+  char input[128];
+  char output[128];
+  char expect[128];
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+  mpack_segment_t value;
+  mpack_string_t name;
+  mpack_map_t map;
+  size_t i;
+
+  mpack_encoder_init(&encoder, input, sizeof(input));
+  mpack_encode_map(&encoder, mpack_map_t{ 3 });
+  mpack_encode_string(&encoder, make_string("id"));
+  mpack_encode_unsigned(&encoder, 1);
+  mpack_encode_string(&encoder, make_string("body"));
+  mpack_encode_array(&encoder, mpack_array_t{ 2 });
+  mpack_encode_string(&encoder, make_string("a"));
+  mpack_encode_double(&encoder, 1.5);
+  mpack_encode_string(&encoder, make_string("meta"));
+  mpack_encode_map(&encoder, mpack_map_t{ 1 });
+  mpack_encode_string(&encoder, make_string("k"));
+  mpack_encode_nil(&encoder);
+  BOOST_REQUIRE(encoder.pos <= encoder.end);
+
+  mpack_decoder_init(&decoder, input, encoder.pos - encoder.begin);
+  mpack_encoder_init(&encoder, output, sizeof(output));
+  BOOST_REQUIRE(mpack_decode_map(&decoder, &map) > 0);
+  mpack_encode_map(&encoder, map);
+
+  for (i = 0; i != map.size; ++i) {
+    BOOST_REQUIRE(mpack_decode_string(&decoder, &name) > 0);
+    mpack_encode_string(&encoder, name);
+
+    if ((name.size == 2) && (std::memcmp(name.data, "id", 2) == 0)) {
+      BOOST_REQUIRE(mpack_decode_skip(&decoder) > 0);
+      mpack_encode_unsigned(&encoder, 4242);
+    }
+    else {
+      BOOST_REQUIRE(mpack_decode_raw(&decoder, &value) > 0);
+      mpack_encode_raw(&encoder, value.data, value.size);
+    }
+  }
+
+  BOOST_REQUIRE(encoder.pos <= encoder.end);
+  BOOST_CHECK(decoder.pos == decoder.end);
+
+  std::string result(encoder.begin, encoder.pos);
+  mpack_encoder_init(&encoder, expect, sizeof(expect));
+  mpack_encode_map(&encoder, mpack_map_t{ 3 });
+  mpack_encode_string(&encoder, make_string("id"));
+  mpack_encode_unsigned(&encoder, 4242);
+  mpack_encode_string(&encoder, make_string("body"));
+  mpack_encode_array(&encoder, mpack_array_t{ 2 });
+  mpack_encode_string(&encoder, make_string("a"));
+  mpack_encode_double(&encoder, 1.5);
+  mpack_encode_string(&encoder, make_string("meta"));
+  mpack_encode_map(&encoder, mpack_map_t{ 1 });
+  mpack_encode_string(&encoder, make_string("k"));
+  mpack_encode_nil(&encoder);
+  BOOST_CHECK(result == std::string(encoder.begin, encoder.pos));
+}
+
+BOOST_AUTO_TEST_CASE(test_fragment_cache)
+{
+  char buffer[512];
+  char header[8];
+  mpack_fragments_t fragments;
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+  mpack_string_t value;
+  mpack_map_t map;
+  int status;
+  int type;
+  int meta;
+  int i;
+
+  mpack_fragments_init(&fragments);
+  BOOST_REQUIRE((status = mpack_fragments_add_string(&fragments, make_string("status"))) == 0);
+  BOOST_REQUIRE((type = mpack_fragments_add_string(&fragments, make_string("type"))) == 1);
+
+  // {"v": 1}, a static sub-object.
+  mpack_encoder_init(&encoder, header, sizeof(header));
+  mpack_encode_map(&encoder, mpack_map_t{ 1 });
+  mpack_encode_string(&encoder, make_string("v"));
+  mpack_encode_unsigned(&encoder, 1);
+  BOOST_REQUIRE((meta = mpack_fragments_add(&fragments, header, encoder.pos - encoder.begin)) == 2);
+
+  // Enough strings to grow the storage a few times.
+  for (i = 0; i != 100; ++i) {
+    std::string s = std::to_string(i);
+    s.append(40, 'x');
+    BOOST_REQUIRE(mpack_fragments_add_string(&fragments, mpack_string_t{ s.data(), s.size() }) == (i + 3));
+  }
+
+  BOOST_CHECK(fragments.count == 103);
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_map(&encoder, mpack_map_t{ 3 });
+  BOOST_CHECK(mpack_encode_fragment(&encoder, &fragments, status) == 7);
+  BOOST_CHECK(mpack_encode_fragment(&encoder, &fragments, 3 + 42) == 44);
+  BOOST_CHECK(mpack_encode_fragment(&encoder, &fragments, type) == 5);
+  mpack_encode_string(&encoder, make_string("ok"));
+  mpack_encode_string(&encoder, make_string("meta"));
+  BOOST_CHECK(mpack_encode_fragment(&encoder, &fragments, meta) == 4);
+  BOOST_REQUIRE(encoder.pos <= encoder.end);
+
+  mpack_decoder_init(&decoder, buffer, encoder.pos - encoder.begin);
+  BOOST_CHECK(mpack_decode_map(&decoder, &map) == 1);
+  BOOST_CHECK(mpack_decode_string(&decoder, &value) == 7);
+  BOOST_CHECK(std::string(value.data, value.size) == "status");
+  BOOST_CHECK(mpack_decode_string(&decoder, &value) == 44);
+  BOOST_CHECK(std::string(value.data, value.size) == std::to_string(42).append(40, 'x'));
+  BOOST_CHECK(mpack_decode_string(&decoder, &value) == 5);
+  BOOST_CHECK(std::string(value.data, value.size) == "type");
+  BOOST_CHECK(mpack_decode_skip(&decoder) == 3);
+  BOOST_CHECK(mpack_decode_skip(&decoder) == 5);
+  BOOST_CHECK(mpack_decode_map(&decoder, &map) == 1);
+  BOOST_CHECK(map.size == 1);
+
+  BOOST_CHECK(mpack_encode_fragment(&encoder, &fragments, 103) == -1);
+  BOOST_CHECK(errno == EINVAL);
+
+  mpack_fragments_term(&fragments);
+  BOOST_CHECK(fragments.count == 0);
+  BOOST_CHECK(fragments.data == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(test_fragment_invalid)
+{
+  const char truncated[] = { '\x92', '\x01' };
+  const char invalid[] = { '\xc1' };
+  mpack_fragments_t fragments;
+
+  mpack_fragments_init(&fragments);
+  BOOST_CHECK(mpack_fragments_add(&fragments, truncated, sizeof(truncated)) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(mpack_fragments_add(&fragments, invalid, sizeof(invalid)) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(mpack_fragments_add(&fragments, "", 0) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(fragments.count == 0);
+
+  // Several values may share a fragment, like a key and its value.
+  BOOST_CHECK(mpack_fragments_add(&fragments, "\xa1k\x01", 3) == 0);
+  BOOST_CHECK(fragments.size == 3);
+  mpack_fragments_term(&fragments);
+}
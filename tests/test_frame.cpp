@@ -0,0 +1,316 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+static std::string compress_decompress(const std::string &input)
+{
+  std::string compressed(mpack_lz_bound(input.size()), '\0');
+  std::string output(input.size(), '\0');
+  size_t length;
+
+  length = mpack_lz_compress(&compressed[0], compressed.size(), input.data(), input.size());
+  BOOST_REQUIRE(length != 0);
+  BOOST_REQUIRE(mpack_lz_decompress(&output[0], output.size(), compressed.data(), length) == 0);
+  return output;
+}
+
+BOOST_AUTO_TEST_CASE(test_lz_round_trip)
+{
+  std::mt19937 random(42);
+  std::string text;
+  std::string noise;
+
+  for (int i = 0; i != 1000; ++i) {
+    text += "{\"id\":" + std::to_string(i) + ",\"name\":\"record\",\"tags\":[\"a\",\"b\"]}";
+    noise += char(random());
+  }
+
+  BOOST_CHECK(compress_decompress("") == "");
+  BOOST_CHECK(compress_decompress("a") == "a");
+  BOOST_CHECK(compress_decompress("abcdabcdabcdabcd") == "abcdabcdabcdabcd");
+  BOOST_CHECK(compress_decompress(std::string(100000, 'x')) == std::string(100000, 'x'));
+  BOOST_CHECK(compress_decompress(text) == text);
+  BOOST_CHECK(compress_decompress(noise) == noise);
+}
+
+BOOST_AUTO_TEST_CASE(test_lz_ratio)
+{
+  std::string text;
+  std::string compressed;
+
+  for (int i = 0; i != 1000; ++i) {
+    text += "{\"id\":" + std::to_string(i) + ",\"name\":\"record\",\"tags\":[\"a\",\"b\"]}";
+  }
+
+  compressed.resize(text.size());
+  BOOST_CHECK(mpack_lz_compress(&compressed[0], compressed.size(), text.data(), text.size()) < (text.size() / 4));
+  BOOST_CHECK(mpack_lz_compress(&compressed[0], 16, text.data(), text.size()) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_lz_corrupt)
+{
+  const std::string input(1000, 'z');
+  std::string compressed(mpack_lz_bound(input.size()), '\0');
+  std::string output(input.size(), '\0');
+  size_t length;
+
+  length = mpack_lz_compress(&compressed[0], compressed.size(), input.data(), input.size());
+
+  // Truncated input, short output and offsets pointing before the output.
+  BOOST_CHECK(mpack_lz_decompress(&output[0], output.size(), compressed.data(), length - 1) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(mpack_lz_decompress(&output[0], output.size() - 1, compressed.data(), length) == -1);
+  BOOST_CHECK(mpack_lz_decompress(&output[0], output.size() + 1, compressed.data(), length) == -1);
+
+  const char bad[] = { 0x10, 'a', 0x05, 0x00, 0x00 };
+  BOOST_CHECK(mpack_lz_decompress(&output[0], 5, bad, sizeof(bad)) == -1);
+}
+
+BOOST_AUTO_TEST_CASE(test_frame_encode_decode)
+{
+  const std::string compressible(4096, 'q');
+  const std::string incompressible = "0123456789";
+  std::string frame(mpack_frame_bound(compressible.size()), '\0');
+  std::string output;
+  mpack_frame_t header;
+  int length;
+
+  length = mpack_frame_encode(&frame[0], frame.size(), compressible.data(), compressible.size());
+  BOOST_CHECK(length > 0);
+  BOOST_CHECK(length < 100);
+  BOOST_CHECK(mpack_frame_header(frame.data(), length, &header) == MPACK_FRAME_HEADER_SIZE);
+  BOOST_CHECK(header.method == MPACK_FRAME_LZ);
+  BOOST_CHECK(header.size == compressible.size());
+  BOOST_CHECK(header.length + MPACK_FRAME_HEADER_SIZE == size_t(length));
+
+  output.resize(header.size);
+  BOOST_CHECK(mpack_frame_decode(&output[0], &header, frame.data() + MPACK_FRAME_HEADER_SIZE) == 0);
+  BOOST_CHECK(output == compressible);
+
+  length = mpack_frame_encode(&frame[0], frame.size(), incompressible.data(), incompressible.size());
+  BOOST_CHECK(length == int(MPACK_FRAME_HEADER_SIZE + incompressible.size()));
+  BOOST_CHECK(mpack_frame_header(frame.data(), length, &header) == MPACK_FRAME_HEADER_SIZE);
+  BOOST_CHECK(header.method == MPACK_FRAME_STORED);
+
+  BOOST_CHECK(mpack_frame_header(frame.data(), 4, &header) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  BOOST_CHECK(mpack_frame_encode(&frame[0], 4, incompressible.data(), incompressible.size()) == -1);
+  BOOST_CHECK(errno == ERANGE);
+}
+
+struct stream {
+  std::string data;
+  size_t offset = 0;
+  int frames = 0;
+};
+
+static int stream_write(void *context, const void *data, size_t size)
+{
+  stream *s = static_cast<stream *>(context);
+  s->data.append(static_cast<const char *>(data), size);
+  s->frames += 1;
+  return size;
+}
+
+static int stream_read(void *context, void *data, size_t size)
+{
+  stream *s = static_cast<stream *>(context);
+  size = std::min(size, s->data.size() - s->offset);
+  std::memcpy(data, s->data.data() + s->offset, size);
+  s->offset += size;
+  return size;
+}
+
+static void encode_record(mpack_encoder_t *encoder, int i, size_t padding)
+{
+  std::string name(padding, 'n');
+  mpack_array_t array;
+  mpack_string_t string;
+
+  array.size = 2;
+  string.data = name.data();
+  string.size = name.size();
+  mpack_encode_array(encoder, array);
+  mpack_encode_signed(encoder, i);
+  mpack_encode_string(encoder, string);
+}
+
+BOOST_AUTO_TEST_CASE(test_frame_writer_reader)
+{
+  stream s;
+  mpack_frame_writer_t writer;
+  mpack_frame_reader_t reader;
+  size_t raw = 0;
+  int count = 0;
+
+  BOOST_CHECK(mpack_frame_writer_init(&writer, 1024, stream_write, &s) == 0);
+
+  for (int i = 0; i != 1000; ++i) {
+    // Record 500 is larger than a block and gets a frame of its own.
+    const size_t padding = (i == 500) ? 5000 : 20;
+    char *start = writer.encoder.pos;
+
+    encode_record(&writer.encoder, i, padding);
+    raw += writer.encoder.pos - start;
+
+    if (mpack_frame_writer_commit(&writer) < 0) {
+      BOOST_REQUIRE(errno == EAGAIN);
+      encode_record(&writer.encoder, i, padding);
+      BOOST_REQUIRE(mpack_frame_writer_commit(&writer) == 0);
+    }
+  }
+
+  BOOST_CHECK(mpack_frame_writer_flush(&writer) > 0);
+  BOOST_CHECK(mpack_frame_writer_flush(&writer) == 0);
+  mpack_frame_writer_term(&writer);
+
+  BOOST_CHECK(s.frames > 20);
+  BOOST_CHECK(s.data.size() < raw / 4);
+
+  BOOST_CHECK(mpack_frame_reader_init(&reader, 1024, 65536, stream_read, &s) == 0);
+
+  while (mpack_frame_reader_next(&reader) > 0) {
+    while (reader.decoder.pos != reader.decoder.end) {
+      mpack_array_t array;
+      mpack_string_t string;
+      long value;
+
+      BOOST_REQUIRE(mpack_decode_array(&reader.decoder, &array) > 0);
+      BOOST_REQUIRE(mpack_decode_signed(&reader.decoder, &value) > 0);
+      BOOST_REQUIRE(mpack_decode_string(&reader.decoder, &string) > 0);
+      BOOST_CHECK(value == count);
+      BOOST_CHECK(string.size == ((count == 500) ? 5000U : 20U));
+      ++count;
+    }
+  }
+
+  BOOST_CHECK(count == 1000);
+  BOOST_CHECK(s.offset == s.data.size());
+  mpack_frame_reader_term(&reader);
+}
+
+BOOST_AUTO_TEST_CASE(test_frame_reader_truncated)
+{
+  stream s;
+  mpack_frame_writer_t writer;
+  mpack_frame_reader_t reader;
+
+  BOOST_CHECK(mpack_frame_writer_init(&writer, 256, stream_write, &s) == 0);
+  encode_record(&writer.encoder, 1, 100);
+  BOOST_CHECK(mpack_frame_writer_commit(&writer) == 0);
+  BOOST_CHECK(mpack_frame_writer_flush(&writer) > 0);
+  mpack_frame_writer_term(&writer);
+
+  s.data.resize(s.data.size() - 1);
+  BOOST_CHECK(mpack_frame_reader_init(&reader, 256, 256, stream_read, &s) == 0);
+  BOOST_CHECK(mpack_frame_reader_next(&reader) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  mpack_frame_reader_term(&reader);
+}
+
+BOOST_AUTO_TEST_CASE(test_frame_reader_max_size)
+{
+  stream s;
+  mpack_frame_reader_t reader;
+
+  // A stored frame announcing a 2 GB block, the reader must not try to
+  // allocate it.
+  s.data = std::string("\x00\x7f\xff\xff\xff\x7f\xff\xff\xff", 9);
+  BOOST_CHECK(mpack_frame_reader_init(&reader, 256, 4096, stream_read, &s) == 0);
+  BOOST_CHECK(mpack_frame_reader_next(&reader) == -1);
+  BOOST_CHECK(errno == ERANGE);
+  BOOST_CHECK(reader.window_size == 256);
+  mpack_frame_reader_term(&reader);
+
+  BOOST_CHECK(mpack_frame_reader_init(&reader, 4096, 256, stream_read, &s) == -1);
+  BOOST_CHECK(errno == EINVAL);
+}
+
+BOOST_AUTO_TEST_CASE(test_frame_writer_dict)
+{
+  stream s;
+  mpack_frame_writer_t writer;
+  mpack_frame_reader_t reader;
+  mpack_dict_t encoder_dict;
+  mpack_dict_t decoder_dict;
+  int count = 0;
+
+  BOOST_REQUIRE(mpack_dict_init(&encoder_dict, 1024) == 0);
+  BOOST_REQUIRE(mpack_dict_init(&decoder_dict, 1024) == 0);
+  BOOST_REQUIRE(mpack_frame_writer_init(&writer, 256, stream_write, &s) == 0);
+  writer.encoder.dict = &encoder_dict;
+
+  // Every record defines a new key, records dropped at the end of a block
+  // must not leave their definition in the dictionary.
+  for (int i = 0; i != 200; ++i) {
+    const std::string key = "key-" + std::to_string(i);
+
+    for (;;) {
+      mpack_encode_map(&writer.encoder, mpack_map_t{ 1 });
+      mpack_encode_key(&writer.encoder, mpack_string_t{ key.data(), key.size() });
+      mpack_encode_signed(&writer.encoder, i);
+
+      if (mpack_frame_writer_commit(&writer) == 0) {
+        break;
+      }
+
+      BOOST_REQUIRE(errno == EAGAIN);
+    }
+  }
+
+  BOOST_CHECK(mpack_frame_writer_flush(&writer) > 0);
+  BOOST_CHECK(mpack_dict_size(&encoder_dict) == 200);
+  mpack_frame_writer_term(&writer);
+
+  BOOST_REQUIRE(mpack_frame_reader_init(&reader, 256, 4096, stream_read, &s) == 0);
+
+  while (mpack_frame_reader_next(&reader) > 0) {
+    reader.decoder.dict = &decoder_dict;
+
+    while (reader.decoder.pos != reader.decoder.end) {
+      mpack_map_t map;
+      mpack_string_t key;
+      long value;
+
+      BOOST_REQUIRE(mpack_decode_map(&reader.decoder, &map) > 0);
+      BOOST_REQUIRE(mpack_decode_string(&reader.decoder, &key) > 0);
+      BOOST_REQUIRE(mpack_decode_signed(&reader.decoder, &value) > 0);
+      BOOST_CHECK(std::string(key.data, key.size) == "key-" + std::to_string(count));
+      BOOST_CHECK(value == count);
+      ++count;
+    }
+  }
+
+  BOOST_CHECK(count == 200);
+  mpack_frame_reader_term(&reader);
+  mpack_dict_term(&decoder_dict);
+  mpack_dict_term(&encoder_dict);
+}
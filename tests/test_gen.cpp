@@ -0,0 +1,247 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+#include "test_gen.h"
+#include "test_helpers.h"
+
+static event_t make_event()
+{
+  event_t value;
+  std::memset(&value, 0, sizeof(value));
+  value.id = 1ULL << 40;
+  value.level = -3;
+  value.port = 8080;
+  value.active = true;
+  value.ratio = 0.5f;
+  value.name = make_string("startup");
+  value.payload.data = "\x01\x02\x03";
+  value.payload.size = 3;
+  value.time.tv_sec = 1500000000;
+  value.time.tv_nsec = 42;
+  value.position.x = 1.0;
+  value.position.y = -2.5;
+  value.position.z = 1e100;
+  return value;
+}
+
+static void check_event(const event_t &value)
+{
+  BOOST_CHECK(value.id == (1ULL << 40));
+  BOOST_CHECK(value.level == -3);
+  BOOST_CHECK(value.port == 8080);
+  BOOST_CHECK(value.active == true);
+  BOOST_CHECK(value.ratio == 0.5f);
+  BOOST_CHECK(std::string(value.name.data, value.name.size) == "startup");
+  BOOST_CHECK(std::string(static_cast<const char *>(value.payload.data), value.payload.size) == "\x01\x02\x03");
+  BOOST_CHECK(value.time.tv_sec == 1500000000);
+  BOOST_CHECK(value.time.tv_nsec == 42);
+  BOOST_CHECK(value.position.x == 1.0);
+  BOOST_CHECK(value.position.y == -2.5);
+  BOOST_CHECK(value.position.z == 1e100);
+}
+
+BOOST_AUTO_TEST_CASE(test_gen_encode_decode)
+{
+  char buffer[256];
+  const event_t input = make_event();
+  event_t output;
+  int size;
+
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  BOOST_CHECK((size = event_encode(&encoder, &input)) > 0);
+  BOOST_CHECK(size == (encoder.pos - buffer));
+
+  mpack_decoder_t decoder;
+  mpack_decoder_init(&decoder, buffer, size);
+  std::memset(&output, 0, sizeof(output));
+  BOOST_CHECK(event_decode(&decoder, &output) == size);
+  BOOST_CHECK(decoder.pos == decoder.end);
+  check_event(output);
+}
+
+BOOST_AUTO_TEST_CASE(test_gen_decode_truncated)
+{
+  char buffer[256];
+  const event_t input = make_event();
+  event_t output;
+  int size;
+  int i;
+
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  size = event_encode(&encoder, &input);
+
+  for (i = 0; i != size; ++i) {
+    mpack_decoder_t decoder;
+    mpack_decoder_init(&decoder, buffer, i);
+    errno = 0;
+    BOOST_CHECK(event_decode(&decoder, &output) == -1);
+    BOOST_CHECK(errno == EAGAIN);
+    BOOST_CHECK(decoder.pos == buffer);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_gen_decode_unordered)
+{
+  char buffer[256];
+  event_t output;
+  mpack_map_t map;
+  int size;
+
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  map.size = 4;
+  mpack_encode_map(&encoder, map);
+  mpack_encode_string(&encoder, make_string("name"));
+  mpack_encode_string(&encoder, make_string("shutdown"));
+  mpack_encode_string(&encoder, make_string("unknown"));
+  mpack_encode_nil(&encoder);
+  mpack_encode_string(&encoder, make_string("id"));
+  mpack_encode_unsigned(&encoder, 300);
+  mpack_encode_string(&encoder, make_string("level"));
+  mpack_encode_signed(&encoder, 100);
+  size = encoder.pos - buffer;
+
+  mpack_decoder_t decoder;
+  mpack_decoder_init(&decoder, buffer, size);
+  std::memset(&output, 0, sizeof(output));
+  BOOST_CHECK(event_decode(&decoder, &output) == size);
+  BOOST_CHECK(output.id == 300);
+  BOOST_CHECK(output.level == 100);
+  BOOST_CHECK(std::string(output.name.data, output.name.size) == "shutdown");
+}
+
+BOOST_AUTO_TEST_CASE(test_gen_decode_invalid)
+{
+  char buffer[256];
+  event_t output;
+  mpack_map_t map;
+
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+
+  // missing required field
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  map.size = 1;
+  mpack_encode_map(&encoder, map);
+  mpack_encode_string(&encoder, make_string("id"));
+  mpack_encode_unsigned(&encoder, 1);
+
+  mpack_decoder_init(&decoder, buffer, encoder.pos - buffer);
+  errno = 0;
+  BOOST_CHECK(event_decode(&decoder, &output) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(decoder.pos == buffer);
+
+  // out of range
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  map.size = 3;
+  mpack_encode_map(&encoder, map);
+  mpack_encode_string(&encoder, make_string("id"));
+  mpack_encode_unsigned(&encoder, 1);
+  mpack_encode_string(&encoder, make_string("name"));
+  mpack_encode_string(&encoder, make_string(""));
+  mpack_encode_string(&encoder, make_string("port"));
+  mpack_encode_unsigned(&encoder, 65536);
+
+  mpack_decoder_init(&decoder, buffer, encoder.pos - buffer);
+  errno = 0;
+  BOOST_CHECK(event_decode(&decoder, &output) == -1);
+  BOOST_CHECK(errno == ERANGE);
+  BOOST_CHECK(decoder.pos == buffer);
+
+  // not a map
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_nil(&encoder);
+
+  mpack_decoder_init(&decoder, buffer, encoder.pos - buffer);
+  errno = 0;
+  BOOST_CHECK(event_decode(&decoder, &output) == -1);
+  BOOST_CHECK(errno == EINVAL);
+}
+
+BOOST_AUTO_TEST_CASE(test_gen_int64_limits)
+{
+  char buffer[64];
+  counter_t input;
+  counter_t output;
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+  int size;
+
+  for (int64_t value : { INT64_MIN, INT64_C(-1), INT64_MAX }) {
+    input.value = value;
+    input.total = UINT64_MAX;
+
+    mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+    BOOST_CHECK((size = counter_encode(&encoder, &input)) > 0);
+
+    mpack_decoder_init(&decoder, buffer, encoder.pos - buffer);
+    std::memset(&output, 0, sizeof(output));
+    BOOST_CHECK(counter_decode(&decoder, &output) == size);
+    BOOST_CHECK(output.value == value);
+    BOOST_CHECK(output.total == UINT64_MAX);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_gen_dict)
+{
+  char buffer[512];
+  const event_t input = make_event();
+  event_t output;
+  int size1;
+  int size2;
+
+  mpack_dict_t encoder_dict;
+  mpack_dict_t decoder_dict;
+  BOOST_CHECK(mpack_dict_init(&encoder_dict, 64) == 0);
+  BOOST_CHECK(mpack_dict_init(&decoder_dict, 64) == 0);
+
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  encoder.dict = &encoder_dict;
+  BOOST_CHECK((size1 = event_encode(&encoder, &input)) > 0);
+  BOOST_CHECK((size2 = event_encode(&encoder, &input)) > 0);
+  BOOST_CHECK(size2 < size1);
+
+  mpack_decoder_t decoder;
+  mpack_decoder_init(&decoder, buffer, encoder.pos - buffer);
+  decoder.dict = &decoder_dict;
+  std::memset(&output, 0, sizeof(output));
+  BOOST_CHECK(event_decode(&decoder, &output) == size1);
+  check_event(output);
+  std::memset(&output, 0, sizeof(output));
+  BOOST_CHECK(event_decode(&decoder, &output) == size2);
+  check_event(output);
+  BOOST_CHECK(decoder.pos == decoder.end);
+
+  mpack_dict_term(&decoder_dict);
+  mpack_dict_term(&encoder_dict);
+}
@@ -0,0 +1,55 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MPACK_TEST_HELPERS_H
+#define MPACK_TEST_HELPERS_H
+
+#include <cstring>
+#include <string>
+#include <mpack.h>
+
+// Values built by the tests point at the characters of the caller.
+inline mpack_string_t make_string(const char *s, size_t n)
+{
+  mpack_string_t value;
+  value.data = s;
+  value.size = n;
+  return value;
+}
+
+inline mpack_string_t make_string(const char *s)
+{ return make_string(s, std::strlen(s)); }
+
+inline mpack_string_t make_string(const std::string &s)
+{ return make_string(s.data(), s.size()); }
+
+inline mpack_object_t key(const char *name)
+{
+  mpack_object_t object;
+  object.type = MPACK_STRING;
+  object.data.string = make_string(name);
+  return object;
+}
+
+#endif
@@ -0,0 +1,172 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+#include "test_helpers.h"
+
+BOOST_AUTO_TEST_CASE(test_intern_insert_find)
+{
+  mpack_intern_t intern;
+  std::string a = "hello";
+  std::string b = "hello";
+  std::string c = "world";
+
+  BOOST_CHECK(mpack_intern_init(&intern, 16) == 0);
+  BOOST_CHECK(mpack_intern_find(&intern, make_string(a)) == NULL);
+
+  const mpack_symbol_t *s1 = mpack_intern_insert(&intern, make_string(a));
+  const mpack_symbol_t *s2 = mpack_intern_insert(&intern, make_string(b));
+  const mpack_symbol_t *s3 = mpack_intern_insert(&intern, make_string(c));
+
+  BOOST_CHECK(s1 != NULL);
+  BOOST_CHECK(s1 == s2);
+  BOOST_CHECK(s1->id == s2->id);
+  BOOST_CHECK(s1->id != s3->id);
+  BOOST_CHECK(s1->data != a.data());
+  BOOST_CHECK(std::string(s1->data, s1->size) == "hello");
+  BOOST_CHECK(mpack_intern_find(&intern, make_string(c)) == s3);
+
+  mpack_intern_term(&intern);
+}
+
+BOOST_AUTO_TEST_CASE(test_intern_invalid_capacity)
+{
+  mpack_intern_t intern;
+  BOOST_CHECK(mpack_intern_init(&intern, 0) == -1);
+  BOOST_CHECK(errno == EINVAL);
+}
+
+BOOST_AUTO_TEST_CASE(test_intern_eviction)
+{
+  mpack_intern_t intern;
+  BOOST_CHECK(mpack_intern_init(&intern, 4) == 0);
+
+  const uint32_t a = mpack_intern_insert(&intern, make_string("a"))->id;
+  mpack_intern_insert(&intern, make_string("b"));
+  mpack_intern_insert(&intern, make_string("c"));
+  mpack_intern_insert(&intern, make_string("d"));
+
+  // "a" was referenced again so the next insertion evicts "b" instead.
+  BOOST_CHECK(mpack_intern_insert(&intern, make_string("a"))->id == a);
+  mpack_intern_insert(&intern, make_string("e"));
+
+  BOOST_CHECK(intern.count == 4);
+  BOOST_CHECK(mpack_intern_find(&intern, make_string("a")) != NULL);
+  BOOST_CHECK(mpack_intern_find(&intern, make_string("b")) == NULL);
+  BOOST_CHECK(mpack_intern_find(&intern, make_string("e")) != NULL);
+
+  // Identifiers of evicted symbols are never handed out again.
+  BOOST_CHECK(mpack_intern_insert(&intern, make_string("b"))->id == 5);
+
+  mpack_intern_term(&intern);
+}
+
+BOOST_AUTO_TEST_CASE(test_intern_retain)
+{
+  mpack_intern_t intern;
+  BOOST_CHECK(mpack_intern_init(&intern, 2) == 0);
+
+  const mpack_symbol_t *a = mpack_symbol_retain(mpack_intern_insert(&intern, make_string("a")));
+  mpack_intern_insert(&intern, make_string("b"));
+  mpack_intern_insert(&intern, make_string("c"));
+  mpack_intern_insert(&intern, make_string("d"));
+  BOOST_CHECK(mpack_intern_find(&intern, make_string("a")) == NULL);
+
+  // The evicted symbol still holds its own string and id.
+  BOOST_CHECK(std::string(a->data, a->size) == "a");
+  BOOST_CHECK(a->id == 0);
+
+  const mpack_symbol_t *again = mpack_intern_insert(&intern, make_string("a"));
+  BOOST_CHECK(again != a);
+  BOOST_CHECK(again->id == 4);
+  BOOST_CHECK(std::string(a->data, a->size) == "a");
+
+  mpack_symbol_release(a);
+  mpack_intern_term(&intern);
+}
+
+BOOST_AUTO_TEST_CASE(test_intern_churn)
+{
+  mpack_intern_t intern;
+  BOOST_CHECK(mpack_intern_init(&intern, 32) == 0);
+
+  for (int i = 0; i != 10000; ++i) {
+    std::string key = "key-" + std::to_string(i % 100);
+    const mpack_symbol_t *symbol = mpack_intern_insert(&intern, make_string(key));
+
+    BOOST_REQUIRE(symbol != NULL);
+    BOOST_CHECK(std::string(symbol->data, symbol->size) == key);
+    BOOST_CHECK(mpack_intern_find(&intern, make_string(key)) == symbol);
+  }
+
+  BOOST_CHECK(intern.count == 32);
+  BOOST_CHECK(intern.tombstones <= (intern.mask + 1) / 4);
+
+  mpack_intern_term(&intern);
+}
+
+BOOST_AUTO_TEST_CASE(test_decode_symbol)
+{
+  char buffer[64] = { 0 };
+  mpack_intern_t intern;
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+  mpack_map_t map;
+  const mpack_symbol_t *k1 = NULL;
+  const mpack_symbol_t *k2 = NULL;
+  long value;
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  map.size = 1;
+  mpack_encode_map(&encoder, map);
+  mpack_encode_string(&encoder, make_string("name"));
+  mpack_encode_signed(&encoder, 1);
+  mpack_encode_map(&encoder, map);
+  mpack_encode_string(&encoder, make_string("name"));
+  mpack_encode_signed(&encoder, 2);
+
+  mpack_decoder_init(&decoder, buffer, encoder.pos - encoder.begin);
+  BOOST_CHECK(mpack_decode_map(&decoder, &map) == 1);
+  BOOST_CHECK(mpack_decode_symbol(&decoder, &k1) == -1);
+  BOOST_CHECK(errno == EINVAL);
+
+  BOOST_CHECK(mpack_intern_init(&intern, 8) == 0);
+  decoder.intern = &intern;
+
+  BOOST_CHECK(mpack_decode_symbol(&decoder, &k1) == 5);
+  BOOST_CHECK(mpack_decode_signed(&decoder, &value) == 1);
+  BOOST_CHECK(mpack_decode_map(&decoder, &map) == 1);
+  BOOST_CHECK(mpack_decode_symbol(&decoder, &k2) == 5);
+  BOOST_CHECK(k1 == k2);
+  BOOST_CHECK(mpack_decode_symbol(&decoder, &k2) == -1);
+  BOOST_CHECK(decoder.pos == decoder.end - 1);
+
+  mpack_intern_term(&intern);
+  mpack_decoder_term(&decoder);
+  mpack_encoder_term(&encoder);
+}
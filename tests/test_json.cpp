@@ -0,0 +1,636 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+#include "test_helpers.h"
+
+static int append(void *context, const void *data, size_t size)
+{
+  static_cast<std::string *>(context)->append(static_cast<const char *>(data), size);
+  return size;
+}
+
+static int fail(void *, const void *, size_t)
+{
+  errno = EIO;
+  return -1;
+}
+
+static std::string to_json(const char *data, size_t size, unsigned int flags = 0)
+{
+  std::string output;
+  mpack_json_sink_t sink;
+  sink.write = append;
+  sink.context = &output;
+  sink.flags = flags;
+
+  mpack_decoder_t decoder;
+  mpack_decoder_init(&decoder, data, size);
+  BOOST_CHECK(mpack_to_json(&decoder, &sink) == static_cast<int>(size));
+  BOOST_CHECK(decoder.pos == decoder.end);
+  return output;
+}
+
+static std::string to_json(const mpack_encoder_t &encoder, unsigned int flags = 0)
+{ return to_json(encoder.begin, encoder.pos - encoder.begin, flags); }
+
+BOOST_AUTO_TEST_CASE(test_json_scalars)
+{
+  char buffer[64];
+  mpack_encoder_t encoder;
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_nil(&encoder);
+  BOOST_CHECK(to_json(encoder) == "null");
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_boolean(&encoder, true);
+  BOOST_CHECK(to_json(encoder) == "true");
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_boolean(&encoder, false);
+  BOOST_CHECK(to_json(encoder) == "false");
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_signed(&encoder, -1234567890123L);
+  BOOST_CHECK(to_json(encoder) == "-1234567890123");
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_signed(&encoder, INT64_MIN);
+  BOOST_CHECK(to_json(encoder) == "-9223372036854775808");
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_unsigned(&encoder, UINT64_MAX);
+  BOOST_CHECK(to_json(encoder) == "18446744073709551615");
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_unsigned(&encoder, 0);
+  BOOST_CHECK(to_json(encoder) == "0");
+}
+
+BOOST_AUTO_TEST_CASE(test_json_numbers)
+{
+  const struct {
+    double value;
+    const char *json;
+  } doubles[] = {
+    { 0.0, "0.0" },
+    { -0.0, "-0.0" },
+    { 1.0, "1.0" },
+    { -1.5, "-1.5" },
+    { 0.1, "0.1" },
+    { 0.3, "0.3" },
+    { 100.0, "100.0" },
+    { 1e20, "100000000000000000000.0" },
+    { 1e21, "1e21" },
+    { 1.5e300, "1.5e300" },
+    { 1e-6, "0.000001" },
+    { 1e-7, "1e-7" },
+    { 1.25e-10, "1.25e-10" },
+    { 5e-324, "5e-324" },
+    { 1.7976931348623157e308, "1.7976931348623157e308" },
+    { 1.0 / 0.0, "null" },
+  };
+  char buffer[64];
+  mpack_encoder_t encoder;
+  size_t i;
+
+  for (i = 0; i != sizeof(doubles) / sizeof(doubles[0]); ++i) {
+    mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+    mpack_encode_double(&encoder, doubles[i].value);
+    BOOST_CHECK_EQUAL(to_json(encoder), doubles[i].json);
+  }
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_float(&encoder, 0.1f);
+  BOOST_CHECK_EQUAL(to_json(encoder), "0.1");
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_float(&encoder, 3.4028235e38f);
+  BOOST_CHECK_EQUAL(to_json(encoder), "3.4028235e38");
+}
+
+BOOST_AUTO_TEST_CASE(test_json_numbers_round_trip)
+{
+  char buffer[16];
+  mpack_encoder_t encoder;
+  std::string json;
+  union { double f; uint64_t u; } var;
+  int i;
+
+  std::srand(1);
+
+  for (i = 0; i != 100000; ++i) {
+    var.u = (uint64_t(std::rand()) << 42) ^ (uint64_t(std::rand()) << 21) ^ uint64_t(std::rand());
+
+    if (((var.u >> 52) & 0x7ff) == 0x7ff) {
+      continue;
+    }
+
+    mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+    mpack_encode_double(&encoder, var.f);
+    json = to_json(encoder);
+    BOOST_REQUIRE(std::strtod(json.c_str(), NULL) == var.f);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_json_strings)
+{
+  std::string s = "\"hello\\world\"\n\t\x01\x1f\x7f caf\xc3\xa9";
+  std::string long_string;
+  std::string expected;
+  char buffer[65536];
+  mpack_encoder_t encoder;
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_string(&encoder, make_string(s.data(), s.size()));
+  BOOST_CHECK_EQUAL(to_json(encoder), "\"\\\"hello\\\\world\\\"\\n\\t\\u0001\\u001f\x7f caf\xc3\xa9\"");
+
+  // long enough to go through the output buffer several times
+  for (int i = 0; i != 3000; ++i) {
+    long_string += "abcdefghijklmnopq\"";
+    expected += "abcdefghijklmnopq\\\"";
+  }
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_string(&encoder, make_string(long_string.data(), long_string.size()));
+  BOOST_CHECK(to_json(encoder) == "\"" + expected + "\"");
+}
+
+BOOST_AUTO_TEST_CASE(test_json_strings_utf8)
+{
+  static const struct {
+    std::string input;
+    std::string json;
+  } strings[] = {
+    { "caf\xc3\xa9 \xf0\x9f\x98\x80", "caf\xc3\xa9 \xf0\x9f\x98\x80" },
+    { "a\xff" "b", "a\xef\xbf\xbd" "b" },
+    { "\xe2\x82", "\xef\xbf\xbd" },
+    { "\xe2\x82" "A", "\xef\xbf\xbd" "A" },
+    { "\xc0\xaf", "\xef\xbf\xbd\xef\xbf\xbd" },
+    { "\xed\xa0\x80", "\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd" },
+    { "\xf4\x90\x80\x80", "\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd" },
+    { "0123456789abcdef\x80\xc3\xa9" "0123456789abcdef", "0123456789abcdef\xef\xbf\xbd\xc3\xa9" "0123456789abcdef" },
+  };
+  char buffer[256];
+  mpack_encoder_t encoder;
+
+  // Ill-formed sequences are replaced with U+FFFD, one per maximal prefix.
+  for (const auto &string : strings) {
+    mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+    mpack_encode_string(&encoder, make_string(string.input.data(), string.input.size()));
+    BOOST_CHECK_EQUAL(to_json(encoder), "\"" + string.json + "\"");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_json_containers)
+{
+  char buffer[4096];
+  mpack_encoder_t encoder;
+  mpack_array_t array;
+  mpack_map_t map;
+  std::string expected;
+  int i;
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  map.size = 4;
+  mpack_encode_map(&encoder, map);
+  mpack_encode_string(&encoder, make_string("list"));
+  array.size = 3;
+  mpack_encode_array(&encoder, array);
+  mpack_encode_signed(&encoder, 1);
+  array.size = 0;
+  mpack_encode_array(&encoder, array);
+  map.size = 0;
+  mpack_encode_map(&encoder, map);
+  mpack_encode_signed(&encoder, 42);
+  mpack_encode_string(&encoder, make_string("answer"));
+  mpack_encode_boolean(&encoder, true);
+  mpack_encode_nil(&encoder);
+  mpack_encode_double(&encoder, 0.5);
+  mpack_encode_string(&encoder, make_string("half"));
+  BOOST_CHECK_EQUAL(to_json(encoder), "{\"list\":[1,[],{}],\"42\":\"answer\",\"true\":null,\"0.5\":\"half\"}");
+
+  // deeper than the initial stack of the walk
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  array.size = 1;
+
+  for (i = 0; i != 1000; ++i) {
+    mpack_encode_array(&encoder, array);
+    expected += "[";
+  }
+
+  mpack_encode_nil(&encoder);
+  expected += "null";
+  expected += std::string(1000, ']');
+  BOOST_CHECK(to_json(encoder) == expected);
+}
+
+BOOST_AUTO_TEST_CASE(test_json_binary_extended)
+{
+  char buffer[64];
+  mpack_encoder_t encoder;
+  mpack_binary_t binary;
+  mpack_extended_t extended;
+
+  binary.data = "\x00\xff\x10\x20";
+  binary.size = 4;
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_binary(&encoder, binary);
+  BOOST_CHECK_EQUAL(to_json(encoder), "\"AP8QIA==\"");
+  BOOST_CHECK_EQUAL(to_json(encoder, MPACK_JSON_BINARY_HEX), "\"00ff1020\"");
+  BOOST_CHECK_EQUAL(to_json(encoder, MPACK_JSON_BINARY_ARRAY), "[0,255,16,32]");
+
+  extended.data = "\x01\x02\x03";
+  extended.size = 3;
+  extended.type = -5;
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_extended(&encoder, extended);
+  BOOST_CHECK_EQUAL(to_json(encoder), "{\"type\":-5,\"data\":\"AQID\"}");
+  BOOST_CHECK_EQUAL(to_json(encoder, MPACK_JSON_EXTENDED_DATA | MPACK_JSON_BINARY_HEX), "\"010203\"");
+  BOOST_CHECK_EQUAL(to_json(encoder, MPACK_JSON_EXTENDED_NULL), "null");
+}
+
+BOOST_AUTO_TEST_CASE(test_json_timestamp)
+{
+  const struct {
+    int64_t sec;
+    long nsec;
+    const char *json;
+  } values[] = {
+    { 0, 0, "\"1970-01-01T00:00:00Z\"" },
+    { 1500000000, 0, "\"2017-07-14T02:40:00Z\"" },
+    { 1500000000, 120000000, "\"2017-07-14T02:40:00.12Z\"" },
+    { 951782400, 1, "\"2000-02-29T00:00:00.000000001Z\"" },
+    { -1, 500000000, "\"1969-12-31T23:59:59.5Z\"" },
+    { -62135596800LL, 0, "\"0001-01-01T00:00:00Z\"" },
+    { 253402300800LL, 0, "\"10000-01-01T00:00:00Z\"" },
+  };
+  char buffer[64];
+  mpack_encoder_t encoder;
+  timespec value;
+  size_t i;
+
+  for (i = 0; i != sizeof(values) / sizeof(values[0]); ++i) {
+    value.tv_sec = values[i].sec;
+    value.tv_nsec = values[i].nsec;
+    mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+    mpack_encode_timestamp(&encoder, value);
+    BOOST_CHECK_EQUAL(to_json(encoder, MPACK_JSON_TIMESTAMP_STRING), values[i].json);
+  }
+
+  value.tv_sec = 1;
+  value.tv_nsec = 0;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_timestamp(&encoder, value);
+  BOOST_CHECK_EQUAL(to_json(encoder), "{\"type\":-1,\"data\":\"AAAAAQ==\"}");
+}
+
+BOOST_AUTO_TEST_CASE(test_json_dict)
+{
+  char buffer[256];
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+  mpack_map_t map;
+  mpack_dict_t encoder_dict;
+  mpack_dict_t decoder_dict;
+  mpack_json_sink_t sink;
+  std::string output;
+  int i;
+
+  BOOST_CHECK(mpack_dict_init(&encoder_dict, 16) == 0);
+  BOOST_CHECK(mpack_dict_init(&decoder_dict, 16) == 0);
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  encoder.dict = &encoder_dict;
+  map.size = 1;
+
+  for (i = 0; i != 2; ++i) {
+    mpack_encode_map(&encoder, map);
+    mpack_encode_key(&encoder, make_string("hostname"));
+    mpack_encode_signed(&encoder, i);
+  }
+
+  sink.write = append;
+  sink.context = &output;
+  sink.flags = 0;
+
+  mpack_decoder_init(&decoder, buffer, encoder.pos - buffer);
+  decoder.dict = &decoder_dict;
+  BOOST_CHECK(mpack_to_json(&decoder, &sink) > 0);
+  BOOST_CHECK(mpack_to_json(&decoder, &sink) > 0);
+  BOOST_CHECK(decoder.pos == decoder.end);
+  BOOST_CHECK_EQUAL(output, "{\"hostname\":0}{\"hostname\":1}");
+
+  mpack_dict_term(&decoder_dict);
+  mpack_dict_term(&encoder_dict);
+}
+
+BOOST_AUTO_TEST_CASE(test_json_errors)
+{
+  char buffer[64];
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+  mpack_json_sink_t sink;
+  mpack_array_t array;
+  mpack_map_t map;
+  mpack_binary_t binary;
+  std::string output;
+  int i;
+
+  sink.write = append;
+  sink.context = &output;
+  sink.flags = 0;
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  array.size = 2;
+  mpack_encode_array(&encoder, array);
+  mpack_encode_string(&encoder, make_string("first"));
+  mpack_encode_string(&encoder, make_string("second"));
+
+  // nothing is written before the whole value is available
+  for (i = 0; i != (encoder.pos - buffer); ++i) {
+    mpack_decoder_init(&decoder, buffer, i);
+    errno = 0;
+    BOOST_CHECK(mpack_to_json(&decoder, &sink) == -1);
+    BOOST_CHECK(errno == EAGAIN);
+    BOOST_CHECK(decoder.pos == buffer);
+    BOOST_CHECK(output.empty());
+  }
+
+  // containers cannot be keys
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  map.size = 1;
+  mpack_encode_map(&encoder, map);
+  array.size = 0;
+  mpack_encode_array(&encoder, array);
+  mpack_encode_nil(&encoder);
+
+  mpack_decoder_init(&decoder, buffer, encoder.pos - buffer);
+  errno = 0;
+  BOOST_CHECK(mpack_to_json(&decoder, &sink) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(decoder.pos == buffer);
+  BOOST_CHECK(output.empty());
+
+  // neither can binary values rendered as arrays
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_map(&encoder, map);
+  binary.data = "\x01";
+  binary.size = 1;
+  mpack_encode_binary(&encoder, binary);
+  mpack_encode_nil(&encoder);
+
+  sink.flags = MPACK_JSON_BINARY_ARRAY;
+  mpack_decoder_init(&decoder, buffer, encoder.pos - buffer);
+  errno = 0;
+  BOOST_CHECK(mpack_to_json(&decoder, &sink) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(output.empty());
+
+  sink.flags = 0;
+  mpack_decoder_init(&decoder, buffer, encoder.pos - buffer);
+  BOOST_CHECK(mpack_to_json(&decoder, &sink) > 0);
+  BOOST_CHECK_EQUAL(output, "{\"AQ==\":null}");
+
+  // write errors are reported
+  sink.write = fail;
+  mpack_decoder_init(&decoder, buffer, encoder.pos - buffer);
+  errno = 0;
+  BOOST_CHECK(mpack_to_json(&decoder, &sink) == -1);
+  BOOST_CHECK(errno == EIO);
+  BOOST_CHECK(decoder.pos == buffer);
+}
+
+static std::string from_json(const std::string &json, int *result = NULL)
+{
+  char buffer[65536];
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+
+  int size = mpack_from_json(&encoder, json.data(), json.size());
+
+  if (result) {
+    *result = size;
+  }
+  else {
+    BOOST_CHECK(size == static_cast<int>(json.size()));
+  }
+
+  return std::string(buffer, encoder.pos - buffer);
+}
+
+BOOST_AUTO_TEST_CASE(test_from_json_scalars)
+{
+  BOOST_CHECK(from_json("null") == "\xc0");
+  BOOST_CHECK(from_json("true") == std::string(1, char(MPACK_TRUE)));
+  BOOST_CHECK(from_json("false") == std::string(1, char(MPACK_FALSE)));
+  BOOST_CHECK(from_json("0") == std::string(1, '\0'));
+  BOOST_CHECK(from_json("-0") == std::string(1, '\0'));
+  BOOST_CHECK(from_json("127") == "\x7f");
+  BOOST_CHECK(from_json("128") == "\xcc\x80");
+  BOOST_CHECK(from_json("-31") == "\xe1");
+  BOOST_CHECK(from_json("-129") == std::string("\xd1\xff\x7f", 3));
+  BOOST_CHECK(from_json("65536") == std::string("\xce\x00\x01\x00\x00", 5));
+  BOOST_CHECK(from_json("-9223372036854775808") == std::string("\xd3\x80\x00\x00\x00\x00\x00\x00\x00", 9));
+  BOOST_CHECK(from_json("18446744073709551615") == "\xcf\xff\xff\xff\xff\xff\xff\xff\xff");
+  BOOST_CHECK(from_json("1.5") == std::string("\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00", 9));
+  BOOST_CHECK(from_json("\"abc\"") == "\xa3" "abc");
+  BOOST_CHECK(from_json(" \t\r\n 1") == "\x01");
+}
+
+BOOST_AUTO_TEST_CASE(test_from_json_numbers)
+{
+  const char *numbers[] = {
+    "0.1", "-0.0", "1e21", "1E-7", "2.5e+3", "3.141592653589793", "5e-324", "1.7976931348623157e308",
+    "123456789012345678901234567890", "0.000000000000000000000000000001", "18446744073709551616",
+    "-9223372036854775809", "9007199254740993.0", "1e400",
+  };
+  mpack_decoder_t decoder;
+  std::string msgpack;
+  double value;
+  size_t i;
+
+  for (i = 0; i != sizeof(numbers) / sizeof(numbers[0]); ++i) {
+    msgpack = from_json(numbers[i]);
+    mpack_decoder_init(&decoder, msgpack.data(), msgpack.size());
+    BOOST_CHECK(mpack_decode_double(&decoder, &value) == 9);
+    BOOST_CHECK_EQUAL(value, std::strtod(numbers[i], NULL));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_from_json_strings)
+{
+  BOOST_CHECK(from_json("\"\"") == "\xa0");
+  BOOST_CHECK(from_json("\"a\\\"b\\\\c\\/d\\n\"") == "\xa8" "a\"b\\c/d\n");
+  BOOST_CHECK(from_json("\"\\u0041\\u00e9\\u20ac\\ud83d\\ude00\"") == "\xaa" "A\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80");
+
+  // escaped string larger than the stack buffer of the parser
+  std::string json = "\"";
+  std::string expected;
+
+  for (int i = 0; i != 1000; ++i) {
+    json += "x\\t";
+    expected += "x\t";
+  }
+
+  json += "\"";
+  BOOST_CHECK(from_json(json) == std::string("\xda\x07\xd0", 3) + expected);
+}
+
+BOOST_AUTO_TEST_CASE(test_from_json_containers)
+{
+  BOOST_CHECK(from_json("[]") == "\x90");
+  BOOST_CHECK(from_json("{}") == "\x80");
+  BOOST_CHECK(from_json("[1, [2, 3], {}, [[]]]") == "\x94\x01\x92\x02\x03\x80\x91\x90");
+  BOOST_CHECK(from_json("{ \"a\" : 1 , \"b\" : [ true ] }") == "\x82\xa1" "a\x01\xa1" "b\x91" + std::string(1, char(MPACK_TRUE)));
+
+  // header sizes come from the element counts of the first pass
+  std::string json = "[";
+
+  for (int i = 0; i != 20; ++i) {
+    json += (i ? ",0" : "0");
+  }
+
+  json += "]";
+  BOOST_CHECK(from_json(json) == std::string("\xdc\x00\x14", 3) + std::string(20, '\0'));
+
+  // deeper than the initial stack of the parser
+  json = std::string(1000, '[') + std::string(1000, ']');
+  BOOST_CHECK(from_json(json) == std::string(999, '\x91') + "\x90");
+}
+
+BOOST_AUTO_TEST_CASE(test_from_json_round_trip)
+{
+  const std::string json =
+    "{\"id\":18446744073709551615,\"name\":\"caf\xc3\xa9 \\\"bar\\\"\\n\",\"values\":[-1,0.1,1.5e300,null,true,false],"
+    "\"nested\":{\"empty\":[],\"map\":{}}}";
+  const std::string msgpack = from_json(json);
+  BOOST_CHECK_EQUAL(to_json(msgpack.data(), msgpack.size()), json);
+}
+
+BOOST_AUTO_TEST_CASE(test_from_json_stream)
+{
+  const std::string json = "{\"a\":1}\n[2]\n3\n\"x\"";
+  char buffer[64];
+  mpack_encoder_t encoder;
+  size_t offset = 0;
+  int size;
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+
+  while ((size = mpack_from_json(&encoder, json.data() + offset, json.size() - offset)) > 0) {
+    offset += size;
+  }
+
+  BOOST_CHECK(offset == json.size());
+  BOOST_CHECK(std::string(buffer, encoder.pos - buffer) == "\x81\xa1" "a\x01\x91\x02\x03\xa1x");
+
+  // only whitespace is left
+  BOOST_CHECK(mpack_from_json(&encoder, "\n ", 2) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+}
+
+BOOST_AUTO_TEST_CASE(test_from_json_errors)
+{
+  const char *incomplete[] = {
+    "", "  ", "[", "[1,", "{\"a\"", "{\"a\":", "\"abc", "\"abc\\", "tr", "fals", "n", "-", "1.", "1e", "1e+",
+    "[1, 2", "{\"a\": [true, {\"b\": null}]",
+  };
+  const char *invalid[] = {
+    "]", "}", ",", "[1 2]", "[1,]", "{\"a\" 1}", "{1: 2}", "{\"a\":1,}", "[}", "{]", "tru ", "nul]", "01",
+    "1.e5", "--1", "+1", "0x10", "\"a\x01\"", "\"\\x\"", "\"\\u12\"", "\"\\ud800\"", "\"\\udc00\"", "[\"\\q\"]",
+    "NaN", "Infinity",
+  };
+  char buffer[64];
+  mpack_encoder_t encoder;
+  size_t i;
+
+  for (i = 0; i != sizeof(incomplete) / sizeof(incomplete[0]); ++i) {
+    mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+    errno = 0;
+    BOOST_CHECK_MESSAGE(mpack_from_json(&encoder, incomplete[i], std::strlen(incomplete[i])) == -1, incomplete[i]);
+    BOOST_CHECK_MESSAGE(errno == EAGAIN, incomplete[i]);
+    BOOST_CHECK(encoder.pos == buffer);
+  }
+
+  for (i = 0; i != sizeof(invalid) / sizeof(invalid[0]); ++i) {
+    mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+    errno = 0;
+    BOOST_CHECK_MESSAGE(mpack_from_json(&encoder, invalid[i], std::strlen(invalid[i])) == -1, invalid[i]);
+    BOOST_CHECK_MESSAGE(errno == EINVAL, invalid[i]);
+    BOOST_CHECK(encoder.pos == buffer);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_from_json_dict_rollback)
+{
+  const std::string json = "{\"alpha\":1,\"beta\":2}";
+  char buffer[64];
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+  mpack_dict_t encoder_dict;
+  mpack_dict_t decoder_dict;
+  mpack_json_sink_t sink;
+  std::string output;
+
+  BOOST_CHECK(mpack_dict_init(&encoder_dict, 16) == 0);
+  BOOST_CHECK(mpack_dict_init(&decoder_dict, 16) == 0);
+
+  // Neither a value that does not fit nor one that fails to parse leaves
+  // definitions behind in the dictionary.
+  mpack_encoder_init(&encoder, buffer, 8);
+  encoder.dict = &encoder_dict;
+  BOOST_CHECK(mpack_from_json(&encoder, json.data(), json.size()) == static_cast<int>(json.size()));
+  BOOST_CHECK(encoder.pos > encoder.end);
+  BOOST_CHECK(mpack_dict_size(&encoder_dict) == 0);
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  encoder.dict = &encoder_dict;
+  BOOST_CHECK(mpack_from_json(&encoder, "{\"gamma\":1,}", 12) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(mpack_dict_size(&encoder_dict) == 0);
+
+  BOOST_CHECK(mpack_from_json(&encoder, json.data(), json.size()) == static_cast<int>(json.size()));
+  BOOST_CHECK(mpack_dict_size(&encoder_dict) == 2);
+
+  sink.write = append;
+  sink.context = &output;
+  sink.flags = 0;
+  mpack_decoder_init(&decoder, buffer, encoder.pos - buffer);
+  decoder.dict = &decoder_dict;
+  BOOST_CHECK(mpack_to_json(&decoder, &sink) > 0);
+  BOOST_CHECK_EQUAL(output, json);
+
+  mpack_dict_term(&decoder_dict);
+  mpack_dict_term(&encoder_dict);
+}
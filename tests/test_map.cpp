@@ -124,3 +124,38 @@ BOOST_AUTO_TEST_CASE(test_encode_decode_map32)
   mpack_decoder_term(&decoder);
   mpack_encoder_term(&encoder);
 }
+
+BOOST_AUTO_TEST_CASE(test_encode_map_begin_end)
+{
+  char buffer[32] = { 0 };
+  size_t offset = 0;
+  mpack_map_t value;
+
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+
+  BOOST_CHECK(mpack_encode_map_begin(&encoder, &offset) == 5);
+  BOOST_CHECK(mpack_encode_signed(&encoder, 1) == 1);
+  BOOST_CHECK(mpack_encode_signed(&encoder, 2) == 1);
+  BOOST_CHECK(mpack_encode_map_end(&encoder, offset, 1) == 0);
+
+  mpack_decoder_t decoder;
+  mpack_decoder_init(&decoder, buffer, 7);
+
+  value.size = 0;
+  BOOST_CHECK(mpack_decode_map(&decoder, &value) == 5);
+  BOOST_CHECK(value.size == 1);
+
+  BOOST_CHECK(mpack_encoder_compact(&encoder, offset) == 4);
+  mpack_decoder_init(&decoder, buffer, 3);
+
+  value.size = 0;
+  BOOST_CHECK(mpack_decode_map(&decoder, &value) == 1);
+  BOOST_CHECK(value.size == 1);
+
+  BOOST_CHECK(mpack_encode_array_end(&encoder, offset, 1) == -1);
+  BOOST_CHECK(errno == EINVAL);
+
+  mpack_decoder_term(&decoder);
+  mpack_encoder_term(&encoder);
+}
@@ -23,6 +23,9 @@
  */
 
 #include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <limits>
 #include <boost/test/unit_test.hpp>
 #include <mpack.h>
 
@@ -160,3 +163,81 @@ BOOST_AUTO_TEST_CASE(test_convert_float_to_double)
   mpack_decoder_term(&decoder);
   mpack_encoder_term(&encoder);
 }
+
+BOOST_AUTO_TEST_CASE(test_encode_double_compact)
+{
+  const double values[] = {
+    0.0, -0.0, 1.0, -1.0, 127.0, 300.0, -70000.0, 4294967296.0, 9007199254740992.0,
+    9007199254740994.0, 0.5, 1.234, 1e300, -3.5e38,
+    std::numeric_limits<double>::infinity(),
+    std::numeric_limits<double>::quiet_NaN(),
+  };
+  const int sizes[] = { 1, 5, 1, 1, 1, 3, 5, 9, 9, 9, 5, 9, 9, 9, 5, 9 };
+  char buffer[256] = { 0 };
+  double value;
+  size_t i;
+
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  encoder.flags = MPACK_ENCODE_COMPACT_FLOAT;
+
+  for (i = 0; i != sizeof(values) / sizeof(values[0]); ++i) {
+    BOOST_CHECK(mpack_encode_double(&encoder, values[i]) == sizes[i]);
+    BOOST_CHECK(mpack_sizeof_double_compact(values[i]) == size_t(sizes[i]));
+  }
+
+  mpack_decoder_t decoder;
+  mpack_decoder_init(&decoder, buffer, encoder.pos - encoder.begin);
+
+  for (i = 0; i != sizeof(values) / sizeof(values[0]); ++i) {
+    BOOST_CHECK(mpack_decode_double(&decoder, &value) == sizes[i]);
+
+    if (std::isnan(values[i])) {
+      BOOST_CHECK(std::isnan(value));
+    }
+    else {
+      BOOST_CHECK(value == values[i]);
+      BOOST_CHECK(std::signbit(value) == std::signbit(values[i]));
+    }
+  }
+
+  mpack_decoder_term(&decoder);
+  mpack_encoder_term(&encoder);
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_double_array)
+{
+  double values[101];
+  char expect[1024] = { 0 };
+  char buffer[1024] = { 0 };
+  mpack_array_t array;
+  size_t i;
+
+  for (i = 0; i != 101; ++i) {
+    values[i] = (i % 4 == 0) ? double(i) : (i % 4 == 1) ? i + 0.25 : (i % 4 == 2) ? i * 0.1 : -double(i) * 1e10;
+  }
+  values[7] = -0.0;
+
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, expect, sizeof(expect));
+  encoder.flags = MPACK_ENCODE_COMPACT_FLOAT;
+  array.size = 101;
+  mpack_encode_array(&encoder, array);
+
+  for (i = 0; i != 101; ++i) {
+    mpack_encode_double(&encoder, values[i]);
+  }
+
+  const int size = encoder.pos - encoder.begin;
+  BOOST_CHECK(size < int(3 + 9 * 101));
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  encoder.flags = MPACK_ENCODE_COMPACT_FLOAT;
+  BOOST_CHECK(mpack_encode_double_array(&encoder, values, 101) == size);
+  BOOST_CHECK(memcmp(buffer, expect, size) == 0);
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  BOOST_CHECK(mpack_encode_double_array(&encoder, values, 101) == int(3 + 9 * 101));
+
+  mpack_encoder_term(&encoder);
+}
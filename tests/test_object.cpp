@@ -441,3 +441,68 @@ BOOST_AUTO_TEST_CASE(test_encode_decode_object_extended)
   mpack_decoder_term(&decoder);
   mpack_encoder_term(&encoder);
 }
+
+BOOST_AUTO_TEST_CASE(test_decode_skip)
+{
+  char buffer[64] = { 0 };
+  mpack_string_t string;
+  mpack_array_t array;
+  mpack_map_t map;
+
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+
+  map.size = 2;
+  BOOST_CHECK(mpack_encode_map(&encoder, map) == 1);
+  string.data = "A";
+  string.size = 1;
+  BOOST_CHECK(mpack_encode_string(&encoder, string) == 2);
+  array.size = 2;
+  BOOST_CHECK(mpack_encode_array(&encoder, array) == 1);
+  BOOST_CHECK(mpack_encode_signed(&encoder, -1000) == 3);
+  array.size = 0;
+  BOOST_CHECK(mpack_encode_array(&encoder, array) == 1);
+  BOOST_CHECK(mpack_encode_string(&encoder, string) == 2);
+  BOOST_CHECK(mpack_encode_nil(&encoder) == 1);
+  BOOST_CHECK(mpack_encode_true(&encoder) == 1);
+
+  mpack_decoder_t decoder;
+  mpack_decoder_init(&decoder, buffer, 11);
+
+  BOOST_CHECK(mpack_decode_skip(&decoder) == 11);
+  BOOST_CHECK(mpack_decode_skip(&decoder) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+
+  mpack_decoder_init(&decoder, buffer, 10);
+  BOOST_CHECK(mpack_decode_skip(&decoder) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  BOOST_CHECK(decoder.pos == buffer);
+
+  mpack_decoder_term(&decoder);
+  mpack_encoder_term(&encoder);
+}
+
+BOOST_AUTO_TEST_CASE(test_object_equal)
+{
+  mpack_object_t a;
+  mpack_object_t b;
+
+  a.type = MPACK_STRING;
+  a.data.string = mpack_string_t{ "abc", 3 };
+  b.type = MPACK_STRING;
+  b.data.string = mpack_string_t{ "abcd", 3 };
+  BOOST_CHECK(mpack_object_equal(&a, &b));
+
+  b.data.string.size = 4;
+  BOOST_CHECK(!mpack_object_equal(&a, &b));
+
+  a.type = MPACK_MAP;
+  a.data.map.size = 2;
+  b.type = MPACK_ARRAY;
+  b.data.array.size = 2;
+  BOOST_CHECK(!mpack_object_equal(&a, &b));
+
+  b.type = MPACK_MAP;
+  b.data.map.size = 2;
+  BOOST_CHECK(mpack_object_equal(&a, &b));
+}
@@ -0,0 +1,316 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+#include "test_helpers.h"
+
+static mpack_object_t index(signed long value)
+{
+  mpack_object_t object;
+  object.type = MPACK_INTEGER;
+  object.data.integer = value;
+  return object;
+}
+
+// {"name": "doc", [1]: 2, "stats": {"hits": 5, "misses": [1, 2, 3]}, "seen": timestamp}
+static std::string document(unsigned int flags)
+{
+  char buffer[256];
+  mpack_encoder_t encoder;
+  struct timespec seen = { 1000, 0 };
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  encoder.flags = flags;
+  mpack_encode_map(&encoder, mpack_map_t{ 4 });
+  mpack_encode_string(&encoder, mpack_string_t{ "name", 4 });
+  mpack_encode_string(&encoder, mpack_string_t{ "doc", 3 });
+  mpack_encode_array(&encoder, mpack_array_t{ 1 });
+  mpack_encode_signed(&encoder, 1);
+  mpack_encode_signed(&encoder, 2);
+  mpack_encode_string(&encoder, mpack_string_t{ "stats", 5 });
+  mpack_encode_map(&encoder, mpack_map_t{ 2 });
+  mpack_encode_string(&encoder, mpack_string_t{ "hits", 4 });
+  mpack_encode_signed(&encoder, 5);
+  mpack_encode_string(&encoder, mpack_string_t{ "misses", 6 });
+  mpack_encode_array(&encoder, mpack_array_t{ 3 });
+  mpack_encode_signed(&encoder, 1);
+  mpack_encode_signed(&encoder, 2);
+  mpack_encode_signed(&encoder, 3);
+  mpack_encode_string(&encoder, mpack_string_t{ "seen", 4 });
+  mpack_encode_timestamp(&encoder, seen);
+  BOOST_REQUIRE(encoder.pos <= encoder.end);
+  return std::string(encoder.begin, encoder.pos);
+}
+
+BOOST_AUTO_TEST_CASE(test_patch_fixed_width)
+{
+  char buffer[64];
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+  signed long s;
+  unsigned long u;
+  struct timespec t;
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  encoder.flags = MPACK_ENCODE_FIXED_WIDTH;
+  BOOST_CHECK(mpack_encode_unsigned(&encoder, 0) == 9);
+  BOOST_CHECK(mpack_encode_signed(&encoder, -1) == 9);
+  BOOST_CHECK(mpack_encode_signed(&encoder, 100) == 9);
+  BOOST_CHECK(mpack_encode_timestamp(&encoder, timespec{ 1, 0 }) == 15);
+  BOOST_CHECK(static_cast<uint8_t>(buffer[0]) == MPACK_UINT64);
+  BOOST_CHECK(static_cast<uint8_t>(buffer[9]) == MPACK_INT64);
+
+  mpack_decoder_init(&decoder, buffer, encoder.pos - encoder.begin);
+  BOOST_CHECK(mpack_decode_unsigned(&decoder, &u) == 9);
+  BOOST_CHECK(u == 0);
+  BOOST_CHECK(mpack_decode_signed(&decoder, &s) == 9);
+  BOOST_CHECK(s == -1);
+  BOOST_CHECK(mpack_decode_signed(&decoder, &s) == 9);
+  BOOST_CHECK(s == 100);
+  BOOST_CHECK(mpack_decode_timestamp(&decoder, &t) == 15);
+  BOOST_CHECK((t.tv_sec == 1) && (t.tv_nsec == 0));
+
+  // The fast path of contiguous ranges honors the option too.
+  std::vector<int> values = { 1, -2, 3 };
+  mpack::encoder cxx(buffer, sizeof(buffer));
+  cxx.flags = MPACK_ENCODE_FIXED_WIDTH;
+  BOOST_CHECK(cxx.encode(values) == 28);
+}
+
+BOOST_AUTO_TEST_CASE(test_patch_find)
+{
+  const std::string data = document(0);
+  const mpack_object_t hits[] = { key("stats"), key("hits") };
+  const mpack_object_t misses[] = { key("stats"), key("misses"), index(2) };
+  const mpack_object_t missing[] = { key("stats"), key("other") };
+  const mpack_object_t bounds[] = { key("stats"), key("misses"), index(3) };
+  const mpack_object_t scalar[] = { key("name"), key("x") };
+  const mpack_object_t stats[] = { key("stats") };
+  mpack_decoder_t decoder;
+  signed long value;
+
+  mpack_decoder_init(&decoder, data.data(), data.size());
+  BOOST_CHECK(mpack_find(&decoder, hits, 2) == 1);
+  BOOST_CHECK(mpack_decode_signed(&decoder, &value) == 1);
+  BOOST_CHECK(value == 5);
+
+  mpack_decoder_init(&decoder, data.data(), data.size());
+  BOOST_CHECK(mpack_find(&decoder, misses, 3) == 1);
+  BOOST_CHECK(mpack_decode_signed(&decoder, &value) == 1);
+  BOOST_CHECK(value == 3);
+
+  mpack_decoder_init(&decoder, data.data(), data.size());
+  BOOST_CHECK(mpack_find(&decoder, stats, 1) == 18);
+  BOOST_CHECK(mpack_find(&decoder, nullptr, 0) == 18);
+
+  for (const mpack_object_t *path : { missing, bounds, scalar }) {
+    mpack_decoder_init(&decoder, data.data(), data.size());
+    BOOST_CHECK(mpack_find(&decoder, path, (path == bounds) ? 3 : 2) == -1);
+    BOOST_CHECK(errno == ENOENT);
+    BOOST_CHECK(decoder.pos == data.data());
+  }
+
+  mpack_decoder_init(&decoder, data.data(), data.size() - 1);
+  BOOST_CHECK(mpack_find(&decoder, misses, 3) == 1);
+  mpack_decoder_init(&decoder, data.data(), 20);
+  BOOST_CHECK(mpack_find(&decoder, misses, 3) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  BOOST_CHECK(decoder.pos == data.data());
+}
+
+BOOST_AUTO_TEST_CASE(test_patch_counter)
+{
+  std::string data = document(MPACK_ENCODE_FIXED_WIDTH);
+  const mpack_object_t hits[] = { key("stats"), key("hits") };
+  const mpack_object_t seen[] = { key("seen") };
+  mpack_decoder_t decoder;
+  signed long value;
+  struct timespec t;
+  int n;
+
+  BOOST_CHECK(data.size() == (document(0).size() + 6 * 8 + 9));
+
+  // Any later counter value fits in the slot of the fixed width encoding.
+  for (signed long counter : { 6L, 300L, -70000L, 1L << 40, 0L }) {
+    mpack_decoder_init(&decoder, data.data(), data.size());
+    BOOST_REQUIRE((n = mpack_find(&decoder, hits, 2)) == 9);
+    BOOST_CHECK(mpack_patch_object(const_cast<char *>(decoder.pos), n, index(counter)) == 9);
+
+    mpack_decoder_init(&decoder, data.data(), data.size());
+    BOOST_REQUIRE(mpack_find(&decoder, hits, 2) == 9);
+    BOOST_CHECK(mpack_decode_signed(&decoder, &value) == 9);
+    BOOST_CHECK(value == counter);
+  }
+
+  mpack_decoder_init(&decoder, data.data(), data.size());
+  BOOST_REQUIRE((n = mpack_find(&decoder, seen, 1)) == 15);
+  BOOST_CHECK(mpack_patch_timestamp(const_cast<char *>(decoder.pos), n, timespec{ 1700000000, 123 }) == 15);
+  BOOST_CHECK(mpack_decode_timestamp(&decoder, &t) == 15);
+  BOOST_CHECK((t.tv_sec == 1700000000) && (t.tv_nsec == 123));
+
+  // The rest of the document is unchanged.
+  mpack_decoder_init(&decoder, data.data(), data.size());
+  BOOST_CHECK(mpack_decode_skip(&decoder) == static_cast<int>(data.size()));
+}
+
+BOOST_AUTO_TEST_CASE(test_patch_sizes)
+{
+  std::string data = document(0);
+  const mpack_object_t hits[] = { key("stats"), key("hits") };
+  const mpack_object_t name[] = { key("name") };
+  const mpack_object_t seen[] = { key("seen") };
+  const std::string before = data;
+  mpack_decoder_t decoder;
+  mpack_string_t string;
+  char *pos;
+  int n;
+
+  mpack_decoder_init(&decoder, data.data(), data.size());
+  BOOST_REQUIRE((n = mpack_find(&decoder, hits, 2)) == 1);
+  pos = const_cast<char *>(decoder.pos);
+  BOOST_CHECK(mpack_patch_object(pos, n, index(1000)) == -1);
+  BOOST_CHECK(errno == ERANGE);
+  BOOST_CHECK(data == before);
+  BOOST_CHECK(mpack_patch_object(pos, n, index(-32)) == 1);
+  BOOST_CHECK(mpack_patch_object(pos, n, index(127)) == 1);
+
+  mpack_decoder_init(&decoder, data.data(), data.size());
+  BOOST_REQUIRE((n = mpack_find(&decoder, name, 1)) == 4);
+  pos = const_cast<char *>(decoder.pos);
+  BOOST_CHECK(mpack_patch_object(pos, n, key("abcd")) == -1);
+  BOOST_CHECK(mpack_patch_object(pos, n, key("xyz")) == 4);
+  BOOST_CHECK(mpack_decode_string(&decoder, &string) == 4);
+  BOOST_CHECK(std::string(string.data, string.size) == "xyz");
+
+  // A shorter string takes a wider header to fill the same bytes.
+  decoder.pos = pos;
+  BOOST_CHECK(mpack_patch_object(pos, n, key("ab")) == 4);
+  BOOST_CHECK(static_cast<uint8_t>(pos[0]) == MPACK_STR8);
+  BOOST_CHECK(mpack_decode_string(&decoder, &string) == 4);
+  BOOST_CHECK(std::string(string.data, string.size) == "ab");
+
+  mpack_decoder_init(&decoder, data.data(), data.size());
+  BOOST_REQUIRE((n = mpack_find(&decoder, seen, 1)) == 6);
+  BOOST_CHECK(mpack_patch_timestamp(const_cast<char *>(decoder.pos), n, timespec{ 5, 0 }) == 6);
+  BOOST_CHECK(mpack_patch_timestamp(const_cast<char *>(decoder.pos), n, timespec{ 5, 1 }) == -1);
+  BOOST_CHECK(errno == ERANGE);
+}
+
+BOOST_AUTO_TEST_CASE(test_patch_timestamp_formats)
+{
+  char buffer[16];
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+  struct timespec value;
+
+  // Each slot keeps its format, whichever format the value would take.
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  BOOST_REQUIRE(mpack_encode_timestamp(&encoder, timespec{ 1, 1 }) == 10);
+  BOOST_CHECK(mpack_patch_timestamp(buffer, 10, timespec{ 2000, 0 }) == 10);
+  BOOST_CHECK(static_cast<uint8_t>(buffer[0]) == MPACK_FIXEXT8);
+  mpack_decoder_init(&decoder, buffer, 10);
+  BOOST_CHECK(mpack_decode_timestamp(&decoder, &value) == 10);
+  BOOST_CHECK(value.tv_sec == 2000);
+  BOOST_CHECK(value.tv_nsec == 0);
+
+  BOOST_CHECK(mpack_patch_timestamp(buffer, 10, timespec{ -1, 0 }) == -1);
+  BOOST_CHECK(errno == ERANGE);
+  BOOST_CHECK(mpack_patch_timestamp(buffer, 10, timespec{ 0, 1000000000 }) == -1);
+  BOOST_CHECK(errno == EINVAL);
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  encoder.flags = MPACK_ENCODE_FIXED_WIDTH;
+  BOOST_REQUIRE(mpack_encode_timestamp(&encoder, timespec{ 1, 1 }) == 15);
+  BOOST_CHECK(mpack_patch_timestamp(buffer, 15, timespec{ 7, 0 }) == 15);
+  mpack_decoder_init(&decoder, buffer, 15);
+  BOOST_CHECK(mpack_decode_timestamp(&decoder, &value) == 15);
+  BOOST_CHECK(value.tv_sec == 7);
+
+  BOOST_CHECK(mpack_patch_timestamp(buffer, 8, timespec{ 7, 0 }) == -1);
+  BOOST_CHECK(errno == ERANGE);
+}
+
+BOOST_AUTO_TEST_CASE(test_patch_types)
+{
+  char buffer[32];
+  mpack_decoder_t decoder;
+  mpack_object_t value;
+  mpack_object_t object;
+
+  value.type = MPACK_NONE;
+  BOOST_CHECK(mpack_patch_object(buffer, 1, value) == 1);
+  BOOST_CHECK(static_cast<uint8_t>(buffer[0]) == MPACK_NIL);
+
+  value.type = MPACK_BOOLEAN;
+  value.data.boolean = true;
+  BOOST_CHECK(mpack_patch_object(buffer, 1, value) == 1);
+  mpack_decoder_init(&decoder, buffer, 1);
+  BOOST_CHECK(mpack_decode_object(&decoder, &object) == 1);
+  BOOST_CHECK(object.data.boolean);
+  BOOST_CHECK(mpack_patch_object(buffer, 2, value) == -1);
+
+  value.type = MPACK_NUMBER;
+  value.data.number = 0.5;
+  BOOST_CHECK(mpack_patch_object(buffer, 5, value) == 5);
+  BOOST_CHECK(mpack_patch_object(buffer, 9, value) == 9);
+  value.data.number = 0.1;
+  BOOST_CHECK(mpack_patch_object(buffer, 5, value) == -1);
+  BOOST_CHECK(mpack_patch_object(buffer, 9, value) == 9);
+  mpack_decoder_init(&decoder, buffer, 9);
+  BOOST_CHECK(mpack_decode_object(&decoder, &object) == 9);
+  BOOST_CHECK(object.data.number == 0.1);
+
+  value.type = MPACK_BINARY;
+  value.data.binary.data = "\x01\x02\x03";
+  value.data.binary.size = 3;
+  BOOST_CHECK(mpack_patch_object(buffer, 4, value) == -1);
+  BOOST_CHECK(mpack_patch_object(buffer, 5, value) == 5);
+  BOOST_CHECK(mpack_patch_object(buffer, 6, value) == 6);
+  mpack_decoder_init(&decoder, buffer, 6);
+  BOOST_CHECK(mpack_decode_object(&decoder, &object) == 6);
+  BOOST_CHECK((object.type == MPACK_BINARY) && (object.data.binary.size == 3));
+
+  value.type = MPACK_EXTENDED;
+  value.data.extended.data = "\x01\x02\x03\x04";
+  value.data.extended.size = 4;
+  value.data.extended.type = 9;
+  BOOST_CHECK(mpack_patch_object(buffer, 6, value) == 6);
+  BOOST_CHECK(static_cast<uint8_t>(buffer[0]) == MPACK_FIXEXT4);
+  BOOST_CHECK(mpack_patch_object(buffer, 7, value) == 7);
+  BOOST_CHECK(static_cast<uint8_t>(buffer[0]) == MPACK_EXT8);
+  mpack_decoder_init(&decoder, buffer, 7);
+  BOOST_CHECK(mpack_decode_object(&decoder, &object) == 7);
+  BOOST_CHECK((object.data.extended.type == 9) && (object.data.extended.size == 4));
+  BOOST_CHECK(mpack_patch_object(buffer, 2, value) == -1);
+
+  value.type = MPACK_ARRAY;
+  value.data.array.size = 1;
+  BOOST_CHECK(mpack_patch_object(buffer, 1, value) == -1);
+  BOOST_CHECK(errno == EINVAL);
+}
@@ -0,0 +1,305 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+static std::string sample()
+{
+  char buffer[1024];
+  mpack_encoder_t encoder;
+  mpack_string_t string;
+  mpack_binary_t binary;
+  mpack_extended_t extended;
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_array(&encoder, mpack_array_t{ 3 });
+  mpack_encode_signed(&encoder, -100000);
+  mpack_encode_double(&encoder, 1.5);
+  mpack_encode_nil(&encoder);
+
+  string.data = "a string that is long enough to cross boundaries";
+  string.size = std::strlen(string.data);
+  mpack_encode_map(&encoder, mpack_map_t{ 2 });
+  mpack_encode_string(&encoder, string);
+  mpack_encode_unsigned(&encoder, 4000000000UL);
+
+  binary.data = "\x01\x02\x03\x04\x05";
+  binary.size = 5;
+  mpack_encode_binary(&encoder, binary);
+
+  extended.type = 7;
+  extended.data = "\x00\x01\x02\x03\x04\x05\x06\x07";
+  extended.size = 8;
+  mpack_encode_extended(&encoder, extended);
+
+  mpack_encode_float(&encoder, 0.25f);
+  return std::string(encoder.begin, encoder.pos);
+}
+
+static std::vector<mpack_segment_t> split(const std::string &data, const std::vector<size_t> &cuts)
+{
+  std::vector<mpack_segment_t> segments;
+  size_t begin = 0;
+
+  for (size_t cut : cuts) {
+    segments.push_back(mpack_segment_t{ data.data() + begin, cut - begin });
+    begin = cut;
+  }
+
+  segments.push_back(mpack_segment_t{ data.data() + begin, data.size() - begin });
+  return segments;
+}
+
+// Decodes the segments object by object and value by value and compares the
+// results with the decoder over the contiguous data.
+static void check_segments(const std::string &data, const std::vector<mpack_segment_t> &segments)
+{
+  mpack_decoder_t contiguous;
+  mpack_decoder_t decoder;
+  mpack_object_t a;
+  mpack_object_t b;
+  mpack_rope_t rope;
+  int n;
+
+  mpack_decoder_init(&contiguous, data.data(), data.size());
+  mpack_rope_init(&rope, segments.data(), segments.size());
+
+  while (contiguous.pos != contiguous.end) {
+    BOOST_REQUIRE((n = mpack_decode_object(&contiguous, &a)) > 0);
+    BOOST_REQUIRE(mpack_rope_decode_object(&rope, &b) == n);
+    BOOST_REQUIRE(mpack_object_equal(&a, &b));
+    BOOST_REQUIRE(rope.position == static_cast<size_t>(contiguous.pos - contiguous.begin));
+  }
+
+  BOOST_CHECK(mpack_rope_decode_object(&rope, &b) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  mpack_rope_term(&rope);
+
+  mpack_decoder_init(&contiguous, data.data(), data.size());
+  mpack_decoder_init(&decoder, nullptr, 0);
+  mpack_rope_init(&rope, segments.data(), segments.size());
+
+  // Values come in parts made of whole tokens.
+  while (contiguous.pos != contiguous.end) {
+    const char *pos = contiguous.pos;
+    BOOST_REQUIRE(mpack_decode_skip(&contiguous) > 0);
+
+    do {
+      BOOST_REQUIRE((n = mpack_rope_next(&rope, &decoder)) > 0);
+      BOOST_REQUIRE(std::memcmp(decoder.begin, pos, n) == 0);
+
+      while (decoder.pos != decoder.end) {
+        BOOST_REQUIRE(mpack_decode_object(&decoder, &b) > 0);
+      }
+
+      pos += n;
+    } while (rope.scanner.offset != 0);
+
+    BOOST_REQUIRE(pos == contiguous.pos);
+  }
+
+  BOOST_CHECK(mpack_rope_next(&rope, &decoder) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  mpack_rope_term(&rope);
+}
+
+BOOST_AUTO_TEST_CASE(test_rope_two_segments)
+{
+  const std::string data = sample();
+
+  for (size_t cut = 0; cut <= data.size(); ++cut) {
+    check_segments(data, split(data, { cut }));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_rope_byte_segments)
+{
+  const std::string data = sample();
+  std::vector<size_t> cuts;
+
+  // Every byte in a segment of its own, with empty segments in between.
+  for (size_t i = 1; i < data.size(); ++i) {
+    cuts.push_back(i);
+    cuts.push_back(i);
+  }
+
+  check_segments(data, split(data, cuts));
+}
+
+BOOST_AUTO_TEST_CASE(test_rope_zero_copy)
+{
+  const std::string data("\xa3" "abc\xa3" "def", 8);
+  const std::vector<mpack_segment_t> segments = split(data, { 6 });
+  mpack_object_t value;
+  mpack_rope_t rope;
+
+  mpack_rope_init(&rope, segments.data(), segments.size());
+  BOOST_CHECK(mpack_rope_decode_object(&rope, &value) == 4);
+  BOOST_CHECK(value.data.string.data == (data.data() + 1));
+  BOOST_CHECK(rope.scratch == nullptr);
+
+  BOOST_CHECK(mpack_rope_decode_object(&rope, &value) == 4);
+  BOOST_CHECK(value.data.string.data == (rope.scratch + 1));
+  BOOST_CHECK(std::string(value.data.string.data, value.data.string.size) == "def");
+  mpack_rope_term(&rope);
+}
+
+BOOST_AUTO_TEST_CASE(test_rope_token_copy)
+{
+  char buffer[128];
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+  mpack_string_t string;
+  mpack_array_t array;
+  mpack_rope_t rope;
+  signed long x;
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_array(&encoder, mpack_array_t{ 41 });
+
+  for (int i = 0; i != 20; ++i) {
+    mpack_encode_signed(&encoder, i);
+  }
+
+  mpack_encode_string(&encoder, mpack_string_t{ "abcdef", 6 });
+
+  for (int i = 0; i != 20; ++i) {
+    mpack_encode_signed(&encoder, i);
+  }
+
+  // The cut falls in the middle of the string, only its 7 bytes are copied.
+  const std::string data(encoder.begin, encoder.pos);
+  const std::vector<mpack_segment_t> segments = split(data, { 25 });
+  mpack_decoder_init(&decoder, nullptr, 0);
+  mpack_rope_init(&rope, segments.data(), segments.size());
+
+  BOOST_CHECK(mpack_rope_next(&rope, &decoder) == 23);
+  BOOST_CHECK(decoder.begin == data.data());
+  BOOST_CHECK(!(decoder.flags & MPACK_DECODE_TRUSTED));
+  BOOST_CHECK(mpack_decode_array(&decoder, &array) > 0);
+  BOOST_CHECK(array.size == 41);
+
+  for (int i = 0; i != 20; ++i) {
+    BOOST_CHECK(mpack_decode_signed(&decoder, &x) > 0);
+    BOOST_CHECK(x == i);
+  }
+
+  BOOST_CHECK(mpack_rope_next(&rope, &decoder) == 7);
+  BOOST_CHECK(decoder.begin == rope.scratch);
+  BOOST_CHECK(rope.scratch_size == 7);
+  BOOST_CHECK(mpack_decode_string(&decoder, &string) > 0);
+  BOOST_CHECK(std::string(string.data, string.size) == "abcdef");
+
+  BOOST_CHECK(mpack_rope_next(&rope, &decoder) == 20);
+  BOOST_CHECK(decoder.begin == (data.data() + 30));
+  BOOST_CHECK(decoder.flags & MPACK_DECODE_TRUSTED);
+  BOOST_CHECK(mpack_decode_skip(&decoder) == 1);
+  BOOST_CHECK(rope.scanner.offset == 0);
+  BOOST_CHECK(rope.position == data.size());
+  mpack_rope_term(&rope);
+}
+
+BOOST_AUTO_TEST_CASE(test_rope_truncated)
+{
+  const std::string data("\x01\x92\xa5hello", 8);
+  const std::vector<mpack_segment_t> segments = split(data, { 3 });
+  mpack_decoder_t decoder;
+  mpack_rope_t rope;
+
+  mpack_decoder_init(&decoder, nullptr, 0);
+  mpack_rope_init(&rope, segments.data(), segments.size());
+  BOOST_CHECK(mpack_rope_skip(&rope) == 1);
+  BOOST_CHECK(mpack_rope_next(&rope, &decoder) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  BOOST_CHECK(mpack_rope_skip(&rope) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  BOOST_CHECK(rope.position == 1);
+  BOOST_CHECK((rope.index == 0) && (rope.offset == 1));
+  mpack_rope_term(&rope);
+
+  mpack_rope_init(&rope, segments.data(), segments.size());
+  BOOST_CHECK(mpack_rope_skip(&rope) == 1);
+  BOOST_CHECK(mpack_rope_skip(&rope) == -1);
+  mpack_rope_term(&rope);
+}
+
+BOOST_AUTO_TEST_CASE(test_rope_ring_buffer)
+{
+  // Two records written to a ring of 16 bytes, the second one wraps around.
+  const std::string records("\x92\x01\xa8overflow\x92\x02\xa3" "abc", 17);
+  char ring[16];
+  const size_t head = 7;
+
+  for (size_t i = 0; i != records.size() - 1; ++i) {
+    ring[(head + i) % sizeof(ring)] = records[i];
+  }
+
+  mpack_segment_t segments[2] = {
+    { ring + head, sizeof(ring) - head },
+    { ring, records.size() - 1 - (sizeof(ring) - head) },
+  };
+  mpack_decoder_t decoder;
+  mpack_rope_t rope;
+  mpack_array_t array;
+  mpack_string_t string;
+  signed long id;
+
+  mpack_decoder_init(&decoder, nullptr, 0);
+  mpack_rope_init(&rope, segments, 2);
+
+  // The string of the first record crosses the end of the ring.
+  BOOST_CHECK(mpack_rope_next(&rope, &decoder) == 2);
+  BOOST_CHECK(mpack_decode_array(&decoder, &array) > 0);
+  BOOST_CHECK(mpack_decode_signed(&decoder, &id) > 0);
+  BOOST_CHECK(id == 1);
+  BOOST_CHECK(mpack_rope_next(&rope, &decoder) == 9);
+  BOOST_CHECK(mpack_decode_string(&decoder, &string) > 0);
+  BOOST_CHECK(std::string(string.data, string.size) == "overflow");
+  BOOST_CHECK(rope.scanner.offset == 0);
+
+  // The last byte of the second record was not written to the ring yet, the
+  // headers that were scanned are not scanned again once it is.
+  BOOST_CHECK(mpack_rope_next(&rope, &decoder) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  BOOST_CHECK(rope.position == 11);
+  BOOST_CHECK(rope.scanner.offset == 6);
+  BOOST_CHECK(rope.scanner.count == 0);
+
+  ring[(head + records.size() - 1) % sizeof(ring)] = records.back();
+  segments[1].size += 1;
+  BOOST_CHECK(mpack_rope_next(&rope, &decoder) == 6);
+  BOOST_CHECK(decoder.begin == (ring + 2));
+  BOOST_CHECK(mpack_decode_array(&decoder, &array) > 0);
+  BOOST_CHECK(mpack_decode_signed(&decoder, &id) > 0);
+  BOOST_CHECK(mpack_decode_string(&decoder, &string) > 0);
+  BOOST_CHECK(id == 2);
+  BOOST_CHECK(std::string(string.data, string.size) == "abc");
+  BOOST_CHECK(rope.position == 17);
+  mpack_rope_term(&rope);
+}
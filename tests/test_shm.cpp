@@ -0,0 +1,338 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+static std::string segment_name(const char *test)
+{
+  return std::string("/mpack-") + test + "-" + std::to_string(getpid());
+}
+
+static int send(mpack_shm_ring_t *ring, unsigned long producer, unsigned long seq, size_t length, int timeout)
+{
+  const std::string payload(length, 'a' + (seq % 26));
+  mpack_encoder_t encoder;
+
+  if (mpack_shm_ring_reserve(ring, length + 16, &encoder, timeout) < 0) {
+    return -1;
+  }
+
+  mpack_encode_array(&encoder, mpack_array_t{ 3 });
+  mpack_encode_unsigned(&encoder, producer);
+  mpack_encode_unsigned(&encoder, seq);
+  mpack_encode_string(&encoder, mpack_string_t{ payload.data(), payload.size() });
+  return mpack_shm_ring_commit(ring, &encoder);
+}
+
+static bool receive(mpack_shm_ring_t *ring, unsigned long *producer, unsigned long *seq, size_t *length, int timeout)
+{
+  mpack_decoder_t decoder;
+  mpack_array_t array;
+  mpack_string_t payload;
+
+  if ((mpack_shm_ring_next(ring, &decoder, timeout) < 0) ||
+      (mpack_decode_array(&decoder, &array) < 0) ||
+      (mpack_decode_unsigned(&decoder, producer) < 0) ||
+      (mpack_decode_unsigned(&decoder, seq) < 0) ||
+      (mpack_decode_string(&decoder, &payload) < 0) ||
+      (decoder.pos != decoder.end) ||
+      (payload.size != 0 && payload.data[0] != static_cast<char>('a' + (*seq % 26)))) {
+    return false;
+  }
+
+  *length = payload.size;
+  return mpack_shm_ring_release(ring) == 0;
+}
+
+BOOST_AUTO_TEST_CASE(test_shm_create_open)
+{
+  const std::string name = segment_name("open");
+  mpack_shm_ring_t ring;
+  mpack_shm_ring_t peer;
+
+  BOOST_CHECK(mpack_shm_ring_create(&ring, name.c_str(), 100) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(mpack_shm_ring_create(&ring, name.c_str(), 32) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(mpack_shm_ring_open(&peer, name.c_str()) == -1);
+  BOOST_CHECK(errno == ENOENT);
+
+  BOOST_REQUIRE(mpack_shm_ring_create(&ring, name.c_str(), 4096) == 0);
+  BOOST_CHECK(ring.capacity == 4096);
+  BOOST_CHECK(mpack_shm_ring_create(&peer, name.c_str(), 4096) == -1);
+  BOOST_CHECK(errno == EEXIST);
+
+  BOOST_REQUIRE(mpack_shm_ring_open(&peer, name.c_str()) == 0);
+  BOOST_CHECK(peer.capacity == 4096);
+  BOOST_CHECK(peer.header != ring.header);
+
+  mpack_shm_ring_term(&peer);
+  mpack_shm_ring_term(&ring);
+  mpack_shm_ring_term(&ring);
+  shm_unlink(name.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(test_shm_in_place)
+{
+  const std::string name = segment_name("place");
+  mpack_shm_ring_t producer;
+  mpack_shm_ring_t consumer;
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+  mpack_string_t string;
+
+  BOOST_REQUIRE(mpack_shm_ring_create(&producer, name.c_str(), 1024) == 0);
+  BOOST_REQUIRE(mpack_shm_ring_open(&consumer, name.c_str()) == 0);
+  shm_unlink(name.c_str());
+
+  BOOST_CHECK(mpack_shm_ring_next(&consumer, &decoder, 0) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  BOOST_CHECK(mpack_shm_ring_release(&consumer) == -1);
+  BOOST_CHECK(errno == EINVAL);
+
+  BOOST_REQUIRE(mpack_shm_ring_reserve(&producer, 32, &encoder, 0) == 0);
+  BOOST_CHECK(encoder.begin > producer.data);
+  BOOST_CHECK(encoder.end <= (producer.data + producer.capacity));
+  BOOST_CHECK(mpack_encode_string(&encoder, mpack_string_t{ "hello", 5 }) == 6);
+
+  // Nothing is visible before the commit.
+  BOOST_CHECK(mpack_shm_ring_next(&consumer, &decoder, 0) == -1);
+  BOOST_CHECK(mpack_shm_ring_commit(&producer, &encoder) == 0);
+
+  BOOST_REQUIRE(mpack_shm_ring_next(&consumer, &decoder, 0) == 6);
+  BOOST_CHECK(decoder.begin == (consumer.data + (encoder.begin - producer.data)));
+  BOOST_CHECK(mpack_decode_string(&decoder, &string) == 6);
+  BOOST_CHECK(string.data == (decoder.begin + 1));
+  BOOST_CHECK(std::string(string.data, string.size) == "hello");
+
+  // The message stays until it is released.
+  BOOST_CHECK(mpack_shm_ring_next(&consumer, &decoder, 0) == 6);
+  BOOST_CHECK(mpack_shm_ring_release(&consumer) == 0);
+  BOOST_CHECK(mpack_shm_ring_next(&consumer, &decoder, 0) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+
+  mpack_shm_ring_term(&consumer);
+  mpack_shm_ring_term(&producer);
+}
+
+BOOST_AUTO_TEST_CASE(test_shm_full)
+{
+  const std::string name = segment_name("full");
+  mpack_shm_ring_t ring;
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+  unsigned long producer;
+  unsigned long seq;
+  size_t length;
+  size_t count = 0;
+
+  BOOST_REQUIRE(mpack_shm_ring_create(&ring, name.c_str(), 256) == 0);
+  shm_unlink(name.c_str());
+
+  BOOST_CHECK(mpack_shm_ring_reserve(&ring, 300, &encoder, 0) == -1);
+  BOOST_CHECK(errno == ERANGE);
+
+  while (send(&ring, 0, count, 10, 0) == 0) {
+    ++count;
+  }
+
+  BOOST_CHECK(errno == EAGAIN);
+  BOOST_CHECK(count == 5);
+
+  // A short timeout expires while the ring stays full.
+  BOOST_CHECK(send(&ring, 0, count, 10, 20) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+
+  BOOST_REQUIRE(receive(&ring, &producer, &seq, &length, 0));
+  BOOST_CHECK(seq == 0);
+  BOOST_CHECK(send(&ring, 0, count, 10, 0) == 0);
+
+  for (size_t i = 1; i <= count; ++i) {
+    BOOST_REQUIRE(receive(&ring, &producer, &seq, &length, 0));
+    BOOST_CHECK(seq == i);
+  }
+
+  BOOST_CHECK(mpack_shm_ring_next(&ring, &decoder, 20) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  mpack_shm_ring_term(&ring);
+}
+
+BOOST_AUTO_TEST_CASE(test_shm_wrap_around)
+{
+  const std::string name = segment_name("wrap");
+  mpack_shm_ring_t ring;
+  unsigned long producer;
+  unsigned long seq;
+  size_t length;
+
+  BOOST_REQUIRE(mpack_shm_ring_create(&ring, name.c_str(), 512) == 0);
+  shm_unlink(name.c_str());
+
+  // Sizes that do not divide the capacity, slots end up padded at the end.
+  for (unsigned long i = 0; i != 1000; ++i) {
+    BOOST_REQUIRE(send(&ring, 1, i, 7 * (i % 23), 0) == 0);
+    BOOST_REQUIRE(receive(&ring, &producer, &seq, &length, 0));
+    BOOST_REQUIRE(seq == i);
+    BOOST_REQUIRE(length == (7 * (i % 23)));
+  }
+
+  mpack_shm_ring_term(&ring);
+}
+
+BOOST_AUTO_TEST_CASE(test_shm_wrap_around_large)
+{
+  const std::string name = segment_name("wrap-large");
+  mpack_shm_ring_t ring;
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+  mpack_string_t string;
+
+  BOOST_REQUIRE(mpack_shm_ring_create(&ring, name.c_str(), 64) == 0);
+  shm_unlink(name.c_str());
+
+  BOOST_REQUIRE(mpack_shm_ring_reserve(&ring, 16, &encoder, 0) == 0);
+  BOOST_CHECK(mpack_shm_ring_commit(&ring, &encoder) == 0);
+  BOOST_REQUIRE(mpack_shm_ring_next(&ring, &decoder, 0) == 0);
+  BOOST_CHECK(mpack_shm_ring_release(&ring) == 0);
+
+  // The slot is larger than the space left before the end of the ring, the
+  // padding is published on its own and the slot waits until it is skipped.
+  BOOST_CHECK(mpack_shm_ring_reserve(&ring, 32, &encoder, 0) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  BOOST_CHECK(mpack_shm_ring_next(&ring, &decoder, 0) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+
+  BOOST_REQUIRE(mpack_shm_ring_reserve(&ring, 32, &encoder, 0) == 0);
+  BOOST_CHECK(encoder.begin == (ring.data + 16));
+  BOOST_CHECK(mpack_encode_string(&encoder, mpack_string_t{ "wrapped", 7 }) == 8);
+  BOOST_CHECK(mpack_shm_ring_commit(&ring, &encoder) == 0);
+
+  BOOST_REQUIRE(mpack_shm_ring_next(&ring, &decoder, 0) == 8);
+  BOOST_CHECK(mpack_decode_string(&decoder, &string) == 8);
+  BOOST_CHECK(std::string(string.data, string.size) == "wrapped");
+  BOOST_CHECK(mpack_shm_ring_release(&ring) == 0);
+
+  mpack_shm_ring_term(&ring);
+}
+
+BOOST_AUTO_TEST_CASE(test_shm_overflow)
+{
+  const std::string name = segment_name("overflow");
+  mpack_shm_ring_t ring;
+  mpack_encoder_t encoder;
+  mpack_decoder_t decoder;
+  unsigned long producer;
+  unsigned long seq;
+  size_t length;
+
+  BOOST_REQUIRE(mpack_shm_ring_create(&ring, name.c_str(), 1024) == 0);
+  shm_unlink(name.c_str());
+
+  BOOST_REQUIRE(mpack_shm_ring_reserve(&ring, 8, &encoder, 0) == 0);
+  mpack_encode_string(&encoder, mpack_string_t{ "a string too long for the slot", 30 });
+  BOOST_CHECK(mpack_shm_ring_commit(&ring, &encoder) == -1);
+  BOOST_CHECK(errno == ERANGE);
+
+  // The dropped message is skipped by the consumer.
+  BOOST_CHECK(mpack_shm_ring_next(&ring, &decoder, 0) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  BOOST_CHECK(send(&ring, 2, 42, 5, 0) == 0);
+  BOOST_REQUIRE(receive(&ring, &producer, &seq, &length, 0));
+  BOOST_CHECK(producer == 2);
+  BOOST_CHECK(seq == 42);
+
+  mpack_shm_ring_term(&ring);
+}
+
+BOOST_AUTO_TEST_CASE(test_shm_processes)
+{
+  const std::string name = segment_name("processes");
+  const unsigned long producers = 4;
+  const unsigned long messages = 20000;
+  std::vector<unsigned long> expected(producers, 0);
+  std::vector<pid_t> children;
+  mpack_shm_ring_t ring;
+  unsigned long producer;
+  unsigned long seq;
+  size_t length = 0;
+  bool ordered = true;
+  mpack_decoder_t decoder;
+
+  // A small ring so that producers and the consumer both end up sleeping.
+  BOOST_REQUIRE(mpack_shm_ring_create(&ring, name.c_str(), 1024) == 0);
+
+  for (unsigned long p = 0; p != producers; ++p) {
+    pid_t pid = fork();
+    BOOST_REQUIRE(pid >= 0);
+
+    if (pid == 0) {
+      mpack_shm_ring_t child;
+      int status = 0;
+
+      if (mpack_shm_ring_open(&child, name.c_str()) < 0) {
+        _exit(1);
+      }
+
+      for (unsigned long i = 0; i != messages; ++i) {
+        if (send(&child, p, i, i % 64, -1) < 0) {
+          status = 2;
+          break;
+        }
+      }
+
+      mpack_shm_ring_term(&child);
+      _exit(status);
+    }
+
+    children.push_back(pid);
+  }
+
+  for (unsigned long i = 0; i != (producers * messages); ++i) {
+    if (!receive(&ring, &producer, &seq, &length, 5000) || (producer >= producers)) {
+      BOOST_FAIL("receive failed at message " << i << ": " << std::strerror(errno));
+    }
+
+    ordered &= (seq == expected[producer]) && (length == (seq % 64));
+    ++expected[producer];
+  }
+
+  for (pid_t pid : children) {
+    int status;
+    BOOST_REQUIRE(waitpid(pid, &status, 0) == pid);
+    BOOST_CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+  }
+
+  BOOST_CHECK(ordered);
+  BOOST_CHECK(mpack_shm_ring_next(&ring, &decoder, 0) == -1);
+  mpack_shm_ring_term(&ring);
+  shm_unlink(name.c_str());
+}
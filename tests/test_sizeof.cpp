@@ -0,0 +1,130 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <climits>
+#include <string>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+BOOST_AUTO_TEST_CASE(test_sizeof_scalars)
+{
+  char buffer[16];
+  mpack_encoder_t encoder;
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  BOOST_CHECK(mpack_sizeof_nil() == size_t(mpack_encode_nil(&encoder)));
+  BOOST_CHECK(mpack_sizeof_boolean(true) == size_t(mpack_encode_boolean(&encoder, true)));
+  BOOST_CHECK(mpack_sizeof_float(1.0f) == size_t(mpack_encode_float(&encoder, 1.0f)));
+  BOOST_CHECK(mpack_sizeof_double(1.0) == size_t(mpack_encode_double(&encoder, 1.0)));
+  mpack_encoder_term(&encoder);
+}
+
+BOOST_AUTO_TEST_CASE(test_sizeof_integers)
+{
+  const signed long values[] = {
+    0, 1, 127, 128, 255, 256, 65535, 65536, 4294967295L, 4294967296L, LONG_MAX,
+    -1, -31, -32, -128, -129, -32768, -32769, -2147483648L, -2147483649L, LONG_MIN,
+  };
+  char buffer[16];
+  mpack_encoder_t encoder;
+
+  for (signed long x : values) {
+    mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+    BOOST_CHECK(mpack_sizeof_signed(x) == size_t(mpack_encode_signed(&encoder, x)));
+
+    if (x >= 0) {
+      mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+      BOOST_CHECK(mpack_sizeof_unsigned(x) == size_t(mpack_encode_unsigned(&encoder, x)));
+    }
+  }
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  BOOST_CHECK(mpack_sizeof_unsigned(ULONG_MAX) == size_t(mpack_encode_unsigned(&encoder, ULONG_MAX)));
+  mpack_encoder_term(&encoder);
+}
+
+BOOST_AUTO_TEST_CASE(test_sizeof_sized)
+{
+  const size_t sizes[] = { 0, 1, 2, 3, 4, 8, 15, 16, 17, 255, 256, 65535, 65536 };
+  std::string data(65536, 'a');
+  std::string buffer(65536 + 16, '\0');
+  mpack_encoder_t encoder;
+  mpack_string_t string;
+  mpack_binary_t binary;
+  mpack_extended_t extended;
+  mpack_array_t array;
+  mpack_map_t map;
+
+  for (size_t n : sizes) {
+    string.data = data.data();
+    string.size = n;
+    mpack_encoder_init(&encoder, const_cast<char *>(buffer.data()), buffer.size());
+    BOOST_CHECK(mpack_sizeof_string(n) == size_t(mpack_encode_string(&encoder, string)));
+
+    binary.data = data.data();
+    binary.size = n;
+    mpack_encoder_init(&encoder, const_cast<char *>(buffer.data()), buffer.size());
+    BOOST_CHECK(mpack_sizeof_binary(n) == size_t(mpack_encode_binary(&encoder, binary)));
+
+    extended.data = data.data();
+    extended.size = n;
+    extended.type = 1;
+    mpack_encoder_init(&encoder, const_cast<char *>(buffer.data()), buffer.size());
+    BOOST_CHECK(mpack_sizeof_extended(n) == size_t(mpack_encode_extended(&encoder, extended)));
+
+    array.size = n;
+    mpack_encoder_init(&encoder, const_cast<char *>(buffer.data()), buffer.size());
+    BOOST_CHECK(mpack_sizeof_array_header(n) == size_t(mpack_encode_array(&encoder, array)));
+
+    map.size = n;
+    mpack_encoder_init(&encoder, const_cast<char *>(buffer.data()), buffer.size());
+    BOOST_CHECK(mpack_sizeof_map_header(n) == size_t(mpack_encode_map(&encoder, map)));
+  }
+
+  BOOST_CHECK(mpack_sizeof_string(size_t(UINT32_MAX) + 1) == 0);
+  BOOST_CHECK(mpack_sizeof_array_header(size_t(UINT32_MAX) + 1) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_sizeof_object)
+{
+  char buffer[64];
+  mpack_object_t value;
+  mpack_encoder_t encoder;
+
+  value.type = MPACK_INTEGER;
+  value.data.integer = -1000;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  BOOST_CHECK(mpack_sizeof_object(value) == size_t(mpack_encode_object(&encoder, value)));
+
+  value.type = MPACK_STRING;
+  value.data.string.data = "Hello World!";
+  value.data.string.size = 12;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  BOOST_CHECK(mpack_sizeof_object(value) == size_t(mpack_encode_object(&encoder, value)));
+
+  value.type = MPACK_MAP;
+  value.data.map.size = 20;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  BOOST_CHECK(mpack_sizeof_object(value) == size_t(mpack_encode_object(&encoder, value)));
+}
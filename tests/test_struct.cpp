@@ -0,0 +1,201 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+typedef struct point {
+  int32_t x;
+  int32_t y;
+} point_t;
+
+typedef struct event {
+  mpack_string_t name;
+  uint64_t id;
+  int8_t level;
+  double score;
+  bool enabled;
+  point_t origin;
+} event_t;
+
+static const mpack_field_desc_t point_fields[] = {
+  { "x", offsetof(point_t, x), MPACK_FIELD_INT32, NULL, true },
+  { "y", offsetof(point_t, y), MPACK_FIELD_INT32, NULL, true },
+};
+
+static mpack_struct_desc_t point_desc = MPACK_STRUCT_DESC(point_fields);
+
+static const mpack_field_desc_t event_fields[] = {
+  { "name", offsetof(event_t, name), MPACK_FIELD_STRING, NULL, true },
+  { "id", offsetof(event_t, id), MPACK_FIELD_UINT64, NULL, true },
+  { "level", offsetof(event_t, level), MPACK_FIELD_INT8, NULL, false },
+  { "score", offsetof(event_t, score), MPACK_FIELD_DOUBLE, NULL, false },
+  { "enabled", offsetof(event_t, enabled), MPACK_FIELD_BOOLEAN, NULL, false },
+  { "origin", offsetof(event_t, origin), MPACK_FIELD_STRUCT, &point_desc, false },
+};
+
+static mpack_struct_desc_t event_desc = MPACK_STRUCT_DESC(event_fields);
+
+BOOST_AUTO_TEST_CASE(test_struct_compile)
+{
+  BOOST_CHECK(mpack_struct_compile(&event_desc) == 0);
+  BOOST_CHECK(event_desc.compiled);
+  BOOST_CHECK(point_desc.compiled);
+  BOOST_CHECK(event_desc.required == 3);
+  BOOST_CHECK(uint8_t(event_desc.keys[0].data[0]) == (MPACK_FIXSTR | 4));
+  BOOST_CHECK(event_desc.keys[0].size == 1);
+  BOOST_CHECK(event_desc.keys[0].length == 4);
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_decode_struct)
+{
+  char buffer[128] = { 0 };
+  event_t value;
+  event_t other;
+
+  BOOST_CHECK(mpack_struct_compile(&event_desc) == 0);
+
+  memset(&value, 0, sizeof(value));
+  value.name.data = "click";
+  value.name.size = 5;
+  value.id = 1234567890123ULL;
+  value.level = -3;
+  value.score = 0.25;
+  value.enabled = true;
+  value.origin.x = 10;
+  value.origin.y = -70000;
+
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  const int size = mpack_encode_struct(&encoder, &event_desc, &value);
+  BOOST_CHECK(size > 0);
+  BOOST_CHECK(uint8_t(buffer[0]) == (MPACK_FIXMAP | 6));
+
+  mpack_decoder_t decoder;
+  mpack_decoder_init(&decoder, buffer, size);
+  memset(&other, 0, sizeof(other));
+  BOOST_CHECK(mpack_decode_struct(&decoder, &event_desc, &other) == size);
+  BOOST_CHECK(other.name.size == 5);
+  BOOST_CHECK(memcmp(other.name.data, "click", 5) == 0);
+  BOOST_CHECK(other.id == value.id);
+  BOOST_CHECK(other.level == -3);
+  BOOST_CHECK(other.score == 0.25);
+  BOOST_CHECK(other.enabled);
+  BOOST_CHECK(other.origin.x == 10);
+  BOOST_CHECK(other.origin.y == -70000);
+
+  mpack_decoder_init(&decoder, buffer, size - 1);
+  BOOST_CHECK(mpack_decode_struct(&decoder, &event_desc, &other) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  BOOST_CHECK(decoder.pos == buffer);
+}
+
+BOOST_AUTO_TEST_CASE(test_decode_struct_unordered)
+{
+  char buffer[128] = { 0 };
+  mpack_string_t key;
+  mpack_map_t map;
+  point_t value = { 0, 0 };
+
+  BOOST_CHECK(mpack_struct_compile(&point_desc) == 0);
+
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  key.size = 1;
+  map.size = 3;
+  mpack_encode_map(&encoder, map);
+  key.data = "y";
+  mpack_encode_string(&encoder, key);
+  mpack_encode_signed(&encoder, 2);
+  key.data = "z";
+  mpack_encode_string(&encoder, key);
+  map.size = 0;
+  mpack_encode_map(&encoder, map);
+  key.data = "x";
+  mpack_encode_string(&encoder, key);
+  mpack_encode_signed(&encoder, 1);
+
+  mpack_decoder_t decoder;
+  mpack_decoder_init(&decoder, buffer, encoder.pos - encoder.begin);
+  BOOST_CHECK(mpack_decode_struct(&decoder, &point_desc, &value) == (encoder.pos - encoder.begin));
+  BOOST_CHECK(value.x == 1);
+  BOOST_CHECK(value.y == 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_decode_struct_missing_required)
+{
+  char buffer[32] = { 0 };
+  mpack_string_t key;
+  mpack_map_t map;
+  point_t value = { 0, 0 };
+
+  BOOST_CHECK(mpack_struct_compile(&point_desc) == 0);
+
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  map.size = 1;
+  mpack_encode_map(&encoder, map);
+  key.data = "x";
+  key.size = 1;
+  mpack_encode_string(&encoder, key);
+  mpack_encode_signed(&encoder, 1);
+
+  mpack_decoder_t decoder;
+  mpack_decoder_init(&decoder, buffer, encoder.pos - encoder.begin);
+  BOOST_CHECK(mpack_decode_struct(&decoder, &point_desc, &value) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(decoder.pos == buffer);
+}
+
+BOOST_AUTO_TEST_CASE(test_struct_key_encoding)
+{
+  typedef struct { int32_t value; } medium_t;
+  static const mpack_field_desc_t medium_fields[] = {
+    { "a_twenty_byte_name_x", offsetof(medium_t, value), MPACK_FIELD_INT32, NULL, true },
+  };
+  mpack_struct_desc_t medium_desc = MPACK_STRUCT_DESC(medium_fields);
+  char buffer[32] = { 0 };
+  char expect[32] = { 0 };
+  medium_t value = { 7 };
+  mpack_encoder_t encoder;
+  mpack_map_t map;
+
+  // Keys of 16 to 31 bytes are str8, like strings written by the encoder.
+  BOOST_CHECK(mpack_struct_compile(&medium_desc) == 0);
+  BOOST_CHECK(uint8_t(medium_desc.keys[0].data[0]) == MPACK_STR8);
+  BOOST_CHECK(medium_desc.keys[0].size == 2);
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  BOOST_CHECK(mpack_encode_struct(&encoder, &medium_desc, &value) == 24);
+
+  mpack_encoder_init(&encoder, expect, sizeof(expect));
+  map.size = 1;
+  mpack_encode_map(&encoder, map);
+  mpack_encode_string(&encoder, mpack_string_t{ "a_twenty_byte_name_x", 20 });
+  mpack_encode_signed(&encoder, 7);
+  BOOST_CHECK(memcmp(buffer, expect, 24) == 0);
+}
@@ -0,0 +1,238 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <string>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+#include "test_helpers.h"
+
+static mpack_object_t map(size_t size)
+{
+  mpack_object_t object;
+  object.type = MPACK_MAP;
+  object.data.map.size = size;
+  return object;
+}
+
+// {"host": str8(16), "seq": uint64, "cpu": float32, "temp": float64, "delta": int16, "tag": bin8(4)}
+struct sample {
+  mpack_template_t tpl;
+  int host;
+  int seq;
+  int cpu;
+  int temp;
+  int delta;
+  int tag;
+
+  sample()
+  {
+    mpack_template_init(&tpl);
+    mpack_template_append_object(&tpl, map(6));
+    mpack_template_append_object(&tpl, key("host"));
+    host = mpack_template_slot(&tpl, MPACK_STR8, 16);
+    mpack_template_append_object(&tpl, key("seq"));
+    seq = mpack_template_slot(&tpl, MPACK_UINT64, 0);
+    mpack_template_append_object(&tpl, key("cpu"));
+    cpu = mpack_template_slot(&tpl, MPACK_FLOAT32, 0);
+    mpack_template_append_object(&tpl, key("temp"));
+    temp = mpack_template_slot(&tpl, MPACK_FLOAT64, 0);
+    mpack_template_append_object(&tpl, key("delta"));
+    delta = mpack_template_slot(&tpl, MPACK_INT16, 0);
+    mpack_template_append_object(&tpl, key("tag"));
+    tag = mpack_template_slot(&tpl, MPACK_BIN8, 4);
+  }
+
+  ~sample()
+  { mpack_template_term(&tpl); }
+};
+
+static void check_field(mpack_decoder_t *decoder, const char *name)
+{
+  mpack_string_t string;
+  BOOST_REQUIRE(mpack_decode_string(decoder, &string) > 0);
+  BOOST_CHECK(std::string(string.data, string.size) == name);
+}
+
+BOOST_AUTO_TEST_CASE(test_template_fill)
+{
+  sample s;
+  char buffer[128];
+  mpack_decoder_t decoder;
+  mpack_string_t string;
+  mpack_binary_t binary;
+  mpack_map_t m;
+  unsigned long u;
+  signed long i;
+  float f;
+  double d;
+  int n;
+
+  BOOST_CHECK(s.tpl.count == 6);
+  BOOST_CHECK(s.tpl.strings == 2);
+  BOOST_CHECK(s.tpl.size == (1 + 5 + 18 + 4 + 9 + 4 + 5 + 5 + 9 + 6 + 3 + 4 + 6));
+
+  // Every sample starts from a copy of the template, the last one is reused
+  // to check that stale values are overwritten.
+  for (unsigned long seq : { 1UL, 1UL << 40 }) {
+    BOOST_REQUIRE(mpack_template_copy(&s.tpl, buffer, sizeof(buffer)) == static_cast<int>(s.tpl.size));
+    BOOST_CHECK(mpack_template_set_string(&s.tpl, buffer, s.host, mpack_string_t{ "web-1", 5 }) == 18);
+    BOOST_CHECK(mpack_template_set_unsigned(&s.tpl, buffer, s.seq, seq) == 9);
+    BOOST_CHECK(mpack_template_set_double(&s.tpl, buffer, s.cpu, 0.5) == 5);
+    BOOST_CHECK(mpack_template_set_double(&s.tpl, buffer, s.temp, 41.25) == 9);
+    BOOST_CHECK(mpack_template_set_signed(&s.tpl, buffer, s.delta, -300) == 3);
+    BOOST_CHECK(mpack_template_set_binary(&s.tpl, buffer, s.tag, mpack_binary_t{ "\x01\x02", 2 }) == 6);
+    BOOST_REQUIRE((n = mpack_template_pack(&s.tpl, buffer)) == static_cast<int>(s.tpl.size - 11 - 2));
+
+    mpack_decoder_init(&decoder, buffer, n);
+    BOOST_CHECK(mpack_decode_map(&decoder, &m) == 1);
+    BOOST_CHECK(m.size == 6);
+    check_field(&decoder, "host");
+    BOOST_CHECK(mpack_decode_string(&decoder, &string) == 7);
+    BOOST_CHECK(std::string(string.data, string.size) == "web-1");
+    check_field(&decoder, "seq");
+    BOOST_CHECK(mpack_decode_unsigned(&decoder, &u) == 9);
+    BOOST_CHECK(u == seq);
+    check_field(&decoder, "cpu");
+    BOOST_CHECK(mpack_decode_float(&decoder, &f) == 5);
+    BOOST_CHECK(f == 0.5f);
+    check_field(&decoder, "temp");
+    BOOST_CHECK(mpack_decode_double(&decoder, &d) == 9);
+    BOOST_CHECK(d == 41.25);
+    check_field(&decoder, "delta");
+    BOOST_CHECK(mpack_decode_signed(&decoder, &i) == 3);
+    BOOST_CHECK(i == -300);
+    check_field(&decoder, "tag");
+    BOOST_CHECK(mpack_decode_binary(&decoder, &binary) == 4);
+    BOOST_CHECK(std::memcmp(binary.data, "\x01\x02", 2) == 0);
+    BOOST_CHECK(decoder.pos == decoder.end);
+    BOOST_CHECK(mpack_validate(buffer, n, nullptr) == 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_template_unset)
+{
+  sample s;
+  char buffer[128];
+  mpack_decoder_t decoder;
+  mpack_string_t string;
+  unsigned long u;
+  int n;
+
+  // Slots that are not set hold zero or an empty value.
+  BOOST_REQUIRE(mpack_template_copy(&s.tpl, buffer, sizeof(buffer)) > 0);
+  BOOST_REQUIRE((n = mpack_template_pack(&s.tpl, buffer)) == static_cast<int>(s.tpl.size - 16 - 4));
+  BOOST_CHECK(mpack_validate(buffer, n, nullptr) == 1);
+
+  mpack_decoder_init(&decoder, buffer, n);
+  const mpack_object_t host[] = { key("host") };
+  BOOST_CHECK(mpack_find(&decoder, host, 1) == 2);
+  BOOST_CHECK(mpack_decode_string(&decoder, &string) == 2);
+  BOOST_CHECK(string.size == 0);
+  BOOST_CHECK(mpack_decode_skip(&decoder) == 4);
+  BOOST_CHECK(mpack_decode_unsigned(&decoder, &u) == 9);
+  BOOST_CHECK(u == 0);
+
+  // Full strings leave nothing to move.
+  BOOST_REQUIRE(mpack_template_copy(&s.tpl, buffer, sizeof(buffer)) > 0);
+  mpack_template_set_string(&s.tpl, buffer, s.host, mpack_string_t{ "0123456789abcdef", 16 });
+  mpack_template_set_binary(&s.tpl, buffer, s.tag, mpack_binary_t{ "abcd", 4 });
+  BOOST_CHECK(mpack_template_pack(&s.tpl, buffer) == static_cast<int>(s.tpl.size));
+  BOOST_CHECK(mpack_validate(buffer, s.tpl.size, nullptr) == 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_template_numbers)
+{
+  mpack_template_t tpl;
+  char buffer[64];
+  mpack_decoder_t decoder;
+  unsigned long u;
+  signed long i;
+  int u8, i8, u32, i64;
+
+  mpack_template_init(&tpl);
+  BOOST_REQUIRE((u8 = mpack_template_slot(&tpl, MPACK_UINT8, 0)) == 0);
+  BOOST_REQUIRE((i8 = mpack_template_slot(&tpl, MPACK_INT8, 0)) == 1);
+  BOOST_REQUIRE((u32 = mpack_template_slot(&tpl, MPACK_UINT32, 0)) == 2);
+  BOOST_REQUIRE((i64 = mpack_template_slot(&tpl, MPACK_INT64, 0)) == 3);
+  BOOST_REQUIRE(mpack_template_copy(&tpl, buffer, sizeof(buffer)) == 2 + 2 + 5 + 9);
+
+  BOOST_CHECK(mpack_template_set_unsigned(&tpl, buffer, u8, 255) == 2);
+  BOOST_CHECK(mpack_template_set_unsigned(&tpl, buffer, u8, 256) == -1);
+  BOOST_CHECK(errno == ERANGE);
+  BOOST_CHECK(mpack_template_set_signed(&tpl, buffer, u8, -1) == -1);
+  BOOST_CHECK(errno == ERANGE);
+  BOOST_CHECK(mpack_template_set_signed(&tpl, buffer, i8, -128) == 2);
+  BOOST_CHECK(mpack_template_set_signed(&tpl, buffer, i8, 128) == -1);
+  BOOST_CHECK(errno == ERANGE);
+  BOOST_CHECK(mpack_template_set_unsigned(&tpl, buffer, i8, 127) == 2);
+  BOOST_CHECK(mpack_template_set_signed(&tpl, buffer, u32, 0xffffffffL) == 5);
+  BOOST_CHECK(mpack_template_set_unsigned(&tpl, buffer, i64, ULONG_MAX) == -1);
+  BOOST_CHECK(errno == ERANGE);
+  BOOST_CHECK(mpack_template_set_signed(&tpl, buffer, i64, LONG_MIN) == 9);
+  BOOST_CHECK(mpack_template_pack(&tpl, buffer) == 18);
+
+  mpack_decoder_init(&decoder, buffer, 18);
+  BOOST_CHECK(mpack_decode_unsigned(&decoder, &u) == 2);
+  BOOST_CHECK(u == 255);
+  BOOST_CHECK(mpack_decode_signed(&decoder, &i) == 2);
+  BOOST_CHECK(i == 127);
+  BOOST_CHECK(mpack_decode_unsigned(&decoder, &u) == 5);
+  BOOST_CHECK(u == 0xffffffffUL);
+  BOOST_CHECK(mpack_decode_signed(&decoder, &i) == 9);
+  BOOST_CHECK(i == LONG_MIN);
+  mpack_template_term(&tpl);
+}
+
+BOOST_AUTO_TEST_CASE(test_template_errors)
+{
+  sample s;
+  char buffer[128];
+
+  BOOST_CHECK(mpack_template_slot(&s.tpl, MPACK_STR8, 256) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(mpack_template_slot(&s.tpl, MPACK_STR16, 10) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(mpack_template_slot(&s.tpl, MPACK_NIL, 0) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(s.tpl.count == 6);
+
+  BOOST_CHECK(mpack_template_copy(&s.tpl, buffer, s.tpl.size - 1) == -1);
+  BOOST_CHECK(errno == ERANGE);
+  BOOST_REQUIRE(mpack_template_copy(&s.tpl, buffer, sizeof(buffer)) > 0);
+
+  BOOST_CHECK(mpack_template_set_unsigned(&s.tpl, buffer, 6, 0) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(mpack_template_set_double(&s.tpl, buffer, s.seq, 1.0) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(mpack_template_set_unsigned(&s.tpl, buffer, s.cpu, 1) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(mpack_template_set_binary(&s.tpl, buffer, s.host, mpack_binary_t{ "x", 1 }) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(mpack_template_set_string(&s.tpl, buffer, s.host, mpack_string_t{ "0123456789abcdefg", 17 }) == -1);
+  BOOST_CHECK(errno == ERANGE);
+  BOOST_CHECK(mpack_template_pack(&s.tpl, buffer) > 0);
+}
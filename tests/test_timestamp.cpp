@@ -0,0 +1,125 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <ctime>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+static timespec make_timespec(int64_t sec, long nsec)
+{
+  timespec value;
+  value.tv_sec = sec;
+  value.tv_nsec = nsec;
+  return value;
+}
+
+BOOST_AUTO_TEST_CASE(test_encode_decode_timestamp)
+{
+  const timespec values[] = {
+    make_timespec(0, 0),
+    make_timespec(1500000000, 0),
+    make_timespec(4294967295LL, 0),
+    make_timespec(1500000000, 123456789),
+    make_timespec(4294967296LL, 0),
+    make_timespec(17179869183LL, 999999999),
+    make_timespec(17179869184LL, 0),
+    make_timespec(-1, 500000000),
+    make_timespec(-62135596800LL, 0),
+  };
+  const int sizes[] = { 6, 6, 6, 10, 10, 10, 15, 15, 15 };
+  char buffer[256] = { 0 };
+  timespec value;
+  size_t i;
+
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+
+  for (i = 0; i != sizeof(values) / sizeof(values[0]); ++i) {
+    BOOST_CHECK(mpack_encode_timestamp(&encoder, values[i]) == sizes[i]);
+    BOOST_CHECK(mpack_sizeof_timestamp(values[i]) == size_t(sizes[i]));
+  }
+
+  BOOST_CHECK(uint8_t(buffer[0]) == MPACK_FIXEXT4);
+  BOOST_CHECK(uint8_t(buffer[0]) == 0xd6);
+  BOOST_CHECK(buffer[1] == -1);
+
+  mpack_decoder_t decoder;
+  mpack_decoder_init(&decoder, buffer, encoder.pos - encoder.begin);
+
+  for (i = 0; i != sizeof(values) / sizeof(values[0]); ++i) {
+    BOOST_CHECK(mpack_decode_timestamp(&decoder, &value) == sizes[i]);
+    BOOST_CHECK(value.tv_sec == values[i].tv_sec);
+    BOOST_CHECK(value.tv_nsec == values[i].tv_nsec);
+  }
+
+  BOOST_CHECK(mpack_decode_timestamp(&decoder, &value) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+
+  mpack_decoder_term(&decoder);
+  mpack_encoder_term(&encoder);
+}
+
+BOOST_AUTO_TEST_CASE(test_timestamp_invalid)
+{
+  char buffer[32] = { 0 };
+  timespec value;
+  mpack_extended_t ext;
+  mpack_object_t object;
+
+  mpack_encoder_t encoder;
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+
+  BOOST_CHECK(mpack_encode_timestamp(&encoder, make_timespec(0, 1000000000)) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(mpack_encode_timestamp(&encoder, make_timespec(0, -1)) == -1);
+  BOOST_CHECK(encoder.pos == encoder.begin);
+
+  // Wrong extension type, then nanoseconds out of range.
+  ext.data = "\0\0\0\1";
+  ext.size = 4;
+  ext.type = 1;
+  mpack_encode_extended(&encoder, ext);
+  ext.data = "\xff\xff\xff\xff\0\0\0\0";
+  ext.size = 8;
+  ext.type = MPACK_EXT_TIMESTAMP;
+  mpack_encode_extended(&encoder, ext);
+
+  mpack_decoder_t decoder;
+  mpack_decoder_init(&decoder, buffer, encoder.pos - encoder.begin);
+
+  BOOST_CHECK(mpack_decode_timestamp(&decoder, &value) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(decoder.pos == decoder.begin);
+
+  // Timestamps are still regular extensions to the generic decoder.
+  BOOST_CHECK(mpack_decode_object(&decoder, &object) == 6);
+  BOOST_CHECK(object.type == MPACK_EXTENDED);
+
+  BOOST_CHECK(mpack_decode_timestamp(&decoder, &value) == -1);
+  BOOST_CHECK(errno == EINVAL);
+
+  mpack_decoder_term(&decoder);
+  mpack_encoder_term(&encoder);
+}
@@ -0,0 +1,223 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+// Kernels built without io_uring, or sandboxes that block it, fail the setup
+// with one of these and the tests have nothing to check.
+static bool unsupported()
+{ return (errno == ENOSYS) || (errno == EPERM) || (errno == EACCES); }
+
+static std::string sample(size_t size)
+{
+  std::string data(size, '\0');
+
+  for (size_t i = 0; i != size; ++i) {
+    data[i] = static_cast<char>((i * 7919) >> 3);
+  }
+
+  return data;
+}
+
+static std::string read_all(int fd)
+{
+  std::string data;
+  char buffer[4096];
+  ssize_t n;
+
+  lseek(fd, 0, SEEK_SET);
+
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+    data.append(buffer, n);
+  }
+
+  return data;
+}
+
+BOOST_AUTO_TEST_CASE(test_uring_write_file)
+{
+  const std::string data = sample(100000);
+  mpack_uring_writer_t writer;
+  FILE *file = tmpfile();
+  size_t chunk = 1;
+
+  BOOST_REQUIRE(file);
+
+  if (mpack_uring_writer_init(&writer, fileno(file), 4096, 4) < 0) {
+    BOOST_REQUIRE(unsupported());
+    fclose(file);
+    return;
+  }
+
+  for (size_t i = 0; i < data.size(); i += chunk, chunk = (chunk * 3) % 5000 + 1) {
+    const size_t n = std::min(chunk, data.size() - i);
+    BOOST_REQUIRE(mpack_uring_write(&writer, data.data() + i, n) == static_cast<int>(n));
+  }
+
+  BOOST_CHECK(mpack_uring_writer_flush(&writer) == 0);
+  BOOST_CHECK(lseek(fileno(file), 0, SEEK_CUR) == static_cast<off_t>(data.size()));
+  mpack_uring_writer_term(&writer);
+
+  BOOST_CHECK(read_all(fileno(file)) == data);
+  fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(test_uring_read_file)
+{
+  const std::string data = sample(100000);
+  mpack_uring_reader_t reader;
+  std::string blocks;
+  const void *block;
+  FILE *file = tmpfile();
+  int n;
+
+  BOOST_REQUIRE(file);
+  BOOST_REQUIRE(fwrite(data.data(), 1, data.size(), file) == data.size());
+  BOOST_REQUIRE(fflush(file) == 0);
+  lseek(fileno(file), 0, SEEK_SET);
+
+  if (mpack_uring_reader_init(&reader, fileno(file), 1000, 3) < 0) {
+    BOOST_REQUIRE(unsupported());
+    fclose(file);
+    return;
+  }
+
+  while ((n = mpack_uring_reader_next(&reader, &block)) > 0) {
+    BOOST_CHECK(n == 1000);
+    blocks.append(static_cast<const char *>(block), n);
+  }
+
+  BOOST_CHECK(n == 0);
+  BOOST_CHECK(mpack_uring_reader_next(&reader, &block) == 0);
+  BOOST_CHECK(blocks == data);
+  mpack_uring_reader_term(&reader);
+
+  // The read callback spans blocks and only comes up short at the end.
+  BOOST_REQUIRE(mpack_uring_reader_init(&reader, fileno(file), 4096, 8) == 0);
+  blocks.clear();
+
+  for (size_t size = 1; ; size = size * 2 + 1) {
+    std::string chunk(size, '\0');
+
+    BOOST_REQUIRE((n = mpack_uring_read(&reader, &chunk[0], size)) >= 0);
+    blocks.append(chunk, 0, n);
+
+    if (static_cast<size_t>(n) != size) {
+      break;
+    }
+  }
+
+  BOOST_CHECK(mpack_uring_read(&reader, &n, 1) == 0);
+  BOOST_CHECK(blocks == data);
+  mpack_uring_reader_term(&reader);
+  fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(test_uring_read_pipe)
+{
+  const std::string data = sample(30000);
+  mpack_uring_reader_t reader;
+  std::string blocks;
+  const void *block;
+  int fds[2];
+  int n;
+
+  BOOST_REQUIRE(pipe(fds) == 0);
+  BOOST_REQUIRE(write(fds[1], data.data(), data.size()) == static_cast<ssize_t>(data.size()));
+  close(fds[1]);
+
+  if (mpack_uring_reader_init(&reader, fds[0], 4096, 4) < 0) {
+    BOOST_REQUIRE(unsupported());
+    close(fds[0]);
+    return;
+  }
+
+  BOOST_CHECK(!reader.seekable);
+
+  while ((n = mpack_uring_reader_next(&reader, &block)) > 0) {
+    blocks.append(static_cast<const char *>(block), n);
+  }
+
+  BOOST_CHECK(n == 0);
+  BOOST_CHECK(blocks == data);
+  mpack_uring_reader_term(&reader);
+  close(fds[0]);
+}
+
+BOOST_AUTO_TEST_CASE(test_uring_frames)
+{
+  mpack_uring_writer_t writer;
+  mpack_uring_reader_t reader;
+  mpack_frame_writer_t frames;
+  mpack_frame_reader_t input;
+  FILE *file = tmpfile();
+  long sum = 0;
+
+  BOOST_REQUIRE(file);
+
+  if (mpack_uring_writer_init(&writer, fileno(file), 8192, 4) < 0) {
+    BOOST_REQUIRE(unsupported());
+    fclose(file);
+    return;
+  }
+
+  BOOST_REQUIRE(mpack_frame_writer_init(&frames, 1024, mpack_uring_write, &writer) == 0);
+
+  for (long i = 0; i != 10000; ++i) {
+    mpack_encode_signed(&frames.encoder, i);
+
+    if (mpack_frame_writer_commit(&frames) < 0) {
+      BOOST_REQUIRE(errno == EAGAIN);
+      mpack_encode_signed(&frames.encoder, i);
+      BOOST_REQUIRE(mpack_frame_writer_commit(&frames) == 0);
+    }
+  }
+
+  BOOST_CHECK(mpack_frame_writer_flush(&frames) > 0);
+  mpack_frame_writer_term(&frames);
+  BOOST_CHECK(mpack_uring_writer_flush(&writer) == 0);
+  mpack_uring_writer_term(&writer);
+
+  lseek(fileno(file), 0, SEEK_SET);
+  BOOST_REQUIRE(mpack_uring_reader_init(&reader, fileno(file), 4096, 4) == 0);
+  BOOST_REQUIRE(mpack_frame_reader_init(&input, 1024, 65536, mpack_uring_read, &reader) == 0);
+
+  while (mpack_frame_reader_next(&input) > 0) {
+    signed long value;
+
+    while (mpack_decode_signed(&input.decoder, &value) > 0) {
+      sum += value;
+    }
+  }
+
+  BOOST_CHECK(sum == 9999L * 10000L / 2);
+  mpack_frame_reader_term(&input);
+  mpack_uring_reader_term(&reader);
+  fclose(file);
+}
@@ -0,0 +1,304 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+static mpack_limits_t make_limits(size_t count, size_t depth, size_t length)
+{
+  mpack_limits_t limits;
+  limits.count = count;
+  limits.depth = depth;
+  limits.length = length;
+  return limits;
+}
+
+static int validate(const std::string &data, size_t count = 0, size_t depth = 0, size_t length = 0)
+{
+  const mpack_limits_t limits = make_limits(count, depth, length);
+  errno = 0;
+  return mpack_validate(data.data(), data.size(), &limits);
+}
+
+/* An array holding one value of every type, integers cover each width and
+   sign. */
+static std::string sample()
+{
+  static const unsigned char data[] = {
+    0xdc, 0x00, 0x11, 0x01, 0xff, 0xc0,
+    0x89,
+    0xa1, 'a', 0xc2,
+    0xa1, 'b', 0xd0, 0x80,
+    0xa1, 'c', 0xd1, 0x80, 0x00,
+    0xa1, 'd', 0xd2, 0x80, 0x00, 0x00, 0x00,
+    0xa1, 'e', 0xd3, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xa1, 'f', 0xcc, 0xff,
+    0xa1, 'g', 0xcd, 0xff, 0xff,
+    0xa1, 'h', 0xce, 0xff, 0xff, 0xff, 0xff,
+    0xa1, 'i', 0xcf, 0x7f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xca, 0x3f, 0xc0, 0x00, 0x00,
+    0xcb, 0x3f, 0xf8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xd9, 0x03, 'x', 'y', 'z',
+    0xda, 0x00, 0x01, '!',
+    0xc4, 0x02, 0x01, 0x02,
+    0xc5, 0x00, 0x00,
+    0xd4, 0x01, 0x2a,
+    0xd8, 0x02, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    0xc7, 0x01, 0x03, 0x2a,
+    0xc9, 0x00, 0x00, 0x00, 0x00, 0x04,
+    0xdc, 0x00, 0x01, 0xde, 0x00, 0x00,
+    0xdd, 0x00, 0x00, 0x00, 0x01, 0xdf, 0x00, 0x00, 0x00, 0x01, 0x90, 0x80,
+    0xc3,
+  };
+  return std::string(reinterpret_cast<const char *>(data), sizeof(data));
+}
+
+static std::string nested(size_t depth)
+{
+  std::string data(depth + 1, '\x91');
+  data[depth] = '\x01';
+  return data;
+}
+
+BOOST_AUTO_TEST_CASE(test_validate_count)
+{
+  const std::string data = sample() + "\x01" + nested(3);
+
+  BOOST_CHECK(mpack_validate(data.data(), data.size(), nullptr) == 3);
+  BOOST_CHECK(validate(data, 3) == 3);
+  BOOST_CHECK(validate(data, 2) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(validate(data, 4) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  BOOST_CHECK(validate(std::string()) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_validate_truncated)
+{
+  const std::string data = sample();
+
+  for (size_t size = 1; size != data.size(); ++size) {
+    BOOST_CHECK(validate(data.substr(0, size)) == -1);
+    BOOST_CHECK(errno == EAGAIN);
+  }
+
+  BOOST_CHECK(validate(data) == 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_validate_malformed)
+{
+  BOOST_CHECK(validate("\xc1") == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(validate(std::string("\x92\x01\xc1", 3)) == -1);
+  BOOST_CHECK(errno == EINVAL);
+}
+
+BOOST_AUTO_TEST_CASE(test_validate_depth)
+{
+  BOOST_CHECK(validate(nested(3), 0, 3) == 1);
+  BOOST_CHECK(validate(nested(3), 0, 2) == -1);
+  BOOST_CHECK(errno == ERANGE);
+  BOOST_CHECK(validate("\x91\x90", 0, 2) == 1);
+  BOOST_CHECK(validate("\x91\x90", 0, 1) == -1);
+  BOOST_CHECK(errno == ERANGE);
+  BOOST_CHECK(validate(nested(1000)) == 1);
+  BOOST_CHECK(validate(nested(1000).substr(0, 1000)) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+}
+
+BOOST_AUTO_TEST_CASE(test_validate_length)
+{
+  std::string string(11, 'x');
+  const std::string map("\x83\x01\x01\x02\x02\x03\x03", 7);
+
+  string[0] = '\xaa';
+  BOOST_CHECK(validate(string, 0, 0, 10) == 1);
+  BOOST_CHECK(validate(string, 0, 0, 9) == -1);
+  BOOST_CHECK(errno == ERANGE);
+  BOOST_CHECK(validate(map, 0, 0, 3) == 1);
+  BOOST_CHECK(validate(map, 0, 0, 2) == -1);
+  BOOST_CHECK(errno == ERANGE);
+
+  /* The length is checked before the payload is known to be complete. */
+  BOOST_CHECK(validate("\xdb\xff\xff\xff\xff", 0, 0, 1024) == -1);
+  BOOST_CHECK(errno == ERANGE);
+}
+
+BOOST_AUTO_TEST_CASE(test_validate_trusted_decode)
+{
+  const std::string data = sample() + "\x01";
+  mpack_decoder_t checked;
+  mpack_decoder_t trusted;
+  mpack_object_t a;
+  mpack_object_t b;
+  int n;
+
+  mpack_decoder_init(&checked, data.data(), data.size());
+  mpack_decoder_init(&trusted, data.data(), data.size());
+  BOOST_CHECK(mpack_decoder_trust(&trusted, nullptr) == 2);
+  BOOST_CHECK(trusted.flags & MPACK_DECODE_TRUSTED);
+
+  while (checked.pos != checked.end) {
+    BOOST_REQUIRE((n = mpack_decode_object(&checked, &a)) > 0);
+    BOOST_REQUIRE(mpack_decode_object(&trusted, &b) == n);
+    BOOST_CHECK(checked.pos == trusted.pos);
+    BOOST_CHECK(mpack_object_equal(&a, &b));
+  }
+
+  BOOST_CHECK(mpack_decode_object(&trusted, &b) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+}
+
+BOOST_AUTO_TEST_CASE(test_validate_trusted_skip)
+{
+  const std::string data = sample() + nested(100);
+  mpack_decoder_t decoder;
+
+  mpack_decoder_init(&decoder, data.data(), data.size());
+  BOOST_CHECK(mpack_decoder_trust(&decoder, nullptr) == 2);
+  BOOST_CHECK(mpack_decode_skip(&decoder) == static_cast<int>(sample().size()));
+  BOOST_CHECK(mpack_decode_skip(&decoder) == 101);
+  BOOST_CHECK(mpack_decode_skip(&decoder) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+}
+
+BOOST_AUTO_TEST_CASE(test_validate_trusted_range)
+{
+  const std::string data("\xcf\xff\xff\xff\xff\xff\xff\xff\xff", 9);
+  mpack_decoder_t decoder;
+  mpack_object_t value;
+
+  mpack_decoder_init(&decoder, data.data(), data.size());
+  BOOST_CHECK(mpack_decoder_trust(&decoder, nullptr) == 1);
+  BOOST_CHECK(mpack_decode_object(&decoder, &value) == -1);
+  BOOST_CHECK(errno == ERANGE);
+  BOOST_CHECK(decoder.pos == decoder.begin);
+}
+
+BOOST_AUTO_TEST_CASE(test_validate_trusted_typed)
+{
+  char buffer[64];
+  mpack_encoder_t encoder;
+  mpack_decoder_t checked;
+  mpack_decoder_t trusted;
+  signed long s[2];
+  unsigned long u[2];
+  float f[2];
+  double d[2];
+  mpack_string_t string[2];
+  mpack_binary_t binary[2];
+  mpack_array_t array[2];
+  mpack_map_t map[2];
+  mpack_extended_t extended[2];
+
+  mpack_encoder_init(&encoder, buffer, sizeof(buffer));
+  mpack_encode_signed(&encoder, -300);
+  mpack_encode_unsigned(&encoder, 18446744073709551615UL);
+  mpack_encode_float(&encoder, 1.5f);
+  mpack_encode_double(&encoder, 0.1);
+  mpack_encode_array(&encoder, mpack_array_t{ 2 });
+  mpack_encode_string(&encoder, mpack_string_t{ "hello", 5 });
+  mpack_encode_binary(&encoder, mpack_binary_t{ "\x01\x02", 2 });
+  mpack_encode_map(&encoder, mpack_map_t{ 1 });
+  mpack_encode_extended(&encoder, mpack_extended_t{ "\x2a", 1, 3 });
+  mpack_encode_signed(&encoder, 7);
+  BOOST_REQUIRE(encoder.pos <= encoder.end);
+
+  mpack_decoder_init(&checked, encoder.begin, encoder.pos - encoder.begin);
+  mpack_decoder_init(&trusted, encoder.begin, encoder.pos - encoder.begin);
+  BOOST_REQUIRE(mpack_decoder_trust(&trusted, nullptr) == 6);
+
+  // A value of the wrong type is rejected without moving the decoder.
+  BOOST_CHECK(mpack_decode_string(&trusted, &string[1]) == -1);
+  BOOST_CHECK(errno == EINVAL);
+  BOOST_CHECK(trusted.pos == trusted.begin);
+
+  BOOST_CHECK(mpack_decode_unsigned(&trusted, &u[1]) == -1);
+  BOOST_CHECK(errno == ERANGE);
+  BOOST_CHECK(trusted.pos == trusted.begin);
+
+  BOOST_CHECK(mpack_decode_signed(&checked, &s[0]) == mpack_decode_signed(&trusted, &s[1]));
+  BOOST_CHECK(mpack_decode_unsigned(&checked, &u[0]) == mpack_decode_unsigned(&trusted, &u[1]));
+  BOOST_CHECK(mpack_decode_float(&checked, &f[0]) == mpack_decode_float(&trusted, &f[1]));
+  BOOST_CHECK(mpack_decode_double(&checked, &d[0]) == mpack_decode_double(&trusted, &d[1]));
+  BOOST_CHECK(mpack_decode_array(&checked, &array[0]) == mpack_decode_array(&trusted, &array[1]));
+  BOOST_CHECK(mpack_decode_string(&checked, &string[0]) == mpack_decode_string(&trusted, &string[1]));
+  BOOST_CHECK(mpack_decode_binary(&checked, &binary[0]) == mpack_decode_binary(&trusted, &binary[1]));
+  BOOST_CHECK(mpack_decode_map(&checked, &map[0]) == mpack_decode_map(&trusted, &map[1]));
+  BOOST_CHECK(mpack_decode_extended(&checked, &extended[0]) == mpack_decode_extended(&trusted, &extended[1]));
+  BOOST_CHECK(mpack_decode_signed(&checked, &s[0]) == mpack_decode_signed(&trusted, &s[1]));
+  BOOST_CHECK(checked.pos == trusted.pos);
+  BOOST_CHECK(trusted.pos == trusted.end);
+
+  BOOST_CHECK(s[1] == 7);
+  BOOST_CHECK(u[1] == 18446744073709551615UL);
+  BOOST_CHECK(f[1] == 1.5f);
+  BOOST_CHECK(d[0] == d[1]);
+  BOOST_CHECK(string[0].data == string[1].data);
+  BOOST_CHECK(string[1].size == 5);
+  BOOST_CHECK(binary[0].data == binary[1].data);
+  BOOST_CHECK(binary[1].size == 2);
+  BOOST_CHECK(array[1].size == 2);
+  BOOST_CHECK(map[1].size == 1);
+  BOOST_CHECK(extended[0].data == extended[1].data);
+  BOOST_CHECK(extended[1].size == 1);
+  BOOST_CHECK(extended[1].type == 3);
+}
+
+BOOST_AUTO_TEST_CASE(test_validate_trusted_cxx)
+{
+  const std::string data("\x93\xa1\x61\x01\xcd\x01\x2c", 7);
+  mpack::decoder decoder(data.data(), data.size());
+  mpack::array header;
+  std::string name;
+  int a;
+  unsigned short b;
+
+  BOOST_REQUIRE(mpack_decoder_trust(&decoder, nullptr) == 1);
+  BOOST_CHECK(decoder.decode(header) == 1);
+  BOOST_CHECK(decoder.decode(name) == 2);
+  BOOST_CHECK(decoder.decode(a) == 1);
+  BOOST_CHECK(decoder.decode(b) == 3);
+  BOOST_CHECK(header.size == 3);
+  BOOST_CHECK(name == "a");
+  BOOST_CHECK(a == 1);
+  BOOST_CHECK(b == 300);
+  BOOST_CHECK(decoder.pos == decoder.end);
+}
+
+BOOST_AUTO_TEST_CASE(test_validate_untrusted)
+{
+  const std::string data("\x92\x01", 2);
+  const mpack_limits_t limits = make_limits(1, 0, 0);
+  mpack_decoder_t decoder;
+
+  mpack_decoder_init(&decoder, data.data(), data.size());
+  BOOST_CHECK(decoder.flags == 0);
+  BOOST_CHECK(mpack_decoder_trust(&decoder, &limits) == -1);
+  BOOST_CHECK(errno == EAGAIN);
+  BOOST_CHECK(!(decoder.flags & MPACK_DECODE_TRUSTED));
+}
@@ -0,0 +1,248 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <boost/test/unit_test.hpp>
+#include <mpack.h>
+
+/* Records the events of a walk as a compact text trace, the context is the
+   trace. Arrays of three elements and map entries with a "skip" key are
+   skipped. */
+static int on_scalar(void *context, const mpack_object_t *value)
+{
+  std::string &trace = *static_cast<std::string *>(context);
+
+  switch (value->type) {
+  case MPACK_NONE:
+    trace += "nil ";
+    break;
+
+  case MPACK_BOOLEAN:
+    trace += value->data.boolean ? "true " : "false ";
+    break;
+
+  case MPACK_INTEGER:
+    trace += std::to_string(value->data.integer) + " ";
+    break;
+
+  default:
+    trace += "number ";
+    break;
+  }
+
+  return 0;
+}
+
+static int on_string(void *context, mpack_string_t value)
+{
+  std::string &trace = *static_cast<std::string *>(context);
+  trace += '"';
+  trace.append(value.data, value.size);
+  trace += "\" ";
+  return 0;
+}
+
+static int on_binary(void *context, mpack_binary_t value)
+{
+  *static_cast<std::string *>(context) += "bin" + std::to_string(value.size) + " ";
+  return 0;
+}
+
+static int on_extended(void *context, mpack_extended_t value)
+{
+  *static_cast<std::string *>(context) += "ext" + std::to_string(value.type) + " ";
+  return 0;
+}
+
+static int on_array_begin(void *context, size_t size)
+{
+  *static_cast<std::string *>(context) += "[ ";
+  return (size == 3) ? MPACK_WALK_SKIP : 0;
+}
+
+static int on_array_end(void *context)
+{
+  *static_cast<std::string *>(context) += "] ";
+  return 0;
+}
+
+static int on_map_begin(void *context, size_t)
+{
+  *static_cast<std::string *>(context) += "{ ";
+  return 0;
+}
+
+static int on_map_key(void *context, const mpack_object_t *key)
+{
+  std::string &trace = *static_cast<std::string *>(context);
+
+  if (key->type != MPACK_STRING) {
+    trace += "key ";
+    return 0;
+  }
+
+  const std::string name(key->data.string.data, key->data.string.size);
+  trace += name + ": ";
+  return (name == "skip") ? MPACK_WALK_SKIP : 0;
+}
+
+static int on_map_end(void *context)
+{
+  *static_cast<std::string *>(context) += "} ";
+  return 0;
+}
+
+static int on_fail(void *, const mpack_object_t *)
+{
+  errno = ECANCELED;
+  return -1;
+}
+
+static mpack_visitor_t make_visitor(size_t depth = 0)
+{
+  mpack_visitor_t visitor;
+  visitor.scalar = on_scalar;
+  visitor.string = on_string;
+  visitor.binary = on_binary;
+  visitor.extended = on_extended;
+  visitor.array_begin = on_array_begin;
+  visitor.array_end = on_array_end;
+  visitor.map_begin = on_map_begin;
+  visitor.map_key = on_map_key;
+  visitor.map_end = on_map_end;
+  visitor.depth = depth;
+  return visitor;
+}
+
+static std::string walk(const std::string &data, const mpack_visitor_t &visitor)
+{
+  std::string trace;
+  mpack_decoder_t decoder;
+
+  mpack_decoder_init(&decoder, data.data(), data.size());
+  BOOST_CHECK(mpack_walk(&decoder, &visitor, &trace) == static_cast<int>(data.size()));
+  BOOST_CHECK(decoder.pos == decoder.end);
+  return trace;
+}
+
+static std::string walk(const std::string &data)
+{ return walk(data, make_visitor()); }
+
+static void check_error(const std::string &data, const mpack_visitor_t &visitor, int error)
+{
+  std::string trace;
+  mpack_decoder_t decoder;
+
+  mpack_decoder_init(&decoder, data.data(), data.size());
+  errno = 0;
+  BOOST_CHECK(mpack_walk(&decoder, &visitor, &trace) == -1);
+  BOOST_CHECK(errno == error);
+  BOOST_CHECK(decoder.pos == decoder.begin);
+}
+
+BOOST_AUTO_TEST_CASE(test_walk_scalars)
+{
+  BOOST_CHECK(walk("\xc0") == "nil ");
+  BOOST_CHECK(walk("\x2a") == "42 ");
+  BOOST_CHECK(walk("\xa2hi") == "\"hi\" ");
+  BOOST_CHECK(walk(std::string("\xc4\x02\x00\x00", 4)) == "bin2 ");
+  BOOST_CHECK(walk(std::string("\xd4\x05\x00", 3)) == "ext5 ");
+}
+
+BOOST_AUTO_TEST_CASE(test_walk_containers)
+{
+  BOOST_CHECK(walk("\x90") == "[ ] ");
+  BOOST_CHECK(walk("\x80") == "{ } ");
+  BOOST_CHECK(walk("\x92\x01\x91\x02") == "[ 1 [ 2 ] ] ");
+  BOOST_CHECK(walk("\x82\xa1" "a\x01\xa1" "b\x91\xc0") == "{ a: 1 b: [ nil ] } ");
+  BOOST_CHECK(walk("\x81\x07\x08") == "{ key 8 } ");
+}
+
+BOOST_AUTO_TEST_CASE(test_walk_container_keys)
+{
+  BOOST_CHECK(walk("\x81\x90\x01") == "{ key [ ] 1 } ");
+  BOOST_CHECK(walk("\x82\x92\x01\x02\xa1" "a\x81\xa1" "b\x03\x04") == "{ key [ 1 2 ] \"a\" key { b: 3 } 4 } ");
+
+  /* The key and value of the entry are skipped together. */
+  BOOST_CHECK(walk("\x82\xa4skip\x01\x93\x01\x02\x03\x05") == "{ skip: key [ 5 } ");
+  BOOST_CHECK(walk("\x81\x91\x91\x01\x02", make_visitor(3)) == "{ key [ [ 1 ] ] 2 } ");
+  check_error("\x81\x91\x91\x01\x02", make_visitor(2), ERANGE);
+}
+
+BOOST_AUTO_TEST_CASE(test_walk_skip)
+{
+  /* Arrays of three elements are skipped by array_begin. */
+  BOOST_CHECK(walk("\x92\x93\x01\x91\x02\x80\x03") == "[ [ 3 ] ");
+  BOOST_CHECK(walk("\x93\x01\x02\x03") == "[ ");
+
+  /* Map entries with a "skip" key are skipped by map_key. */
+  BOOST_CHECK(walk("\x83\xa1" "a\x01\xa4skip\x92\x81\x01\x02\x03\xa1" "c\x02") == "{ a: 1 skip: c: 2 } ");
+}
+
+BOOST_AUTO_TEST_CASE(test_walk_null_callbacks)
+{
+  mpack_visitor_t visitor;
+  std::memset(&visitor, 0, sizeof(visitor));
+  BOOST_CHECK(walk("\x82\xa1" "a\x93\x01\x02\x03\xa1" "b\xc4\x01" "x", visitor) == "");
+}
+
+BOOST_AUTO_TEST_CASE(test_walk_deep)
+{
+  const size_t depth = 100000;
+  std::string data(depth + 1, '\x91');
+  data[depth] = '\x01';
+
+  const std::string trace = walk(data);
+  BOOST_CHECK(trace.size() == (4 * depth + 2));
+  BOOST_CHECK(trace.compare(2 * depth, 2, "1 ") == 0);
+
+  check_error(data, make_visitor(depth - 1), ERANGE);
+  BOOST_CHECK(walk(data, make_visitor(depth)) == trace);
+}
+
+BOOST_AUTO_TEST_CASE(test_walk_errors)
+{
+  mpack_visitor_t visitor = make_visitor();
+  check_error("\x92\x01", visitor, EAGAIN);
+  check_error("\x92\x01\xc1", visitor, EINVAL);
+  check_error("\x81\x91\xc1\x01", visitor, EINVAL);
+
+  visitor.scalar = on_fail;
+  check_error("\x92\xa1x\x01", visitor, ECANCELED);
+}
+
+BOOST_AUTO_TEST_CASE(test_walk_trusted)
+{
+  const std::string data("\x82\xa1" "a\x92\x01\x02\xa4skip\x91\xa3xyz", 16);
+  mpack_visitor_t visitor = make_visitor();
+  mpack_decoder_t decoder;
+  std::string trace;
+
+  mpack_decoder_init(&decoder, data.data(), data.size());
+  BOOST_CHECK(mpack_decoder_trust(&decoder, nullptr) == 1);
+  BOOST_CHECK(mpack_walk(&decoder, &visitor, &trace) == static_cast<int>(data.size()));
+  BOOST_CHECK(trace == "{ a: [ 1 2 ] skip: } ");
+}
@@ -0,0 +1,315 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Compares io_uring with plain read and write loops on a file of records.
+
+     mpack-bench-io [-n records] [-s size] [-b block_size] [-d depth] file
+
+   The file is written with write() and with mpack_uring_write, then read
+   back with read() and with mpack_uring_reader_next, each record being
+   skipped by the decoder. The page cache of the file is dropped before each
+   read pass so the reads go to the device. */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <mpack.h>
+
+enum {
+  RECORD_OVERHEAD = 64,
+};
+
+typedef struct options {
+  long records;
+  size_t size;
+  size_t block_size;
+  unsigned int depth;
+} options_t;
+
+/* Bytes of a record cut by the end of a block are carried over in front of
+   the next block. */
+typedef struct scan {
+  char *buffer;
+  size_t capacity;
+  size_t size;
+  long records;
+} scan_t;
+
+static double now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void fail(const char *what)
+{
+  perror(what);
+  exit(1);
+}
+
+static void report(const char *name, double seconds, off_t bytes, long records)
+{ printf("%-14s %8.3f s %10.1f MB/s %12ld records\n", name, seconds, bytes / seconds / 1e6, records); }
+
+static size_t encode_record(char *buffer, size_t capacity, long id, const char *payload, size_t size)
+{
+  mpack_encoder_t encoder;
+  mpack_string_t value;
+
+  mpack_encoder_init(&encoder, buffer, capacity);
+  mpack_encode_map(&encoder, (mpack_map_t){ 3 });
+  mpack_encode_string(&encoder, (mpack_string_t){ "id", 2 });
+  mpack_encode_signed(&encoder, id);
+  mpack_encode_string(&encoder, (mpack_string_t){ "time", 4 });
+  mpack_encode_double(&encoder, id * 0.001);
+  mpack_encode_string(&encoder, (mpack_string_t){ "payload", 7 });
+  value.data = payload;
+  value.size = size;
+  mpack_encode_string(&encoder, value);
+  return encoder.pos - encoder.begin;
+}
+
+static void scan_block(scan_t *scan, const void *data, size_t size)
+{
+  mpack_decoder_t decoder;
+
+  if (scan->size + size > scan->capacity) {
+    scan->capacity = 2 * (scan->size + size);
+
+    if (!(scan->buffer = realloc(scan->buffer, scan->capacity))) {
+      fail("mpack-bench-io");
+    }
+  }
+
+  memcpy(scan->buffer + scan->size, data, size);
+  mpack_decoder_init(&decoder, scan->buffer, scan->size + size);
+
+  while (mpack_decode_skip(&decoder) > 0) {
+    ++scan->records;
+  }
+
+  scan->size = decoder.end - decoder.pos;
+  memmove(scan->buffer, decoder.pos, scan->size);
+}
+
+static void drop_cache(int fd)
+{
+  if ((fsync(fd) < 0) || (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) != 0)) {
+    fail("mpack-bench-io: drop cache");
+  }
+}
+
+static void write_plain(int fd, const options_t *options, const char *payload, char *record)
+{
+  char *block = malloc(options->block_size);
+  size_t fill = 0;
+  size_t n;
+  long i;
+
+  if (!block) {
+    fail("mpack-bench-io");
+  }
+
+  for (i = 0; i != options->records; ++i) {
+    n = encode_record(record, RECORD_OVERHEAD + options->size, i, payload, options->size);
+
+    if (fill + n > options->block_size) {
+      if (write(fd, block, fill) != (ssize_t)fill) {
+        fail("mpack-bench-io: write");
+      }
+      fill = 0;
+    }
+
+    memcpy(block + fill, record, n);
+    fill += n;
+  }
+
+  if (write(fd, block, fill) != (ssize_t)fill) {
+    fail("mpack-bench-io: write");
+  }
+
+  free(block);
+}
+
+static void write_uring(int fd, const options_t *options, const char *payload, char *record)
+{
+  mpack_uring_writer_t writer;
+  size_t n;
+  long i;
+
+  if (mpack_uring_writer_init(&writer, fd, options->block_size, options->depth) < 0) {
+    fail("mpack-bench-io: io_uring");
+  }
+
+  for (i = 0; i != options->records; ++i) {
+    n = encode_record(record, RECORD_OVERHEAD + options->size, i, payload, options->size);
+
+    if (mpack_uring_write(&writer, record, n) < 0) {
+      fail("mpack-bench-io: io_uring write");
+    }
+  }
+
+  if (mpack_uring_writer_flush(&writer) < 0) {
+    fail("mpack-bench-io: io_uring write");
+  }
+
+  mpack_uring_writer_term(&writer);
+}
+
+static long read_plain(int fd, const options_t *options)
+{
+  char *block = malloc(options->block_size);
+  scan_t scan = { NULL, 0, 0, 0 };
+  ssize_t n;
+
+  if (!block) {
+    fail("mpack-bench-io");
+  }
+
+  while ((n = read(fd, block, options->block_size)) > 0) {
+    scan_block(&scan, block, n);
+  }
+
+  if (n < 0) {
+    fail("mpack-bench-io: read");
+  }
+
+  free(scan.buffer);
+  free(block);
+  return scan.records;
+}
+
+static long read_uring(int fd, const options_t *options)
+{
+  mpack_uring_reader_t reader;
+  scan_t scan = { NULL, 0, 0, 0 };
+  const void *block;
+  int n;
+
+  if (mpack_uring_reader_init(&reader, fd, options->block_size, options->depth) < 0) {
+    fail("mpack-bench-io: io_uring");
+  }
+
+  while ((n = mpack_uring_reader_next(&reader, &block)) > 0) {
+    scan_block(&scan, block, n);
+  }
+
+  if (n < 0) {
+    fail("mpack-bench-io: io_uring read");
+  }
+
+  mpack_uring_reader_term(&reader);
+  free(scan.buffer);
+  return scan.records;
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: mpack-bench-io [-n records] [-s size] [-b block_size] [-d depth] file\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  options_t options = { 1000000, 200, 1 << 20, 8 };
+  char *payload;
+  char *record;
+  double t;
+  off_t size;
+  long records;
+  int fd;
+  int c;
+
+  while ((c = getopt(argc, argv, "n:s:b:d:")) != -1) {
+    switch (c) {
+    case 'n':
+      options.records = atol(optarg);
+      break;
+
+    case 's':
+      options.size = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'b':
+      options.block_size = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'd':
+      options.depth = strtoul(optarg, NULL, 10);
+      break;
+
+    default:
+      usage();
+    }
+  }
+
+  if ((optind + 1 != argc) || (options.records <= 0) || (options.size > 65536) || (options.block_size < RECORD_OVERHEAD + options.size)) {
+    usage();
+  }
+
+  if (!(payload = malloc(options.size + 1)) || !(record = malloc(RECORD_OVERHEAD + options.size))) {
+    fail("mpack-bench-io");
+  }
+
+  memset(payload, 'x', options.size);
+
+  if ((fd = open(argv[optind], O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+    fail(argv[optind]);
+  }
+
+  t = now();
+  write_plain(fd, &options, payload, record);
+  drop_cache(fd);
+  size = lseek(fd, 0, SEEK_END);
+  report("write()", now() - t, size, options.records);
+
+  if ((ftruncate(fd, 0) < 0) || (lseek(fd, 0, SEEK_SET) < 0)) {
+    fail(argv[optind]);
+  }
+
+  t = now();
+  write_uring(fd, &options, payload, record);
+  drop_cache(fd);
+  report("io_uring write", now() - t, size, options.records);
+
+  lseek(fd, 0, SEEK_SET);
+  t = now();
+  records = read_plain(fd, &options);
+  report("read()", now() - t, size, records);
+
+  drop_cache(fd);
+  lseek(fd, 0, SEEK_SET);
+  t = now();
+  records = read_uring(fd, &options);
+  report("io_uring read", now() - t, size, records);
+
+  close(fd);
+  free(record);
+  free(payload);
+  return 0;
+}
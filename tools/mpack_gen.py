@@ -0,0 +1,414 @@
+#!/usr/bin/env python
+# encoding: utf-8
+#
+# The MIT License (MIT)
+#
+# Copyright (c) 2014 Achille Roussel
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+#
+# Generates a C header with struct definitions and specialized encode/decode
+# functions from a JSON schema:
+#
+#   {
+#     "structs": [
+#       { "name": "point", "fields": [
+#         { "name": "x", "type": "double", "required": true },
+#         { "name": "label", "type": "string" }
+#       ] }
+#     ]
+#   }
+#
+# Field types are bool, int8 to int64, uint8 to uint64, float, double, string,
+# binary, timestamp or the name of a struct declared earlier in the schema.
+# The generated code is valid C99 and C++.
+import argparse
+import json
+import re
+import sys
+
+SCALARS = {
+    'bool':      'bool',
+    'int8':      'int8_t',
+    'int16':     'int16_t',
+    'int32':     'int32_t',
+    'int64':     'int64_t',
+    'uint8':     'uint8_t',
+    'uint16':    'uint16_t',
+    'uint32':    'uint32_t',
+    'uint64':    'uint64_t',
+    'float':     'float',
+    'double':    'double',
+    'string':    'mpack_string_t',
+    'binary':    'mpack_binary_t',
+    'timestamp': 'struct timespec',
+}
+
+SIGNED_LIMITS = {
+    'int8':  ('INT8_MIN', 'INT8_MAX'),
+    'int16': ('INT16_MIN', 'INT16_MAX'),
+    'int32': ('INT32_MIN', 'INT32_MAX'),
+    'int64': ('INT64_MIN', 'INT64_MAX'),
+}
+
+UNSIGNED_LIMITS = {
+    'uint8':  'UINT8_MAX',
+    'uint16': 'UINT16_MAX',
+    'uint32': 'UINT32_MAX',
+    'uint64': 'UINT64_MAX',
+}
+
+HELPERS = r'''
+#ifndef MPACK_GEN_HELPERS
+#define MPACK_GEN_HELPERS
+
+static inline bool mpack_gen_match(mpack_decoder_t *decoder, const char *key, size_t size)
+{
+  if (((size_t)(decoder->end - decoder->pos) >= size) && (memcmp(decoder->pos, key, size) == 0)) {
+    decoder->pos += size;
+    return true;
+  }
+  return false;
+}
+
+static inline int mpack_gen_key(mpack_encoder_t *encoder, const char *key, size_t size, size_t header)
+{
+  mpack_string_t name;
+
+  if (encoder->dict) {
+    name.data = key + header;
+    name.size = size - header;
+    return mpack_encode_key(encoder, name);
+  }
+
+  mpack_encoder_write_bytes(encoder, key, size);
+  return (int)size;
+}
+
+static inline int mpack_gen_decode_signed(mpack_decoder_t *decoder, long *value, int64_t min, int64_t max)
+{
+  int size;
+
+  if ((decoder->pos != decoder->end) && ((int8_t)*decoder->pos >= -32)) {
+    *value = (int8_t)*decoder->pos++;
+    return 1;
+  }
+
+  if (((size = mpack_decode_signed(decoder, value)) > 0) && ((*value < min) || (*value > max))) {
+    decoder->pos -= size;
+    errno = ERANGE;
+    return -1;
+  }
+
+  return size;
+}
+
+static inline int mpack_gen_decode_unsigned(mpack_decoder_t *decoder, unsigned long *value, uint64_t max)
+{
+  int size;
+
+  if ((decoder->pos != decoder->end) && ((uint8_t)*decoder->pos <= 0x7f)) {
+    *value = (uint8_t)*decoder->pos++;
+    return 1;
+  }
+
+  if (((size = mpack_decode_unsigned(decoder, value)) > 0) && (*value > max)) {
+    decoder->pos -= size;
+    errno = ERANGE;
+    return -1;
+  }
+
+  return size;
+}
+
+static inline int mpack_gen_decode_float(mpack_decoder_t *decoder, float *value)
+{
+  union { uint32_t u; float f; } var;
+
+  if (((decoder->end - decoder->pos) >= 5) && ((uint8_t)*decoder->pos == MPACK_FLOAT32)) {
+    ++decoder->pos;
+    mpack_decoder_read_uint32(decoder, &var.u);
+    *value = var.f;
+    return 5;
+  }
+
+  return mpack_decode_float(decoder, value);
+}
+
+static inline int mpack_gen_decode_double(mpack_decoder_t *decoder, double *value)
+{
+  union { uint64_t u; double f; } var;
+
+  if (((decoder->end - decoder->pos) >= 9) && ((uint8_t)*decoder->pos == MPACK_FLOAT64)) {
+    ++decoder->pos;
+    mpack_decoder_read_uint64(decoder, &var.u);
+    *value = var.f;
+    return 9;
+  }
+
+  return mpack_decode_double(decoder, value);
+}
+
+static inline int mpack_gen_decode_string(mpack_decoder_t *decoder, mpack_string_t *value)
+{
+  size_t size;
+
+  if ((decoder->pos != decoder->end) && (((uint8_t)*decoder->pos & MPACK_FIXSTR_MASK) == MPACK_FIXSTR)) {
+    size = (uint8_t)*decoder->pos & ~MPACK_FIXSTR_MASK;
+
+    if ((size_t)(decoder->end - decoder->pos) > size) {
+      value->data = decoder->pos + 1;
+      value->size = size;
+      decoder->pos += size + 1;
+      return size + 1;
+    }
+  }
+
+  return mpack_decode_string(decoder, value);
+}
+
+#endif /* MPACK_GEN_HELPERS */
+'''
+
+
+class SchemaError(Exception):
+    pass
+
+
+def c_string(data):
+    return '"' + ''.join('\\x%02x' % b for b in data) + '"'
+
+
+def encode_key(name):
+    # Same layout as mpack_encode_string so the fast path matches the output
+    # of the generic encoders too.
+    data = bytearray(name.encode('utf-8'))
+    if len(data) <= 15:
+        header = bytearray([0xa0 | len(data)])
+    elif len(data) <= 255:
+        header = bytearray([0xd9, len(data)])
+    else:
+        raise SchemaError('field name too long: %s' % name)
+    return header, data
+
+
+def map_header(count):
+    if count <= 15:
+        return bytearray([0x80 | count])
+    return bytearray([0xde, count >> 8, count & 0xff])
+
+
+def check_identifier(name):
+    if not re.match(r'^[A-Za-z_][A-Za-z0-9_]*$', name):
+        raise SchemaError('invalid identifier: %s' % name)
+    return name
+
+
+def c_type(type, structs):
+    if type in SCALARS:
+        return SCALARS[type]
+    if type in structs:
+        return '%s_t' % type
+    raise SchemaError('unknown type: %s' % type)
+
+
+def generate_struct(out, struct, structs):
+    name = check_identifier(struct['name'])
+    fields = struct['fields']
+
+    if len(fields) > 64:
+        raise SchemaError('%s: too many fields' % name)
+
+    for f in fields:
+        check_identifier(f['name'])
+        c_type(f['type'], structs)
+
+    required = 0
+    for i, f in enumerate(fields):
+        if f.get('required', False):
+            required |= 1 << i
+
+    out.append('typedef struct %s {' % name)
+    for f in fields:
+        out.append('  %s %s;' % (c_type(f['type'], structs), f['name']))
+    out.append('} %s_t;' % name)
+    out.append('')
+
+    # Encoder: the map header and the keys are written from their precomputed
+    # encoding unless a session dictionary is attached.
+    out.append('static inline int %s_encode(mpack_encoder_t *encoder, const %s_t *value)' % (name, name))
+    out.append('{')
+    out.append('  char *start = encoder->pos;')
+    out.append('')
+    header = map_header(len(fields))
+    out.append('  mpack_encoder_write_bytes(encoder, %s, %d);' % (c_string(header), len(header)))
+    out.append('')
+    for f in fields:
+        header, data = encode_key(f['name'])
+        out.append('  if ((mpack_gen_key(encoder, %s, %d, %d) < 0) || (%s < 0)) {' % (
+            c_string(header + data), len(header) + len(data), len(header), encode_value(f, structs)))
+        out.append('    return -1;')
+        out.append('  }')
+        out.append('')
+    out.append('  return encoder->pos - start;')
+    out.append('}')
+    out.append('')
+
+    # Decoder: each key is first compared with the expected key for its
+    # position, then looked up by size and content, unknown keys are skipped.
+    types = set(f['type'] for f in fields)
+    out.append('static inline int %s_decode(mpack_decoder_t *decoder, %s_t *value)' % (name, name))
+    out.append('{')
+    out.append('  mpack_map_t map;')
+    out.append('  mpack_string_t key;')
+    if types & set(SIGNED_LIMITS):
+        out.append('  long s;')
+    if types & set(UNSIGNED_LIMITS):
+        out.append('  unsigned long u;')
+    out.append('  uint64_t seen;')
+    out.append('  size_t i;')
+    out.append('  MPACK_DECODE_BEGIN(decoder);')
+    out.append('  seen = 0;')
+    out.append('  MPACK_DECODE_ASSERT(mpack_decode_map(decoder, &map));')
+    out.append('')
+    out.append('  for (i = 0; i != map.size; ++i) {')
+    out.append('    switch (i) {')
+    for i, f in enumerate(fields):
+        header, data = encode_key(f['name'])
+        out.append('    case %d:' % i)
+        out.append('      if (mpack_gen_match(decoder, %s, %d)) {' % (c_string(header + data), len(header) + len(data)))
+        out.append('        goto field_%d;' % i)
+        out.append('      }')
+        out.append('      break;')
+    out.append('    }')
+    out.append('')
+    out.append('    MPACK_DECODE_ASSERT(mpack_decode_string(decoder, &key));')
+    out.append('')
+    by_size = {}
+    for i, f in enumerate(fields):
+        by_size.setdefault(len(f['name'].encode('utf-8')), []).append(i)
+    out.append('    switch (key.size) {')
+    for size in sorted(by_size):
+        out.append('    case %d:' % size)
+        for i in by_size[size]:
+            data = bytearray(fields[i]['name'].encode('utf-8'))
+            out.append('      if (memcmp(key.data, %s, %d) == 0) {' % (c_string(data), size))
+            out.append('        goto field_%d;' % i)
+            out.append('      }')
+        out.append('      break;')
+    out.append('    }')
+    out.append('')
+    out.append('    MPACK_DECODE_ASSERT(mpack_decode_skip(decoder));')
+    out.append('    continue;')
+    for i, f in enumerate(fields):
+        out.append('')
+        out.append('  field_%d:' % i)
+        for line in decode_value(f, structs):
+            out.append('    ' + line)
+        out.append('    seen |= (uint64_t)1 << %d;' % i)
+        out.append('    continue;')
+    out.append('  }')
+    out.append('')
+    out.append('  if ((seen & 0x%xULL) != 0x%xULL) {' % (required, required))
+    out.append('    MPACK_DECODE_FAIL(EINVAL);')
+    out.append('  }')
+    out.append('')
+    out.append('  MPACK_DECODE_END(decoder);')
+    out.append('}')
+    out.append('')
+
+
+def encode_value(f, structs):
+    type = f['type']
+    field = 'value->%s' % f['name']
+    if type == 'bool':
+        return 'mpack_encode_boolean(encoder, %s)' % field
+    if type in SIGNED_LIMITS:
+        return 'mpack_encode_signed(encoder, %s)' % field
+    if type in UNSIGNED_LIMITS:
+        return 'mpack_encode_unsigned(encoder, %s)' % field
+    if type in ('float', 'double', 'string', 'binary', 'timestamp'):
+        return 'mpack_encode_%s(encoder, %s)' % (type, field)
+    return '%s_encode(encoder, &%s)' % (type, field)
+
+
+def decode_value(f, structs):
+    type = f['type']
+    field = 'value->%s' % f['name']
+    if type in SIGNED_LIMITS:
+        return ['MPACK_DECODE_ASSERT(mpack_gen_decode_signed(decoder, &s, %s, %s));' % SIGNED_LIMITS[type],
+                '%s = (%s)s;' % (field, SCALARS[type])]
+    if type in UNSIGNED_LIMITS:
+        return ['MPACK_DECODE_ASSERT(mpack_gen_decode_unsigned(decoder, &u, %s));' % UNSIGNED_LIMITS[type],
+                '%s = (%s)u;' % (field, SCALARS[type])]
+    if type in ('float', 'double', 'string'):
+        return ['MPACK_DECODE_ASSERT(mpack_gen_decode_%s(decoder, &%s));' % (type, field)]
+    if type in ('bool', 'binary', 'timestamp'):
+        function = 'boolean' if type == 'bool' else type
+        return ['MPACK_DECODE_ASSERT(mpack_decode_%s(decoder, &%s));' % (function, field)]
+    return ['MPACK_DECODE_ASSERT(%s_decode(decoder, &%s));' % (type, field)]
+
+
+def generate(schema, source, guard):
+    out = []
+    out.append('/* Generated by mpack_gen.py from %s, do not edit. */' % source)
+    out.append('#ifndef %s' % guard)
+    out.append('#define %s' % guard)
+    out.append('')
+    out.append('#include <string.h>')
+    out.append('#include <mpack.h>')
+    out.extend(HELPERS.split('\n'))
+
+    structs = set()
+    for struct in schema['structs']:
+        generate_struct(out, struct, structs)
+        structs.add(struct['name'])
+
+    out.append('#endif /* %s */' % guard)
+    return '\n'.join(out) + '\n'
+
+
+def main():
+    parser = argparse.ArgumentParser(description='generate msgpack codecs from a schema')
+    parser.add_argument('schema', help='path to the JSON schema')
+    parser.add_argument('-o', '--output', help='path of the generated header (default: stdout)')
+    args = parser.parse_args()
+
+    with open(args.schema) as f:
+        schema = json.load(f)
+
+    guard = re.sub(r'[^A-Za-z0-9]', '_', (args.output or args.schema).split('/')[-1]).upper()
+
+    try:
+        code = generate(schema, args.schema.split('/')[-1], guard)
+    except (SchemaError, KeyError) as e:
+        sys.stderr.write('%s: %s\n' % (args.schema, e))
+        return 1
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            f.write(code)
+    else:
+        sys.stdout.write(code)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,270 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Achille Roussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Converts the stream of MessagePack values read from the standard input, or
+   from the files given on the command line, to JSON Lines on the standard
+   output, or the other way around with -r.
+
+     mpack-json [-r] [-b base64|hex|array] [-e object|data|null] [-t] [file...]
+
+   -b selects how binary values are rendered, -e how extended values are
+   rendered and -t writes timestamps as RFC 3339 strings. */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <mpack.h>
+
+enum {
+  BUFFER_SIZE = 65536,
+};
+
+typedef struct output {
+  mpack_json_sink_t sink;
+  bool reverse;
+  char *buffer;
+  size_t capacity;
+} output_t;
+
+static int write_file(void *context, const void *data, size_t size)
+{ return (fwrite(data, 1, size, context) == size) ? (int)size : -1; }
+
+static int to_json(output_t *output, mpack_decoder_t *decoder)
+{
+  if (mpack_to_json(decoder, &output->sink) < 0) {
+    return -1;
+  }
+
+  if (fputc('\n', stdout) == EOF) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/* A number at the end of the input may continue in the next read, so the
+   value is only complete if something follows it or the input is over. */
+static int from_json(output_t *output, mpack_decoder_t *decoder, bool last)
+{
+  mpack_encoder_t encoder;
+  char *tmp;
+  int size;
+
+  for (;;) {
+    mpack_encoder_init(&encoder, output->buffer, output->capacity);
+
+    if ((size = mpack_from_json(&encoder, decoder->pos, decoder->end - decoder->pos)) < 0) {
+      return -1;
+    }
+
+    if (!last && ((decoder->pos + size) == decoder->end)) {
+      errno = EAGAIN;
+      return -1;
+    }
+
+    if (encoder.pos <= encoder.end) {
+      break;
+    }
+
+    if (!(tmp = realloc(output->buffer, 2 * output->capacity))) {
+      return -1;
+    }
+
+    output->buffer = tmp;
+    output->capacity *= 2;
+  }
+
+  decoder->pos += size;
+
+  if (fwrite(encoder.begin, 1, encoder.pos - encoder.begin, stdout) != (size_t)(encoder.pos - encoder.begin)) {
+    return -1;
+  }
+
+  return 0;
+}
+
+static bool is_space(const char *data, size_t size)
+{
+  size_t i;
+
+  for (i = 0; i != size; ++i) {
+    if (!strchr(" \t\r\n", data[i])) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static int convert(FILE *file, const char *name, output_t *output)
+{
+  size_t capacity = BUFFER_SIZE;
+  size_t size = 0;
+  size_t offset = 0;
+  size_t n;
+  char *buffer;
+  char *tmp;
+  mpack_decoder_t decoder;
+  int result = -1;
+
+  if (!(buffer = malloc(capacity))) {
+    perror("mpack-json");
+    return -1;
+  }
+
+  do {
+    if (size == capacity) {
+      if (!(tmp = realloc(buffer, 2 * capacity))) {
+        perror("mpack-json");
+        goto done;
+      }
+      buffer = tmp;
+      capacity *= 2;
+    }
+
+    n = fread(buffer + size, 1, capacity - size, file);
+    size += n;
+    mpack_decoder_init(&decoder, buffer, size);
+
+    while ((output->reverse ? from_json(output, &decoder, n == 0) : to_json(output, &decoder)) == 0);
+
+    if (errno != EAGAIN) {
+      fprintf(stderr, "mpack-json: %s: offset %zu: %s\n", name, offset + (decoder.pos - buffer), strerror(errno));
+      goto done;
+    }
+
+    offset += decoder.pos - buffer;
+    size = decoder.end - decoder.pos;
+    memmove(buffer, decoder.pos, size);
+  } while (n != 0);
+
+  if (ferror(file)) {
+    fprintf(stderr, "mpack-json: %s: %s\n", name, strerror(errno));
+  }
+  else if ((size != 0) && !(output->reverse && is_space(buffer, size))) {
+    fprintf(stderr, "mpack-json: %s: offset %zu: truncated value\n", name, offset);
+  }
+  else {
+    result = 0;
+  }
+
+done:
+  free(buffer);
+  return result;
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: mpack-json [-r] [-b base64|hex|array] [-e object|data|null] [-t] [file...]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  output_t output;
+  FILE *file;
+  int status = 0;
+  int c;
+  int i;
+
+  output.sink.write = write_file;
+  output.sink.context = stdout;
+  output.sink.flags = 0;
+  output.reverse = false;
+  output.capacity = BUFFER_SIZE;
+
+  if (!(output.buffer = malloc(output.capacity))) {
+    perror("mpack-json");
+    return 1;
+  }
+
+  while ((c = getopt(argc, argv, "rb:e:t")) != -1) {
+    switch (c) {
+    case 'r':
+      output.reverse = true;
+      break;
+
+    case 'b':
+      output.sink.flags &= ~MPACK_JSON_BINARY_MASK;
+      if (strcmp(optarg, "hex") == 0) {
+        output.sink.flags |= MPACK_JSON_BINARY_HEX;
+      }
+      else if (strcmp(optarg, "array") == 0) {
+        output.sink.flags |= MPACK_JSON_BINARY_ARRAY;
+      }
+      else if (strcmp(optarg, "base64") != 0) {
+        usage();
+      }
+      break;
+
+    case 'e':
+      output.sink.flags &= ~MPACK_JSON_EXTENDED_MASK;
+      if (strcmp(optarg, "data") == 0) {
+        output.sink.flags |= MPACK_JSON_EXTENDED_DATA;
+      }
+      else if (strcmp(optarg, "null") == 0) {
+        output.sink.flags |= MPACK_JSON_EXTENDED_NULL;
+      }
+      else if (strcmp(optarg, "object") != 0) {
+        usage();
+      }
+      break;
+
+    case 't':
+      output.sink.flags |= MPACK_JSON_TIMESTAMP_STRING;
+      break;
+
+    default:
+      usage();
+    }
+  }
+
+  if (optind == argc) {
+    status = (convert(stdin, "<stdin>", &output) < 0) ? 1 : 0;
+  }
+
+  for (i = optind; i != argc; ++i) {
+    if (!(file = fopen(argv[i], "rb"))) {
+      fprintf(stderr, "mpack-json: %s: %s\n", argv[i], strerror(errno));
+      status = 1;
+      continue;
+    }
+
+    if (convert(file, argv[i], &output) < 0) {
+      status = 1;
+    }
+
+    fclose(file);
+  }
+
+  if (fflush(stdout) == EOF) {
+    perror("mpack-json");
+    status = 1;
+  }
+
+  free(output.buffer);
+  return status;
+}